@@ -0,0 +1,624 @@
+//==========================================================================================================
+// aggregator.cpp - Implements the thread that pulls entries from upstream loggers and merges them into our
+//                  log, and the code that serves them to an aggregator
+//==========================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "aggregator.h"
+#include "ingest.h"
+#include "ingest_proto.h"
+#include "sockutil.h"
+#include "livelog.h"
+#include "globals.h"
+#include "tags.h"
+
+// The longest frame in a batch.  Frames are datagrams, so they're never longer than this
+const int MAX_FRAME = 0xFFFF;
+
+// Later than any entry
+static const log_time_t TIME_MAX = INT64_MAX;
+
+
+//==========================================================================================================
+// send_frame() - Sends a frame of a batch: its 32-bit little-endian length, then the frame itself
+//==========================================================================================================
+static bool send_frame(int fd, const char* data, int length)
+{
+    char header[4] = {(char)length, (char)(length >> 8), (char)(length >> 16), (char)(length >> 24)};
+    return send_all(fd, header, sizeof header) && (length == 0 || send_all(fd, data, length));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// forward_log_data() - Sends an aggregator the entries it asked for, in batch format (see aggregator.h)
+//
+// Passed:  fd    = The aggregator's socket
+//          query = What it asked for.  "m_from" says where to start in each shard, and "m_limit" how many
+//                  entries it wants at most
+//
+// Returns: The number of entries sent
+//==========================================================================================================
+uint64_t forward_log_data(int fd, const CLogQuery& query)
+{
+    CLogSnapshot  snapshot;
+    log_view_t    entry;
+    CIngestWriter writer;
+    vector<uint64_t> from(query.m_from), to, end;
+    uint64_t      sent = 0;
+    bool          more = false;
+    char          number[48];
+
+    // Take note of the time before the snapshot, so that nothing still to come is much older than it
+    log_time_t now = log_clock();
+
+    // Start each shard where the aggregator left off.  If our indices have started over since it last
+    // asked, where it left off means nothing, and it needs to start again from the beginning.  Its place
+    // being past the end says the same, from an aggregator that doesn't know about instances
+    uint64_t instance = DataLog.instance();
+    if (query.m_instance && query.m_instance != instance) from.clear();
+    DataLog.end(end);
+    from.resize(end.size(), 0);
+    for (size_t i = 0; i < end.size(); ++i) if (from[i] > end[i]) from[i] = 0;
+    to.resize(end.size(), LOG_END);
+    DataLog.snapshot(snapshot, from, to);
+
+    // Pack the entries into frames, sending each one as it fills up.  Every entry we look at counts as
+    // seen, whether or not it matched the query, so the next batch resumes after it
+    vector<uint64_t> next(from);
+    while (snapshot.next(entry))
+    {
+        if (query.m_limit && sent == query.m_limit)
+        {
+            // The rest of the entries are newer than this one, so the aggregator may go that far
+            more = true;
+            now  = entry.timestamp;
+            break;
+        }
+        next[entry.shard] = entry.index + 1;
+        if (!query.matches(entry)) continue;
+        ++sent;
+        if (writer.add(entry)) continue;
+        if (!send_frame(fd, writer.data(), writer.size())) return sent;
+        writer.clear();
+        writer.add(entry);
+    }
+    if (writer.count() && !send_frame(fd, writer.data(), writer.size())) return sent;
+
+    // If we got to the end of the snapshot, the next batch resumes at the end of it
+    if (!more) next = snapshot.end();
+
+    // And tell the aggregator where to resume, and how far it may merge what we've sent
+    string trailer = "EOF from=";
+    for (size_t i = 0; i < next.size(); ++i)
+    {
+        sprintf(number, "%s%llu", i ? "," : "", (unsigned long long)next[i]);
+        trailer += number;
+    }
+    sprintf(number, " now=%lld", (long long)now);
+    trailer += number;
+    trailer += more ? " more=1" : " more=0";
+    sprintf(number, " instance=%llu\n", (unsigned long long)instance);
+    trailer += number;
+    if (send_frame(fd, NULL, 0)) send_all(fd, trailer.data(), trailer.size());
+    return sent;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CAggregator() - Constructor
+//==========================================================================================================
+CAggregator::CAggregator()
+{
+    memset(&m_stats, 0, sizeof m_stats);
+    m_shard       = 0;
+    m_batch       = 0;
+    m_max_pending = 0;
+    m_interval    = 0;
+    m_timeout     = 0;
+    m_delay       = 0;
+    m_merged      = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_upstreams() - Parses a comma-separated list of upstream loggers
+//
+// Passed:  text     = The list, each item of which is "host:port"
+//          upstream = Filled in with the items in the list
+//          error    = Filled in with a description of what's wrong, if anything is
+//
+// Returns: true if the text made sense
+//==========================================================================================================
+bool CAggregator::parse_upstreams(const string& text, vector<string>& upstream, string* error)
+{
+    size_t pos = 0;
+
+    upstream.clear();
+
+    while (pos < text.size())
+    {
+        // Fetch the next item in the list, ignoring blanks around it
+        size_t comma = text.find(',', pos);
+        if (comma == string::npos) comma = text.size();
+        string spec = text.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t a = spec.find_first_not_of(" \t"), b = spec.find_last_not_of(" \t");
+        if (a == string::npos) continue;
+        spec = spec.substr(a, b - a + 1);
+
+        // It must have a host and a port
+        char*  end;
+        size_t colon = spec.rfind(':');
+        if (colon == string::npos || colon == 0) {*error = "Expected host:port, got \"" + spec + "\""; return false;}
+        long   port = strtol(spec.c_str() + colon + 1, &end, 10);
+        if (*end || port <= 0 || port > 65535) {*error = "Bad port in \"" + spec + "\""; return false;}
+        upstream.push_back(spec);
+    }
+
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// spawn() - Looks up each upstream logger, then spawns the thread
+//
+// Passed:  upstreams = The list of upstream loggers.  It must already have been checked with parse_upstreams()
+//          shard     = The shard of the log that merged entries are appended to
+//==========================================================================================================
+void CAggregator::spawn(const string& upstreams, int shard)
+{
+    vector<string> name;
+    string error;
+
+    parse_upstreams(upstreams, name, &error);
+
+    m_upstream.resize(name.size());
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        upstream_t& up = m_upstream[i];
+        size_t colon   = name[i].rfind(':');
+        string host    = name[i].substr(0, colon);
+
+        // Find out where the upstream is
+        addrinfo hints, *info;
+        memset(&hints, 0, sizeof hints);
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), NULL, &hints, &info) != 0)
+        {
+            fprintf(stderr, "Can't find upstream logger \"%s\"\n", name[i].c_str());
+            exit(1);
+        }
+        memcpy(&up.addr, info->ai_addr, sizeof up.addr);
+        up.addr.sin_port = htons(atoi(name[i].c_str() + colon + 1));
+        freeaddrinfo(info);
+
+        // Until an upstream proves otherwise, we assume that it's there, and that it has entries older
+        // than anything we've seen
+        up.name       = name[i];
+        up.fd         = -1;
+        up.connecting = false;
+        up.healthy    = true;
+        up.more       = false;
+        up.next_ask   = 0;
+        up.asked      = 0;
+        up.watermark  = 0;
+        up.head       = 0;
+    }
+
+    m_shard       = shard;
+    m_batch       = conf.aggregate_batch;
+    m_max_pending = 4 * m_batch;
+    m_interval    = (uint64_t)conf.aggregate_interval * 1000000;
+    m_timeout     = 5ULL * NS_PER_SEC;
+    m_delay       = (log_time_t)conf.merge_delay * 1000000;
+    m_stats.upstreams = m_upstream.size();
+    m_stats.healthy   = m_upstream.size();
+
+    CThread::spawn();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// connect_to() - Starts connecting to an upstream, to ask for its next batch.  The request is sent once
+//                the connection has been made
+//==========================================================================================================
+void CAggregator::connect_to(upstream_t& up, uint64_t now)
+{
+    up.asked = now;
+    up.fd    = socket(AF_INET, SOCK_STREAM, 0);
+    if (up.fd < 0) {finish(up, false, now); return;}
+    set_nonblocking(up.fd);
+
+    up.connecting = true;
+    if (connect(up.fd, (sockaddr*)&up.addr, sizeof up.addr) == 0)
+        up.connecting = false;
+    else if (errno != EINPROGRESS)
+    {
+        finish(up, false, now);
+        return;
+    }
+
+    if (!up.connecting && !ask(up)) finish(up, false, now);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// ask() - Sends an upstream the request for its next batch
+//
+// Returns: false if it couldn't be sent
+//==========================================================================================================
+bool CAggregator::ask(upstream_t& up)
+{
+    char request[64];
+
+    sprintf(request, "format=binary limit=%llu", (unsigned long long)m_batch);
+    string line = request;
+    if (!up.from.empty()) line += " from=" + up.from;
+    if (!up.instance.empty()) line += " instance=" + up.instance;
+    line += "\n";
+
+    // The request is tiny, and the socket's buffer is empty, so it all goes at once
+    return send(up.fd, line.data(), line.size(), 0) == (ssize_t)line.size();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// finish() - Closes the connection for a batch, and decides when to ask for the next one
+//
+// Passed:  up  = The upstream
+//          ok  = true if the batch arrived safely
+//          now = The current metrics_clock() time
+//
+// Note:    An upstream whose batch failed no longer holds up merging, so whatever it has already sent is
+//          merged, and the entries it sends once it's back may turn out to be late
+//==========================================================================================================
+void CAggregator::finish(upstream_t& up, bool ok, uint64_t now)
+{
+    if (up.fd >= 0) close(up.fd);
+    up.fd         = -1;
+    up.connecting = false;
+    up.rx.clear();
+
+    if (!ok)
+    {
+        if (up.healthy) fprintf(stderr, "Aggregator lost contact with upstream %s\n", up.name.c_str());
+        up.healthy  = false;
+        up.more     = false;
+        up.next_ask = now + RETRY_NS;
+        ++m_stats.errors;
+        return;
+    }
+
+    if (!up.healthy) fprintf(stderr, "Aggregator regained contact with upstream %s\n", up.name.c_str());
+    up.healthy = true;
+    ++m_stats.batches;
+
+    // If the upstream has more for us, we ask again straight away
+    up.next_ask = up.more ? now : now + m_interval;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive() - Reads whatever an upstream has sent, and parses every complete frame of its batch
+//
+// Returns: -1 if the batch failed, 1 if it's complete, or 0 if there's more to come
+//==========================================================================================================
+int CAggregator::receive(upstream_t& up)
+{
+    const int CHUNK = 256 * 1024;
+
+    // Read until there's nothing more to read, or the upstream has closed the connection
+    bool closed = false;
+    while (true)
+    {
+        size_t size = up.rx.size();
+        up.rx.resize(size + CHUNK);
+        ssize_t n = recv(up.fd, &up.rx[size], CHUNK, 0);
+        up.rx.resize(size + (n > 0 ? n : 0));
+        if (n > 0) {m_stats.bytes += n; continue;}
+        if (n < 0 && errno == EINTR) continue;
+        closed = (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
+        break;
+    }
+
+    // Parse every complete frame
+    size_t pos = 0;
+    int    result = 0;
+    while (up.rx.size() - pos >= 4)
+    {
+        const uint8_t* p = (const uint8_t*)&up.rx[pos];
+        uint32_t length  = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+        // A frame of length zero is followed by the trailer line
+        if (length == 0)
+        {
+            char* start = &up.rx[pos + 4];
+            char* nl    = (char*)memchr(start, '\n', up.rx.size() - pos - 4);
+            if (nl == NULL) break;
+            *nl = 0;
+            result = parse_trailer(up, start) ? 1 : -1;
+            break;
+        }
+
+        // Otherwise the frame is a datagram of entries
+        if (length > (uint32_t)MAX_FRAME) {result = -1; break;}
+        if (up.rx.size() - pos - 4 < length) break;
+        if (!parse_frame(up, &up.rx[pos + 4], length)) {result = -1; break;}
+        pos += 4 + length;
+    }
+    up.rx.erase(up.rx.begin(), up.rx.begin() + pos);
+
+    // If the connection has closed before the trailer arrived, the batch is incomplete
+    if (result == 0 && closed) result = -1;
+    return result;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_frame() - Adds the entries in a frame to the upstream's pending entries
+//
+// Returns: false if the frame is damaged
+//==========================================================================================================
+bool CAggregator::parse_frame(upstream_t& up, const char* frame, int length)
+{
+    static vector<log_item_t>    item;
+    static vector<sender_info_t> sender;
+
+    // Only this thread ever parses frames, so the buffers can be kept from one frame to the next
+    size_t most = length / INGEST_RECORD_SIZE + 1;
+    if (item.size() < most)
+    {
+        item.resize(most);
+        sender.resize(most);
+    }
+
+    int count = parse_binary(frame, length, &item[0], &sender[0]);
+    if (count < 0) return false;
+
+    // Each entry keeps the timestamp it had upstream, and is given a sequence number of our own when it's
+    // merged into the log.  Its message is copied, since the frame is about to be thrown away
+    for (int i = 0; i < count; ++i)
+    {
+        pending_t p;
+        p.timestamp = sender[i].timestamp;
+        p.tag_id    = item[i].tag_id;
+        p.severity  = item[i].severity;
+        p.offset    = up.text.size();
+        p.length    = item[i].data_len;
+        up.text.insert(up.text.end(), item[i].data, item[i].data + item[i].data_len);
+        up.pending.push_back(p);
+    }
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_trailer() - Parses the line that ends a batch: "EOF from=I[,I...] now=TIME more=0|1 instance=ID"
+//
+// Note:    An upstream from before instances were added leaves them out, and is never sent one
+//
+// Returns: false if it doesn't make sense
+//==========================================================================================================
+bool CAggregator::parse_trailer(upstream_t& up, const char* line)
+{
+    const char* from = strstr(line, " from=");
+    const char* now  = strstr(line, " now=");
+    const char* more = strstr(line, " more=");
+    const char* instance = strstr(line, " instance=");
+
+    if (strncmp(line, "EOF", 3) != 0 || !from || !now || !more || now < from) return false;
+
+    // Where the next batch resumes, and which instance of the upstream's log that's in
+    up.from.assign(from + 6, now);
+    up.more = (more[6] == '1');
+    if (instance) up.instance.assign(instance + 10, strcspn(instance + 10, " "));
+
+    // Nothing still to come from the upstream is much older than its clock was
+    log_time_t watermark = strtoll(now + 5, NULL, 10) - m_delay;
+    if (watermark > up.watermark) up.watermark = watermark;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// merge() - Appends every pending entry that no healthy upstream can still send anything older than to
+//           the log, oldest first
+//==========================================================================================================
+void CAggregator::merge()
+{
+    vector<log_item_t> batch;
+    const size_t BATCH = 1024;
+    bool   appended = false;
+
+    // Find out how far we can go.  If no upstream is healthy, there's nothing to wait for
+    log_time_t limit = TIME_MAX;
+    for (size_t i = 0; i < m_upstream.size(); ++i)
+    {
+        if (m_upstream[i].healthy && m_upstream[i].watermark < limit) limit = m_upstream[i].watermark;
+    }
+
+    // Take the oldest entry that's waiting, over and over.  Each upstream's entries are already in order,
+    // and its sequence numbers mean nothing next to another's, so entries from different upstreams with
+    // the same timestamp are simply taken in the order the upstreams are listed.  There are only a handful
+    // of upstreams, so a linear scan is as quick as anything
+    while (true)
+    {
+        int best = -1;
+        for (size_t i = 0; i < m_upstream.size(); ++i)
+        {
+            upstream_t& up = m_upstream[i];
+            if (up.head == up.pending.size() || up.pending[up.head].timestamp >= limit) continue;
+            if (best < 0) {best = i; continue;}
+            const pending_t& a = up.pending[up.head];
+            const pending_t& b = m_upstream[best].pending[m_upstream[best].head];
+            if (a.timestamp < b.timestamp) best = i;
+        }
+
+        // Append the batch once it's full, or there's nothing more to add to it
+        if (batch.size() == BATCH || (best < 0 && batch.size()))
+        {
+            DataLog.append(m_shard, &batch[0], batch.size());
+            m_stats.entries += batch.size();
+            appended = true;
+            batch.clear();
+        }
+        if (best < 0) break;
+
+        // Add the entry to the batch.  Its text stays put until compact() is called
+        upstream_t&      up = m_upstream[best];
+        const pending_t& p  = up.pending[up.head++];
+        const tag_info_t& info = TagTable.info(p.tag_id);
+        log_item_t item;
+        item.timestamp = p.timestamp;
+        item.tag_id    = p.tag_id;
+        item.severity  = p.severity;
+        item.tag       = info.name.c_str();
+        item.tag_len   = info.name.size();
+        item.data      = &up.text[p.offset];
+        item.data_len  = p.length;
+        batch.push_back(item);
+
+        // An entry older than some we've already merged is late, but it's better late than never
+        if (p.timestamp < m_merged) ++m_stats.late;
+    }
+
+    // Let the live-log clients know there's something new
+    if (limit != TIME_MAX && limit > m_merged) m_merged = limit;
+    if (appended) LiveLog.notify();
+
+    // Throw away what has been merged
+    m_stats.pending = 0;
+    for (size_t i = 0; i < m_upstream.size(); ++i)
+    {
+        compact(m_upstream[i]);
+        m_stats.pending += m_upstream[i].pending.size() - m_upstream[i].head;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// compact() - Throws away the entries of an upstream that have been merged, and their text
+//==========================================================================================================
+void CAggregator::compact(upstream_t& up)
+{
+    if (up.head == 0) return;
+
+    // Usually everything has been merged
+    if (up.head == up.pending.size())
+    {
+        up.pending.clear();
+        up.text.clear();
+        up.head = 0;
+        return;
+    }
+
+    // Otherwise move what's left to the front
+    uint32_t base = up.pending[up.head].offset;
+    up.pending.erase(up.pending.begin(), up.pending.begin() + up.head);
+    for (size_t i = 0; i < up.pending.size(); ++i) up.pending[i].offset -= base;
+    up.text.erase(up.text.begin(), up.text.begin() + base);
+    up.head = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Asks each upstream for batches, and merges them into the log, forever
+//==========================================================================================================
+void CAggregator::main()
+{
+    vector<pollfd> pfd;
+    vector<int>    which;
+
+    while (true)
+    {
+        uint64_t now  = metrics_clock();
+        uint64_t wake = now + m_interval;
+
+        // Start a batch from every upstream that's due to be asked, unless it already has too much waiting
+        // to be merged.  The rest stays in the upstream's own log until we catch up
+        pfd.clear();
+        which.clear();
+        for (size_t i = 0; i < m_upstream.size(); ++i)
+        {
+            upstream_t& up = m_upstream[i];
+            if (up.fd < 0 && now >= up.next_ask)
+            {
+                if (up.pending.size() - up.head < m_max_pending)
+                    connect_to(up, now);
+                else
+                    up.next_ask = now + m_interval;
+            }
+            if (up.fd < 0)
+            {
+                if (up.next_ask < wake) wake = up.next_ask;
+                continue;
+            }
+
+            // Give up on a batch that takes too long
+            if (now - up.asked > m_timeout) {finish(up, false, now); continue;}
+            pollfd p = {up.fd, (short)(up.connecting ? POLLOUT : POLLIN), 0};
+            pfd.push_back(p);
+            which.push_back(i);
+        }
+
+        // Wait for a batch to arrive, or for it to be time to ask for another
+        int timeout = (wake > now) ? (wake - now) / 1000000 + 1 : 0;
+        if (pfd.empty())
+            usleep(timeout * 1000);
+        else if (poll(&pfd[0], pfd.size(), timeout) < 0 && errno != EINTR)
+            continue;
+
+        now = metrics_clock();
+        for (size_t k = 0; k < pfd.size(); ++k)
+        {
+            upstream_t& up = m_upstream[which[k]];
+            if (pfd[k].revents == 0) continue;
+
+            // A connection has been made, or has failed
+            if (up.connecting)
+            {
+                int error = 0;
+                socklen_t len = sizeof error;
+                getsockopt(up.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                up.connecting = false;
+                if (error || !ask(up)) finish(up, false, now);
+                continue;
+            }
+
+            // Part of a batch has arrived
+            int result = receive(up);
+            if (result != 0) finish(up, result > 0, now);
+        }
+
+        // Merge whatever we can.  Our shard picks up a change in the log's size even if nothing was
+        merge();
+        DataLog.idle(m_shard);
+
+        // Keep count of how many upstreams are healthy
+        uint64_t healthy = 0;
+        for (size_t i = 0; i < m_upstream.size(); ++i) healthy += m_upstream[i].healthy;
+        m_stats.healthy = healthy;
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,160 @@
+//==========================================================================================================
+// aggregator.h - Defines the thread that pulls entries from upstream loggers and merges them into our log
+//
+// A logger with "upstreams" configured is an aggregator.  Every so often, it connects to the server port
+// of each upstream logger and asks for the entries that have been logged since it last asked (see
+// query.h).  The upstream sends them in the binary format, and says where the aggregator should resume
+// next time, and how far its clock has got.  A connection only lasts for a single batch, so an
+// aggregator never ties up an upstream's dump threads.
+//
+// Entries from each upstream arrive in timestamp order, and are held until every connected upstream has
+// moved past them.  Then they're merged, oldest first, into a shard of the log of their own, so our own
+// dump and live-log ports serve a single stream from every upstream.  Merged entries keep the timestamps
+// they had upstream, but are given sequence numbers of ours, as any other entry appended here is.  Each
+// upstream is only asked for more once the aggregator has room for it, and the rest waits in the
+// upstream's own log.
+//
+// The wire format of a batch is a sequence of frames, each a 32-bit little-endian length followed by a
+// datagram in the binary format of ingest_proto.h, and then a frame of length zero followed by the line
+//
+//     EOF from=I[,I...] now=TIME more=0|1 instance=ID
+//
+// where "from" is where to resume, "now" is the upstream's clock in nanoseconds (no entry still to come
+// is much older than that), "more" says the batch was cut short by its limit, and "instance" identifies
+// the upstream's log indices.  The aggregator hands "instance" back with "from" when it asks for the next
+// batch, so an upstream that has been restarted since (and whose indices have started over) knows to
+// send its log from the beginning, however far it has got.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "cthread.h"
+#include "logdata.h"
+#include "query.h"
+
+using namespace std;
+
+
+// Sends the entries an aggregator asked for, in the wire format above.  Returns the number of entries sent
+uint64_t forward_log_data(int fd, const CLogQuery& query);
+
+
+//==========================================================================================================
+// agg_stats_t - Counters maintained by the aggregator
+//==========================================================================================================
+struct agg_stats_t
+{
+    uint64_t    upstreams;      // The number of upstream loggers
+    uint64_t    healthy;        // The number of them whose last batch arrived safely
+    uint64_t    errors;         // The number of batches that failed or timed out
+    uint64_t    batches;        // The number of batches received
+    uint64_t    bytes;          // The number of bytes received
+    uint64_t    entries;        // The number of entries merged into the log
+    uint64_t    late;           // The number of those that arrived after newer entries had been merged
+    uint64_t    pending;        // The number of entries waiting to be merged, as of the last merge
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CAggregator - A thread that pulls entries from every upstream logger, and merges them into the log
+//==========================================================================================================
+class CAggregator : public CThread
+{
+public:
+    CAggregator();
+
+    // Parses a comma-separated list of upstream "host:port"s.  Returns false, with a description of the
+    // problem in "error", if it doesn't make sense
+    static bool parse_upstreams(const string& text, vector<string>& upstream, string* error);
+
+    // Spawns the thread, which appends to "shard" of the log
+    void    spawn(const string& upstreams, int shard);
+
+    // Returns a copy of the aggregator's counters
+    agg_stats_t get_stats() {return m_stats;}
+
+protected:
+
+    void    main();
+
+    // An entry received from an upstream, waiting to be merged.  Its data is in the upstream's text buffer
+    struct pending_t
+    {
+        log_time_t  timestamp;
+        uint32_t    tag_id;
+        uint8_t     severity;
+        uint32_t    offset, length;
+    };
+
+    // The state of the connection to a single upstream logger
+    struct upstream_t
+    {
+        string      name;           // "host:port", for messages
+        sockaddr_in addr;           // Where it is
+        int         fd;             // The connection for the batch under way, or -1
+        bool        connecting;     // True while that connection is being made
+        bool        healthy;        // False if the last batch failed.  Only healthy upstreams hold up merging
+        bool        more;           // True if the last batch was cut short by its limit
+        uint64_t    next_ask;       // When to ask for the next batch (metrics_clock() time)
+        uint64_t    asked;          // When we asked for the batch under way
+        string      from;           // Where the next batch starts, as the upstream told us
+        string      instance;       // The instance of the upstream's log that "from" is in
+        log_time_t  watermark;      // No entry still to come from the upstream is older than this
+        vector<char> rx;            // What has been received but not parsed yet
+        vector<pending_t> pending;  // The entries waiting to be merged, oldest first
+        size_t      head;           // The first of them that hasn't been merged yet
+        vector<char> text;          // The data of those entries
+    };
+
+    // Connects to an upstream to ask for its next batch
+    void    connect_to(upstream_t& up, uint64_t now);
+
+    // Closes the connection for a batch, and decides when to ask for the next one
+    void    finish(upstream_t& up, bool ok, uint64_t now);
+
+    // Sends the request for a batch, once the connection has been made
+    bool    ask(upstream_t& up);
+
+    // Reads whatever an upstream has sent, and parses every complete frame.  Returns -1 if the batch
+    // failed, 1 if it's complete, and 0 if there's more to come
+    int     receive(upstream_t& up);
+
+    // Parses a single frame of entries
+    bool    parse_frame(upstream_t& up, const char* frame, int length);
+
+    // Parses the trailer that ends a batch
+    bool    parse_trailer(upstream_t& up, const char* line);
+
+    // How long to wait before asking an upstream that failed again, in nanoseconds
+    enum {RETRY_NS = 1000000000};
+
+    // Merges every pending entry that no upstream can still send anything older than into the log
+    void    merge();
+
+    // Throws away the entries of an upstream that have been merged
+    void    compact(upstream_t& up);
+
+    // The upstream loggers
+    vector<upstream_t> m_upstream;
+
+    // The shard of the log we append to
+    int     m_shard;
+
+    // The most entries to ask for at once, and the most that may wait to be merged for each upstream
+    size_t  m_batch, m_max_pending;
+
+    // How long to wait between asking for batches, and how long an upstream has to answer, in nanoseconds
+    uint64_t m_interval, m_timeout;
+
+    // How far behind an upstream's clock entries may still turn up, in nanoseconds
+    log_time_t m_delay;
+
+    // Everything older than this has been merged
+    log_time_t m_merged;
+
+    agg_stats_t m_stats;
+};
+//==========================================================================================================
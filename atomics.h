@@ -0,0 +1,45 @@
+//==========================================================================================================
+// atomics.h - Memory-ordering helpers for the lock-free data structures
+//
+// Newer compilers get the C++11 memory-model builtins.  Older compilers (such as our ARM toolchain)
+// fall back to full barriers, which are slower but equally correct.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+
+#if defined(__ATOMIC_ACQUIRE)
+
+inline uint64_t load_acquire (const volatile uint64_t* p)   {return __atomic_load_n(p, __ATOMIC_ACQUIRE);}
+inline void     store_release(volatile uint64_t* p, uint64_t v) {__atomic_store_n(p, v, __ATOMIC_RELEASE);}
+inline void     fence_acquire() {__atomic_thread_fence(__ATOMIC_ACQUIRE);}
+inline void     fence_release() {__atomic_thread_fence(__ATOMIC_RELEASE);}
+inline void     fence_full()    {__atomic_thread_fence(__ATOMIC_SEQ_CST);}
+
+inline uint32_t load_acquire (const volatile uint32_t* p)   {return __atomic_load_n(p, __ATOMIC_ACQUIRE);}
+inline void     store_release(volatile uint32_t* p, uint32_t v) {__atomic_store_n(p, v, __ATOMIC_RELEASE);}
+
+inline uint16_t load_acquire (const volatile uint16_t* p)   {return __atomic_load_n(p, __ATOMIC_ACQUIRE);}
+inline void     store_release(volatile uint16_t* p, uint16_t v) {__atomic_store_n(p, v, __ATOMIC_RELEASE);}
+
+template <class T> inline T*   load_acquire (T* const volatile* p)  {return __atomic_load_n(p, __ATOMIC_ACQUIRE);}
+template <class T> inline void store_release(T* volatile* p, T* v)  {__atomic_store_n(p, v, __ATOMIC_RELEASE);}
+
+#else
+
+inline uint64_t load_acquire (const volatile uint64_t* p)   {uint64_t v = *p; __sync_synchronize(); return v;}
+inline void     store_release(volatile uint64_t* p, uint64_t v) {__sync_synchronize(); *p = v;}
+inline void     fence_acquire() {__sync_synchronize();}
+inline void     fence_release() {__sync_synchronize();}
+inline void     fence_full()    {__sync_synchronize();}
+
+inline uint32_t load_acquire (const volatile uint32_t* p)   {uint32_t v = *p; __sync_synchronize(); return v;}
+inline void     store_release(volatile uint32_t* p, uint32_t v) {__sync_synchronize(); *p = v;}
+
+inline uint16_t load_acquire (const volatile uint16_t* p)   {uint16_t v = *p; __sync_synchronize(); return v;}
+inline void     store_release(volatile uint16_t* p, uint16_t v) {__sync_synchronize(); *p = v;}
+
+template <class T> inline T*   load_acquire (T* const volatile* p)  {T* v = *p; __sync_synchronize(); return v;}
+template <class T> inline void store_release(T* volatile* p, T* v)  {__sync_synchronize(); *p = v;}
+
+#endif
+//==========================================================================================================
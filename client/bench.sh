@@ -0,0 +1,225 @@
+#!/bin/bash
+#==========================================================================================================
+# bench.sh - Starts a logger for each max_entries setting, runs logger_bench against it for every
+#            combination of the other settings, and collects the results
+#
+# Given more than one logger executable (say, built with and without the io_uring backend), each one is
+# put through the same sweep in turn, so their results can be compared.  A result's "io_uring" field
+# says which backend the logger used.
+#
+# Every setting can be overridden from the environment, for example:
+#     ENTRIES="5000 1000000" SIZES="64 1000" make bench
+#
+# Each run's results are a line of JSON, appended to $RESULTS and echoed to stdout.  The log is not
+# cleared between runs against the same logger, so the dumps measure whatever it holds by then, up to
+# max_entries.
+#
+# MODE picks what's run:
+#     sweep         The sweep described above (the default)
+#     slow_reader   Checks that dump clients that stop reading don't slow down logging.  The log is filled
+#                   to $SLOW_ENTRIES, then $SLOW_COUNT messages are sent at $SLOW_RATE per second, once
+#                   with no stalled clients and once with $STALLED of them.  The second run must log as
+#                   many messages, give or take $TOLERANCE percent of them, and the script exits with 1 if
+#                   it doesn't
+#     persist       Measures how long the disk engine takes to start up with a full log.  The log is filled
+#                   with $PERSIST_ENTRIES binary-format messages at $PERSIST_RATE per second, then the
+#                   logger is restarted.  The result is how long it took to answer again, how long it spent
+#                   recovering the log (its log.create_ns), and how many entries it recovered
+#==========================================================================================================
+
+MODE=${MODE:-sweep}                         # What to run (see above)
+LOGGER=${LOGGER:-./logger.x86}              # The logger executables to benchmark, one after another
+CONFIG=${CONFIG:-logger.conf}               # The configuration to start from
+BENCH=${BENCH:-client/logger_bench}         # The load generator
+ENTRIES=${ENTRIES:-"5000 100000 1000000"}   # The max_entries settings to try
+SIZES=${SIZES:-"64 256 1000"}               # Message sizes, in bytes
+THREADS=${THREADS:-"1 4"}                   # Numbers of sending threads
+DUMP_CLIENTS=${DUMP_CLIENTS:-"1 8"}         # Numbers of clients dumping the log at once
+LIVE_CLIENTS=${LIVE_CLIENTS:-1}             # The number of live-log clients measuring latency
+FORMATS=${FORMATS:-"text binary shm"}       # Datagram formats to send ("shm" writes to the shared-memory ring)
+COUNT=${COUNT:-200000}                      # Messages sent per run
+RATE=${RATE:-0}                             # Messages per second per run (0 = as fast as possible)
+SLOW_ENTRIES=${SLOW_ENTRIES:-10000}         # slow_reader: the size of the log the stalled clients ask for
+SLOW_COUNT=${SLOW_COUNT:-200000}            # slow_reader: messages sent per run
+SLOW_RATE=${SLOW_RATE:-50000}               # slow_reader: messages per second
+STALLED=${STALLED:-4}                       # slow_reader: the number of stalled dump clients
+TOLERANCE=${TOLERANCE:-1}                   # slow_reader: how much worse the stalled run may do, in percent
+PERSIST_ENTRIES=${PERSIST_ENTRIES:-10000000} # persist: the number of entries in the log when it's restarted
+PERSIST_RATE=${PERSIST_RATE:-500000}        # persist: messages per second while the log is filled
+PERSIST_SIZE=${PERSIST_SIZE:-32}            # persist: message size, in bytes
+RESULTS=${RESULTS:-bench_results.jsonl}     # Where the results are collected
+PORT_BASE=${PORT_BASE:-15000}               # The logger under test listens on ports from here up
+SHM_NAME=${SHM_NAME:-/logger_bench.$$}      # The logger under test's shared-memory ring
+
+LOG_PORT=$PORT_BASE
+DUMP_PORT=$((PORT_BASE + 1))
+LIVE_PORT=$((PORT_BASE + 2))
+STATS_PORT=$((PORT_BASE + 3))
+
+LOGGERS=
+for logger in $LOGGER; do LOGGERS="$LOGGERS $(realpath "$logger")" || exit 1; done
+BENCH=$(realpath "$BENCH") || exit 1
+WORK=$(mktemp -d /tmp/logger_bench.XXXXXX)
+PID=
+
+# Make sure the logger doesn't outlive us
+cleanup()
+{
+    [ -n "$PID" ] && kill $PID 2>/dev/null && wait $PID 2>/dev/null
+    rm -rf "$WORK" "/dev/shm$SHM_NAME"
+}
+trap cleanup EXIT
+
+# Sets "key = value" in the working configuration, adding it if it isn't there
+set_conf()
+{
+    if grep -q "^$1 *=" "$WORK/logger.conf"; then
+        sed -i "s|^$1 *=.*|$1 = $2|" "$WORK/logger.conf"
+    else
+        echo "$1 = $2" >> "$WORK/logger.conf"
+    fi
+}
+
+# Starts a logger ($1) with $2 entries, on ports of its own, and waits for it to start answering.  Any
+# more arguments are settings of the form key=value.  A shared-memory ring gets a shard of the log to itself
+start_logger()
+{
+    local logger=$1 entries=$2 setting
+    shift 2
+
+    cp "$CONFIG" "$WORK/logger.conf"
+    set_conf max_entries   $entries
+    set_conf log_port      $LOG_PORT
+    set_conf server_port   $DUMP_PORT
+    set_conf live_log_port $LIVE_PORT
+    set_conf stats_port    $STATS_PORT
+    set_conf log_dir       "$WORK/logdata"
+    for setting in "$@"; do set_conf "${setting%%=*}" "${setting#*=}"; done
+    (cd "$WORK" && exec "$logger" -config "$WORK/logger.conf" > /dev/null) &
+    PID=$!
+
+    for i in $(seq 500); do
+        (exec 3<>/dev/tcp/127.0.0.1/$STATS_PORT) 2>/dev/null && break
+        sleep 0.01
+    done
+}
+
+stop_logger()
+{
+    kill $PID; wait $PID 2>/dev/null; PID=
+}
+
+# Runs logger_bench against the logger under test, with whatever options are given
+run_bench()
+{
+    "$BENCH" -p $LOG_PORT -d $DUMP_PORT -l $LIVE_PORT -S $STATS_PORT "$@"
+}
+
+# Pulls a numeric field out of a line of JSON results
+field()
+{
+    echo "$1" | grep -o "\"$2\":-\?[0-9.]*" | cut -d: -f2
+}
+
+# Fetches one of the statistics of the logger under test
+stat()
+{
+    (exec 3<>/dev/tcp/127.0.0.1/$STATS_PORT && cat <&3) 2>/dev/null | grep "^$1 " | cut -d' ' -f2
+}
+
+# The sweep
+sweep()
+{
+    for logger in $LOGGERS; do
+        for entries in $ENTRIES; do
+            start_logger "$logger" $entries shm_name=$SHM_NAME
+
+            for format in $FORMATS; do
+                flag=; [ "$format" = binary ] && flag=-b; [ "$format" = shm ] && flag="-M $SHM_NAME"
+                for size in $SIZES; do
+                    for threads in $THREADS; do
+                        for dumps in $DUMP_CLIENTS; do
+                            run_bench $flag -m $entries -s $size -t $threads -c $dumps -L $LIVE_CLIENTS \
+                                      -n $COUNT -r $RATE | tee -a "$RESULTS"
+                        done
+                    done
+                done
+            done
+
+            stop_logger
+        done
+    done
+}
+
+# The slow-reader check
+slow_reader()
+{
+    local failed=0
+
+    for logger in $LOGGERS; do
+        start_logger "$logger" $SLOW_ENTRIES
+
+        # Fill the log, so the stalled clients have a full log to be stuck on
+        run_bench -m $SLOW_ENTRIES -n $SLOW_ENTRIES -r $SLOW_RATE -L 0 -c 0 > /dev/null 2>&1
+
+        # Then log the same load without stalled clients, and with them
+        base=$(run_bench -m $SLOW_ENTRIES -n $SLOW_COUNT -r $SLOW_RATE -L 0 -c 1 -w 0)
+        slow=$(run_bench -m $SLOW_ENTRIES -n $SLOW_COUNT -r $SLOW_RATE -L 0 -c 1 -w $STALLED)
+        echo "$base" | tee -a "$RESULTS"
+        echo "$slow" | tee -a "$RESULTS"
+        stop_logger
+
+        # The stalled run must have logged as much, and lost no more to the kernel
+        slack=$((SLOW_COUNT * TOLERANCE / 100))
+        base_logged=$(field "$base" logged);       slow_logged=$(field "$slow" logged)
+        base_drops=$(field "$base" kernel_drops);  slow_drops=$(field "$slow" kernel_drops)
+        stalled_bytes=$(field "$slow" stalled_bytes)
+        if [ -z "$slow_logged" ] || [ "$slow_logged" -lt 0 ]; then
+            echo "slow_reader: $logger has no stats_port, so nothing can be checked" >&2
+            failed=1
+        elif [ "$slow_logged" -lt $((base_logged - slack)) ] || [ "$slow_drops" -gt $((base_drops + slack)) ]; then
+            echo "slow_reader FAILED: $logger logged $slow_logged (dropped $slow_drops) with $STALLED stalled" \
+                 "clients, against $base_logged (dropped $base_drops) without" >&2
+            failed=1
+        else
+            echo "slow_reader passed: $logger logged $slow_logged (dropped $slow_drops) with $STALLED stalled" \
+                 "clients holding $stalled_bytes unread bytes, against $base_logged (dropped $base_drops) without" >&2
+        fi
+    done
+
+    return $failed
+}
+
+# The disk engine's startup time, with a full log
+persist()
+{
+    for logger in $LOGGERS; do
+        # Fill a fresh log
+        rm -rf "$WORK/logdata"
+        start_logger "$logger" $PERSIST_ENTRIES log_engine=disk
+        run_bench -b -m $PERSIST_ENTRIES -n $PERSIST_ENTRIES -r $PERSIST_RATE -s $PERSIST_SIZE -L 0 -c 0 > /dev/null
+        held=$(stat log.entries)
+        stop_logger
+
+        # Restart it, and time how long it takes to answer
+        start=$(date +%s%N)
+        start_logger "$logger" $PERSIST_ENTRIES log_engine=disk
+        startup=$(( $(date +%s%N) - start ))
+        recovered=$(stat log.entries)
+        create_ns=$(stat log.create_ns)
+        stop_logger
+
+        {
+            printf '{"mode":"persist","logger":"%s","msg_size":%d,"entries":%d,"recovered":%d,"disk_bytes":%d,' \
+                   "$(basename "$logger")" $PERSIST_SIZE ${held:--1} ${recovered:--1} $(du -sb "$WORK/logdata" | cut -f1)
+            printf '"startup_ms":%d,"create_ns":%d}\n' $((startup / 1000000)) ${create_ns:--1}
+        } | tee -a "$RESULTS"
+    done
+}
+
+case $MODE in
+    sweep)       sweep ;;
+    slow_reader) slow_reader ;;
+    persist)     persist ;;
+    *)           echo "Unknown MODE \"$MODE\"" >&2; exit 1 ;;
+esac
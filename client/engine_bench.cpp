@@ -0,0 +1,223 @@
+/*==========================================================================================================
+ * engine_bench.cpp - Measures how fast each log storage engine takes appends, and how much memory it uses
+ *
+ * Usage: engine_bench [-e engines] [-m entries] [-s size] [-x passes] [-b bytes]
+ *     -e engines     The engines to measure, comma-separated: ring, deque, packed ("ring,deque")
+ *     -m entries     The max_entries settings to try, comma-separated ("5000,100000,1000000")
+ *     -s size        The size of each message in bytes, not counting the tag (40)
+ *     -x passes      How many times over the engine is filled (3)
+ *     -b bytes       The ring and packed engines' byte budget, per entry (100)
+ *
+ * Each engine is created with each max_entries, and then fed passes * max_entries entries in batches, as
+ * a listener thread feeds it, so that it spends most of the run evicting.  Nothing else is running, so
+ * this is the engine's own cost, without the network, the parsing, or the readers.
+ *
+ * Every run is made in a process of its own, so that the memory it reports (the growth in its resident
+ * set) is the engine's alone.  The results are printed as a line of JSON per run on stdout, and a
+ * human-readable summary goes to stderr.
+ *
+ * This is built from the logger's own engines, so "make engine_bench" builds them first.
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "ring_log.h"
+#include "deque_log.h"
+#include "packed_log.h"
+#include "tags.h"
+
+using namespace std;
+
+/* How many distinct tags the messages are spread over */
+#define TAGS 8
+
+/* How many entries are appended at once.  This is what a listener appends for a full batch of datagrams */
+#define BATCH 64
+
+static int size      = 40;
+static int passes    = 3;
+static int per_entry = 100;
+
+
+/*==========================================================================================================
+ * now() - Returns the time in seconds from a monotonic clock
+ *==========================================================================================================
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * resident() - Returns the size of our resident set, in bytes
+ *==========================================================================================================
+ */
+static long long resident(void)
+{
+    long long pages = 0, rss = 0;
+
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == NULL) return 0;
+    if (fscanf(file, "%lld %lld", &pages, &rss) != 2) rss = 0;
+    fclose(file);
+    return rss * sysconf(_SC_PAGESIZE);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * split() - Splits a comma-separated list
+ *==========================================================================================================
+ */
+static vector<string> split(const char* text)
+{
+    vector<string> item;
+    string         list = text;
+    size_t         start = 0, comma;
+
+    do
+    {
+        comma = list.find(',', start);
+        item.push_back(list.substr(start, comma - start));
+        start = comma + 1;
+    }
+    while (comma != string::npos);
+    return item;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * run() - Fills an engine "passes" times over, and reports how fast it went and how much memory it took
+ *==========================================================================================================
+ */
+static void run(const string& engine, int max_entries)
+{
+    char         tag[TAGS][16];
+    log_item_t   item[BATCH];
+    vector<char> text(BATCH * (size + 16));
+    int          i, j;
+
+    // Make up the tags, and a batch of messages.  Each batch is the same, but every message in it differs
+    TagTable.create(TAGS * 2, 12);
+    for (i = 0; i < TAGS; ++i) sprintf(tag[i], "TAG%d", i);
+    for (i = 0; i < BATCH; ++i)
+    {
+        char* p = &text[i * (size + 16)];
+        int   n = sprintf(p, "message %d ", i);
+        memset(p + n, 'a' + i % 26, size > n ? size - n : 0);
+        item[i].tag_id    = TagTable.intern(tag[i % TAGS], strlen(tag[i % TAGS]));
+        item[i].severity  = 0;
+        item[i].tag       = tag[i % TAGS];
+        item[i].tag_len   = strlen(tag[i % TAGS]);
+        item[i].data      = p;
+        item[i].data_len  = size > n ? size : n;
+    }
+
+    // Create the engine.  Whatever memory it takes from here on is its own
+    long long before = resident();
+    CLogEngine* log;
+    if (engine == "ring")
+        log = new CRingLog(max_entries, max_entries * per_entry);
+    else if (engine == "packed")
+        log = new CPackedLog(max_entries, max_entries * per_entry);
+    else
+        log = new CDequeLog(max_entries);
+
+    // Fill it over and over, as a listener would
+    long long total = (long long)max_entries * passes;
+    uint64_t  seq = 0;
+    double    start = now();
+    for (long long done = 0; done < total; done += BATCH)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        for (j = 0; j < BATCH; ++j) item[j].timestamp = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        log->append(item, BATCH, seq);
+        seq += BATCH;
+    }
+    double seconds = now() - start;
+    long long rss = resident() - before;
+
+    // The results, for machines
+    printf("{\"engine\":\"%s\",\"max_entries\":%d,\"msg_size\":%d,\"appends\":%llu,\"seconds\":%.3f,"
+           "\"appends_per_s\":%.0f,\"rss_bytes\":%lld,\"entries_held\":%llu}\n",
+           engine.c_str(), max_entries, size, (unsigned long long)seq, seconds, seq / seconds, rss,
+           (unsigned long long)(log->end() - log->first()));
+
+    // And for people
+    fprintf(stderr, "%-6s %8d entries: %6.2f M appends/s, %7.1f MB resident\n",
+            engine.c_str(), max_entries, seq / seconds / 1e6, rss / 1e6);
+    fflush(stdout);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * usage() - Explains the command line, and exits
+ *==========================================================================================================
+ */
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-e ring,deque,packed] [-m entries,...] [-s size] [-x passes] [-b bytes]\n", name);
+    exit(1);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * main() - Runs every engine at every size, each in a process of its own
+ *==========================================================================================================
+ */
+int main(int argc, char** argv)
+{
+    const char* engine_list = "ring,deque";
+    const char* entry_list  = "5000,100000,1000000";
+    int c;
+
+    while ((c = getopt(argc, argv, "e:m:s:x:b:")) != -1)
+    {
+        switch (c)
+        {
+            case 'e': engine_list = optarg;       break;
+            case 'm': entry_list  = optarg;       break;
+            case 's': size        = atoi(optarg); break;
+            case 'x': passes      = atoi(optarg); break;
+            case 'b': per_entry   = atoi(optarg); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (size < 1 || size > 60000 || passes < 1 || per_entry < 1) usage(argv[0]);
+
+    vector<string> engines = split(engine_list), sizes = split(entry_list);
+    vector<int>    entries;
+    for (size_t i = 0; i < sizes.size(); ++i) entries.push_back(atoi(sizes[i].c_str()));
+
+    for (size_t i = 0; i < engines.size(); ++i)
+    {
+        if (engines[i] != "ring" && engines[i] != "deque" && engines[i] != "packed") usage(argv[0]);
+        for (size_t j = 0; j < entries.size(); ++j)
+        {
+            if (entries[j] < 1) usage(argv[0]);
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                run(engines[i], entries[j]);
+                exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+    }
+    return 0;
+}
+/*========================================================================================================*/
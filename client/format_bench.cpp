@@ -0,0 +1,268 @@
+/*==========================================================================================================
+ * format_bench.cpp - Measures how many lines per second the logger formats, against the sprintf path it
+ *                    replaced
+ *
+ * Usage: format_bench [-n lines] [-r rate] [-s size] [-p precision] [-c checks]
+ *     -n lines       The number of lines each formatter is timed on (5000000)
+ *     -r rate        How many entries per second the timestamps are spread at (10000)
+ *     -s size        The size of each message in bytes (64)
+ *     -p precision   The number of digits of fractional seconds: 0, 3, 6, or 9 (0)
+ *     -c checks      How many random entries the two formatters are checked against each other on (200000)
+ *
+ * The sprintf path is the one the logger used to take: localtime_r() and snprintf() for every line.  It's
+ * kept here, made to render the same line as format_log_entry() (fraction, tag padding, severity, and
+ * truncation included), so the two can be checked byte for byte before they're timed.  The checks use
+ * entries with random tags, severities, lengths, and timestamps, formatted into random buffer sizes, so
+ * that truncation is covered too.  The program exits with 1 if any line differs.
+ *
+ * The timed run formats every line into a large buffer, the way a dump does, with timestamps "rate" to
+ * the second.  The results are printed as a line of JSON on stdout, and a summary goes to stderr.  The
+ * time zone is whatever TZ says, since that changes what localtime_r() costs.
+ *
+ * This is built from the logger's own formatter, so "make format_bench" builds it first.
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "formatter.h"
+#include "globals.h"
+#include "tags.h"
+#include "ingest_proto.h"
+
+using namespace std;
+
+/* The formatter reads the configuration, so we have one of our own */
+conf_t conf;
+
+/* How many distinct tags the entries are spread over */
+#define TAGS 32
+
+/* The size of the buffer the timed lines are formatted into, as a dump formats them */
+#define BUFFER_SIZE (128 * 1024)
+
+/* How each severity is rendered, as in formatter.cpp */
+static const char* const severity_text[] = {"", "DEBUG: ", "INFO: ", "WARNING: ", "ERROR: ", "CRITICAL: "};
+
+
+/*==========================================================================================================
+ * now() - Returns the time in seconds from a monotonic clock
+ *==========================================================================================================
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * sprintf_format() - Formats an entry the way the logger used to: localtime_r() and snprintf() every time
+ *
+ * Returns: The length of the formatted line, not including the nul-terminator
+ *==========================================================================================================
+ */
+static int sprintf_format(const log_view_t& entry, char* line, int size)
+{
+    struct tm tm;
+    char      fraction[16] = "";
+
+    // Break the timestamp out into components
+    time_t seconds = entry.timestamp / NS_PER_SEC;
+    localtime_r(&seconds, &tm);
+
+    // Render the fraction of a second, if it's wanted, cut short to the digits that are
+    if (conf.time_precision > 0)
+    {
+        snprintf(fraction, sizeof fraction, ".%09d", (int)(entry.timestamp % NS_PER_SEC));
+        fraction[conf.time_precision + 1] = 0;
+    }
+
+    // Format the time, tag, severity, and data
+    int severity = (entry.severity <= LOG_SEV_CRITICAL) ? entry.severity : LOG_SEV_CRITICAL;
+    int length = snprintf(line, size, "%02d:%02d:%02d%s (%-*.*s): %s%.*s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                          fraction, conf.id_length, entry.tag_len, entry.tag, severity_text[severity],
+                          entry.data_len, entry.data);
+
+    // If the line didn't fit, it was truncated, but it still ends with a linefeed
+    if (length >= size)
+    {
+        length = size - 1;
+        line[length - 1] = '\n';
+    }
+    return length;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * make_entry() - Fills in an entry with one of the tags and some of the text
+ *==========================================================================================================
+ */
+static void make_entry(log_view_t& entry, const vector<string>& tag, const vector<uint32_t>& tag_id,
+                       int which, const string& text, int length, int severity, log_time_t timestamp)
+{
+    memset(&entry, 0, sizeof entry);
+    entry.timestamp = timestamp;
+    entry.tag_id    = tag_id[which];
+    entry.tag       = tag[which].data();
+    entry.tag_len   = tag[which].size();
+    entry.severity  = severity;
+    entry.data      = text.data();
+    entry.data_len  = length;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * check() - Formats random entries both ways, into random buffer sizes, and compares the lines
+ *
+ * Returns: The number of lines that differ
+ *==========================================================================================================
+ */
+static int check(int count, const vector<string>& tag, const vector<uint32_t>& tag_id, const string& text)
+{
+    vector<char> ours(MAX_LINE_LENGTH + 1), theirs(MAX_LINE_LENGTH + 1);
+    log_time_t   base = (log_time_t)time(NULL) * NS_PER_SEC;
+    int          failed = 0;
+    log_view_t   entry;
+
+    for (int i = 0; i < count; ++i)
+    {
+        // Mostly nearby timestamps, so the cache gets used, with the odd jump of up to a year either way
+        log_time_t timestamp = base + (rand() % 4000) * (NS_PER_SEC / 1000);
+        if (rand() % 100 == 0) base += ((log_time_t)rand() % (366 * 86400) - 183 * 86400) * NS_PER_SEC;
+        make_entry(entry, tag, tag_id, rand() % tag.size(), text, rand() % text.size(), rand() % 7, timestamp);
+
+        // Usually a buffer with room to spare, sometimes one that's too small
+        int size = (rand() % 4) ? MAX_LINE_LENGTH + 1 : 2 + rand() % 80;
+        int length1 = format_log_entry(entry, &ours[0], size);
+        int length2 = sprintf_format(entry, &theirs[0], size);
+        if (length1 == length2 && memcmp(&ours[0], &theirs[0], length1 + 1) == 0) continue;
+
+        if (++failed <= 5)
+            fprintf(stderr, "mismatch in a buffer of %d bytes:\n  ours:    %.*s  sprintf: %.*s", size,
+                    length1, &ours[0], length2, &theirs[0]);
+    }
+    return failed;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * timed() - Formats "count" lines into a large buffer with one of the formatters
+ *
+ * Returns: The number of lines formatted per second
+ *==========================================================================================================
+ */
+static double timed(int (*format)(const log_view_t&, char*, int), int count, int rate, int size,
+                    const vector<string>& tag, const vector<uint32_t>& tag_id, const string& text)
+{
+    vector<char> buffer(BUFFER_SIZE);
+    log_time_t   base = (log_time_t)time(NULL) * NS_PER_SEC;
+    int          used = 0;
+    uint64_t     bytes = 0;
+    log_view_t   entry;
+
+    double start = now();
+    for (int i = 0; i < count; ++i)
+    {
+        log_time_t timestamp = base + (log_time_t)i * NS_PER_SEC / rate;
+        make_entry(entry, tag, tag_id, i % tag.size(), text, size, i % 6, timestamp);
+        if (BUFFER_SIZE - used <= MAX_LINE_LENGTH)
+        {
+            bytes += used;
+            used = 0;
+        }
+        used += format(entry, &buffer[used], MAX_LINE_LENGTH);
+    }
+    double seconds = now() - start;
+
+    // Make sure the compiler can't decide the lines weren't needed
+    if (bytes + used == 0) fprintf(stderr, "nothing was formatted\n");
+    return count / seconds;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * usage() - Explains the command line, and exits
+ *==========================================================================================================
+ */
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-n lines] [-r rate] [-s size] [-p precision] [-c checks]\n", name);
+    exit(1);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * main() - Checks that the two formatters agree, then times them both
+ *==========================================================================================================
+ */
+int main(int argc, char** argv)
+{
+    int count = 5000000, rate = 10000, size = 64, checks = 200000, c;
+
+    conf.id_length      = 12;
+    conf.time_precision = 0;
+
+    while ((c = getopt(argc, argv, "n:r:s:p:c:")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': count               = atoi(optarg); break;
+            case 'r': rate                = atoi(optarg); break;
+            case 's': size                = atoi(optarg); break;
+            case 'p': conf.time_precision = atoi(optarg); break;
+            case 'c': checks              = atoi(optarg); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (count < 1 || rate < 1 || size < 1 || size > 60000 || checks < 0) usage(argv[0]);
+    if (conf.time_precision < 0 || conf.time_precision > 9 || conf.time_precision % 3) usage(argv[0]);
+
+    // Make up the tags, some shorter than id_length and some longer, and the text the messages come from
+    vector<string>   tag;
+    vector<uint32_t> tag_id;
+    TagTable.create(TAGS * 2, conf.id_length);
+    for (int i = 0; i < TAGS; ++i)
+    {
+        tag.push_back(string(1 + i % 16, 'A' + i % 26));
+        tag_id.push_back(TagTable.intern(tag[i].data(), tag[i].size()));
+    }
+    string text;
+    for (int i = 0; i < 60000; ++i) text += (char)(' ' + i % 95);
+
+    // The two formatters must render every line the same
+    srand(1);
+    int failed = check(checks, tag, tag_id, text);
+    if (failed)
+    {
+        fprintf(stderr, "%d of %d lines differ\n", failed, checks);
+        return 1;
+    }
+
+    // Then time them
+    double sprintf_rate = timed(sprintf_format,   count, rate, size, tag, tag_id, text);
+    double ours_rate    = timed(format_log_entry, count, rate, size, tag, tag_id, text);
+
+    // The results, for machines
+    printf("{\"lines\":%d,\"rate\":%d,\"msg_size\":%d,\"precision\":%d,\"checked\":%d,"
+           "\"sprintf_lines_per_s\":%.0f,\"lines_per_s\":%.0f,\"speedup\":%.2f}\n",
+           count, rate, size, conf.time_precision, checks, sprintf_rate, ours_rate, ours_rate / sprintf_rate);
+
+    // And for people
+    fprintf(stderr, "%d lines of %d bytes, %d per second: sprintf %.2f M lines/s, format_log_entry %.2f M "
+                    "lines/s (%.1fx), %d lines checked\n", count, size, rate, sprintf_rate / 1e6,
+                    ours_rate / 1e6, ours_rate / sprintf_rate, checks);
+    return 0;
+}
+/*========================================================================================================*/
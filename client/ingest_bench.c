@@ -0,0 +1,178 @@
+/*==========================================================================================================
+ * ingest_bench.c - Measures how fast messages can be logged in the text format versus the binary format
+ *
+ * Usage: ingest_bench [-h host] [-p port] [-s stats_port] [-n messages] [-l length] [-r rate]
+ *                     [-f text|binary|both]
+ *
+ * Sends "messages" messages of about "length" bytes, spread over a handful of tags, as fast as it can
+ * (or at "rate" messages per second).  If the logger's stats port is given, the benchmark also asks
+ * the logger how many messages it actually logged, which shows how many were lost.
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "logclient.h"
+
+/* How many distinct tags the messages are spread over */
+#define TAGS 8
+
+/* When sending at a fixed rate, how many messages are sent between checks of the schedule */
+#define PACE_INTERVAL 256
+
+/* How long to give the logger to drain its socket before asking what it received, in microseconds */
+#define DRAIN_TIME 500000
+
+static const char* host       = "127.0.0.1";
+static int         port       = 5000;
+static int         stats_port = 0;
+static int         messages   = 1000000;
+static int         length     = 80;
+static double      rate       = 0;
+
+
+/*==========================================================================================================
+ * now() - Returns the time in seconds from a monotonic clock
+ *==========================================================================================================
+ */
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logged() - Asks the logger's stats port how many messages it has logged.  Returns -1 if it can't
+ *==========================================================================================================
+ */
+static long long logged(void)
+{
+    struct sockaddr_in addr;
+    char   report[65536], *p;
+    int    size = 0, n;
+
+    if (stats_port == 0) return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(stats_port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof addr) < 0)
+    {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    // Read the whole report
+    while (size < (int)sizeof report - 1 && (n = read(fd, report + size, sizeof report - 1 - size)) > 0) size += n;
+    report[size] = 0;
+    close(fd);
+
+    // And find the count of records the listeners have logged
+    p = strstr(report, "listener.records ");
+    return p ? atoll(p + 17) : -1;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * run() - Sends the messages in one format, and reports how it went
+ *==========================================================================================================
+ */
+static void run(int binary)
+{
+    logclient_t lc;
+    char        tag[TAGS][16];
+    char        text[4096];
+    int         i;
+
+    if (logclient_open(&lc, host, port) < 0)
+    {
+        perror("logclient_open");
+        exit(1);
+    }
+
+    // Every message looks much like a real one: a few fields that vary, padded out to the length
+    for (i = 0; i < TAGS; ++i) sprintf(tag[i], "service_%02d", i);
+    memset(text, 'x', sizeof text);
+
+    long long before = logged();
+    double start = now();
+    for (i = 0; i < messages; ++i)
+    {
+        int n = sprintf(text, "req=%d user=u%03d latency_us=%d status=ok ", i, i % 997, (i * 7919) % 100000);
+        if (n < length) text[n] = 'x', n = length;
+        if (binary)
+            logclient_log(&lc, LOG_SEV_INFO, tag[i % TAGS], text, n);
+        else
+            logclient_send_text(&lc, tag[i % TAGS], text, n);
+
+        // If we're sending at a fixed rate and we're ahead of schedule, wait for it to catch up
+        if (rate > 0 && i % PACE_INTERVAL == 0)
+        {
+            double ahead = start + i / rate - now();
+            if (ahead > 0) usleep(ahead * 1e6);
+        }
+    }
+    logclient_flush(&lc);
+    double elapsed = now() - start;
+
+    // Tell the caller how fast we sent
+    printf("%-6s  %9d msgs  %8.0f msgs/s sent  %8llu datagrams  %5.1f msgs/datagram  %llu send errors\n",
+           binary ? "binary" : "text", messages, messages / elapsed, (unsigned long long)lc.datagrams,
+           (double)messages / lc.datagrams, (unsigned long long)lc.errors);
+
+    // And, if we can find out, how many the logger logged
+    usleep(DRAIN_TIME);
+    long long after = logged();
+    if (before >= 0 && after >= 0)
+    {
+        printf("        %9lld logged  %5.2f%% lost\n", after - before, 100.0 * (messages - (after - before)) / messages);
+    }
+
+    logclient_close(&lc);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * main() - Parses the command line and runs the benchmark
+ *==========================================================================================================
+ */
+int main(int argc, char** argv)
+{
+    const char* format = "both";
+    int c;
+
+    while ((c = getopt(argc, argv, "h:p:s:n:l:r:f:")) != -1)
+    {
+        switch (c)
+        {
+            case 'h': host       = optarg;       break;
+            case 'p': port       = atoi(optarg); break;
+            case 's': stats_port = atoi(optarg); break;
+            case 'n': messages   = atoi(optarg); break;
+            case 'l': length     = atoi(optarg); break;
+            case 'r': rate       = atof(optarg); break;
+            case 'f': format     = optarg;       break;
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-s stats_port] [-n messages] [-l length]"
+                                " [-r rate] [-f text|binary|both]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (length > 4000) length = 4000;
+
+    if (strcmp(format, "binary") != 0) run(0);
+    if (strcmp(format, "text")   != 0) run(1);
+    return 0;
+}
+/*========================================================================================================*/
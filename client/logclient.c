@@ -0,0 +1,351 @@
+/*==========================================================================================================
+ * logclient.c - Implements the client library for the logger's binary format
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "logclient.h"
+
+/* The longest message logclient_logf() will format */
+#define MAX_FORMATTED 1024
+
+
+/*==========================================================================================================
+ * put16(), put64() - Store little-endian fields
+ *==========================================================================================================
+ */
+static void put16(char* p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void put64(char* p, uint64_t value)
+{
+    int i;
+    for (i = 0; i < 8; ++i, value >>= 8) p[i] = value & 0xFF;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * start_datagram() - Empties the buffer and writes a datagram header into it
+ *==========================================================================================================
+ */
+static void start_datagram(logclient_t* lc)
+{
+    lc->buffer[0] = (char)INGEST_MAGIC;
+    lc->buffer[1] = INGEST_VERSION;
+    put16(lc->buffer + 2, 0);
+    lc->size  = INGEST_HEADER_SIZE;
+    lc->count = 0;
+    lc->tags  = 0;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_open() - Creates the socket that sends to the logger
+ *==========================================================================================================
+ */
+int logclient_open(logclient_t* lc, const char* host, int port)
+{
+    memset(lc, 0, sizeof *lc);
+    lc->addr.sin_family = AF_INET;
+    lc->addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, host, &lc->addr.sin_addr) != 1) return -1;
+
+    lc->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (lc->fd < 0) return -1;
+
+    start_datagram(lc);
+    return 0;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_open_shm() - Maps the logger's shared-memory ring
+ *==========================================================================================================
+ */
+int logclient_open_shm(logclient_t* lc, const char* name)
+{
+    struct stat st;
+
+    memset(lc, 0, sizeof *lc);
+    lc->fd = -1;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(shm_ring_t))
+    {
+        close(fd);
+        errno = ENOENT;
+        return -1;
+    }
+
+    void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+
+    // Make sure the logger has finished creating the ring, and that it's laid out the way we expect
+    shm_ring_t* ring = (shm_ring_t*)p;
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || ring->version != SHM_VERSION
+        || sizeof(shm_ring_t) + ring->capacity != (uint64_t)st.st_size)
+    {
+        munmap(p, st.st_size);
+        errno = ENOENT;
+        return -1;
+    }
+
+    lc->shm      = ring;
+    lc->shm_size = st.st_size;
+    start_datagram(lc);
+    return 0;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_close() - Sends anything that hasn't been sent yet, and closes the socket or unmaps the ring
+ *==========================================================================================================
+ */
+void logclient_close(logclient_t* lc)
+{
+    if (lc->shm)
+    {
+        logclient_flush(lc);
+        munmap(lc->shm, lc->shm_size);
+        lc->shm = NULL;
+        return;
+    }
+
+    if (lc->fd < 0) return;
+    logclient_flush(lc);
+    close(lc->fd);
+    lc->fd = -1;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * shm_write() - Writes a datagram into the logger's shared-memory ring (see shm_proto.h)
+ *
+ * Returns: 0, or -1 if the ring is full
+ *==========================================================================================================
+ */
+static int shm_write(shm_ring_t* ring, const char* data, int length)
+{
+    char*    base     = SHM_DATA(ring);
+    uint64_t capacity = ring->capacity;
+    uint64_t size     = SHM_RECORD_SIZE(length);
+    uint64_t pos, pad, end;
+
+    // Claim the space for the record, and for padding to the end of the ring if it won't fit before then
+    pos = __atomic_load_n(&ring->reserved, __ATOMIC_RELAXED);
+    do
+    {
+        uint64_t offset = pos & (capacity - 1);
+        pad = (capacity - offset < size) ? capacity - offset : 0;
+        end = pos + pad + size;
+        if (end - __atomic_load_n(&ring->consumed, __ATOMIC_ACQUIRE) > capacity)
+        {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&ring->reserved, &pos, end, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // The padding is committed straight away
+    if (pad)
+    {
+        uint32_t* state = (uint32_t*)(base + (pos & (capacity - 1)));
+        __atomic_store_n(state, SHM_COMMITTED | SHM_PAD | (uint32_t)(pad - SHM_ALIGN), __ATOMIC_RELEASE);
+        pos += pad;
+    }
+
+    // Copy the datagram in, then commit it
+    char* record = base + (pos & (capacity - 1));
+    memcpy(record + SHM_ALIGN, data, length);
+    __atomic_store_n((uint32_t*)record, SHM_COMMITTED | (uint32_t)length, __ATOMIC_RELEASE);
+
+    // If the logger is asleep, wake it up.  Only one producer needs to
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &ring->waiting, FUTEX_WAKE, 1, NULL, NULL, 0);
+    return 0;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_flush() - Sends the datagram being built, if there's anything in it
+ *==========================================================================================================
+ */
+int logclient_flush(logclient_t* lc)
+{
+    int result = 0;
+
+    // If there's nothing to send, we're done
+    if (lc->count == 0) return 0;
+
+    // Fill in the record count, and send the datagram, or write it to the ring
+    put16(lc->buffer + 2, lc->count);
+    if (lc->shm ? shm_write(lc->shm, lc->buffer, lc->size) < 0 :
+        sendto(lc->fd, lc->buffer, lc->size, 0, (struct sockaddr*)&lc->addr, sizeof lc->addr) != lc->size)
+    {
+        ++lc->errors;
+        result = -1;
+    }
+    ++lc->datagrams;
+
+    // And start the next one
+    start_datagram(lc);
+    return result;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * find_tag() - Returns the index of a tag that has been spelled out in the datagram, or -1
+ *==========================================================================================================
+ */
+static int find_tag(const logclient_t* lc, const char* tag, int length)
+{
+    int i;
+    for (i = 0; i < lc->tags; ++i)
+    {
+        if (lc->tag_len[i] == length && memcmp(lc->buffer + lc->tag_offset[i], tag, length) == 0) return i;
+    }
+    return -1;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_log() - Adds a message to the datagram being built, sending the datagram first if the
+ *                   message won't fit in it
+ *==========================================================================================================
+ */
+int logclient_log(logclient_t* lc, int severity, const char* tag, const char* data, int length)
+{
+    struct timespec ts;
+    int result = 0;
+
+    // Measure the tag and the data
+    int tag_len = strlen(tag);
+    if (tag_len > 255) tag_len = 255;
+    if (length < 0) length = strlen(data);
+
+    // If the tag is new to this datagram and there's no room to spell it out, or there's no room for
+    // the message, send what we have and start over
+    int ref = find_tag(lc, tag, tag_len);
+    int needed = INGEST_RECORD_SIZE + (ref < 0 ? tag_len : 0) + length;
+    if (lc->count && (lc->size + needed > LOGCLIENT_MAX_DATAGRAM || (ref < 0 && lc->tags == LOGCLIENT_MAX_TAGS)))
+    {
+        result = logclient_flush(lc);
+        ref    = -1;
+    }
+
+    // If the message is too long to fit even in an empty datagram, truncate it
+    int room = LOGCLIENT_MAX_DATAGRAM - lc->size - INGEST_RECORD_SIZE - (ref < 0 ? tag_len : 0);
+    if (length > room) length = room;
+
+    // The fixed part of the record
+    char* p = lc->buffer + lc->size;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    put16(p, INGEST_RECORD_SIZE - 2 + (ref < 0 ? tag_len : 0) + length);
+    p[2] = severity;
+    p[3] = (ref < 0) ? 0 : INGEST_TAG_REF;
+    put64(p + 4, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+    put64(p + 12, lc->seq++);
+    p += 20;
+
+    // The tag, either as a reference to one that was spelled out earlier, or spelled out here
+    if (ref >= 0)
+        *p++ = ref;
+    else
+    {
+        *p++ = tag_len;
+        lc->tag_offset[lc->tags] = p - lc->buffer;
+        lc->tag_len[lc->tags++]  = tag_len;
+        memcpy(p, tag, tag_len);
+        p += tag_len;
+    }
+
+    // And the message
+    memcpy(p, data, length);
+    p += length;
+
+    // The record is complete
+    lc->size = p - lc->buffer;
+    ++lc->count;
+    return result;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_logf() - Logs a printf-style message
+ *==========================================================================================================
+ */
+int logclient_logf(logclient_t* lc, int severity, const char* tag, const char* format, ...)
+{
+    char    text[MAX_FORMATTED];
+    va_list ap;
+
+    va_start(ap, format);
+    int length = vsnprintf(text, sizeof text, format, ap);
+    va_end(ap);
+
+    if (length < 0) length = 0;
+    if (length >= (int)sizeof text) length = sizeof text - 1;
+    return logclient_log(lc, severity, tag, text, length);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * logclient_send_text() - Sends a single message in the original "tag$message" text format
+ *==========================================================================================================
+ */
+int logclient_send_text(logclient_t* lc, const char* tag, const char* data, int length)
+{
+    char datagram[LOGCLIENT_MAX_DATAGRAM];
+
+    // The shared-memory ring only takes the binary format
+    if (lc->shm)
+    {
+        ++lc->errors;
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Build "tag$message", truncated to what the logger will receive
+    int tag_len = strlen(tag);
+    if (length < 0) length = strlen(data);
+    if (tag_len > LOGCLIENT_MAX_DATAGRAM - 1) tag_len = LOGCLIENT_MAX_DATAGRAM - 1;
+    if (length > LOGCLIENT_MAX_DATAGRAM - 1 - tag_len) length = LOGCLIENT_MAX_DATAGRAM - 1 - tag_len;
+    memcpy(datagram, tag, tag_len);
+    datagram[tag_len] = '$';
+    memcpy(datagram + tag_len + 1, data, length);
+
+    // And send it
+    int size = tag_len + 1 + length;
+    ++lc->datagrams;
+    if (sendto(lc->fd, datagram, size, 0, (struct sockaddr*)&lc->addr, sizeof lc->addr) == size) return 0;
+    ++lc->errors;
+    return -1;
+}
+/*========================================================================================================*/
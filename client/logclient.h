@@ -0,0 +1,89 @@
+/*==========================================================================================================
+ * logclient.h - A small client library for sending log messages to the logger in its binary format
+ *
+ * Messages are packed into datagrams as they're logged, and a datagram is sent as soon as the next
+ * message won't fit in it, when logclient_flush() is called, or when the client is closed.  Each distinct
+ * tag is spelled out once per datagram, and every other message with that tag refers back to it.
+ *
+ * A client on the logger's own host can write its datagrams straight into the logger's shared-memory ring
+ * instead (see shm_proto.h), by opening it with logclient_open_shm() in place of logclient_open().  That
+ * costs no system calls unless the logger is idle, and any number of threads and processes may share the
+ * ring.  If the ring is full, the datagram is dropped, just as the kernel would drop it.
+ *
+ * A logclient_t is not thread-safe: give each thread that logs its own.
+ *
+ * Usage:
+ *     logclient_t lc;
+ *     if (logclient_open(&lc, "127.0.0.1", 5000) < 0) ...
+ *     logclient_logf(&lc, LOG_SEV_INFO, "mytag", "started with %d workers", workers);
+ *     logclient_flush(&lc);
+ *     logclient_close(&lc);
+ *==========================================================================================================
+ */
+#ifndef LOGCLIENT_H
+#define LOGCLIENT_H
+#include <stdint.h>
+#include <netinet/in.h>
+#include "../ingest_proto.h"
+#include "../shm_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The largest datagram the logger receives without truncating it */
+#define LOGCLIENT_MAX_DATAGRAM  1023
+
+/* The most distinct tags the client will spell out in a single datagram before sending it */
+#define LOGCLIENT_MAX_TAGS      32
+
+typedef struct
+{
+    int                 fd;                                 /* The UDP socket, or -1 */
+    shm_ring_t*         shm;                                /* Or the logger's shared-memory ring */
+    uint64_t            shm_size;                           /* The size of its mapping */
+    struct sockaddr_in  addr;                               /* The logger's address */
+    uint64_t            seq;                                /* The sequence number of the next message */
+    char                buffer[LOGCLIENT_MAX_DATAGRAM];     /* The datagram being built */
+    int                 size;                               /* The number of bytes in it */
+    int                 count;                              /* The number of records in it */
+    int                 tags;                               /* The number of tags spelled out in it */
+    int                 tag_offset[LOGCLIENT_MAX_TAGS];     /* Where in the buffer each tag's text is */
+    int                 tag_len[LOGCLIENT_MAX_TAGS];        /* And how long it is */
+    uint64_t            datagrams;                          /* The number of datagrams sent */
+    uint64_t            errors;                             /* The number of datagrams that couldn't be sent */
+} logclient_t;
+
+/* Creates the socket that sends to the logger at host:port, where host is a dotted IPv4 address.
+   Returns 0, or -1 with errno set */
+int     logclient_open(logclient_t* lc, const char* host, int port);
+
+/* Maps the logger's shared-memory ring, whose name is the logger's "shm_name" setting.  Returns 0, or -1
+   with errno set.  If the logger hasn't created the ring, or it's being created, errno is ENOENT */
+int     logclient_open_shm(logclient_t* lc, const char* name);
+
+/* Sends anything that hasn't been sent yet, and closes the socket or unmaps the ring */
+void    logclient_close(logclient_t* lc);
+
+/* Logs a message.  If "length" is negative, "data" is nul-terminated.  A tag longer than 255 characters,
+   or a message too long to fit in a datagram, is truncated.  Returns 0, or -1 if a datagram that had
+   to be sent to make room couldn't be */
+int     logclient_log(logclient_t* lc, int severity, const char* tag, const char* data, int length);
+
+/* Logs a printf-style message */
+int     logclient_logf(logclient_t* lc, int severity, const char* tag, const char* format, ...)
+        __attribute__((format(printf, 4, 5)));
+
+/* Sends the datagram being built, if there's anything in it.  Returns 0, or -1 if it couldn't be sent */
+int     logclient_flush(logclient_t* lc);
+
+/* Sends a single message in the original "tag$message" text format, unbuffered.  Returns 0 or -1.  The
+   shared-memory ring only takes the binary format, so this always fails on a client that uses it */
+int     logclient_send_text(logclient_t* lc, const char* tag, const char* data, int length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+/*========================================================================================================*/
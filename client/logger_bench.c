@@ -0,0 +1,581 @@
+/*==========================================================================================================
+ * logger_bench.c - Load generator and consumer that measures a running logger end to end
+ *
+ * Usage: logger_bench [options]
+ *     -h host        The logger's address (127.0.0.1)
+ *     -p port        Its log_port (5000)
+ *     -l port        Its live_log_port (12001)
+ *     -d port        Its server_port, where the log is dumped from (12000)
+ *     -S port        Its stats_port, if it has one (0 = don't ask it for statistics)
+ *     -t threads     The number of threads sending datagrams (1)
+ *     -n count       The total number of messages to send (100000)
+ *     -r rate        The total number of messages per second to send (0 = as fast as possible)
+ *     -s size        The size of each message in bytes, not counting the tag (100)
+ *     -L clients     The number of live-log clients to measure latency with (1)
+ *     -c clients     The number of clients that dump the log at once, after sending (1)
+ *     -w clients     The number of stalled clients: each asks for the whole log before sending starts, and
+ *                    then reads none of it until sending is done (0)
+ *     -b             Send in the binary format, packing as many messages per datagram as fit
+ *     -M name        Write to the logger's shared-memory ring of this name instead, in the binary format
+ *     -m entries     The logger's max_entries.  Only used to label the results
+ *
+ * Every message carries a run ID, its sequence number, and the time it was sent.  The live-log clients
+ * look for them in the lines they receive, which gives the latency from sending a message to its arrival
+ * on the live-log socket, and how many messages never arrived.  When sending is done, the dump clients
+ * each fetch the entire log, and the time that takes is measured.
+ *
+ * A stalled client stands in for a dump client on a slow link.  Its receive buffer is kept tiny, so the
+ * logger is stuck part way through sending it the log for as long as sending goes on.  Comparing a run
+ * with stalled clients to one without shows whether they slow down logging.
+ *
+ * The results are printed as a single line of JSON on stdout, so runs can be collected and compared.
+ * A human-readable summary goes to stderr.
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "logclient.h"
+
+/* The tag every benchmark message is logged with */
+#define BENCH_TAG "BENCH"
+
+/* When sending at a fixed rate, how many messages are sent between checks of the schedule */
+#define PACE_INTERVAL 64
+
+/* A live-log client gives up waiting for more messages once none have arrived for this long, in ms */
+#define IDLE_TIMEOUT 1000
+
+/* How long to give the logger to drain its socket before asking for its statistics, in microseconds */
+#define DRAIN_TIME 500000
+
+/* The receive buffer of a stalled client, in bytes.  The kernel doubles it, and won't go below its minimum */
+#define STALLED_RCVBUF 4096
+
+static const char* host        = "127.0.0.1";
+static int         log_port    = 5000;
+static int         live_port   = 12001;
+static int         dump_port   = 12000;
+static int         stats_port  = 0;
+static int         threads     = 1;
+static int         total       = 100000;
+static double      rate        = 0;
+static int         size        = 100;
+static int         live_count  = 1;
+static int         dump_count  = 1;
+static int         stall_count = 0;
+static int         binary      = 0;
+static const char* shm_name    = NULL;
+static int         max_entries = 0;
+
+/* Identifies this run's messages, so that lines left over from earlier runs are ignored */
+static unsigned    run_id;
+
+/* The live-log clients are told to stop once this is set and they've gone idle */
+static volatile int sending_done = 0;
+
+
+/*==========================================================================================================
+ * now_ns() - Returns the time of day in nanoseconds.  Senders and receivers compare these, so it has to
+ *            be a clock that every process (and, with synchronized clocks, every host) agrees on
+ *==========================================================================================================
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * connect_tcp() - Connects to a TCP port on the logger's host, with a receive buffer of "rcvbuf" bytes
+ *                 (0 = the system default).  Returns the socket, or -1
+ *==========================================================================================================
+ */
+static int connect_tcp_rcvbuf(int port, int rcvbuf)
+{
+    struct sockaddr_in addr;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    // The receive buffer has to be set before connecting, since it decides the window we offer
+    if (rcvbuf) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof addr) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_tcp(int port)
+{
+    return connect_tcp_rcvbuf(port, 0);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * stat_value() - Asks the logger's stats port for one of its statistics.  Returns -1 if it can't
+ *==========================================================================================================
+ */
+static long long stat_value(const char* name)
+{
+    static char report[65536];
+    char   key[128];
+    int    length = 0, n;
+
+    if (stats_port == 0) return -1;
+    int fd = connect_tcp(stats_port);
+    if (fd < 0) return -1;
+
+    // Read the whole report
+    while (length < (int)sizeof report - 1 && (n = read(fd, report + length, sizeof report - 1 - length)) > 0)
+        length += n;
+    report[length] = 0;
+    close(fd);
+
+    // And find the statistic in it
+    sprintf(key, "\n%s ", name);
+    char* p = strstr(report, key);
+    return p ? atoll(p + strlen(key)) : -1;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * Senders - Each thread sends its share of the messages.  Message "seq" of the run is sent by thread
+ *           seq % threads
+ *==========================================================================================================
+ */
+typedef struct
+{
+    pthread_t   thread;
+    int         index;
+    uint64_t    datagrams;
+    uint64_t    errors;
+} sender_t;
+
+static void* sender_main(void* arg)
+{
+    sender_t*   sender = (sender_t*)arg;
+    logclient_t lc;
+    char        text[65536];
+    int         i, n;
+
+    if (shm_name ? logclient_open_shm(&lc, shm_name) < 0 : logclient_open(&lc, host, log_port) < 0)
+    {
+        perror(shm_name ? "logclient_open_shm" : "logclient_open");
+        exit(1);
+    }
+
+    // Messages are padded out to the requested size
+    memset(text, 'x', sizeof text);
+    double thread_rate = rate / threads;
+    int64_t start = now_ns();
+
+    for (i = 0; ; ++i)
+    {
+        int seq = i * threads + sender->index;
+        if (seq >= total) break;
+
+        // Every message says which run it's from, which message it is, and when it was sent
+        n = sprintf(text, "bench=%08x s=%d t=%lld ", run_id, seq, (long long)now_ns());
+        if (n < size) text[n] = 'x', n = size;
+        if (binary)
+            logclient_log(&lc, LOG_SEV_INFO, BENCH_TAG, text, n);
+        else
+            logclient_send_text(&lc, BENCH_TAG, text, n);
+
+        // If we're sending at a fixed rate and we're ahead of schedule, send what we have and wait for
+        // the schedule to catch up
+        if (thread_rate > 0 && i % PACE_INTERVAL == 0)
+        {
+            int64_t ahead = start + (int64_t)(i / thread_rate * 1e9) - now_ns();
+            if (ahead > 0)
+            {
+                logclient_flush(&lc);
+                usleep(ahead / 1000);
+            }
+        }
+    }
+
+    logclient_flush(&lc);
+    sender->datagrams = lc.datagrams;
+    sender->errors    = lc.errors;
+    logclient_close(&lc);
+    return NULL;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * Live-log clients - Each one watches the live log, and records the latency of every message of this
+ *                    run that it sees
+ *==========================================================================================================
+ */
+typedef struct
+{
+    pthread_t   thread;
+    int         fd;
+    uint8_t*    seen;           /* One bit per message of the run */
+    int64_t*    latency;        /* The latency of each message received, in nanoseconds */
+    uint64_t    received;       /* The number of distinct messages received */
+    uint64_t    duplicates;     /* The number of messages received more than once */
+    uint64_t    gaps;           /* The number of "lines missed" notices from the logger */
+} live_t;
+
+/* Looks for a message from this run in a line, and records it */
+static void live_line(live_t* live, const char* line, int64_t arrived)
+{
+    unsigned id;
+    long long sent;
+    int  seq;
+
+    // The logger tells a client when its queue overflowed and lines were lost
+    if (strstr(line, "***")) ++live->gaps;
+
+    // Ignore anything that isn't one of our messages
+    const char* p = strstr(line, "bench=");
+    if (p == NULL || sscanf(p, "bench=%x s=%d t=%lld", &id, &seq, &sent) != 3) return;
+    if (id != run_id || seq < 0 || seq >= total) return;
+
+    // Count the message, unless we've already seen it
+    if (live->seen[seq / 8] & (1 << (seq % 8)))
+    {
+        ++live->duplicates;
+        return;
+    }
+    live->seen[seq / 8] |= 1 << (seq % 8);
+    live->latency[live->received++] = arrived - sent;
+}
+
+static void* live_main(void* arg)
+{
+    live_t*        live = (live_t*)arg;
+    static __thread char buffer[1 << 16];
+    struct timeval tv = {0, 100000};
+    int            used = 0, idle = 0;
+
+    setsockopt(live->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    // Read lines until every message has arrived, or nothing has for a while after sending stopped
+    while (live->received < (uint64_t)total)
+    {
+        int n = read(live->fd, buffer + used, sizeof buffer - 1 - used);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            idle += tv.tv_usec / 1000;
+            if (sending_done && idle >= IDLE_TIMEOUT) break;
+            continue;
+        }
+        idle = 0;
+
+        // Every line is stamped with the time the read that completed it returned
+        int64_t arrived = now_ns();
+        used += n;
+        buffer[used] = 0;
+        char* line = buffer;
+        char* eol;
+        while ((eol = memchr(line, '\n', buffer + used - line)) != NULL)
+        {
+            *eol = 0;
+            live_line(live, line, arrived);
+            line = eol + 1;
+        }
+
+        // Keep whatever partial line is left for next time.  A line that fills the buffer is discarded
+        used = buffer + used - line;
+        if (used == sizeof buffer - 1) used = 0;
+        memmove(buffer, line, used);
+    }
+
+    close(live->fd);
+    return NULL;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * Dump clients - Each one fetches the entire log, and times it
+ *==========================================================================================================
+ */
+typedef struct
+{
+    pthread_t   thread;
+    double      seconds;
+    uint64_t    bytes;
+    uint64_t    lines;
+} dump_t;
+
+static void* dump_main(void* arg)
+{
+    dump_t* dump = (dump_t*)arg;
+    static __thread char buffer[1 << 16];
+    int     n, i;
+
+    int64_t start = now_ns();
+    int fd = connect_tcp(dump_port);
+    if (fd < 0) return NULL;
+
+    // Say nothing, which asks for the whole log, and read until the logger closes the connection
+    shutdown(fd, SHUT_WR);
+    while ((n = read(fd, buffer, sizeof buffer)) > 0)
+    {
+        dump->bytes += n;
+        for (i = 0; i < n; ++i) dump->lines += (buffer[i] == '\n');
+    }
+    close(fd);
+
+    dump->seconds = (now_ns() - start) / 1e9;
+    return NULL;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * percentile() - Returns the value that "fraction" of the sorted values are at or below
+ *==========================================================================================================
+ */
+static int64_t percentile(const int64_t* value, uint64_t count, double fraction)
+{
+    if (count == 0) return 0;
+    uint64_t i = (uint64_t)(fraction * count);
+    return value[i < count ? i : count - 1];
+}
+
+static int compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * usage() - Explains the command line, and exits
+ *==========================================================================================================
+ */
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p log_port] [-l live_port] [-d dump_port] [-S stats_port]\n"
+                    "       [-t threads] [-n count] [-r rate] [-s size] [-L live_clients] [-c dump_clients]\n"
+                    "       [-w stalled_clients] [-b] [-M shm_name] [-m max_entries]\n", name);
+    exit(1);
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * main() - Runs the benchmark and reports the results
+ *==========================================================================================================
+ */
+int main(int argc, char** argv)
+{
+    int c, i;
+
+    while ((c = getopt(argc, argv, "h:p:l:d:S:t:n:r:s:L:c:w:bM:m:")) != -1)
+    {
+        switch (c)
+        {
+            case 'h': host        = optarg;       break;
+            case 'p': log_port    = atoi(optarg); break;
+            case 'l': live_port   = atoi(optarg); break;
+            case 'd': dump_port   = atoi(optarg); break;
+            case 'S': stats_port  = atoi(optarg); break;
+            case 't': threads     = atoi(optarg); break;
+            case 'n': total       = atoi(optarg); break;
+            case 'r': rate        = atof(optarg); break;
+            case 's': size        = atoi(optarg); break;
+            case 'L': live_count  = atoi(optarg); break;
+            case 'c': dump_count  = atoi(optarg); break;
+            case 'w': stall_count = atoi(optarg); break;
+            case 'b': binary      = 1;            break;
+            case 'M': shm_name    = optarg;       break;
+            case 'm': max_entries = atoi(optarg); break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (threads < 1 || total < 1 || size < 0 || size > 60000 || live_count < 0 || dump_count < 0 || stall_count < 0)
+        usage(argv[0]);
+    run_id = (unsigned)(now_ns() ^ getpid());
+
+    // The shared-memory ring only takes the binary format, and has counters of its own
+    if (shm_name) binary = 1;
+    const char* format        = shm_name ? "shm" : binary ? "binary" : "text";
+    const char* logged_stat   = shm_name ? "shm.records" : "listener.records";
+    const char* dropped_stat  = shm_name ? "shm.dropped" : "listener.drops";
+
+    sender_t* sender = calloc(threads, sizeof(sender_t));
+    live_t*   live   = calloc(live_count ? live_count : 1, sizeof(live_t));
+    dump_t*   dump   = calloc(dump_count ? dump_count : 1, sizeof(dump_t));
+    int*      stall  = calloc(stall_count ? stall_count : 1, sizeof(int));
+
+    // Connect the live-log clients before anything is sent, so they see every message
+    for (i = 0; i < live_count; ++i)
+    {
+        live[i].fd = connect_tcp(live_port);
+        if (live[i].fd < 0)
+        {
+            fprintf(stderr, "can't connect to live-log port %d\n", live_port);
+            return 1;
+        }
+        live[i].seen    = calloc(total / 8 + 1, 1);
+        live[i].latency = malloc(total * sizeof(int64_t));
+        pthread_create(&live[i].thread, NULL, live_main, &live[i]);
+    }
+
+    // The stalled clients ask for the whole log, by saying nothing, and then don't read it
+    for (i = 0; i < stall_count; ++i)
+    {
+        stall[i] = connect_tcp_rcvbuf(dump_port, STALLED_RCVBUF);
+        if (stall[i] < 0)
+        {
+            fprintf(stderr, "can't connect to dump port %d\n", dump_port);
+            return 1;
+        }
+        shutdown(stall[i], SHUT_WR);
+    }
+
+    // Give the live-log clients a moment to get through the backlog the logger replays to them, and the
+    // logger a moment to fill the stalled clients' buffers
+    usleep(200000);
+
+    // Send the messages, and time it
+    long long logged_before = stat_value(logged_stat);
+    long long drops_before  = stat_value(dropped_stat);
+    long long rx_calls_before   = stat_value("listener.syscalls");
+    long long live_calls_before = stat_value("live.syscalls");
+    int64_t start = now_ns();
+    for (i = 0; i < threads; ++i)
+    {
+        sender[i].index = i;
+        pthread_create(&sender[i].thread, NULL, sender_main, &sender[i]);
+    }
+    uint64_t datagrams = 0, errors = 0;
+    for (i = 0; i < threads; ++i)
+    {
+        pthread_join(sender[i].thread, NULL);
+        datagrams += sender[i].datagrams;
+        errors    += sender[i].errors;
+    }
+    double send_seconds = (now_ns() - start) / 1e9;
+
+    // Wait for the live-log clients to see everything they're going to
+    sending_done = 1;
+    for (i = 0; i < live_count; ++i) pthread_join(live[i].thread, NULL);
+
+    // Find out how many messages the logger actually logged, and how many datagrams the kernel dropped (or
+    // for the shared-memory ring, how many didn't fit in it)
+    usleep(DRAIN_TIME);
+    long long logged_after = stat_value(logged_stat);
+    long long drops_after  = stat_value(dropped_stat);
+    long long logged = (logged_before >= 0 && logged_after >= 0) ? logged_after - logged_before : -1;
+    long long kernel_drops = (drops_before >= 0 && drops_after >= 0) ? drops_after - drops_before : -1;
+
+    // The stalled clients have been stuck all this time.  What's waiting in their buffers shows that the
+    // logger really was part way through sending to them.  Then they go away, so that they don't hold up
+    // the dumps below
+    long long stalled_bytes = 0;
+    for (i = 0; i < stall_count; ++i)
+    {
+        int waiting = 0;
+        if (ioctl(stall[i], FIONREAD, &waiting) == 0) stalled_bytes += waiting;
+        close(stall[i]);
+    }
+
+    // And how many system calls it took to receive them and stream them to the live-log clients, and
+    // whether they went through io_uring
+    long long rx_calls_after   = stat_value("listener.syscalls");
+    long long live_calls_after = stat_value("live.syscalls");
+    long long rx_calls   = (rx_calls_before >= 0 && rx_calls_after >= 0) ? rx_calls_after - rx_calls_before : -1;
+    long long live_calls = (live_calls_before >= 0 && live_calls_after >= 0) ? live_calls_after - live_calls_before : -1;
+    long long io_uring   = stat_value("io.uring");
+
+    // Dump the log with every dump client at once, counting the system calls the logger makes sending it
+    long long dump_calls_before = stat_value("dump.syscalls");
+    for (i = 0; i < dump_count; ++i) pthread_create(&dump[i].thread, NULL, dump_main, &dump[i]);
+    double dump_max = 0, dump_total = 0;
+    uint64_t dump_lines = 0, dump_bytes = 0;
+    for (i = 0; i < dump_count; ++i)
+    {
+        pthread_join(dump[i].thread, NULL);
+        if (dump[i].seconds > dump_max) dump_max = dump[i].seconds;
+        dump_total += dump[i].seconds;
+        dump_lines += dump[i].lines;
+        dump_bytes += dump[i].bytes;
+    }
+    long long dump_calls_after = stat_value("dump.syscalls");
+    long long dump_calls = (dump_calls_before >= 0 && dump_calls_after >= 0) ? dump_calls_after - dump_calls_before : -1;
+
+    // Combine every live-log client's latencies
+    uint64_t received = 0, duplicates = 0, gaps = 0, min_received = total;
+    for (i = 0; i < live_count; ++i)
+    {
+        received   += live[i].received;
+        duplicates += live[i].duplicates;
+        gaps       += live[i].gaps;
+        if (live[i].received < min_received) min_received = live[i].received;
+    }
+    int64_t* latency = malloc((received ? received : 1) * sizeof(int64_t));
+    uint64_t n = 0;
+    for (i = 0; i < live_count; ++i)
+    {
+        memcpy(latency + n, live[i].latency, live[i].received * sizeof(int64_t));
+        n += live[i].received;
+    }
+    qsort(latency, n, sizeof(int64_t), compare);
+    if (live_count == 0) min_received = 0;
+
+    // The fraction of messages that never made it to the live log, averaged over the clients
+    double live_loss = live_count ? 1.0 - (double)received / ((double)total * live_count) : 0;
+
+    // The results, for machines
+    printf("{\"format\":\"%s\",\"max_entries\":%d,\"threads\":%d,\"msg_size\":%d,\"sent\":%d,"
+           "\"datagrams\":%llu,\"send_errors\":%llu,\"send_seconds\":%.3f,\"send_rate\":%.0f,"
+           "\"logged\":%lld,\"kernel_drops\":%lld,\"log_drop_rate\":%.6f,"
+           "\"live_clients\":%d,\"live_received\":%llu,\"live_duplicates\":%llu,\"live_gaps\":%llu,"
+           "\"live_drop_rate\":%.6f,\"latency_p50_us\":%.1f,\"latency_p99_us\":%.1f,"
+           "\"latency_p999_us\":%.1f,\"latency_max_us\":%.1f,"
+           "\"dump_clients\":%d,\"dump_lines\":%llu,\"dump_bytes\":%llu,\"dump_seconds_max\":%.3f,"
+           "\"dump_seconds_mean\":%.3f,\"dump_mb_per_s\":%.1f,"
+           "\"io_uring\":%lld,\"listener_syscalls\":%lld,\"live_syscalls\":%lld,"
+           "\"dump_syscalls\":%lld,\"stalled_clients\":%d,\"stalled_bytes\":%lld}\n",
+           format, max_entries, threads, size, total,
+           (unsigned long long)datagrams, (unsigned long long)errors, send_seconds, total / send_seconds,
+           logged, kernel_drops, logged >= 0 ? 1.0 - (double)logged / total : -1.0,
+           live_count, (unsigned long long)received, (unsigned long long)duplicates,
+           (unsigned long long)gaps, live_loss,
+           percentile(latency, n, 0.50) / 1e3, percentile(latency, n, 0.99) / 1e3,
+           percentile(latency, n, 0.999) / 1e3, n ? latency[n - 1] / 1e3 : 0.0,
+           dump_count, (unsigned long long)dump_lines, (unsigned long long)dump_bytes, dump_max,
+           dump_count ? dump_total / dump_count : 0.0, dump_max > 0 ? dump_bytes / dump_max / 1e6 : 0.0,
+           io_uring, rx_calls, live_calls, dump_calls, stall_count, stalled_bytes);
+
+    // And for people
+    fprintf(stderr, "%s x%d, %d byte messages: %.0f msgs/s sent, %lld logged, %llu of %d seen live by the "
+                    "slowest client, latency p50 %.1f us p99 %.1f us p999 %.1f us, %d dumps of %llu lines in "
+                    "%.3f s\n",
+            format, threads, size, total / send_seconds, logged,
+            (unsigned long long)min_received, total,
+            percentile(latency, n, 0.50) / 1e3, percentile(latency, n, 0.99) / 1e3,
+            percentile(latency, n, 0.999) / 1e3, dump_count,
+            (unsigned long long)(dump_count ? dump_lines / dump_count : 0), dump_max);
+    return 0;
+}
+/*========================================================================================================*/
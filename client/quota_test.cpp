@@ -0,0 +1,137 @@
+/*==========================================================================================================
+ * quota_test.cpp - Checks that CLogData sends each entry of a batch to the right shard when tags have a
+ *                  quota
+ *
+ * Usage: quota_test
+ *
+ * A tag that has its quota of a shard's entries has its new entries diverted to the shard's overflow
+ * shard, and every other tag's entries go to the shard itself.  The batches here mix the two, including
+ * a tag the shard has never seen straight after one that's over its quota, and the program checks where
+ * each run of entries ended up.  Build it with -fsanitize=address to have stray reads reported too.
+ *
+ * Each check that fails is described on stderr, and the program exits with 1 if any did.
+ *
+ * This is built from the logger's own log, so "make quota_test" builds it first, and runs it.
+ *==========================================================================================================
+ */
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "logdata.h"
+#include "tags.h"
+
+using namespace std;
+
+/* The stats server is linked in with the log's histograms, but there are no stats to report here */
+void report_stats(string& text) {text.clear();}
+
+/* The log's size, and the quota that gives each tag */
+#define MAX_ENTRIES 100
+#define TAG_QUOTA   10
+
+static int failures = 0;
+
+
+/*==========================================================================================================
+ * append() - Appends a batch of entries with the given tags to the first shard of the log
+ *==========================================================================================================
+ */
+static void append(CLogData& log, const vector<string>& tags)
+{
+    vector<log_item_t> item(tags.size());
+
+    for (size_t i = 0; i < tags.size(); ++i)
+    {
+        memset(&item[i], 0, sizeof item[i]);
+        item[i].timestamp = log_clock();
+        item[i].tag_id    = TagTable.intern(tags[i].data(), tags[i].size());
+        item[i].tag       = tags[i].data();
+        item[i].tag_len   = tags[i].size();
+        item[i].data      = "message";
+        item[i].data_len  = 7;
+    }
+    log.append(0, &item[0], item.size());
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * expect() - Checks how many entries the shard and its overflow shard hold
+ *==========================================================================================================
+ */
+static void expect(CLogData& log, const char* what, uint64_t entries, uint64_t overflow)
+{
+    vector<uint64_t> end;
+    log.end(end);
+    if (end.size() == 2 && end[0] == entries && end[1] == overflow) return;
+
+    end.resize(2, 0);
+    fprintf(stderr, "FAILED: %s: expected %llu entries and %llu in the overflow shard, found %llu and %llu\n",
+            what, (unsigned long long)entries, (unsigned long long)overflow, (unsigned long long)end[0],
+            (unsigned long long)end[1]);
+    ++failures;
+}
+/*========================================================================================================*/
+
+
+/*==========================================================================================================
+ * main() - Runs the checks
+ *==========================================================================================================
+ */
+int main()
+{
+    CLogData   log;
+    log_spec_t spec;
+    char       name[16];
+
+    // A single shard, where each tag may have 10% of the entries
+    TagTable.create(4096, 12);
+    spec.engine        = "deque";
+    spec.max_entries   = MAX_ENTRIES;
+    spec.max_bytes     = 0;
+    spec.segment_size  = 0;
+    spec.segment_age   = 0;
+    spec.tag_quota     = TAG_QUOTA;
+    spec.quota_entries = MAX_ENTRIES / 4;
+    if (!log.create(spec, 1))
+    {
+        fprintf(stderr, "FAILED: can't create the log\n");
+        return 1;
+    }
+
+    // Give "noisy" its quota, and then one more
+    append(log, vector<string>(TAG_QUOTA, "noisy"));
+    expect(log, "a tag filling its quota", TAG_QUOTA, 0);
+    append(log, vector<string>(1, "noisy"));
+    expect(log, "a tag over its quota", TAG_QUOTA, 1);
+
+    // Put plenty of tags in the tag table that the shard hasn't seen, so that the next one's ID is far past
+    // anything the shard has counted
+    for (int i = 0; i < 1000; ++i)
+    {
+        sprintf(name, "unseen%d", i);
+        TagTable.intern(name, strlen(name));
+    }
+
+    // A brand-new tag straight after an over-quota one, in the same batch, belongs in the shard itself
+    vector<string> batch;
+    batch.push_back("noisy");
+    batch.push_back("newcomer");
+    append(log, batch);
+    expect(log, "a new tag after an over-quota tag", TAG_QUOTA + 1, 2);
+
+    // And so do the new tag's next entries, with over-quota entries on either side of them
+    batch.clear();
+    batch.push_back("noisy");
+    batch.push_back("newcomer");
+    batch.push_back("newcomer");
+    batch.push_back("noisy");
+    append(log, batch);
+    expect(log, "runs alternating between the shards", TAG_QUOTA + 3, 4);
+
+    if (failures) return 1;
+    fprintf(stderr, "quota_test passed\n");
+    return 0;
+}
+/*========================================================================================================*/
@@ -0,0 +1,236 @@
+//==========================================================================================================
+// deque_log.cpp - Implements the original heap-allocated log storage engine
+//==========================================================================================================
+#include "deque_log.h"
+#include "tags.h"
+
+
+//==========================================================================================================
+// CDequeCursor - Walks the chunk ranges that were captured when the snapshot was taken.  The cursor
+//                holds references to those chunks, so they stay alive until the cursor is destroyed.
+//==========================================================================================================
+class CDequeCursor : public CLogCursor
+{
+public:
+    CDequeCursor() {m_index = 0; m_pos = 0;}
+
+    // Fetches the next entry in the snapshot
+    bool    next(log_view_t& view);
+
+    // Skips ahead to the entry with the specified index
+    void    seek(uint64_t index);
+
+    // A range of entries [first, last) within a single chunk, whose first entry has index "base"
+    struct range_t {log_chunk_ptr chunk; uint64_t base; int first, last;};
+
+    // The chunk ranges that make up this snapshot, oldest first
+    vector<range_t> m_range;
+
+    // The index of the range we're reading, and our position within it
+    size_t  m_index;
+    int     m_pos;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends a batch of entries to the queue of logged data
+//==========================================================================================================
+void CDequeLog::append(const log_item_t* item, int count, uint64_t seq)
+{
+    vector<log_data_t> batch(count);
+
+    // Build queue entries from our input data before we take the lock
+    for (int i = 0; i < count; ++i)
+    {
+        batch[i].data.assign(item[i].data, item[i].data_len);
+        batch[i].timestamp = item[i].timestamp;
+        batch[i].seq       = seq + i;
+        batch[i].tag_id    = item[i].tag_id;
+        batch[i].severity  = item[i].severity;
+    }
+
+    // Ensure thread-safe access to m_chunk, keeping track of how long we have to wait for it
+    uint64_t start = metrics_clock();
+    m_mutex.lock();
+    m_lock_wait += metrics_clock() - start;
+
+    for (int i = 0; i < count; ++i)
+    {
+        // If our queue is full, retire the oldest entry
+        if (m_count >= m_max_entries) retire_oldest();
+
+        // If the newest chunk is full (or there isn't one), add a fresh chunk to the back of the queue
+        if (m_chunk.empty() || m_chunk.back()->entry.size() == LOG_CHUNK_SIZE)
+        {
+            m_chunk.push_back(log_chunk_ptr(new log_chunk_t));
+        }
+
+        // Add the current entry to the back of the queue
+        m_chunk.back()->entry.push_back(batch[i]);
+        ++m_count;
+    }
+
+    // Allow other threads to access m_chunk;
+    m_mutex.unlock();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// retire_oldest() - Retires the oldest entry in the queue, and the oldest chunk once it's entirely
+//                   retired.  Snapshots that still refer to that chunk keep it alive until they are done
+//                   with it.
+//==========================================================================================================
+void CDequeLog::retire_oldest()
+{
+    --m_count;
+    if (++m_first == LOG_CHUNK_SIZE)
+    {
+        m_chunk.pop_front();
+        m_first = 0;
+        m_base += LOG_CHUNK_SIZE;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize() - Changes the maximum number of entries in the queue, and retires whatever no longer fits
+//==========================================================================================================
+void CDequeLog::resize(int max_entries, int max_bytes)
+{
+    UniqueLock lock(m_mutex);
+    m_max_entries = (max_entries > 0) ? max_entries : 1;
+    while (m_count > m_max_entries) retire_oldest();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// first() - Returns the index of the oldest entry in the queue
+//==========================================================================================================
+uint64_t CDequeLog::first()
+{
+    UniqueLock lock(m_mutex);
+    return m_base + m_first;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// end() - Returns the index one past the newest entry in the queue
+//==========================================================================================================
+uint64_t CDequeLog::end()
+{
+    UniqueLock lock(m_mutex);
+    return m_base + m_first + m_count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Returns a cursor over the entries in the range [from, to).  Only chunk references are
+//              copied while the lock is held, so this is cheap no matter how many entries there are.
+//==========================================================================================================
+CLogCursor* CDequeLog::snapshot(uint64_t from, uint64_t to)
+{
+    // Create the cursor that will walk the snapshot
+    CDequeCursor* cursor = new CDequeCursor;
+
+    // Ensure thread-safe access to m_chunk
+    m_mutex.lock();
+
+    // Record the portion of the range that exists in every chunk
+    uint64_t base = m_base;
+    for (size_t i = 0; i < m_chunk.size(); ++i, base += LOG_CHUNK_SIZE)
+    {
+        // The oldest entry lives at m_first in the first chunk, every other chunk starts at zero
+        uint64_t first = base + (i ? 0 : m_first);
+        uint64_t last  = base + m_chunk[i]->entry.size();
+
+        // Clip the chunk to the range the caller asked for
+        if (first < from) first = from;
+        if (last  > to  ) last  = to;
+
+        // If any of the range is in this chunk, the cursor needs to visit it
+        if (first < last)
+        {
+            CDequeCursor::range_t range = {m_chunk[i], base, (int)(first - base), (int)(last - base)};
+            cursor->m_range.push_back(range);
+        }
+    }
+
+    // Allow other threads to access m_chunk;
+    m_mutex.unlock();
+
+    // If there's a range to read, position ourselves at its first entry
+    if (!cursor->m_range.empty()) cursor->m_pos = cursor->m_range[0].first;
+
+    // Hand the caller the cursor
+    return cursor;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the next entry in the snapshot
+//
+// Passed:  view = Filled in with the next entry
+//
+// Returns: true if an entry was fetched, false if we've reached the end of the snapshot
+//==========================================================================================================
+bool CDequeCursor::next(log_view_t& view)
+{
+    while (m_index < m_range.size())
+    {
+        range_t& range = m_range[m_index];
+
+        // If there's another entry in this range, hand it to the caller
+        if (m_pos < range.last)
+        {
+            const log_data_t& entry = range.chunk->entry[m_pos++];
+            const tag_info_t& tag = TagTable.info(entry.tag_id);
+            view.timestamp = entry.timestamp;
+            view.seq       = entry.seq;
+            view.tag_id    = entry.tag_id;
+            view.severity  = entry.severity;
+            view.tag       = tag.name.c_str();
+            view.tag_len   = tag.name.size();
+            view.data      = entry.data.c_str();
+            view.data_len  = entry.data.size();
+            view.index     = range.base + m_pos - 1;
+            return true;
+        }
+
+        // Otherwise, move to the start of the next range
+        if (++m_index < m_range.size()) m_pos = m_range[m_index].first;
+    }
+
+    // If we get here, there are no more entries
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// seek() - Skips ahead so that the next entry fetched is the one with the specified index
+//==========================================================================================================
+void CDequeCursor::seek(uint64_t index)
+{
+    while (m_index < m_range.size())
+    {
+        range_t& range = m_range[m_index];
+
+        // If the entry is in this range (or the gap before it), position ourselves there
+        if (index < range.base + range.last)
+        {
+            if (index > range.base + m_pos) m_pos = index - range.base;
+            return;
+        }
+
+        // Otherwise, move to the start of the next range
+        if (++m_index < m_range.size()) m_pos = m_range[m_index].first;
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,96 @@
+//==========================================================================================================
+// deque_log.h - Defines the original heap-allocated log storage engine
+//==========================================================================================================
+#pragma once
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include "logdata.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------------------------------------
+// A single log entry.  The tag is stored as its ID in the TagTable, so an entry costs one heap allocation
+// for its data (or none, if it's short enough to be stored inside the string itself)
+//----------------------------------------------------------------------------------------------------------
+struct log_data_t
+{
+    log_time_t  timestamp;
+    uint64_t    seq;
+    string      data;
+    uint32_t    tag_id;
+    uint8_t     severity;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// log_chunk_t - A fixed-capacity block of log entries.  Once an entry has been written into a chunk it
+//               is never modified again, so a snapshot may read it without holding any lock.
+//==========================================================================================================
+enum {LOG_CHUNK_SIZE = 256};
+
+struct log_chunk_t
+{
+    log_chunk_t() {entry.reserve(LOG_CHUNK_SIZE);}
+
+    // Reserved up front so that appending never moves the entries a reader might be looking at
+    vector<log_data_t> entry;
+};
+
+typedef shared_ptr<log_chunk_t> log_chunk_ptr;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CDequeLog - Stores each entry as a heap-allocated string in a double-ended queue of chunks
+//==========================================================================================================
+class CDequeLog : public CLogEngine
+{
+public:
+    CDequeLog(int max_entries) {m_max_entries = (max_entries > 0) ? max_entries : 1; m_count = 0; m_first = 0; m_base = 0; m_lock_wait = 0;}
+
+    // Append a batch of entries to the queue
+    void        append(const log_item_t* item, int count, uint64_t seq);
+
+    // Returns the index of the oldest entry in the queue
+    uint64_t    first();
+
+    // Returns the index one past the newest entry in the queue
+    uint64_t    end();
+
+    // Returns a cursor over the entries in the range [from, to) that are still in the queue
+    CLogCursor* snapshot(uint64_t from, uint64_t to);
+
+    // Returns the total time, in nanoseconds, that append() has spent waiting for m_mutex
+    uint64_t    lock_wait() {return m_lock_wait;}
+
+    // Changes the maximum number of entries in the queue, retiring whatever no longer fits
+    bool        can_resize() {return true;}
+    void        resize(int max_entries, int max_bytes);
+
+protected:
+
+    // Retires the oldest entry in the queue.  m_mutex must be held
+    void        retire_oldest();
+
+    // Maximum number of entries in our queue
+    int m_max_entries;
+
+    // All access to the queue is protected by this
+    CMutex m_mutex;
+
+    // A double-ended queue of chunks of log data
+    deque<log_chunk_ptr> m_chunk;
+
+    // The number of entries in the queue, and the position of the oldest entry in the first chunk
+    int m_count, m_first;
+
+    // The index of the entry at position zero of the first chunk
+    uint64_t m_base;
+
+    // The total time append() has spent waiting for m_mutex.  Only the appending thread writes this
+    uint64_t m_lock_wait;
+};
+//==========================================================================================================
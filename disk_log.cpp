@@ -0,0 +1,460 @@
+//==========================================================================================================
+// disk_log.cpp - Implements a persistent log storage engine built from memory-mapped segment files
+//==========================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "disk_log.h"
+#include "atomics.h"
+#include "tags.h"
+
+// Every segment file starts with these bytes
+static const char SEG_MAGIC[8] = {'L', 'O', 'G', 'S', 'E', 'G', '0', '1'};
+
+// Segment files are never smaller than this many bytes
+static const uint32_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+// No single record will ever be larger than this many bytes
+static const uint32_t MAX_RECORD_SIZE = 64 * 1024;
+
+// No tag will ever be longer than this many bytes
+static const int MAX_TAG_LEN = 1024;
+
+// The size of a record holding a tag and data of the specified lengths, rounded up to a multiple of 8
+static inline uint32_t record_size(uint32_t tag_len, uint32_t data_len)
+{
+    return (sizeof(seg_rec_t) + tag_len + data_len + 2 + 7) & ~7;
+}
+
+
+//==========================================================================================================
+// CDiskCursor - Walks a range of entry indices across the segments that were captured when the snapshot
+//               was taken.  Entries are handed to the caller straight out of the mapped segment files.
+//==========================================================================================================
+class CDiskCursor : public CLogCursor
+{
+public:
+    CDiskCursor(uint64_t first, uint64_t end) {m_index = first; m_end = end; m_current = 0;}
+
+    // Fetches the next entry in the snapshot
+    bool    next(log_view_t& view);
+
+    // Skips ahead to the entry with the specified index
+    void    seek(uint64_t index) {if (index > m_index) m_index = index;}
+
+    // The segments that hold the snapshot, oldest first
+    vector<segment_ptr> m_segment;
+
+protected:
+
+    uint64_t    m_index, m_end;
+    size_t      m_current;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Unmaps and closes the segment file
+//==========================================================================================================
+segment_t::~segment_t()
+{
+    if (base) munmap(base, hdr->segment_size);
+    if (fd >= 0) close(fd);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor - Records the settings.  Nothing touches the disk until open() is called
+//==========================================================================================================
+CDiskLog::CDiskLog(const string& dir, int max_entries, int segment_size, int segment_age)
+{
+    m_dir          = dir;
+    m_max_entries  = (max_entries > 0) ? max_entries : 1;
+    m_segment_size = (segment_size > (int)MIN_SEGMENT_SIZE) ? (segment_size & ~7) : MIN_SEGMENT_SIZE;
+    m_segment_age  = (log_time_t)segment_age * NS_PER_SEC;
+    m_first = m_end = m_next_seq = 0;
+    m_failed       = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// open() - Creates the directory if need be, and recovers any log that is already stored in it
+//
+// Returns: true if the directory is usable
+//
+// Note:    Only the header of each segment is read.  Segment files that aren't valid are left alone
+//==========================================================================================================
+bool CDiskLog::open()
+{
+    vector<string> name;
+    struct dirent* entry;
+
+    // Make sure the directory exists
+    if (mkdir(m_dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        perror(m_dir.c_str());
+        return false;
+    }
+
+    // Find every segment file in it
+    DIR* dir = opendir(m_dir.c_str());
+    if (dir == NULL)
+    {
+        perror(m_dir.c_str());
+        return false;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char* dot = strrchr(entry->d_name, '.');
+        if (dot && strcmp(dot, ".seg") == 0) name.push_back(entry->d_name);
+    }
+    closedir(dir);
+
+    // Segment files are named after their first index, zero-padded, so this puts them oldest first
+    sort(name.begin(), name.end());
+
+    // Map each of them
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        segment_ptr segment = load_segment(m_dir + "/" + name[i]);
+        if (!segment) continue;
+
+        // A segment that doesn't follow on from the one before it doesn't belong to this log
+        if (!m_segment.empty() && segment->hdr->first_index < m_end)
+        {
+            fprintf(stderr, "%s overlaps the segment before it, ignoring it\n", segment->path.c_str());
+            continue;
+        }
+
+        // If this is the first segment, the log starts here
+        if (m_segment.empty()) m_first = segment->hdr->first_index;
+
+        // The log now extends to the end of this segment
+        m_end = segment->hdr->first_index + segment->hdr->count;
+        if (segment->hdr->next_seq > m_next_seq) m_next_seq = segment->hdr->next_seq;
+        m_segment.push_back(segment);
+    }
+
+    // If the newest segment still has room, we carry on appending to it
+    if (!m_segment.empty() && !m_segment.back()->hdr->closed) m_active = m_segment.back();
+
+    // Throw away anything beyond our entry limit
+    evict();
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// load_segment() - Maps an existing segment file, and checks that its header makes sense
+//
+// Returns: The segment, or NULL if the file isn't a valid segment
+//==========================================================================================================
+segment_ptr CDiskLog::load_segment(const string& path)
+{
+    struct stat st;
+    segment_ptr segment(new segment_t);
+    segment->path = path;
+
+    // Open and map the file
+    segment->fd = ::open(path.c_str(), O_RDWR);
+    if (segment->fd < 0 || fstat(segment->fd, &st) < 0 || st.st_size < SEG_HEADER_SIZE)
+    {
+        fprintf(stderr, "%s isn't a valid segment, ignoring it\n", path.c_str());
+        return segment_ptr();
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror(path.c_str());
+        return segment_ptr();
+    }
+    segment->base = (char*)base;
+    segment->hdr  = (seg_hdr_t*)base;
+
+    // If the header doesn't describe this file, it isn't one of ours.  Unmap it with the size we mapped
+    seg_hdr_t* hdr = segment->hdr;
+    if (memcmp(hdr->magic, SEG_MAGIC, sizeof SEG_MAGIC) != 0 || hdr->header_size != SEG_HEADER_SIZE
+    ||  hdr->segment_size != st.st_size || hdr->data_end < SEG_HEADER_SIZE
+    ||  hdr->data_end + 4 * hdr->count > hdr->segment_size)
+    {
+        fprintf(stderr, "%s isn't a valid segment, ignoring it\n", path.c_str());
+        munmap(base, st.st_size);
+        segment->base = NULL;
+        return segment_ptr();
+    }
+
+    // Hand the caller the segment
+    return segment;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rotate() - Closes the active segment, and creates a new one whose first entry will be m_end
+//
+// Passed:  now = The timestamp of the entry that is about to be appended
+//
+// Returns: true if the new segment was created
+//==========================================================================================================
+bool CDiskLog::rotate(log_time_t now)
+{
+    char name[32];
+
+    // Mark the active segment as full, and start writing it back to disk
+    if (m_active)
+    {
+        m_active->hdr->closed = 1;
+        msync(m_active->base, m_active->hdr->segment_size, MS_ASYNC);
+        m_active.reset();
+    }
+
+    // Create the new segment file, named after the index of its first entry
+    segment_ptr segment(new segment_t);
+    sprintf(name, "/%020llu.seg", (unsigned long long)m_end);
+    segment->path = m_dir + name;
+    segment->fd   = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    // Reserve the disk space up front, so that we never fault on a page we can't write back
+    int error = (segment->fd < 0) ? errno : posix_fallocate(segment->fd, 0, m_segment_size);
+    if (error == 0)
+    {
+        void* base = mmap(NULL, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+        if (base == MAP_FAILED) error = errno; else segment->base = (char*)base;
+    }
+
+    // If anything went wrong, tell the user (just once) and give up
+    if (error)
+    {
+        if (!m_failed) fprintf(stderr, "%s: %s\n", segment->path.c_str(), strerror(error));
+        m_failed = true;
+        if (segment->fd >= 0) unlink(segment->path.c_str());
+        return false;
+    }
+
+    // Fill in the header
+    seg_hdr_t* hdr = segment->hdr = (seg_hdr_t*)segment->base;
+    memcpy(hdr->magic, SEG_MAGIC, sizeof SEG_MAGIC);
+    hdr->header_size  = SEG_HEADER_SIZE;
+    hdr->segment_size = m_segment_size;
+    hdr->first_index  = m_end;
+    hdr->created      = now;
+    hdr->count        = 0;
+    hdr->data_end     = SEG_HEADER_SIZE;
+    hdr->next_seq     = m_next_seq;
+    hdr->closed       = 0;
+
+    // And add it to the log
+    m_mutex.lock();
+    m_segment.push_back(segment);
+    m_mutex.unlock();
+    m_active = segment;
+    m_failed = false;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize() - Changes the maximum number of entries in the log, and drops whatever no longer fits
+//==========================================================================================================
+void CDiskLog::resize(int max_entries, int max_bytes)
+{
+    m_max_entries = (max_entries > 0) ? max_entries : 1;
+    if (m_end - m_first > m_max_entries) evict();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// evict() - Drops entries until there are no more than m_max_entries, and then drops every segment that
+//           no longer holds any entries.  Their files are deleted, but readers that are still walking
+//           them keep them mapped until they are done.
+//==========================================================================================================
+void CDiskLog::evict()
+{
+    // Figure out which is the oldest entry we keep
+    uint64_t first = m_first;
+    if (m_end - first > m_max_entries) first = m_end - m_max_entries;
+    store_release(&m_first, first);
+
+    // Throw away every segment that ends before that entry
+    m_mutex.lock();
+    while (!m_segment.empty() && m_segment.front() != m_active)
+    {
+        seg_hdr_t* hdr = m_segment.front()->hdr;
+        if (hdr->first_index + hdr->count > first) break;
+        unlink(m_segment.front()->path.c_str());
+        m_segment.pop_front();
+    }
+    m_mutex.unlock();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// first() - Returns the index of the oldest entry in the log
+//==========================================================================================================
+uint64_t CDiskLog::first()
+{
+    return load_acquire(&m_first);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// end() - Returns the index one past the newest entry in the log
+//==========================================================================================================
+uint64_t CDiskLog::end()
+{
+    return load_acquire(&m_end);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends a batch of entries to the log.  This never takes a lock unless a segment fills up.
+//            The readers see the entire batch appear at once.
+//==========================================================================================================
+void CDiskLog::append(const log_item_t* item, int count, uint64_t seq)
+{
+    uint64_t end = m_end;
+
+    for (int i = 0; i < count; ++i, ++seq)
+    {
+        int tag_len  = item[i].tag_len;
+        int data_len = item[i].data_len;
+
+        // Make sure the entry will fit into a single record, truncating it if need be
+        if (tag_len > MAX_TAG_LEN) tag_len = MAX_TAG_LEN;
+        int room = MAX_RECORD_SIZE - sizeof(seg_rec_t) - tag_len - 2;
+        if (data_len > room) data_len = room;
+        uint32_t size = record_size(tag_len, data_len);
+
+        // If there's no room in the active segment, or it's too old, start a new one
+        if (!m_active || m_active->room() < size + 4
+        ||  (m_segment_age && item[i].timestamp - m_active->hdr->created >= m_segment_age))
+        {
+            // Entries that arrived before the switch have to be published before the new segment is
+            store_release(&m_end, end);
+            if (!rotate(item[i].timestamp)) continue;
+        }
+
+        // Write the record
+        seg_hdr_t* hdr = m_active->hdr;
+        seg_rec_t* rec = (seg_rec_t*)(m_active->base + hdr->data_end);
+        rec->tag_len   = tag_len;
+        rec->severity  = item[i].severity;
+        rec->reserved  = 0;
+        rec->data_len  = data_len;
+        rec->timestamp = item[i].timestamp;
+        rec->seq       = seq;
+        char* p = (char*)(rec + 1);
+        memcpy(p, item[i].tag, tag_len);
+        p[tag_len] = 0;
+        p += tag_len + 1;
+        memcpy(p, item[i].data, data_len);
+        p[data_len] = 0;
+
+        // Record where it lives, and then commit it to the segment
+        m_active->slot(hdr->count) = hdr->data_end;
+        hdr->data_end += size;
+        hdr->next_seq  = seq + 1;
+        store_release(&hdr->count, hdr->count + 1);
+        m_next_seq = seq + 1;
+        ++end;
+    }
+
+    // Publish the new entries to the readers
+    store_release(&m_end, end);
+
+    // And throw away whatever no longer fits
+    if (m_end - m_first > m_max_entries) evict();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Returns a cursor over the entries in the range [from, to) that are still in the log.  Only
+//              segment references are copied while the lock is held.
+//==========================================================================================================
+CLogCursor* CDiskLog::snapshot(uint64_t from, uint64_t to)
+{
+    uint64_t end = this->end(), first = this->first();
+    if (to   > end  ) to   = end;
+    if (from < first) from = first;
+
+    CDiskCursor* cursor = new CDiskCursor(from, to);
+
+    // Collect every segment that holds part of the range
+    m_mutex.lock();
+    for (size_t i = 0; i < m_segment.size(); ++i)
+    {
+        seg_hdr_t* hdr = m_segment[i]->hdr;
+        uint64_t count = load_acquire(&hdr->count);
+        if (hdr->first_index + count <= from) continue;
+        if (hdr->first_index >= to) break;
+        cursor->m_segment.push_back(m_segment[i]);
+    }
+    m_mutex.unlock();
+
+    // Hand the caller the cursor
+    return cursor;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the next entry in the snapshot, directly from the mapped segment
+//
+// Passed:  view = Filled in with the next entry
+//
+// Returns: true if an entry was fetched, false if we've reached the end of the snapshot
+//==========================================================================================================
+bool CDiskCursor::next(log_view_t& view)
+{
+    while (m_index < m_end && m_current < m_segment.size())
+    {
+        segment_t& segment = *m_segment[m_current];
+        uint64_t first = segment.hdr->first_index;
+        uint64_t count = load_acquire(&segment.hdr->count);
+
+        // If we're past the end of this segment, move on to the next one
+        if (m_index >= first + count)
+        {
+            ++m_current;
+            continue;
+        }
+
+        // If a segment was missing when the log was recovered, skip over the gap it left
+        if (m_index < first) m_index = first;
+        if (m_index >= m_end) break;
+
+        // Point the caller at the record
+        const seg_rec_t* rec = (const seg_rec_t*)(segment.base + segment.slot(m_index - first));
+        view.timestamp = rec->timestamp;
+        view.seq       = rec->seq;
+        view.tag       = (const char*)(rec + 1);
+        view.tag_len   = rec->tag_len;
+        view.tag_id    = TagTable.intern(view.tag, view.tag_len);
+        view.severity  = rec->severity;
+        view.data      = view.tag + rec->tag_len + 1;
+        view.data_len  = rec->data_len;
+        view.index     = m_index++;
+        return true;
+    }
+
+    // If we get here, there are no more entries
+    return false;
+}
+//==========================================================================================================
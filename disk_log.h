@@ -0,0 +1,160 @@
+//==========================================================================================================
+// disk_log.h - Defines a persistent log storage engine built from memory-mapped segment files
+//
+// The log is stored in a directory of append-only segment files, each of a fixed size.  A segment
+// begins with a one-page header.  Records are written forward from the end of the header, and a table
+// of record offsets grows backward from the end of the file, so any entry can be found without scanning.
+//
+// The header records how many entries the segment holds, so on startup the log is recovered by reading
+// the header of each segment, without looking at any of the records.
+//
+// There is exactly one writer.  Records are never modified once they have been written, so readers
+// view them directly in the mapping without taking a lock or making a copy.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include "cthread.h"
+#include "logdata.h"
+
+using namespace std;
+
+// The size of the header at the front of every segment file
+const int SEG_HEADER_SIZE = 4096;
+
+//----------------------------------------------------------------------------------------------------------
+// The header at the front of every segment file
+//----------------------------------------------------------------------------------------------------------
+struct seg_hdr_t
+{
+    char        magic[8];       // SEG_MAGIC
+    uint32_t    header_size;    // SEG_HEADER_SIZE
+    uint32_t    segment_size;   // The size of the file in bytes
+    uint64_t    first_index;    // The index of the first entry in this segment
+    log_time_t  created;        // When the segment was started
+    uint64_t    count;          // The number of entries that have been committed to this segment
+    uint64_t    data_end;       // The offset one past the last committed record
+    uint64_t    next_seq;       // One past the sequence number of the last committed entry
+    uint32_t    closed;         // Non-zero once the segment is full and will never be appended to
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// The fixed header at the front of every record in a segment.  The tag follows the header, then the
+// data, each with a nul-terminator.  Records are padded to a multiple of 8 bytes.
+//
+// Unlike the in-memory engines, the tag text is stored in the record rather than a TagTable ID, since
+// IDs are only meaningful to the process that assigned them.  It is looked up in the table as it's read.
+//----------------------------------------------------------------------------------------------------------
+struct seg_rec_t
+{
+    uint16_t    tag_len;
+    uint8_t     severity;       // Zero in segments written before severities were recorded
+    uint8_t     reserved;
+    uint32_t    data_len;
+    int64_t     timestamp;
+    uint64_t    seq;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// segment_t - A single segment file, mapped into memory.  The file is unmapped when the last reference
+//             to it goes away, so a segment that is evicted while being read stays readable.
+//==========================================================================================================
+struct segment_t
+{
+    segment_t() {fd = -1; base = NULL;}
+    ~segment_t();
+
+    // Returns the offset of the record for the entry "n" entries into the segment
+    uint32_t&   slot(uint64_t n) {return ((uint32_t*)(base + hdr->segment_size))[-1 - (int64_t)n];}
+
+    // Returns the number of bytes still free between the records and the offset table
+    uint64_t    room() {return hdr->segment_size - hdr->data_end - 4 * hdr->count;}
+
+    string      path;
+    int         fd;
+    char*       base;
+    seg_hdr_t*  hdr;
+};
+
+typedef shared_ptr<segment_t> segment_ptr;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CDiskLog - Single-producer/multi-reader log that persists across restarts
+//==========================================================================================================
+class CDiskLog : public CLogEngine
+{
+public:
+
+    // Passed: dir          = The directory where this log's segment files live
+    //         max_entries  = The maximum number of entries in the log
+    //         segment_size = The size of each segment file in bytes
+    //         segment_age  = A segment is closed once it is this many seconds old (0 = never)
+    CDiskLog(const string& dir, int max_entries, int segment_size, int segment_age);
+
+    // Creates the directory if need be, and recovers whatever log is already stored there
+    bool        open();
+
+    // Append a batch of entries to the log.  Must only ever be called from one thread at a time
+    void        append(const log_item_t* item, int count, uint64_t seq);
+
+    // Returns the index of the oldest entry in the log
+    uint64_t    first();
+
+    // Returns the index one past the newest entry in the log
+    uint64_t    end();
+
+    // Returns a cursor over the entries in the range [from, to) that are still in the log
+    CLogCursor* snapshot(uint64_t from, uint64_t to);
+
+    // One past the highest sequence number in the log, which may have been recovered from disk
+    uint64_t    next_seq() {return m_next_seq;}
+
+    // Changes the maximum number of entries, evicting whatever no longer fits.  The disk engine has no
+    // byte budget.  Must only be called from the thread that appends
+    bool        can_resize() {return true;}
+    void        resize(int max_entries, int max_bytes);
+
+protected:
+
+    // Maps an existing segment file.  Returns NULL if it isn't a valid segment
+    segment_ptr load_segment(const string& path);
+
+    // Closes the active segment (if there is one) and starts a new one.  Returns false on failure
+    bool        rotate(log_time_t now);
+
+    // Drops the oldest entries, and any segment that no longer holds any entries
+    void        evict();
+
+    // The directory where the segment files live
+    string      m_dir;
+
+    // The size and maximum age of a segment, and the maximum number of entries in the log
+    uint32_t    m_segment_size;
+    log_time_t  m_segment_age;
+    uint64_t    m_max_entries;
+
+    // The segments, oldest first.  The writer only locks this to add or remove a segment
+    CMutex      m_mutex;
+    deque<segment_ptr> m_segment;
+
+    // The segment that entries are being appended to, or NULL if a new one needs to be started
+    segment_ptr m_active;
+
+    // The oldest entry in the log, and one past the newest published entry
+    volatile uint64_t m_first, m_end;
+
+    // One past the highest sequence number in the log
+    uint64_t    m_next_seq;
+
+    // True if we've already complained about being unable to write a segment
+    bool        m_failed;
+};
+//==========================================================================================================
@@ -0,0 +1,216 @@
+//==========================================================================================================
+// formatter.cpp - Formats log entries into lines of text
+//==========================================================================================================
+#include <string.h>
+#include <time.h>
+#include "formatter.h"
+#include "globals.h"
+#include "tags.h"
+#include "ingest_proto.h"
+
+// How each severity is rendered in front of the message.  Text-format messages have no severity, and are
+// rendered exactly as they arrived
+static const char* const severity_text[] = {"", "DEBUG: ", "INFO: ", "WARNING: ", "ERROR: ", "CRITICAL: "};
+static const int severity_len[] = {0, 7, 6, 9, 7, 10};
+
+
+//==========================================================================================================
+// The timestamp cache.  Each thread that formats log entries has its own copy, so there's no locking.
+//
+// Consecutive entries almost always fall within the same minute, and local time only ever changes its
+// offset from UTC on a minute boundary.  So we only call localtime_r() when the minute changes: within
+// a minute, the seconds are just the distance from the start of the minute.  The fraction of a second
+// is never cached, it's cheap enough to render every time.
+//==========================================================================================================
+static __thread bool   tc_valid = false;    // True once the cache has been filled in
+static __thread time_t tc_minute;           // The time_t at the start of the cached minute
+static __thread time_t tc_second;           // The time_t of the second currently rendered in tc_text
+static __thread char   tc_text[8];          // The rendered "HH:MM:SS"
+//==========================================================================================================
+
+
+//==========================================================================================================
+// put2() - Writes a number in the range 0 - 99 as two decimal digits
+//==========================================================================================================
+static inline void put2(char* p, int value)
+{
+    p[0] = '0' + value / 10;
+    p[1] = '0' + value % 10;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format_time() - Returns a pointer to the 8-character "HH:MM:SS" rendering of a timestamp.  The pointer
+//                 is valid until the next call from the same thread.
+//==========================================================================================================
+static const char* format_time(time_t timestamp)
+{
+    struct tm tm;
+
+    // If this is the same second as last time, the text is already rendered
+    if (tc_valid && timestamp == tc_second) return tc_text;
+
+    // If it's within the cached minute, only the seconds change
+    if (tc_valid && timestamp >= tc_minute && timestamp < tc_minute + 60)
+    {
+        put2(tc_text + 6, timestamp - tc_minute);
+        tc_second = timestamp;
+        return tc_text;
+    }
+
+    // Otherwise, break the timestamp out into components and render the whole thing
+    localtime_r(&timestamp, &tm);
+    put2(tc_text + 0, tm.tm_hour);
+    tc_text[2] = ':';
+    put2(tc_text + 3, tm.tm_min);
+    tc_text[5] = ':';
+    put2(tc_text + 6, tm.tm_sec);
+
+    // And remember which minute and second we've rendered
+    tc_minute = timestamp - tm.tm_sec;
+    tc_second = timestamp;
+    tc_valid  = true;
+    return tc_text;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format_fraction() - Renders the fraction of a second in a timestamp as "." followed by "digits" digits
+//
+// Returns: The length of the rendered text, which is zero if "digits" is zero
+//==========================================================================================================
+static int format_fraction(log_time_t timestamp, int digits, char* text)
+{
+    // If the fraction isn't wanted, there's nothing to render
+    if (digits <= 0) return 0;
+
+    // Throw away the digits we don't want
+    uint32_t fraction = timestamp % NS_PER_SEC;
+    for (int i = digits; i < 9; ++i) fraction /= 10;
+
+    // And render the rest from right to left
+    text[0] = '.';
+    for (int i = digits; i > 0; --i)
+    {
+        text[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    return digits + 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// put() - Copies as much of "text" as will fit between "p" and "end", and returns the new end of line
+//==========================================================================================================
+static inline char* put(char* p, char* end, const char* text, int length)
+{
+    if (length > end - p) length = end - p;
+    memcpy(p, text, length);
+    return p + length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// line_length() - Returns the length an entry's formatted line will have, including the linefeed
+//==========================================================================================================
+int line_length(const log_view_t& entry)
+{
+    int severity = (entry.severity <= LOG_SEV_CRITICAL) ? entry.severity : LOG_SEV_CRITICAL;
+    int fraction = (conf.time_precision > 0) ? conf.time_precision + 1 : 0;
+    return 8 + fraction + TagTable.info(entry.tag_id).rendered.size() + severity_len[severity] + entry.data_len + 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format_log_entry() - Formats a log entry into a line of text
+//
+// Passed:   entry = timestamp, tag, and message to be formatted
+//           line  = The buffer where the formatted line should be stored
+//           size  = The size of that buffer, in bytes
+//
+// Returns:  The length of the formatted line, not including the nul-terminator
+//==========================================================================================================
+int format_log_entry(const log_view_t& entry, char* line, int size)
+{
+    char  fraction[10];
+    char* p   = line;
+    char* end = line + size - 1;
+
+    // The tag, padded out to the configured width, was rendered once when it was added to the tag table
+    const string& tag = TagTable.info(entry.tag_id).rendered;
+
+    // Format the time (with as many digits of fractional seconds as were asked for), the tag, the
+    // severity if there is one, and the data
+    int severity = (entry.severity <= LOG_SEV_CRITICAL) ? entry.severity : LOG_SEV_CRITICAL;
+    p = put(p, end, format_time(entry.timestamp / NS_PER_SEC), 8);
+    p = put(p, end, fraction, format_fraction(entry.timestamp, conf.time_precision, fraction));
+    p = put(p, end, tag.data(), tag.size());
+    p = put(p, end, severity_text[severity], severity_len[severity]);
+    p = put(p, end, entry.data, entry.data_len);
+    p = put(p, end, "\n", 1);
+    *p = 0;
+
+    // If the line didn't fit, it was truncated, but it still ends with a linefeed
+    if (p == end) p[-1] = '\n';
+
+    // Tell the caller how long the line is
+    return p - line;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor - Allocates the buffer
+//==========================================================================================================
+COutputBuffer::COutputBuffer(int capacity)
+{
+    m_buffer   = new char[capacity];
+    m_capacity = capacity;
+    m_size     = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Formats a log entry onto the end of the buffer
+//
+// Returns: The length of the formatted line, or 0 if there wasn't room for it
+//
+// Note:    The line is measured first, so a buffer is filled right up, whatever the length of its lines
+//==========================================================================================================
+int COutputBuffer::append(const log_view_t& entry)
+{
+    // If the line (and its nul-terminator) won't fit, don't try
+    int length = line_length(entry);
+    if (length > MAX_LINE_LENGTH) length = MAX_LINE_LENGTH;
+    if (room() <= length) return 0;
+
+    // Format the entry directly into the buffer
+    length = format_log_entry(entry, m_buffer + m_size, length + 1);
+    m_size += length;
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Copies text onto the end of the buffer
+//
+// Returns: The length of the text, or 0 if there wasn't room for it
+//==========================================================================================================
+int COutputBuffer::append(const char* text, int length)
+{
+    // If the text won't fit, don't try
+    if (room() < length) return 0;
+
+    // Copy the text into the buffer
+    memcpy(m_buffer + m_size, text, length);
+    m_size += length;
+    return length;
+}
+//==========================================================================================================
@@ -0,0 +1,58 @@
+//==========================================================================================================
+// formatter.h - Formats log entries into lines of text
+//==========================================================================================================
+#pragma once
+#include "logdata.h"
+
+// The longest formatted line we produce, including the linefeed.  There's room for the largest message a
+// datagram can carry, with its timestamp, tag, and severity.  Anything longer is truncated
+const int MAX_LINE_LENGTH = 72 * 1024;
+
+// Returns the length an entry's formatted line will have, including the linefeed, but before it's
+// truncated to MAX_LINE_LENGTH
+int     line_length(const log_view_t& entry);
+
+// Formats an entry into "line" (which holds "size" bytes).  Returns the length of the formatted line
+int     format_log_entry(const log_view_t& entry, char* line, int size);
+
+
+//==========================================================================================================
+// COutputBuffer - A large, reusable buffer that many formatted lines are written into, so that they
+//                 can be sent to a client in big chunks rather than a line at a time
+//==========================================================================================================
+class COutputBuffer
+{
+public:
+    COutputBuffer(int capacity = 128 * 1024);
+    ~COutputBuffer() {delete[] m_buffer;}
+
+    // Formats an entry onto the end of the buffer.  Returns the length of the line, or 0 if it won't fit.
+    // A line always fits in an empty buffer that holds more than MAX_LINE_LENGTH bytes
+    int     append(const log_view_t& entry);
+
+    // Copies text onto the end of the buffer.  Returns the length of the text, or 0 if it won't fit
+    int     append(const char* text, int length);
+
+    // The contents of the buffer, and their length
+    char*   data() {return m_buffer;}
+    int     size() {return m_size;}
+
+    // The number of bytes that can still be appended to the buffer
+    int     room() {return m_capacity - m_size;}
+
+    // Empties the buffer
+    void    clear() {m_size = 0;}
+
+protected:
+
+    char*   m_buffer;
+    int     m_capacity;
+    int     m_size;
+
+private:
+
+    // Output buffers own their memory, so they can't be copied
+    COutputBuffer(const COutputBuffer&);
+    COutputBuffer& operator=(const COutputBuffer&);
+};
+//==========================================================================================================
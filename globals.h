@@ -0,0 +1,70 @@
+//==========================================================================================================
+// globals.h - Declares the configuration and the objects that are shared between modules
+//==========================================================================================================
+#pragma once
+#include <string>
+#include "logdata.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------------------------------------
+// The settings from the configuration file
+//----------------------------------------------------------------------------------------------------------
+struct conf_t
+{
+    int             log_port;
+    int             server_port;
+    int             live_log_port;
+    int             max_entries;
+    int             max_bytes;
+    int             id_length;
+    int             max_tags;
+    int             time_precision;
+    int             query_timeout;
+    int             dump_clients;
+    int             stats_port;
+    string          log_engine;
+    string          log_dir;
+    int             segment_size;
+    int             segment_age;
+    int             rx_batch;
+    int             rx_buffer;
+    int             max_message;
+    int             listener_threads;
+    int             live_log_clients;
+    int             live_log_queue;
+    string          live_log_overflow;
+    int             tag_rate;
+    int             tag_burst;
+    string          tag_limits;
+    int             tag_sample;
+    string          rate_exempt;
+    int             suppress_interval;
+    int             tag_quota;
+    int             quota_entries;
+    string          upstreams;
+    int             aggregate_interval;
+    int             aggregate_batch;
+    int             aggregate_entries;
+    int             merge_delay;
+    string          shm_name;
+    int             shm_size;
+    bool            use_section;
+    string          section;
+};
+//----------------------------------------------------------------------------------------------------------
+
+extern conf_t   conf;
+extern CLogData DataLog;
+
+// The live-log server, which the threads that append to the log notify.  See livelog.h
+class CLiveLog;
+extern CLiveLog LiveLog;
+
+// Fills in a plain-text report of the logger's statistics, one "name value" pair per line
+void report_stats(string& text);
+
+// Re-reads the configuration file and applies whatever changed, filling in a report of what became of
+// each change.  Returns false, having changed nothing, if the file can't be read or makes no sense
+bool reload_config(string& report);
+//==========================================================================================================
@@ -0,0 +1,210 @@
+//==========================================================================================================
+// ingest.cpp - Reads and writes the binary record format described in ingest_proto.h
+//==========================================================================================================
+#include <string.h>
+#include "ingest.h"
+#include "ingest_proto.h"
+#include "tags.h"
+
+
+//==========================================================================================================
+// Little-endian field readers for binary-format datagrams
+//==========================================================================================================
+static inline uint16_t get16(const uint8_t* p) {return p[0] | (p[1] << 8);}
+static inline uint64_t get64(const uint8_t* p)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_binary() - Divides a received binary-format datagram into records (see ingest_proto.h)
+//
+// Passed:  buffer = The datagram
+//          length = The length of the datagram in bytes
+//          item   = Filled in with the records.  There must be room for length / INGEST_RECORD_SIZE of them
+//          sender = Filled in with the sender's timestamp and sequence number for each record
+//
+// Returns: The number of records found.  If the datagram is malformed (or was truncated because it
+//          didn't fit in the receive buffer), it's the number of records before the damage, negated
+//          and less one, so that a datagram that's damaged from the start returns -1
+//==========================================================================================================
+int parse_binary(const char* buffer, int length, log_item_t* item, sender_info_t* sender)
+{
+    const uint8_t* p   = (const uint8_t*)buffer;
+    const uint8_t* end = p + length;
+    uint32_t       tag_id[INGEST_MAX_TAGS];
+    const char*    tag_name[INGEST_MAX_TAGS];
+    uint8_t        tag_len[INGEST_MAX_TAGS];
+    int            tags = 0, n = 0;
+
+    // Check the header.  We only understand one version of the format
+    if (length < INGEST_HEADER_SIZE || p[1] != INGEST_VERSION) return -1;
+    int count = get16(p + 2);
+    p += INGEST_HEADER_SIZE;
+
+    for (; n < count; ++n)
+    {
+        // Make sure the record is all there
+        if (end - p < 2) return -1 - n;
+        const uint8_t* record = p + 2;
+        const uint8_t* next   = record + get16(p);
+        if (next > end || next - record < INGEST_RECORD_SIZE - 2) return -1 - n;
+
+        // The fixed part of the record
+        int severity   = record[0];
+        int flags      = record[1];
+        sender[n].timestamp = (log_time_t)get64(record + 2);
+        sender[n].seq       = get64(record + 10);
+        p = record + 18;
+
+        // The tag is either one that was spelled out earlier in the datagram...
+        if (flags & INGEST_TAG_REF)
+        {
+            int ref = *p++;
+            if (ref >= tags) return -1 - n;
+            item[n].tag_id  = tag_id[ref];
+            item[n].tag     = tag_name[ref];
+            item[n].tag_len = tag_len[ref];
+        }
+
+        // Or is spelled out here
+        else
+        {
+            int len = *p++;
+            if (next - p < len || tags == INGEST_MAX_TAGS) return -1 - n;
+            tag_name[tags]  = (const char*)p;
+            tag_len[tags]   = len;
+            tag_id[tags]    = TagTable.intern((const char*)p, len);
+            item[n].tag_id  = tag_id[tags];
+            item[n].tag     = tag_name[tags];
+            item[n].tag_len = len;
+            ++tags;
+            p += len;
+        }
+
+        // Everything else is the message
+        item[n].severity = (severity <= LOG_SEV_CRITICAL) ? severity : LOG_SEV_CRITICAL;
+        item[n].data     = (const char*)p;
+        item[n].data_len = next - p;
+        p = next;
+    }
+
+    // Tell the caller how many records there were
+    return n;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Little-endian field writers for binary-format datagrams
+//==========================================================================================================
+static inline void put16(char* p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static inline void put64(char* p, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i, value >>= 8) p[i] = value & 0xFF;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CIngestWriter() - Constructor.  A datagram can be no larger than its 16-bit record lengths allow
+//==========================================================================================================
+CIngestWriter::CIngestWriter(int capacity)
+{
+    if (capacity < INGEST_HEADER_SIZE + INGEST_RECORD_SIZE) capacity = INGEST_HEADER_SIZE + INGEST_RECORD_SIZE;
+    m_buffer.resize(capacity);
+    m_gen = 0;
+    clear();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// clear() - Empties the datagram, leaving just its header
+//==========================================================================================================
+void CIngestWriter::clear()
+{
+    m_buffer[0] = (char)INGEST_MAGIC;
+    m_buffer[1] = INGEST_VERSION;
+    put16(&m_buffer[2], 0);
+    m_size  = INGEST_HEADER_SIZE;
+    m_count = 0;
+    m_tags  = 0;
+    ++m_gen;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add() - Adds an entry to the datagram
+//
+// Returns: true if it was added, false if there's no room for it
+//==========================================================================================================
+bool CIngestWriter::add(const log_view_t& entry)
+{
+    const int MAX_RECORD = 0xFFFF + 2;
+
+    // Find out whether the tag has already been spelled out in this datagram
+    uint32_t id = entry.tag_id;
+    if (id >= m_ref.size())
+    {
+        m_ref.resize(id + 1);
+        m_ref_gen.resize(id + 1, 0);
+    }
+    bool is_ref  = (m_ref_gen[id] == m_gen);
+    int  tag_len = (entry.tag_len > 255) ? 255 : entry.tag_len;
+
+    // If we'd need to spell the tag out and every tag reference is taken, the datagram is full
+    if (!is_ref && m_tags == INGEST_MAX_TAGS) return false;
+
+    // Make sure the record fits, both in the datagram and in its 16-bit length
+    int fixed = INGEST_RECORD_SIZE + (is_ref ? 0 : tag_len);
+    int room  = (int)m_buffer.size() - m_size - fixed;
+    if (room > MAX_RECORD - fixed) room = MAX_RECORD - fixed;
+    int data_len = entry.data_len;
+    if (data_len > room)
+    {
+        if (m_count || room < 0) return false;
+        data_len = room;
+    }
+
+    // The fixed part of the record
+    char* p = &m_buffer[m_size];
+    put16(p, fixed - 2 + data_len);
+    p[2] = entry.severity;
+    p[3] = is_ref ? INGEST_TAG_REF : 0;
+    put64(p + 4,  entry.timestamp);
+    put64(p + 12, entry.seq);
+    p += 20;
+
+    // The tag, either as a reference to one spelled out earlier, or spelled out here
+    if (is_ref)
+        *p++ = m_ref[id];
+    else
+    {
+        *p++ = tag_len;
+        memcpy(p, entry.tag, tag_len);
+        p += tag_len;
+        m_ref[id]     = m_tags++;
+        m_ref_gen[id] = m_gen;
+    }
+
+    // And the message
+    memcpy(p, entry.data, data_len);
+    p += data_len;
+
+    // The record is complete
+    m_size = p - &m_buffer[0];
+    put16(&m_buffer[2], ++m_count);
+    return true;
+}
+//==========================================================================================================
@@ -0,0 +1,64 @@
+//==========================================================================================================
+// ingest.h - Reads and writes the binary record format described in ingest_proto.h
+//
+// The listener reads datagrams in this format from emitters, and the same format carries batches of
+// entries from an upstream logger to an aggregator (see aggregator.h).
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "logdata.h"
+
+using namespace std;
+
+
+//==========================================================================================================
+// sender_info_t - What the sender of a binary-format record said about it
+//==========================================================================================================
+struct sender_info_t
+{
+    log_time_t  timestamp;      // When the sender logged the record, or 0 if it didn't say
+    uint64_t    seq;            // The sender's sequence number for the record
+};
+//==========================================================================================================
+
+
+// Divides a binary-format datagram into records.  Returns the number of records, or if the datagram is
+// damaged, the number of records before the damage negated and less one
+int     parse_binary(const char* buffer, int length, log_item_t* item, sender_info_t* sender);
+
+
+//==========================================================================================================
+// CIngestWriter - Packs log entries into a binary-format datagram, spelling out each distinct tag once
+//==========================================================================================================
+class CIngestWriter
+{
+public:
+    CIngestWriter(int capacity = 65535);
+
+    // Adds an entry to the datagram, with its own timestamp and sequence number.  Returns false if it
+    // won't fit, unless the datagram is empty, in which case its message is truncated to fit
+    bool    add(const log_view_t& entry);
+
+    // The datagram, its length in bytes, and the number of records in it
+    const char* data() {return &m_buffer[0];}
+    int     size()  {return m_size;}
+    int     count() {return m_count;}
+
+    // Empties the datagram
+    void    clear();
+
+protected:
+
+    vector<char> m_buffer;
+    int     m_size, m_count;
+
+    // The number of tags spelled out in the datagram
+    int     m_tags;
+
+    // For each tag ID, its index among the tags spelled out, and the datagram that index belongs to.
+    // Counting datagrams means clear() doesn't have to forget every tag
+    vector<uint32_t> m_ref, m_ref_gen;
+    uint32_t m_gen;
+};
+//==========================================================================================================
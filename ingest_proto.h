@@ -0,0 +1,57 @@
+/*==========================================================================================================
+ * ingest_proto.h - Defines the binary datagram format that emitters may use in place of "tag$message"
+ *
+ * This header is shared by the logger and by the client library in client/, so it's plain C.
+ *
+ * A binary datagram begins with INGEST_MAGIC, a byte that can never begin a text-format datagram (it
+ * never appears in UTF-8 text).  Every multi-byte field is little-endian, and nothing is aligned.
+ *
+ *     Datagram:   uint8   magic           INGEST_MAGIC
+ *                 uint8   version         INGEST_VERSION
+ *                 uint16  count           The number of records that follow
+ *                 record  [count]
+ *
+ *     Record:     uint16  length          The number of bytes in the record after this field
+ *                 uint8   severity        One of the LOG_SEV_xxx values
+ *                 uint8   flags           INGEST_xxx flags
+ *                 int64   timestamp       When the sender logged the record, in nanoseconds since the
+ *                                         epoch, or 0 if the sender doesn't say
+ *                 uint64  seq             The sender's sequence number for the record
+ *                 uint8   tag             If INGEST_TAG_REF is set, the index of the tag within the list
+ *                                         of tags this datagram has spelled out so far.  Otherwise the
+ *                                         length of the tag, whose text follows
+ *                 char    payload[]       The rest of the record is the message
+ *
+ * A receiver ignores any flags it doesn't know about, and a version it doesn't know about is rejected.
+ *==========================================================================================================
+ */
+#ifndef INGEST_PROTO_H
+#define INGEST_PROTO_H
+
+/* The first byte of every binary datagram, and the version of the format described above */
+#define INGEST_MAGIC            0xFE
+#define INGEST_VERSION          1
+
+/* The sizes of the datagram header, and of the fixed part of a record (including its length field) */
+#define INGEST_HEADER_SIZE      4
+#define INGEST_RECORD_SIZE      21
+
+/* The record's tag is an index into the tags spelled out earlier in the same datagram */
+#define INGEST_TAG_REF          0x01
+
+/* The most distinct tags a single datagram may spell out */
+#define INGEST_MAX_TAGS         255
+
+/* Severities, least severe first.  LOG_SEV_NONE is what every text-format message gets */
+enum
+{
+    LOG_SEV_NONE     = 0,
+    LOG_SEV_DEBUG    = 1,
+    LOG_SEV_INFO     = 2,
+    LOG_SEV_WARNING  = 3,
+    LOG_SEV_ERROR    = 4,
+    LOG_SEV_CRITICAL = 5
+};
+
+#endif
+/*========================================================================================================*/
@@ -0,0 +1,1083 @@
+//==========================================================================================================
+// livelog.cpp - Implements the thread that streams log entries to clients in real time
+//==========================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include "livelog.h"
+#include "globals.h"
+#include "sockutil.h"
+#include "tags.h"
+#include "ratelimit.h"
+#include "ingest_proto.h"
+
+// The maximum number of epoll events we handle per wakeup
+static const int MAX_EVENTS = 64;
+
+// A client that is catching up has its queue refilled from the log this many lines at a time
+static const size_t CATCH_UP_BATCH = 256;
+
+// The size of the blocks that formatted lines are written into
+static const int BLOCK_SIZE = 16 * 1024;
+
+// The most queued lines we hand to the kernel in a single send
+static const int MAX_IOV = 64;
+
+// The longest request a client may make
+static const size_t MAX_REQUEST = 1024;
+
+// epoll data values that identify our own descriptors.  Clients are identified by their socket
+static const uint64_t LISTEN_ID = ~0ULL;
+static const uint64_t EVENT_ID  = ~0ULL - 1;
+static const uint64_t URING_ID  = ~0ULL - 2;
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+CLiveLog::CLiveLog()
+{
+    m_epoll_fd  = -1;
+    m_listen_fd = -1;
+    m_event_fd  = -1;
+    m_sleeping  = 0;
+    m_use_ring  = false;
+    m_syscalls  = 0;
+    m_settled   = 0;
+    m_awaiting  = 0;
+    memset(&m_stats, 0, sizeof m_stats);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// spawn() - Spawns the thread
+//==========================================================================================================
+void CLiveLog::spawn(int port)
+{
+    m_port = port;
+    CThread::spawn();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rebind() - Moves the server to a different port
+//
+// Returns: false if the new port can't be listened on, in which case we stay where we are
+//==========================================================================================================
+bool CLiveLog::rebind(int port)
+{
+    struct epoll_event ev;
+
+    // The new socket takes the old one's descriptor
+    if (m_listen_fd < 0 || !rebind_tcp_server(m_listen_fd, port)) return false;
+
+    // Our epoll instance forgets the old socket once it's closed, so it has to be told about the new one
+    ev.events   = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev);
+    m_port = port;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_overflow() - Translates the name of an overflow policy into an overflow_t
+//
+// Passed:  name     = "drop-oldest", "drop-client", or "mark-gap"
+//          p_policy = Where to store the corresponding overflow_t
+//
+// Returns: true if the name was recognized
+//==========================================================================================================
+bool CLiveLog::parse_overflow(const string& name, overflow_t* p_policy)
+{
+    if (name == "drop-oldest") {*p_policy = OVERFLOW_DROP_OLDEST; return true;}
+    if (name == "drop-client") {*p_policy = OVERFLOW_DROP_CLIENT; return true;}
+    if (name == "mark-gap"   ) {*p_policy = OVERFLOW_MARK_GAP;    return true;}
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// notify() - Wakes up this thread if it's waiting.  Called by the threads that append to the data-log
+//            after each append.  When this thread is already busy, this costs nothing but a memory fence.
+//==========================================================================================================
+void CLiveLog::notify()
+{
+    static const uint64_t one = 1;
+
+    // Make sure our appends are visible before we look to see if the thread is sleeping
+    __sync_synchronize();
+
+    // If the thread is sleeping, wake it up
+    if (m_sleeping && __sync_lock_test_and_set(&m_sleeping, 0))
+    {
+        if (write(m_event_fd, &one, sizeof one) < 0) perror("live-log notify");
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Runs the event loop that serves the live-log clients
+//==========================================================================================================
+void CLiveLog::main()
+{
+    struct epoll_event ev, event[MAX_EVENTS];
+    uint64_t counter;
+    char     junk[256];
+
+    // Fetch our settings from the configuration
+    parse_overflow(conf.live_log_overflow, &m_overflow);
+    m_queue_limit = (conf.live_log_queue > 0) ? conf.live_log_queue : 1;
+
+    // Create the server, the eventfd that notify() uses to wake us, and the epoll instance
+    m_listen_fd = create_tcp_server(m_port);
+    m_event_fd  = eventfd(0, EFD_NONBLOCK);
+    m_epoll_fd  = epoll_create(MAX_EVENTS);
+    if (m_listen_fd < 0 || m_event_fd < 0 || m_epoll_fd < 0)
+    {
+        fprintf(stderr, "can't create server on TCP port %i\n", m_port);
+        exit(1);
+    }
+
+    // We want to know when a client connects, and when someone calls notify()
+    ev.events   = EPOLLIN;
+    ev.data.u64 = LISTEN_ID;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev);
+    ev.data.u64 = EVENT_ID;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &ev);
+
+    // If we can send through io_uring, we do.  Each client has at most one send in flight
+    if (CUring::built_in() && m_ring.create(MAX_EVENTS, 2 * (conf.live_log_clients > MAX_EVENTS ? conf.live_log_clients : MAX_EVENTS)))
+    {
+        m_use_ring  = true;
+        ev.data.u64 = URING_ID;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_ring.fd(), &ev);
+    }
+
+    // Nothing is dispatched until someone connects.  Whatever is in the log by then is history
+    m_next.assign(DataLog.shards(), 0);
+
+    // Sit in a loop forever, waiting for something to happen
+    while (true)
+    {
+        // Tell notify() we're going to sleep, then make sure nothing was appended before it could see that
+        m_sleeping = 1;
+        __sync_synchronize();
+        int timeout = -1;
+        if (has_new_entries())
+        {
+            m_sleeping = 0;
+            timeout = 0;
+        }
+
+        // A client that's slow to make its request gets the entire log once its time is up
+        else if (m_awaiting) timeout = request_wait();
+
+        // Wait for something to happen
+        int count = epoll_wait(m_epoll_fd, event, MAX_EVENTS, timeout);
+        m_sleeping = 0;
+
+        for (int i = 0; i < count; ++i)
+        {
+            // If a client is connecting, go accept it
+            if (event[i].data.u64 == LISTEN_ID)
+            {
+                accept_clients();
+                continue;
+            }
+
+            // If notify() woke us up, reset the eventfd.  The entries get dispatched below
+            if (event[i].data.u64 == EVENT_ID)
+            {
+                while (read(m_event_fd, &counter, sizeof counter) > 0);
+                continue;
+            }
+
+            // If sends have completed, carry on from where they left off
+            if (event[i].data.u64 == URING_ID)
+            {
+                complete_sends();
+                continue;
+            }
+
+            // Otherwise, it's an event on a client socket
+            live_client_t* client = m_client[(int)event[i].data.u64];
+
+            // Apart from its request, a client has nothing to say to us, so if the socket is readable
+            // after that it's probably been closed
+            if ((event[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && client->awaiting)
+                read_request(client);
+            else if (event[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                int n = recv(client->fd, junk, sizeof junk, MSG_DONTWAIT);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) client->closing = true;
+            }
+
+            // If the socket is writable, send the client whatever is in its queue
+            if ((event[i].events & EPOLLOUT) && !client->closing) flush(client);
+        }
+
+        // Start sending the clients whose time to make a request is up
+        if (m_awaiting) expire_requests();
+
+        // Hand any new log entries to the clients
+        if (has_new_entries()) dispatch();
+
+        // Get rid of any clients we're done with
+        close_marked_clients();
+
+        // Hand the kernel every send we've queued up, all at once
+        if (m_use_ring)
+        {
+            m_ring.submit();
+            m_stats.syscalls = m_syscalls + m_ring.syscalls();
+        }
+        else m_stats.syscalls = m_syscalls;
+
+        // Keep track of how much output is waiting to be sent
+        uint64_t queued = 0;
+        for (map<int, live_client_t*>::iterator it = m_client.begin(); it != m_client.end(); ++it)
+        {
+            queued += it->second->queue.size();
+        }
+        m_stats.queued = queued;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// accept_clients() - Accepts every client that's waiting to connect
+//==========================================================================================================
+void CLiveLog::accept_clients()
+{
+    struct epoll_event ev;
+    static const char too_many[] = "Too many live-log clients\n";
+    int one = 1;
+
+    while (true)
+    {
+        // Accept a connection.  If there aren't any more, we're done
+        int fd = accept(m_listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        // If we already have as many clients as we're allowed, turn this one away
+        if ((int)m_client.size() >= conf.live_log_clients)
+        {
+            send(fd, too_many, sizeof too_many - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            ++m_stats.rejected;
+            continue;
+        }
+
+        // Writing to the client must never block this thread, and lines must go out as soon as they're
+        // written rather than waiting for the client to acknowledge the previous ones
+        set_nonblocking(fd);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+        // If nobody was connected, nothing has been dispatched for a while.  Catch up with the log
+        if (m_client.empty()) resync();
+
+        // Create the client.  It gets nothing until it has said what it wants, or its time to do so is up
+        live_client_t* client = new live_client_t;
+        client->fd          = fd;
+        client->awaiting    = true;
+        client->deadline    = metrics_clock() + conf.query_timeout * 1000000ULL;
+        client->offset      = 0;
+        client->missed      = 0;
+        client->want_output = false;
+        client->closing     = false;
+        client->backlog     = NULL;
+        client->expect      = 0;
+        client->sending     = false;
+        client->inflight    = 0;
+        client->shut        = false;
+        m_client[fd] = client;
+        m_stats.clients = m_client.size();
+        ++m_awaiting;
+
+        // We want to know when the client sends its request, and when it closes the connection
+        ev.events   = EPOLLIN;
+        ev.data.u64 = fd;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close_client() - Disconnects a client and frees its resources
+//==========================================================================================================
+void CLiveLog::close_client(live_client_t* client)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    m_client.erase(client->fd);
+    m_stats.clients = m_client.size();
+    if (client->awaiting) --m_awaiting;
+    delete client->backlog;
+    delete client;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// close_marked_clients() - Disconnects every client that has been marked for closing
+//
+// Note:    A client with a send in flight is left until it completes.  Shutting its socket down makes
+//          sure that doesn't take long
+//==========================================================================================================
+void CLiveLog::close_marked_clients()
+{
+    map<int, live_client_t*>::iterator it = m_client.begin();
+
+    while (it != m_client.end())
+    {
+        live_client_t* client = (it++)->second;
+        if (!client->closing) continue;
+        if (!client->sending)
+            close_client(client);
+        else if (!client->shut)
+        {
+            shutdown(client->fd, SHUT_RDWR);
+            client->shut = true;
+        }
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read_request() - Reads whatever has arrived of a client's request.  Once the whole line is here, the
+//                  client starts receiving what it asked for
+//==========================================================================================================
+void CLiveLog::read_request(live_client_t* client)
+{
+    char   buffer[256];
+    string error;
+
+    // Fetch what has arrived.  If the client has gone away, we're done with it
+    int n = recv(client->fd, buffer, sizeof buffer, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0)
+    {
+        client->closing = true;
+        return;
+    }
+    client->request.append(buffer, n);
+
+    // If the line isn't complete yet, wait for the rest of it
+    size_t length = client->request.find('\n');
+    if (length == string::npos)
+    {
+        if (client->request.size() > MAX_REQUEST) reject(client, "request is too long");
+        return;
+    }
+    if (length && client->request[length - 1] == '\r') --length;
+    client->request.resize(length);
+
+    // If the request doesn't make sense, tell the client what's wrong with it
+    if (!client->sub.parse(client->request.c_str(), &error))
+    {
+        reject(client, error);
+        return;
+    }
+
+    // Otherwise, give it what it asked for
+    subscribe(client);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// subscribe() - Starts sending a client what it asked for.  It starts out by replaying the entries that
+//               have already been dispatched, or those of them from the sequence number it asked for on
+//==========================================================================================================
+void CLiveLog::subscribe(live_client_t* client)
+{
+    vector<uint64_t> from(m_next.size(), 0);
+
+    client->awaiting = false;
+    client->request.clear();
+    --m_awaiting;
+
+    // A client that's resuming is replayed each shard from the first entry it hasn't seen, with the shards
+    // merged in sequence order, just as the live entries are dispatched
+    client->backlog = new CLogSnapshot;
+    if (client->sub.m_numbered)
+    {
+        client->backlog->by_seq();
+        client->expect = client->sub.m_from;
+        for (size_t i = 0; i < from.size(); ++i)
+        {
+            from[i] = DataLog.find_seq(i, client->sub.m_from);
+            if (from[i] > m_next[i]) from[i] = m_next[i];
+        }
+    }
+    DataLog.snapshot(*client->backlog, from, m_next);
+
+    // And start sending it the log
+    flush(client);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reject() - Tells a client what's wrong with its request, and disconnects it
+//==========================================================================================================
+void CLiveLog::reject(live_client_t* client, const string& error)
+{
+    string text = "ERROR " + error + "\n";
+    send(client->fd, text.data(), text.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    client->closing = true;
+    ++m_stats.errors;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// request_wait() - Returns how many milliseconds until the next client runs out of time to make its
+//                  request, or -1 if no client is making one
+//==========================================================================================================
+int CLiveLog::request_wait()
+{
+    uint64_t now = metrics_clock(), deadline = ~0ULL;
+
+    for (map<int, live_client_t*>::iterator it = m_client.begin(); it != m_client.end(); ++it)
+    {
+        live_client_t* client = it->second;
+        if (client->awaiting && !client->closing && client->deadline < deadline) deadline = client->deadline;
+    }
+
+    if (deadline == ~0ULL) return -1;
+    return (deadline <= now) ? 0 : (int)((deadline - now + 999999) / 1000000);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// expire_requests() - Subscribes every client that has run out of time to make its request to everything
+//==========================================================================================================
+void CLiveLog::expire_requests()
+{
+    uint64_t now = metrics_clock();
+
+    for (map<int, live_client_t*>::iterator it = m_client.begin(); it != m_client.end(); ++it)
+    {
+        live_client_t* client = it->second;
+        if (!client->awaiting || client->closing || client->deadline > now) continue;
+        client->sub.clear();
+        subscribe(client);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resync() - Moves the dispatch position of every shard up to the first entry that isn't settled yet.
+//            Called when the first client connects, since nothing is dispatched while nobody is connected
+//==========================================================================================================
+void CLiveLog::resync()
+{
+    uint64_t settled = DataLog.settled();
+    if (settled > m_settled) m_settled = settled;
+    for (size_t i = 0; i < m_next.size(); ++i) m_next[i] = DataLog.find_seq(i, m_settled);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// has_new_entries() - Returns true if there are entries in the data-log that haven't been dispatched
+//==========================================================================================================
+bool CLiveLog::has_new_entries()
+{
+    vector<uint64_t> end;
+
+    // While nobody is connected, there's nobody to dispatch anything to
+    if (m_client.empty()) return false;
+
+    DataLog.end(end);
+    return end != m_next;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// dispatch() - Formats the entries that have been appended to the data-log since the last time we were
+//              called, and queues them to every client that has caught up with the log and wants them
+//
+// Note:    Entries are taken in sequence order, as far as the first one that isn't settled yet (see
+//          CLogData::settled()).  That one, and everything after it, waits for the next time
+//==========================================================================================================
+void CLiveLog::dispatch()
+{
+    map<int, live_client_t*>::iterator it;
+    vector<live_client_t*> live;
+    vector<uint64_t> to(m_next.size(), LOG_END);
+    CLogSnapshot snapshot;
+    log_view_t   entry;
+    out_line_t   line[2];
+    uint64_t     missed = 0;
+    bool         finished = true;
+
+    // Find out how far we can go.  Once something is settled it stays settled, even if an append that's
+    // just starting makes it look otherwise for a moment
+    uint64_t settled = DataLog.settled();
+    if (settled > m_settled) m_settled = settled;
+
+    // Take a snapshot of everything appended since the last dispatch
+    snapshot.by_seq();
+    DataLog.snapshot(snapshot, m_next, to);
+
+    // Find out who there is to send these entries to, and look out for any of their tags that are new
+    for (it = m_client.begin(); it != m_client.end(); ++it)
+    {
+        live_client_t* client = it->second;
+        if (client->awaiting || client->backlog || client->closing) continue;
+        client->sub.refresh();
+        live.push_back(client);
+    }
+
+    while (snapshot.next(entry))
+    {
+        // If entries were evicted before we got to them, the clients have missed them
+        if (!live.empty()) missed += entry.index - m_next[entry.shard];
+        m_next[entry.shard] = entry.index;
+
+        // If an entry before this one is still on its way into the log, the rest have to wait for it
+        if (entry.seq >= m_settled)
+        {
+            finished = false;
+            break;
+        }
+        ++m_next[entry.shard];
+
+        // Queue the entry to every client that wants it, formatting it the first time one does
+        line[0].block.reset();
+        line[1].block.reset();
+        for (size_t i = 0; i < live.size(); ++i)
+        {
+            live_client_t* client = live[i];
+            if (client->closing || !client->sub.matches(entry.seq, entry.tag_id, entry.severity)) continue;
+            out_line_t& out = line[client->sub.m_numbered];
+            if (!out.block) out = format(m_block, entry, client->sub.m_numbered);
+            enqueue(client, out);
+        }
+    }
+
+    // Account for entries at the end of each shard that were evicted before we got to them
+    for (size_t i = 0; finished && i < m_next.size(); ++i)
+    {
+        if (!live.empty()) missed += snapshot.end()[i] - m_next[i];
+        m_next[i] = snapshot.end()[i];
+    }
+
+    // Tell the live clients about anything they've missed, and start sending them their new output
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        live_client_t* client = live[i];
+        if (client->closing) continue;
+        client->missed += missed;
+        m_stats.missed += missed;
+        if (!client->want_output) flush(client);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format() - Formats an entry onto the end of a block of output lines.  If the block is full (or there
+//            isn't one yet) a fresh block is started.  Lines already in the old block are unaffected.
+//
+// Passed:  block    = The block
+//          entry    = The entry to format
+//          numbered = True if the line is to begin with the entry's sequence number
+//==========================================================================================================
+out_line_t CLiveLog::format(block_ptr& block, const log_view_t& entry, bool numbered)
+{
+    out_line_t line;
+    char prefix[24];
+
+    // If there's no room in the current block, start a new one, big enough for the line if it's a long one
+    int length = line_length(entry);
+    if (length > MAX_LINE_LENGTH) length = MAX_LINE_LENGTH;
+    int prefix_length = numbered ? sprintf(prefix, "#%llu ", (unsigned long long)entry.seq) : 0;
+    length += prefix_length;
+    if (!block || block->room() <= length) block.reset(new COutputBuffer(length < BLOCK_SIZE ? BLOCK_SIZE : length + 1));
+
+    // Format the entry onto the end of the block, after its sequence number
+    line.block  = block;
+    line.text   = block->data() + block->size();
+    line.length = prefix_length ? block->append(prefix, prefix_length) : 0;
+    line.length += block->append(entry);
+    return line;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format() - Copies a line of text onto the end of a block of output lines
+//==========================================================================================================
+out_line_t CLiveLog::format(block_ptr& block, const char* text, int length)
+{
+    out_line_t line;
+
+    // If there's no room in the current block, start a new one
+    if (!block || block->room() < length) block.reset(new COutputBuffer(length < BLOCK_SIZE ? BLOCK_SIZE : length));
+
+    // Copy the text onto the end of the block
+    line.block  = block;
+    line.text   = block->data() + block->size();
+    line.length = block->append(text, length);
+    return line;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// format_missed() - Formats the line that tells a client how many entries it has missed
+//==========================================================================================================
+out_line_t CLiveLog::format_missed(block_ptr& block, uint64_t missed)
+{
+    char marker[80];
+    int length = sprintf(marker, "*** %llu log entries missed ***\n", (unsigned long long)missed);
+    return format(block, marker, length);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// enqueue() - Queues a line of output to a client.  If the client's queue is full, the overflow policy
+//             decides what happens.
+//==========================================================================================================
+void CLiveLog::enqueue(live_client_t* client, const out_line_t& line)
+{
+    // If the client's queue is full, see if its socket will take some of it right now.  With io_uring,
+    // that means handing the kernel the send now rather than at the end of the pass
+    if (client->queue.size() >= m_queue_limit)
+    {
+        flush(client);
+        if (m_use_ring)
+        {
+            m_ring.submit();
+            complete_sends();
+        }
+    }
+
+    // If the client's queue is still full...
+    if (client->queue.size() >= m_queue_limit)
+    {
+        switch (m_overflow)
+        {
+            // Throw away the oldest line that we haven't started sending yet.  If every line in the queue
+            // is being sent, it's the new line that goes
+            case OVERFLOW_DROP_OLDEST:
+            {
+                size_t busy = client->sending ? client->inflight : (client->offset ? 1 : 0);
+                ++m_stats.missed;
+                if (busy >= client->queue.size()) return;
+                client->queue.erase(client->queue.begin() + busy);
+                break;
+            }
+
+            // Give up on the client entirely
+            case OVERFLOW_DROP_CLIENT:
+                client->closing = true;
+                ++m_stats.dropped;
+                return;
+
+            // Throw away the new line, and remember to tell the client it missed it
+            case OVERFLOW_MARK_GAP:
+                ++client->missed;
+                ++m_stats.missed;
+                return;
+        }
+    }
+
+    // If the client has missed some lines, tell it so before sending it anything else
+    if (client->missed)
+    {
+        client->queue.push_back(format_missed(m_block, client->missed));
+        client->missed = 0;
+    }
+
+    // And queue up the new line
+    client->queue.push_back(line);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// catch_up() - Refills the output queue of a client that is still replaying the log.  When the client has
+//              replayed every entry that has been dispatched so far, it joins the live stream.
+//==========================================================================================================
+void CLiveLog::catch_up(live_client_t* client)
+{
+    CSubscription& sub = client->sub;
+    log_view_t entry;
+
+    // Look out for any of the client's tags that are new
+    sub.refresh();
+
+    while (client->backlog && client->queue.size() < CATCH_UP_BATCH)
+    {
+        // If there's another entry in the backlog, queue it up if the client wants it
+        if (client->backlog->next(entry))
+        {
+            // A client replaying from a sequence number has missed any entries the replay skips over
+            if (sub.m_numbered && entry.seq >= client->expect)
+            {
+                client->missed += entry.seq - client->expect;
+                m_stats.missed += entry.seq - client->expect;
+                client->expect  = entry.seq + 1;
+            }
+            if (!sub.matches(entry.seq, entry.tag_id, entry.severity)) continue;
+
+            // If it has, tell it so before it gets anything else
+            if (client->missed)
+            {
+                client->queue.push_back(format_missed(client->block, client->missed));
+                client->missed = 0;
+            }
+            client->queue.push_back(format(client->block, entry, sub.m_numbered));
+            continue;
+        }
+
+        // If more entries have been dispatched since we took the backlog snapshot, replay those next
+        if (client->backlog->end() != m_next)
+        {
+            vector<uint64_t> from = client->backlog->end();
+            DataLog.snapshot(*client->backlog, from, m_next);
+            continue;
+        }
+
+        // Otherwise, the client has caught up and will receive new entries as they are dispatched.  Those
+        // dispatched so far are exactly those below m_settled, so any of them a replay from a sequence
+        // number hasn't reached were evicted before it could
+        if (sub.m_numbered && m_settled > client->expect)
+        {
+            client->missed += m_settled - client->expect;
+            m_stats.missed += m_settled - client->expect;
+        }
+        delete client->backlog;
+        client->backlog = NULL;
+        client->block.reset();
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// flush() - Writes as much of a client's output queue as its socket will accept without blocking
+//
+// Note:    With io_uring, the write is only queued, and carries on from its completion
+//==========================================================================================================
+void CLiveLog::flush(live_client_t* client)
+{
+    struct iovec  iov[MAX_IOV];
+    struct msghdr msg;
+
+    if (m_use_ring)
+    {
+        if (!client->sending) submit_send(client);
+        return;
+    }
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+
+    while (true)
+    {
+        // If the client is replaying the log and is running low on output, fetch some more
+        if (client->backlog && client->queue.size() < CATCH_UP_BATCH / 2) catch_up(client);
+
+        // If there's nothing left to send, we're done
+        if (client->queue.empty()) break;
+
+        // Gather up the lines at the front of the queue, and send as many of them as the socket will take
+        msg.msg_iovlen = gather(client, iov);
+        ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        ++m_syscalls;
+
+        // If the socket is full, we'll try again when epoll says it's writable
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0 && errno == EINTR) continue;
+
+        // If the socket has failed, we're done with this client
+        if (n < 0)
+        {
+            client->closing = true;
+            return;
+        }
+
+        // If the socket didn't take everything we offered, it's full
+        sent(client, n);
+        if (client->offset) break;
+    }
+
+    // If there's still output waiting to be sent, we want to know when the socket is writable
+    watch_output(client, !client->queue.empty());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// gather() - Points an array of up to MAX_IOV iovecs at the lines at the front of a client's queue,
+//            skipping whatever part of the first was already sent
+//
+// Returns: The number of iovecs filled in
+//==========================================================================================================
+int CLiveLog::gather(live_client_t* client, struct iovec* iov)
+{
+    int count = 0;
+    deque<out_line_t>::iterator it = client->queue.begin();
+    for (; it != client->queue.end() && count < MAX_IOV; ++it, ++count)
+    {
+        iov[count].iov_base = (void*)it->text;
+        iov[count].iov_len  = it->length;
+    }
+    iov[0].iov_base = (char*)iov[0].iov_base + client->offset;
+    iov[0].iov_len -= client->offset;
+    return count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sent() - Throws away every line that was sent in its entirety, and remembers how much of the next was
+//
+// Passed:  client = The client
+//          length = The number of bytes that were sent, from where the last send left off
+//==========================================================================================================
+void CLiveLog::sent(live_client_t* client, size_t length)
+{
+    length += client->offset;
+    while (!client->queue.empty() && length >= (size_t)client->queue.front().length)
+    {
+        length -= client->queue.front().length;
+        client->queue.pop_front();
+        ++m_stats.sent;
+    }
+    client->offset = length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// submit_send() - Queues a send of the lines at the front of a client's queue to the ring.  It goes to the
+//                 kernel with everything else at the end of the pass through the event loop
+//==========================================================================================================
+void CLiveLog::submit_send(live_client_t* client)
+{
+    // If the client is replaying the log and is running low on output, fetch some more
+    if (client->backlog && client->queue.size() < CATCH_UP_BATCH / 2) catch_up(client);
+
+    // The ring waits for the socket to be writable itself, so epoll needn't
+    watch_output(client, false);
+    if (client->queue.empty()) return;
+
+    client->iov.resize(MAX_IOV);
+    client->inflight = gather(client, &client->iov[0]);
+    memset(&client->msg, 0, sizeof client->msg);
+    client->msg.msg_iov    = &client->iov[0];
+    client->msg.msg_iovlen = client->inflight;
+    client->sending = true;
+    m_ring.sendmsg(client->fd, &client->msg, MSG_NOSIGNAL, client->fd);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// complete_sends() - Handles every send that has completed, queueing the next for each client that has
+//                    more to send
+//==========================================================================================================
+void CLiveLog::complete_sends()
+{
+    uint64_t tag;
+    uint32_t flags;
+    int      result;
+
+    while (m_ring.next(&tag, &result, &flags))
+    {
+        map<int, live_client_t*>::iterator it = m_client.find((int)tag);
+        if (it == m_client.end()) continue;
+        live_client_t* client = it->second;
+        client->sending = false;
+
+        // If the socket was full, we'll try again when epoll says it's writable
+        if (result == -EAGAIN || result == -EINTR)
+        {
+            watch_output(client, true);
+            continue;
+        }
+
+        // If the socket has failed, we're done with this client
+        if (result < 0)
+        {
+            client->closing = true;
+            continue;
+        }
+
+        // Otherwise, carry on sending
+        sent(client, result);
+        if (!client->closing) submit_send(client);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// watch_output() - Tells epoll whether or not we want to know when a client's socket is writable
+//==========================================================================================================
+void CLiveLog::watch_output(live_client_t* client, bool enable)
+{
+    struct epoll_event ev;
+
+    // If nothing's changing, there's nothing to do
+    if (client->want_output == enable) return;
+
+    ev.events   = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.u64 = client->fd;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+    ++m_syscalls;
+    client->want_output = enable;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// clear() - Resets the subscription so that it asks for everything
+//==========================================================================================================
+void CSubscription::clear()
+{
+    m_numbered  = false;
+    m_from      = 0;
+    m_severity  = LOG_SEV_NONE;
+    m_by_tag    = false;
+    m_bits.clear();
+    m_missing.clear();
+    m_tag_count = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse() - Parses a request line from a live-log client
+//
+// Passed:  text    = The request, without its line terminator
+//          p_error = Where to store a description of the problem if the request isn't valid
+//
+// Returns: true if the request is valid
+//==========================================================================================================
+bool CSubscription::parse(const char* text, string* p_error)
+{
+    const char* p = text;
+
+    clear();
+
+    while (true)
+    {
+        // Skip over the whitespace between terms.  If there are no more terms, we're done
+        while (*p == ' ' || *p == '\t') ++p;
+        if (*p == 0) break;
+
+        // Find the key and its value
+        const char* equals = strchr(p, '=');
+        if (equals == NULL)
+        {
+            *p_error = "expected key=value at \"" + string(p) + "\"";
+            return false;
+        }
+        string key(p, equals - p);
+        p = equals + 1;
+        const char* end = p + strcspn(p, " \t");
+        string value(p, end - p);
+        p = end;
+
+        // The sequence number to start at
+        if (key == "seq")
+        {
+            char* end;
+            m_from = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end)
+            {
+                *p_error = "invalid sequence number \"" + value + "\"";
+                return false;
+            }
+            m_numbered = true;
+            continue;
+        }
+
+        // A comma-separated list of tags.  They're looked up in the TagTable below
+        if (key == "tag")
+        {
+            size_t start = 0, comma;
+            do
+            {
+                comma = value.find(',', start);
+                m_missing.push_back(value.substr(start, comma - start));
+                start = comma + 1;
+            }
+            while (comma != string::npos);
+            m_by_tag = true;
+            continue;
+        }
+
+        // The least severe entry wanted
+        if (key == "severity")
+        {
+            if (!CRateLimiter::parse_severity(value, &m_severity))
+            {
+                *p_error = "unknown severity \"" + value + "\"";
+                return false;
+            }
+            continue;
+        }
+
+        // If we get here, we don't know what the client is asking for
+        *p_error = "unknown key \"" + key + "\"";
+        return false;
+    }
+
+    // Look up the tags that are already known
+    refresh();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// refresh() - Looks through the tags added to the TagTable since we last looked for any of ours
+//
+// Note:    A tag's information is in place before the TagTable's count includes it, so every tag we
+//          look at is complete, and none is ever missed
+//==========================================================================================================
+void CSubscription::refresh()
+{
+    uint32_t count = TagTable.count();
+
+    for (; m_tag_count < count && !m_missing.empty(); ++m_tag_count)
+    {
+        const string& name = TagTable.info(m_tag_count).name;
+        vector<string>::iterator it = remove(m_missing.begin(), m_missing.end(), name);
+        if (it == m_missing.end()) continue;
+        m_missing.erase(it, m_missing.end());
+        if (m_tag_count / 64 >= m_bits.size()) m_bits.resize(m_tag_count / 64 + 1, 0);
+        m_bits[m_tag_count / 64] |= 1ULL << (m_tag_count % 64);
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,330 @@
+//==========================================================================================================
+// livelog.h - Defines the thread that streams log entries to clients in real time
+//
+// A client that connects to the live-log port may send a single line saying what it wants, made up of
+// any of these space-separated terms:
+//
+//     seq=N                Start at the entry with sequence number N: replay the entries from there on
+//                          that are still in the log, then carry on with new ones.  Every line the client
+//                          is sent begins with its entry's sequence number, as "#N ", so a client that
+//                          reconnects can ask to start one past the last line it saw, and miss nothing
+//     tag=NAME[,NAME...]   Only entries with one of these tags
+//     severity=LEVEL       Only entries at least this severe: debug, info, warning, error, or critical.
+//                          Entries that arrived in the text format have no severity, so they're left out
+//
+// A client that sends nothing within query_timeout milliseconds (or an empty line) is replayed the
+// entire log and then sent everything new, just as it always has been.  Entries the client should have
+// been sent but wasn't, because they were evicted first, or its queue was full, are reported with a
+// "*** N log entries missed ***" line, which counts them whatever their tags.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "cthread.h"
+#include "logdata.h"
+#include "formatter.h"
+#include "uring.h"
+
+using namespace std;
+
+// A block of formatted output lines.  Lines are only ever appended to a block, never changed
+typedef shared_ptr<COutputBuffer> block_ptr;
+
+// A formatted line of output.  It lives in a block that is shared by every client it gets sent to, and
+// the block stays alive for as long as any client still has one of its lines queued
+struct out_line_t
+{
+    block_ptr           block;
+    const char*         text;
+    int                 length;
+};
+
+// What to do with a new line when a client's output queue is already full
+enum overflow_t
+{
+    OVERFLOW_DROP_OLDEST,   // Discard the oldest line in the queue to make room
+    OVERFLOW_DROP_CLIENT,   // Disconnect the client
+    OVERFLOW_MARK_GAP       // Discard the new line, and later tell the client how many lines it missed
+};
+
+
+//==========================================================================================================
+// live_stats_t - Counters maintained by the live-log thread
+//==========================================================================================================
+struct live_stats_t
+{
+    uint64_t    clients;        // The number of clients connected right now
+    uint64_t    queued;         // The number of lines waiting to be sent to all of them, as of the last wakeup
+    uint64_t    sent;           // The number of lines that have been sent to clients
+    uint64_t    missed;         // The number of lines that clients missed, because their queue was full or
+                                // the entries were evicted before they could be dispatched
+    uint64_t    dropped;        // The number of clients that were disconnected because their queue was full
+    uint64_t    rejected;       // The number of clients turned away because there were too many
+    uint64_t    syscalls;       // The number of system calls made sending to clients
+    uint64_t    errors;         // The number of clients whose requests didn't make sense
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CSubscription - The entries a live-log client asked for when it connected
+//
+// The tags are looked up once, into a bitmap indexed by tag ID, so checking an entry costs the same
+// however many tags the client named.  A tag that hasn't been logged yet is watched for among the tags
+// added to the TagTable from then on.
+//==========================================================================================================
+class CSubscription
+{
+public:
+    CSubscription() {clear();}
+
+    // Resets the subscription to "everything"
+    void    clear();
+
+    // Parses a request line.  Returns false (with a description of the problem) if it isn't valid
+    bool    parse(const char* text, string* p_error);
+
+    // Looks up any of the client's tags that have been added to the TagTable since we last looked
+    void    refresh();
+
+    // Returns true if the client wants an entry
+    bool    matches(uint64_t seq, uint32_t tag_id, uint8_t severity) const
+    {
+        if (seq < m_from || severity < m_severity) return false;
+        if (!m_by_tag) return true;
+        return tag_id / 64 < m_bits.size() && (m_bits[tag_id / 64] >> (tag_id % 64) & 1);
+    }
+
+    // True if the client asked to start at a sequence number.  Its lines are prefixed with theirs
+    bool            m_numbered;
+
+    // The sequence number of the first entry the client wants
+    uint64_t        m_from;
+
+    // The least severe entry the client wants
+    int             m_severity;
+
+protected:
+
+    // True if only some tags are wanted.  The bitmap of the IDs of the wanted tags found so far
+    bool             m_by_tag;
+    vector<uint64_t> m_bits;
+
+    // The wanted tags that weren't in the TagTable yet, and how many of its tags we've looked through
+    vector<string>   m_missing;
+    uint32_t         m_tag_count;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// live_client_t - The state of a single live-log client
+//==========================================================================================================
+struct live_client_t
+{
+    // The client's socket
+    int                 fd;
+
+    // True until the client has said what it wants, or the time it has to say so (by metrics_clock())
+    // has run out, and what it has said so far
+    bool                awaiting;
+    uint64_t            deadline;
+    string              request;
+
+    // What it wants
+    CSubscription       sub;
+
+    // Formatted lines waiting to be sent, and how much of the line at the front has already been sent
+    deque<out_line_t>   queue;
+    size_t              offset;
+
+    // The number of lines the client has missed that we haven't told it about yet
+    uint64_t            missed;
+
+    // True if we've asked epoll to tell us when the client's socket is writable
+    bool                want_output;
+
+    // True if the client is to be disconnected
+    bool                closing;
+
+    // While a newly connected client is catching up with the log, this is the portion being replayed.
+    // Once the client has caught up, this is NULL, and the client receives new entries as they arrive.
+    CLogSnapshot*       backlog;
+
+    // The block that lines replayed from the backlog are formatted into
+    block_ptr           block;
+
+    // For a client that asked to start at a sequence number, the sequence number of the entry it should
+    // be replayed next.  Any it skips over were evicted before the client could be sent them
+    uint64_t            expect;
+
+    // With io_uring: true while a send is in flight, the number of lines at the front of the queue that
+    // it covers, and what it was handed.  The kernel reads these until the send completes, so the client
+    // isn't freed before then
+    bool                sending;
+    int                 inflight;
+    vector<iovec>       iov;
+    struct msghdr       msg;
+
+    // True once a client that is to be disconnected has had its socket shut down, to hurry its send along
+    bool                shut;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CLiveLog - A thread that outputs logging messages in real time
+//
+// The threads that append to the data-log never touch a client socket: they just call notify().  This
+// thread then picks up the new entries from the data-log, formats each of them once, and queues them
+// to every client.  Each client's queue is bounded, and a slow client only ever hurts itself.
+//
+// Lines are formatted back to back into large shared blocks, and a client's queue is written to its
+// socket with a single gathering send, so a busy client costs one system call per batch of lines.
+//
+// With the io_uring backend, those sends are queued to a ring instead, and every client's send goes to
+// the kernel in the one system call at the end of each pass through the event loop.  The ring's
+// completions wake the loop through epoll like everything else.
+//
+// Entries are dispatched in sequence order, and only once every entry with a lower sequence number is in
+// the log (see CLogData::settled()), so the entries dispatched so far are always exactly those below some
+// sequence number.  A client that resumes from a sequence number is replayed the entries from there up
+// to that point, in sequence order, and then joins the live stream where the replay left off, so it sees
+// every entry once, in order.  An entry is only formatted if some client wants it, and then only once
+// however many clients want it (or twice, if some want it with its sequence number and some without).
+//==========================================================================================================
+class CLiveLog : public CThread
+{
+public:
+
+    CLiveLog();
+
+    // Called by another thread to spawn this server
+    void    spawn(int port);
+
+    // Called by another thread to move the server to a different port.  Clients that are already
+    // connected stay connected.  Returns false if the new port can't be listened on
+    bool    rebind(int port);
+
+    // Called by the threads that append to the data-log after they've appended something
+    void    notify();
+
+    // Translates the name of an overflow policy into an overflow_t.  Returns false on an unknown name
+    static bool parse_overflow(const string& name, overflow_t* p_policy);
+
+    // Returns a copy of the live-log's counters
+    live_stats_t get_stats() {return m_stats;}
+
+protected:
+
+    void    main();
+
+    // Accepts every client that is waiting to connect
+    void    accept_clients();
+
+    // Reads what a client has sent of its request, and acts on it once the whole line has arrived
+    void    read_request(live_client_t* client);
+
+    // Starts sending a client what it asked for, beginning with its replay of the log
+    void    subscribe(live_client_t* client);
+
+    // Tells a client what's wrong with its request, and disconnects it
+    void    reject(live_client_t* client, const string& error);
+
+    // Returns how many milliseconds until the next client runs out of time to make its request, or -1 if
+    // no client is making one
+    int     request_wait();
+
+    // Subscribes every client that has run out of time to make its request to everything
+    void    expire_requests();
+
+    // Moves the dispatch position of every shard up to the entries that aren't settled yet
+    void    resync();
+
+    // Disconnects a client and frees its resources
+    void    close_client(live_client_t* client);
+
+    // Disconnects every client that has been marked for closing
+    void    close_marked_clients();
+
+    // Returns true if entries have been appended to the data-log that we haven't dispatched yet
+    bool    has_new_entries();
+
+    // Formats new entries from the data-log and queues them to every client
+    void    dispatch();
+
+    // Formats an entry (prefixed with its sequence number if "numbered") or copies text into a block of
+    // output lines, starting a new block if it's full
+    out_line_t  format(block_ptr& block, const log_view_t& entry, bool numbered = false);
+    out_line_t  format(block_ptr& block, const char* text, int length);
+
+    // Formats the line that tells a client how many entries it has missed into a block
+    out_line_t  format_missed(block_ptr& block, uint64_t missed);
+
+    // Queues a line of output to a client, applying the overflow policy if its queue is full
+    void    enqueue(live_client_t* client, const out_line_t& line);
+
+    // Refills the output queue of a client that is still catching up with the log
+    void    catch_up(live_client_t* client);
+
+    // Writes as much of a client's output queue as its socket will accept without blocking
+    void    flush(live_client_t* client);
+
+    // Points an array of iovecs at the lines at the front of a client's queue.  Returns how many
+    int     gather(live_client_t* client, struct iovec* iov);
+
+    // Throws away the lines at the front of a client's queue that have been sent in their entirety
+    void    sent(live_client_t* client, size_t length);
+
+    // With io_uring: queues a send of the front of a client's queue, and handles the sends that completed
+    void    submit_send(live_client_t* client);
+    void    complete_sends();
+
+    // Tells epoll whether or not we care when a client's socket becomes writable
+    void    watch_output(live_client_t* client, bool enable);
+
+    // The TCP port we listen on
+    int     m_port;
+
+    // The epoll instance, our listening socket, and the eventfd that notify() uses to wake us
+    int     m_epoll_fd, m_listen_fd, m_event_fd;
+
+    // The ring that sends go through, and whether we have one
+    CUring  m_ring;
+    bool    m_use_ring;
+
+    // The number of system calls made sending, other than through the ring
+    uint64_t m_syscalls;
+
+    // Non-zero while this thread is (about to be) waiting for something to happen
+    volatile int m_sleeping;
+
+    // What to do when a client's queue overflows, and how many lines a client's queue may hold
+    overflow_t  m_overflow;
+    size_t      m_queue_limit;
+
+    // For each shard of the data-log, the index of the next entry to be dispatched.  The entries before
+    // them are exactly those with sequence numbers below m_settled.  While nobody is connected, these
+    // aren't kept up to date: the first client to connect brings them up to date (see resync())
+    vector<uint64_t> m_next;
+    uint64_t    m_settled;
+
+    // The number of clients that haven't made their request yet
+    int         m_awaiting;
+
+    // The block that dispatched lines are formatted into
+    block_ptr   m_block;
+
+    // The connected clients, keyed by socket descriptor
+    map<int, live_client_t*> m_client;
+
+    // Our counters.  Only this thread writes them
+    live_stats_t m_stats;
+};
+//==========================================================================================================
@@ -1,30 +1,859 @@
 //==========================================================================================================
-// logdata.cpp - Implements a thread-safe structure that maintains a queue of log-data 
+// logdata.cpp - Implements a thread-safe structure that maintains a queue of log-data
 //==========================================================================================================
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "logdata.h"
+#include "deque_log.h"
+#include "ring_log.h"
+#include "packed_log.h"
+#include "ingest_proto.h"
+#include "disk_log.h"
+#include "tags.h"
+#include "atomics.h"
 
 
+//==========================================================================================================
+// CSharedCursor - Wraps an engine's cursor, and keeps the engine alive until the cursor is deleted, even
+//                 if the engine is replaced in the meantime
+//==========================================================================================================
+class CSharedCursor : public CLogCursor
+{
+public:
+    CSharedCursor(CLogData* log, CLogData::engine_ref_t* ref, CLogCursor* cursor) {m_log = log; m_ref = ref; m_cursor = cursor;}
+    ~CSharedCursor() {delete m_cursor; m_log->release(m_ref);}
+
+    bool    next(log_view_t& view)      {return m_cursor->next(view);}
+    void    seek(uint64_t index)        {m_cursor->seek(index);}
+    void    hint(const log_hint_t& hint) {m_cursor->hint(hint);}
+
+protected:
+
+    CLogData*               m_log;
+    CLogData::engine_ref_t* m_ref;
+    CLogCursor*             m_cursor;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// log_clock() - Returns the current time of day, in nanoseconds since the epoch
+//==========================================================================================================
+log_time_t log_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// load_instance() - Returns the instance identifier kept in a file, storing "fresh" there first if the file
+//                   doesn't have one.  The disk engine's indices outlast the logger, and so must this
+//==========================================================================================================
+static uint64_t load_instance(const string& filename, uint64_t fresh)
+{
+    unsigned long long instance = 0;
+
+    FILE* file = fopen(filename.c_str(), "r");
+    if (file)
+    {
+        if (fscanf(file, "%llu", &instance) != 1) instance = 0;
+        fclose(file);
+    }
+    if (instance) return instance;
+
+    file = fopen(filename.c_str(), "w");
+    if (file)
+    {
+        fprintf(file, "%llu\n", (unsigned long long)fresh);
+        fclose(file);
+    }
+    return fresh;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates the storage engines
+//
+// Passed:  spec   = Describes the storage engine to create
+//          shards = The number of shards to divide the log into
+//
+// Returns: true on success, false if the engine isn't one we know about, or couldn't be created
+//
+// Note:    The entry and byte budgets are divided between the shards by divide().  The disk engine keeps
+//          each shard in its own subdirectory of spec.dir.  If tags have a quota, each shard gets an
+//          overflow shard too, which shares spec.quota_entries (and a like share of the bytes)
+//==========================================================================================================
+bool CLogData::create(const log_spec_t& spec, int shards)
+{
+    const string& engine = spec.engine;
+    int max_entries = spec.max_entries, max_bytes = spec.max_bytes;
+    vector<int> entries, bytes;
+    char name[32];
+
+    // Throw away any engines we already have
+    destroy();
+    m_spec = spec;
+
+    // Make sure the engine type is one we know about
+    if (engine != "ring" && engine != "deque" && engine != "disk" && engine != "packed") return false;
+
+    // There is always at least one shard
+    if (shards < 1) shards = 1;
+
+    // The disk engine's shard directories live inside this one
+    if (engine == "disk" && mkdir(spec.dir.c_str(), 0755) < 0 && errno != EEXIST)
+    {
+        perror(spec.dir.c_str());
+        return false;
+    }
+
+    // Create a storage engine for each shard
+    divide(spec, shards, entries, bytes);
+    for (int i = 0; i < shards; ++i)
+    {
+        sprintf(name, "/shard%d", i);
+        CLogEngine* shard = create_engine(spec, name, entries[i], bytes[i]);
+        if (!shard) return false;
+        m_shard.push_back(shard);
+    }
+
+    // If tags have a quota, create the overflow shards, and start counting tags
+    if (spec.tag_quota > 0)
+    {
+        int quota_entries = (spec.quota_entries > 0) ? spec.quota_entries : 1;
+        int quota_bytes   = (int)((double)max_bytes * quota_entries / (max_entries > 0 ? max_entries : 1));
+
+        // Every overflow shard has room for at least one entry, even if there are more shards than that
+        int shard_entries = (quota_entries / shards > 0) ? quota_entries / shards : 1;
+        for (int i = 0; i < shards; ++i)
+        {
+            sprintf(name, "/overflow%d", i);
+            CLogEngine* shard = create_engine(spec, name, shard_entries, quota_bytes / shards);
+            if (!shard) return false;
+            m_shard.push_back(shard);
+        }
+
+        m_census.resize(shards);
+        for (int i = 0; i < shards; ++i)
+        {
+            tag_census_t& census = m_census[i];
+            uint64_t size = (entries[i] > 0) ? entries[i] : 1;
+            census.tag.resize(size);
+            census.first    = census.end = m_shard[i]->end();
+            census.quota    = size * spec.tag_quota / 100;
+            census.diverted = 0;
+            if (census.quota < 1) census.quota = 1;
+        }
+    }
+
+    // Each shard keeps track of how long its appends take, and of the cursors walking its engine
+    m_latency.resize(m_shard.size());
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        engine_ref_t* ref = new engine_ref_t;
+        ref->engine  = m_shard[i];
+        ref->cursors = 0;
+        ref->retired = false;
+        m_ref.push_back(ref);
+    }
+
+    // No ordinary shard has a change of size waiting for it
+    m_resize.assign(shards, (resize_t*)NULL);
+
+    // And none is being appended to
+    appending_t idle = {LOG_END};
+    m_appending.assign(shards, idle);
+
+    // Sequence numbers carry on from wherever the recovered log left off
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        if (m_shard[i]->next_seq() > m_seq) m_seq = m_shard[i]->next_seq();
+    }
+
+    // The indices start over from zero, so they get a new instance identifier, unless they were recovered
+    // along with the entries they refer to.  Zero is never used
+    m_instance = ((uint64_t)log_clock() ^ ((uint64_t)getpid() << 40)) | 1;
+    if (engine == "disk") m_instance = load_instance(spec.dir + "/instance", m_instance);
+
+    // Tell the caller that all is well
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// divide() - Works out how many of the log's entries and bytes each ordinary shard gets
+//
+// Passed:  spec    = The log's max_entries, max_bytes, and shard_entries
+//          shards  = The number of ordinary shards
+//          entries = Filled in with the most entries each shard may hold
+//          bytes   = Filled in with each shard's share of the byte budget
+//
+// Note:    A shard with a size of its own gets a like share of the bytes.  The other shards divide what's
+//          left evenly between them
+//==========================================================================================================
+void CLogData::divide(const log_spec_t& spec, int shards, vector<int>& entries, vector<int>& bytes)
+{
+    int max_entries = spec.max_entries, max_bytes = spec.max_bytes, even = shards, i;
+
+    entries.assign(shards, 0);
+    bytes.assign(shards, 0);
+
+    // Hand out the sizes of the shards that have sizes of their own
+    for (i = 0; i < shards && i < (int)spec.shard_entries.size(); ++i)
+    {
+        if (spec.shard_entries[i] <= 0) continue;
+        entries[i] = spec.shard_entries[i];
+        bytes[i]   = (int)((double)spec.max_bytes * entries[i] / (spec.max_entries > 0 ? spec.max_entries : 1));
+        max_entries -= entries[i];
+        max_bytes   -= bytes[i];
+        --even;
+    }
+    if (max_entries < 0) max_entries = 0;
+    if (max_bytes < 0)   max_bytes   = 0;
+
+    // And divide the rest evenly
+    for (i = 0; i < shards; ++i)
+    {
+        if (entries[i] > 0) continue;
+        entries[i] = max_entries / even;
+        bytes[i]   = max_bytes / even;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_engine() - Creates the storage engine for one shard
+//
+// Passed:  spec        = Describes the storage engine to create
+//          dir         = The name of the shard's subdirectory, for the disk engine
+//          max_entries = The most entries the shard may hold
+//          max_bytes   = The shard's share of the byte budget
+//
+// Returns: The engine, or NULL if it couldn't be created
+//==========================================================================================================
+CLogEngine* CLogData::create_engine(const log_spec_t& spec, const char* dir, int max_entries, int max_bytes)
+{
+    const string& engine = spec.engine;
+
+    // Create the preallocated, lock-free ring buffer engine
+    if (engine == "ring") return new CRingLog(max_entries, max_bytes);
+
+    // Create the original heap-allocated engine
+    if (engine == "deque") return new CDequeLog(max_entries);
+
+    // Create the engine that compresses all but its newest entries
+    if (engine == "packed") return new CPackedLog(max_entries, max_bytes);
+
+    // Create the persistent engine, and recover whatever it held when we last ran
+    CDiskLog* disk = new CDiskLog(spec.dir + dir, max_entries, spec.segment_size, spec.segment_age);
+    if (disk->open()) return disk;
+    delete disk;
+    return NULL;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// destroy() - Deletes all of the storage engines
+//==========================================================================================================
+void CLogData::destroy()
+{
+    for (size_t i = 0; i < m_resize.size(); ++i)
+    {
+        if (!m_resize[i]) continue;
+        delete m_resize[i]->engine[0];
+        delete m_resize[i]->engine[1];
+        delete m_resize[i];
+    }
+    for (size_t i = 0; i < m_shard.size(); ++i) delete m_shard[i];
+    for (size_t i = 0; i < m_ref.size(); ++i) delete m_ref[i];
+    m_resize.clear();
+    m_shard.clear();
+    m_ref.clear();
+    m_latency.clear();
+    m_census.clear();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends an entry to a shard of the queue of logged data
+//==========================================================================================================
+void CLogData::append(int shard, const char* tag, int tag_len, const char* data, int data_len)
+{
+    log_item_t item = {log_clock(), TagTable.intern(tag, tag_len), LOG_SEV_NONE, tag, tag_len, data, data_len};
+    append(shard, &item, 1);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends a batch of entries to a shard of the queue of logged data.  The whole batch is
+//            stored with a single lock acquisition (or none at all, depending on the engine), and the
+//            sequence numbers for the whole batch are reserved with a single atomic add
+//==========================================================================================================
+void CLogData::append(int shard, const log_item_t* item, int count)
+{
+    uint64_t start = metrics_clock();
+
+    // If the shard has been resized, this is where it finds out
+    if (load_acquire(&m_resize[shard])) apply_resize(shard);
+
+    // Let settled() know that entries are on their way to this shard, before we take their sequence
+    // numbers.  The atomic add orders the two
+    m_appending[shard].seq = m_seq;
+    uint64_t seq = __sync_fetch_and_add(&m_seq, count);
+    if (m_census.empty())
+        m_shard[shard]->append(item, count, seq);
+    else
+        append_by_quota(shard, item, count, seq);
+
+    // They're in the log now
+    store_release(&m_appending[shard].seq, LOG_END);
+    m_latency[shard].record(metrics_clock() - start);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// idle() - Picks up the change of size waiting for a shard, if there is one, when there's nothing to
+//          append to it.  Without this, a shard that gets no traffic would keep its old size (and, for an
+//          engine that can't be resized where it is, the replacement made for it) indefinitely
+//==========================================================================================================
+void CLogData::idle(int shard)
+{
+    if (load_acquire(&m_resize[shard])) apply_resize(shard);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append_by_quota() - Appends a batch of entries to a shard, except that entries whose tags already have
+//                     their quota of the shard's entries go to the shard's overflow shard instead
+//
+// Passed:  shard = The ordinary shard to append to
+//          item  = The entries
+//          count = How many there are
+//          seq   = The sequence number of the first of them
+//
+// Note:    The batch is appended as runs of consecutive entries bound for the same shard, so a well-
+//          behaved batch is still a single append.  A shard never holds more entries than its census
+//          has room for, so by the time an entry's place in the census is reused, the entry it
+//          belonged to has been evicted
+//==========================================================================================================
+void CLogData::append_by_quota(int shard, const log_item_t* item, int count, uint64_t seq)
+{
+    tag_census_t& census = m_census[shard];
+    CLogEngine*   engine = m_shard[shard];
+    CLogEngine*   overflow = m_shard[shard + m_census.size()];
+    uint64_t      size = census.tag.size();
+    int           i = 0, run;
+
+    while (i < count)
+    {
+        // Gather a run of entries whose tags are within their quota, counting each one in as we go
+        for (run = 0; i + run < count; ++run)
+        {
+            uint32_t tag_id = item[i + run].tag_id;
+            if (tag_id >= census.count.size()) census.count.resize(tag_id + 1, 0);
+            if (census.count[tag_id] >= census.quota) break;
+            if (census.end - census.first == size) --census.count[census.tag[census.first++ % size]];
+            census.tag[census.end++ % size] = tag_id;
+            ++census.count[tag_id];
+        }
+        if (run) engine->append(item + i, run, seq + i);
+        i += run;
+
+        // Then a run of entries whose tags are over their quota.  A tag the census has never counted has
+        // no entries yet, so it ends the run
+        for (run = 0; i + run < count; ++run)
+        {
+            uint32_t tag_id = item[i + run].tag_id;
+            if (tag_id >= census.count.size() || census.count[tag_id] < census.quota) break;
+        }
+        if (run) overflow->append(item + i, run, seq + i);
+        census.diverted += run;
+        i += run;
+    }
+
+    // Stop counting entries the shard has evicted to stay within its byte budget
+    uint64_t first = engine->first();
+    while (census.first < first && census.first < census.end) --census.count[census.tag[census.first++ % size]];
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize() - Changes the number of entries (and bytes) the log keeps, and the tags' quota of them
+//
+// Passed:  spec = The new max_entries, max_bytes, shard_entries, tag_quota, and quota_entries.  Everything
+//                 else must be as it was when the log was created
+//
+// Note:    The sizes are divided between the shards as create() divides them.  Each shard picks up its
+//          new size the next time it's appended to, or idle() is called for it (see apply_resize()).  For
+//          an engine that can't change size where it is, we make its replacement here and copy the entries
+//          that will fit into it, while the shard carries on being appended to.  A shard that hasn't picked
+//          up its last change of size yet has it replaced by this one
+//==========================================================================================================
+void CLogData::resize(const log_spec_t& spec)
+{
+    int  shards = m_resize.size(), max_entries = spec.max_entries, max_bytes = spec.max_bytes;
+    bool quota  = !m_census.empty();
+    vector<int> entries, bytes;
+    char name[32];
+
+    // The overflow shards' budget is worked out just as create() works it out
+    int quota_entries = (spec.quota_entries > 0) ? spec.quota_entries : 1;
+    int quota_bytes   = (int)((double)max_bytes * quota_entries / (max_entries > 0 ? max_entries : 1));
+
+    divide(spec, shards, entries, bytes);
+    for (int i = 0; i < shards; ++i)
+    {
+        resize_t* resize = new resize_t;
+        resize->max_entries[0] = entries[i];
+        resize->max_bytes[0]   = bytes[i];
+        resize->max_entries[1] = (quota_entries / shards > 0) ? quota_entries / shards : 1;
+        resize->max_bytes[1]   = quota_bytes / shards;
+        resize->engine[0] = resize->engine[1] = NULL;
+        resize->census_size = (entries[i] > 0) ? entries[i] : 1;
+        resize->quota       = resize->census_size * spec.tag_quota / 100;
+        if (resize->quota < 1) resize->quota = 1;
+
+        // Make a replacement for each engine that can't change its size where it is, and fill it with
+        // the newest entries that will fit.  The copying is done without any lock held
+        for (int j = 0; j < (quota ? 2 : 1); ++j)
+        {
+            int shard = i + j * shards;
+            m_mutex.lock();
+            bool can_resize = m_shard[shard]->can_resize();
+            uint64_t end = m_shard[shard]->end();
+            m_mutex.unlock();
+            if (can_resize) continue;
+
+            sprintf(name, j ? "/overflow%d" : "/shard%d", i);
+            CLogEngine* engine = create_engine(m_spec, name, resize->max_entries[j], resize->max_bytes[j]);
+            if (!engine) continue;
+            uint64_t keep = (resize->max_entries[j] > 0) ? resize->max_entries[j] : 1;
+            copy_entries(cursor(shard, end > keep ? end - keep : 0, end), engine);
+            resize->engine[j] = engine;
+        }
+
+        // Hand the change to the shard, in place of any change it hasn't picked up yet
+        resize_t* stale = __sync_lock_test_and_set(&m_resize[i], resize);
+        if (stale)
+        {
+            delete stale->engine[0];
+            delete stale->engine[1];
+            delete stale;
+        }
+    }
+
+    m_spec.max_entries   = spec.max_entries;
+    m_spec.max_bytes     = spec.max_bytes;
+    m_spec.tag_quota     = spec.tag_quota;
+    m_spec.quota_entries = spec.quota_entries;
+    m_spec.shard_entries = spec.shard_entries;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resizing() - Returns the number of shards that haven't picked up their new size yet
+//==========================================================================================================
+int CLogData::resizing()
+{
+    int count = 0;
+    for (size_t i = 0; i < m_resize.size(); ++i) if (load_acquire(&m_resize[i])) ++count;
+    return count;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// copy_entries() - Copies every entry a cursor returns into an engine, giving each the same index and
+//                  sequence number it had, then deletes the cursor
+//
+// Note:    If the engine being copied from evicts entries before we get to them, the copy starts over at
+//          the first entry we do get, so that the indices in the engine never have a gap in them
+//==========================================================================================================
+void CLogData::copy_entries(CLogCursor* cursor, CLogEngine* engine)
+{
+    log_view_t view;
+
+    while (cursor->next(view))
+    {
+        if (view.index != engine->end()) engine->restart(view.index);
+        log_item_t item = {view.timestamp, view.tag_id, view.severity, view.tag, view.tag_len, view.data, view.data_len};
+        engine->append(&item, 1, view.seq);
+    }
 
+    delete cursor;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// apply_resize() - Picks up the change of size waiting for a shard, and for its overflow shard
+//
+// Note:    This is only ever called by the thread that appends to the shard, so nothing is appended to
+//          its engines while they're being resized or replaced
+//==========================================================================================================
+void CLogData::apply_resize(int shard)
+{
+    resize_t* resize = __sync_lock_test_and_set(&m_resize[shard], (resize_t*)NULL);
+    if (!resize) return;
+
+    resize_engine(shard, resize->max_entries[0], resize->max_bytes[0], resize->engine[0]);
+    if (!m_census.empty())
+    {
+        resize_engine(shard + m_census.size(), resize->max_entries[1], resize->max_bytes[1], resize->engine[1]);
+        resize_census(m_census[shard], resize->census_size, resize->quota);
+    }
+
+    delete resize;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize_engine() - Resizes a shard's engine, or puts the replacement that was made for it in its place
+//
+// Passed:  shard       = The shard
+//          max_entries = Its new size
+//          max_bytes   = Its new byte budget
+//          engine      = Its replacement, or NULL if the engine can change its size where it is
+//==========================================================================================================
+void CLogData::resize_engine(int shard, int max_entries, int max_bytes, CLogEngine* engine)
+{
+    CLogEngine* old = m_shard[shard];
+
+    // An engine that can change its size does so where it is
+    if (!engine)
+    {
+        if (old->can_resize()) old->resize(max_entries, max_bytes);
+        return;
+    }
+
+    // Otherwise its replacement has a copy of its entries as they were when the replacement was made.
+    // Copy whatever has been appended since, and make sure the next entry gets the index it would have
+    copy_entries(old->snapshot(engine->end(), LOG_END), engine);
+    if (engine->end() < old->end()) engine->restart(old->end());
+
+    engine_ref_t* ref = new engine_ref_t;
+    ref->engine  = engine;
+    ref->cursors = 0;
+    ref->retired = false;
+
+    // Then put it in place of the old one, which lives on for as long as a cursor is walking it
+    m_mutex.lock();
+    engine_ref_t* old_ref = m_ref[shard];
+    m_shard[shard] = engine;
+    m_ref[shard]   = ref;
+    old_ref->retired = true;
+    bool unused = (old_ref->cursors == 0);
+    m_mutex.unlock();
+
+    if (unused)
+    {
+        delete old;
+        delete old_ref;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize_census() - Changes the size of a shard's census of tags, and the quota each tag has of it
+//
+// Note:    If the census shrinks, the oldest entries stop being counted.  The shard's engine has already
+//          been resized, so it holds no more entries than the census has room for
+//==========================================================================================================
+void CLogData::resize_census(tag_census_t& census, uint64_t size, uint32_t quota)
+{
+    uint64_t old_size = census.tag.size();
+
+    // Stop counting the oldest entries if there's no longer room for them
+    while (census.end - census.first > size) --census.count[census.tag[census.first++ % old_size]];
+
+    // And move the rest to where they belong in a census of the new size
+    vector<uint32_t> tag(size);
+    for (uint64_t i = census.first; i < census.end; ++i) tag[i % size] = census.tag[i % old_size];
+    census.tag.swap(tag);
+    census.quota = quota;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// release() - Forgets a cursor over an engine.  If the engine has been replaced, and that was the last
+//             cursor walking it, the engine is deleted
+//==========================================================================================================
+void CLogData::release(engine_ref_t* ref)
+{
+    m_mutex.lock();
+    bool done = (--ref->cursors == 0 && ref->retired);
+    m_mutex.unlock();
+
+    if (done)
+    {
+        delete ref->engine;
+        delete ref;
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// cursor() - Returns a newly allocated cursor over the entries in the range [from, to) of a single shard.
+//            The shard's engine stays alive until the cursor is deleted
+//==========================================================================================================
+CLogCursor* CLogData::cursor(int shard, uint64_t from, uint64_t to)
+{
+    UniqueLock lock(m_mutex);
+    engine_ref_t* ref = m_ref[shard];
+    ++ref->cursors;
+    return new CSharedCursor(this, ref, ref->engine->snapshot(from, to));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// diverted() - Returns the number of entries that have gone to the overflow shards
+//==========================================================================================================
+uint64_t CLogData::diverted()
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < m_census.size(); ++i) total += m_census[i].diverted;
+    return total;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_append_latency() - Fills in the combined histogram of how long the appends to every shard took
+//==========================================================================================================
+void CLogData::get_append_latency(CHistogram& latency)
+{
+    latency.clear();
+    for (size_t i = 0; i < m_latency.size(); ++i) latency.merge(m_latency[i]);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// lock_wait() - Returns the total time, in nanoseconds, that appends have spent waiting for locks
+//==========================================================================================================
+uint64_t CLogData::lock_wait()
+{
+    UniqueLock lock(m_mutex);
+    uint64_t total = 0;
+    for (size_t i = 0; i < m_shard.size(); ++i) total += m_shard[i]->lock_wait();
+    return total;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Fills in a snapshot of every shard of the queue
+//==========================================================================================================
+void CLogData::snapshot(CLogSnapshot& snap)
+{
+    vector<uint64_t> from(m_shard.size(), 0), to(m_shard.size(), LOG_END);
+    snapshot(snap, from, to);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Fills in a snapshot of a range of entries from every shard of the queue
+//
+// Passed:  snap = The snapshot to fill in
+//          from = For each shard, the index of the first entry to include
+//          to   = For each shard, the index one past the last entry to include
+//==========================================================================================================
+void CLogData::snapshot(CLogSnapshot& snap, const vector<uint64_t>& from, const vector<uint64_t>& to)
+{
+    vector<CLogCursor*> cursor(m_shard.size());
+    vector<uint64_t>    end(m_shard.size());
+
+    snap.clear();
+
+    // Make a cursor over each shard, with no shard's engine being replaced while we do
+    m_mutex.lock();
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        // Find out where the shard ends right now, so we know where the snapshot ends
+        engine_ref_t* ref = m_ref[i];
+        end[i] = ref->engine->end();
+        if (end[i] > to[i]) end[i] = to[i];
+
+        // And make a cursor over that range, which keeps the engine alive
+        ++ref->cursors;
+        cursor[i] = new CSharedCursor(this, ref, ref->engine->snapshot(from[i], end[i]));
+    }
+    m_mutex.unlock();
+
+    // Add the cursors to the snapshot, which reads the first entry from each
+    for (size_t i = 0; i < cursor.size(); ++i) snap.add(cursor[i], end[i]);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// end() - Fills in the index, for each shard, one past the newest entry in that shard
+//==========================================================================================================
+void CLogData::end(vector<uint64_t>& end)
+{
+    UniqueLock lock(m_mutex);
+    end.resize(m_shard.size());
+    for (size_t i = 0; i < m_shard.size(); ++i) end[i] = m_shard[i]->end();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// first() - Fills in the index, for each shard, of the oldest entry in that shard
+//==========================================================================================================
+void CLogData::first(vector<uint64_t>& first)
+{
+    UniqueLock lock(m_mutex);
+    first.resize(m_shard.size());
+    for (size_t i = 0; i < m_shard.size(); ++i) first[i] = m_shard[i]->first();
+}
 //==========================================================================================================
-// append() - Appends an entry to the queue of logged data
+
+
+//==========================================================================================================
+// settled() - Returns a sequence number that every entry before it is already in the log by
+//
+// Note:    Sequence numbers are handed out before the entries are appended, so an entry can turn up in
+//          one shard after an entry with a higher sequence number has turned up in another.  Whoever
+//          reads the log in sequence order can safely go as far as this, but no further
 //==========================================================================================================
-void CLogData::append(const string& tag,  const string& data)
+uint64_t CLogData::settled()
 {
-    // Build a queue entry from our input data
-    struct log_data_t entry = {time(NULL), tag, data};
+    // Every sequence number handed out before this one belongs to an entry that is either in the log, or
+    // in the middle of being appended.  If it's the latter, the shard it's going to says so
+    uint64_t settled = load_acquire(&m_seq);
+    for (size_t i = 0; i < m_appending.size(); ++i)
+    {
+        uint64_t appending = load_acquire(&m_appending[i].seq);
+        if (appending < settled) settled = appending;
+    }
+    return settled;
+}
+//==========================================================================================================
 
-    // Ensure thread-safe access to m_data
-    lock();
 
-    // If our queue is full, delete the oldest entry
-    if (m_data.size() >= m_max_entries) m_data.pop_front();
+//==========================================================================================================
+// find_seq() - Finds the first entry in a shard with a sequence number of at least "seq"
+//
+// Passed:  shard = The shard to look in
+//          seq   = The sequence number to look for
+//
+// Returns: The entry's index, or the end of the shard if there's no such entry
+//
+// Note:    A shard is only ever appended to by one thread, so its sequence numbers rise with its indices,
+//          and we can look for the entry by bisection.  If entries are evicted while we look, the answer
+//          may be the index of one of them, which a cursor starting there skips over just the same
+//==========================================================================================================
+uint64_t CLogData::find_seq(int shard, uint64_t seq)
+{
+    log_view_t view;
+
+    m_mutex.lock();
+    uint64_t low = m_shard[shard]->first(), high = m_shard[shard]->end();
+    m_mutex.unlock();
 
-    // Add the current entry to the back of the queue
-    m_data.push_back(entry);
+    while (low < high)
+    {
+        // Fetch the entry in the middle of the range, or the first one after it that's still in the log
+        uint64_t middle = low + (high - low) / 2;
+        CLogCursor* walker = cursor(shard, middle, high);
+        bool found = walker->next(view);
+        delete walker;
 
-    // Allow other threads to access m_data;
-    unlock();
+        // If everything from there on has been evicted, so has everything before it
+        if (!found) return high;
+
+        // Carry on looking in whichever half the entry must be in
+        if (view.seq < seq)
+            low = view.index + 1;
+        else
+            high = middle;
+    }
+
+    return low;
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// clear() - Deletes all of the cursors in the snapshot
+//==========================================================================================================
+void CLogSnapshot::clear()
+{
+    for (size_t i = 0; i < m_cursor.size(); ++i) delete m_cursor[i];
+    m_cursor.clear();
+    m_end.clear();
+    m_head.clear();
+    m_has_head.clear();
+    m_last = -1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// add() - Adds a shard's cursor to the snapshot, and fetches the first entry from it
+//==========================================================================================================
+void CLogSnapshot::add(CLogCursor* cursor, uint64_t end)
+{
+    m_cursor.push_back(cursor);
+    m_end.push_back(end);
+    m_head.push_back(log_view_t());
+    m_has_head.push_back(cursor->next(m_head.back()));
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the oldest entry from among all of the shards
+//
+// Passed:  view = Filled in with the next entry
+//
+// Returns: true if an entry was fetched, false if we've reached the end of the snapshot
+//==========================================================================================================
+bool CLogSnapshot::next(log_view_t& view)
+{
+    // The entry we handed out last time is no longer in use, so its cursor can move on
+    if (m_last >= 0) m_has_head[m_last] = m_cursor[m_last]->next(m_head[m_last]);
+
+    // Find the shard whose next entry is the oldest.  Entries with the same timestamp are taken in
+    // sequence order, as are all entries if that's what we were asked for
+    m_last = -1;
+    for (size_t i = 0; i < m_cursor.size(); ++i)
+    {
+        if (!m_has_head[i]) continue;
+        if (m_last < 0) {m_last = i; continue;}
+        const log_view_t& a = m_head[i];
+        const log_view_t& b = m_head[m_last];
+        if (m_by_seq ? a.seq < b.seq : (a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.seq < b.seq))) m_last = i;
+    }
+
+    // If every shard is exhausted, we're done
+    if (m_last < 0) return false;
+
+    // Hand the caller the oldest entry
+    view = m_head[m_last];
+    view.shard = m_last;
+    return true;
+}
+//==========================================================================================================
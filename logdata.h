@@ -3,54 +3,415 @@
 //==========================================================================================================
 #pragma once
 #include <time.h>
-#include <deque>
+#include <stdint.h>
 #include <string>
-#include <time.h>
+#include <vector>
 #include "cthread.h"
+#include "metrics.h"
 
 using namespace std;
 
-struct log_data_t
+// A timestamp, in nanoseconds since the epoch
+typedef int64_t log_time_t;
+
+// The number of nanoseconds in a second
+const log_time_t NS_PER_SEC = 1000000000;
+
+// Returns the current time of day as a log_time_t
+log_time_t log_clock();
+
+
+//==========================================================================================================
+// log_view_t - A read-only view of a single log entry.  The tag and data are nul-terminated, and remain
+//              valid until the cursor that produced the view is advanced.
+//
+//              "seq" is unique across the entire log and increases with every entry appended, so it
+//              orders entries that arrived within the same nanosecond, or on different shards.
+//
+//              "tag_id" is the tag's ID in the TagTable.  The tag text itself is the name stored there.
+//
+//              "severity" is one of the LOG_SEV_xxx values in ingest_proto.h.  Entries that arrived in the
+//              text format have no severity (LOG_SEV_NONE).
+//==========================================================================================================
+struct log_view_t
+{
+    log_time_t  timestamp;
+    uint64_t    seq;
+    uint32_t    tag_id;
+    uint8_t     severity;
+    const char* tag;
+    int         tag_len;
+    const char* data;
+    int         data_len;
+    int         shard;
+    uint64_t    index;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// log_item_t - A new entry to be appended to the log.  "tag_id" must be the ID that TagTable.intern()
+//              returned for the tag, and "severity" is as in log_view_t
+//==========================================================================================================
+struct log_item_t
+{
+    log_time_t  timestamp;
+    uint32_t    tag_id;
+    uint8_t     severity;
+    const char* tag;
+    int         tag_len;
+    const char* data;
+    int         data_len;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// log_hint_t - Tells a cursor which entries its reader actually wants: those with timestamps in the range
+//              [since, until), and (unless "tags" is empty) one of the tag IDs in "tags".  A cursor may use
+//              it to skip over entries it knows aren't wanted, but it is free to return them anyway.
+//==========================================================================================================
+struct log_hint_t
+{
+    log_time_t          since, until;
+    vector<uint32_t>    tags;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CLogCursor - Walks the entries of a snapshot, oldest first.  Each storage engine supplies its own.
+//==========================================================================================================
+class CLogCursor
+{
+public:
+    virtual ~CLogCursor() {}
+
+    // Fetches the next entry.  Returns false when there are no more entries
+    virtual bool next(log_view_t& view) = 0;
+
+    // Skips ahead so that the next entry fetched is the one with the specified index (or the first one
+    // after it, if it has been evicted).  A cursor never moves backwards.
+    virtual void seek(uint64_t index) = 0;
+
+    // Tells the cursor which entries the reader wants.  Only an engine that can skip entries cheaply
+    // has any use for it
+    virtual void hint(const log_hint_t&) {}
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CLogEngine - The interface to a log storage engine
+//
+// Every entry appended to an engine is given an index, starting at zero and incrementing by one for
+// every entry.  Indices are never reused, even after the entry they refer to has been evicted.
+//==========================================================================================================
+class CLogEngine
+{
+public:
+    virtual ~CLogEngine() {}
+
+    // Appends a batch of entries to the log, evicting the oldest entries if needed to make room.  The
+    // entries are given the sequence numbers seq, seq + 1, seq + 2, etc.
+    virtual void append(const log_item_t* item, int count, uint64_t seq) = 0;
+
+    // Returns the index of the oldest entry in the log
+    virtual uint64_t first() = 0;
+
+    // Returns the index one past the newest entry in the log
+    virtual uint64_t end() = 0;
+
+    // Returns a newly allocated cursor over the entries with indices in the range [from, to) that
+    // are still in the log.  "to" is clipped to the end of the log.
+    virtual CLogCursor* snapshot(uint64_t from, uint64_t to) = 0;
+
+    // Returns one past the highest sequence number in the log.  Only an engine that recovers its
+    // contents from a previous run starts out with anything in it
+    virtual uint64_t next_seq() {return 0;}
+
+    // Returns the total time, in nanoseconds, that append() has spent waiting for a lock.  Only an
+    // engine that locks anything on the append path has anything to report
+    virtual uint64_t lock_wait() {return 0;}
+
+    // Returns true if the engine can change its size where it is.  If it can't, the log copies its
+    // entries into a new engine of the new size instead (see CLogData::resize())
+    virtual bool can_resize() {return false;}
+
+    // Changes the most entries the engine may hold, and its byte budget, evicting the oldest entries if
+    // it now holds too many.  Only ever called by the thread that appends to the engine
+    virtual void resize(int max_entries, int max_bytes) {}
+
+    // Throws away every entry, so that the next one appended is given index "index".  Only called on a
+    // new engine, which the entries of an engine that can't be resized are about to be copied into
+    virtual void restart(uint64_t index) {}
+};
+//==========================================================================================================
+
+// A snapshot range that extends to the end of the log
+const uint64_t LOG_END = ~0ULL;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CLogSnapshot - A consistent, read-only view of the log at the moment the snapshot was taken.  It may
+//                be walked at leisure with no lock held while other threads continue appending to the log.
+//
+//                The log may be divided into shards, each with its own cursor.  The snapshot merges the
+//                entries from all of the shards back into timestamp order, and then sequence order, or
+//                into sequence order alone if asked to.
+//==========================================================================================================
+class CLogSnapshot
+{
+public:
+    CLogSnapshot() {m_last = -1; m_by_seq = false;}
+    ~CLogSnapshot() {clear();}
+
+    // Fetches the next entry.  Returns false when there are no more entries
+    bool    next(log_view_t& view);
+
+    // Merges the shards in sequence order rather than timestamp order.  This outlasts clear(), so it
+    // holds for every range the snapshot is filled with from then on
+    void    by_seq() {m_by_seq = true;}
+
+    // Returns the index, for each shard, one past the last entry in the snapshot
+    const vector<uint64_t>& end() {return m_end;}
+
+    // Deletes all of the cursors
+    void    clear();
+
+    // Adds the next shard's cursor to the snapshot.  The snapshot takes ownership of the cursor
+    void    add(CLogCursor* cursor, uint64_t end);
+
+protected:
+
+    // The engine-specific cursor for each shard
+    vector<CLogCursor*> m_cursor;
+
+    // The index, for each shard, one past the last entry in the snapshot
+    vector<uint64_t>    m_end;
+
+    // The next entry from each cursor, and whether there is one
+    vector<log_view_t>  m_head;
+    vector<bool>        m_has_head;
+
+    // The cursor whose entry we handed out last.  It gets advanced on the next call to next()
+    int     m_last;
+
+    // True if the shards are merged in sequence order
+    bool    m_by_seq;
+
+private:
+
+    // Snapshots own their cursor, so they can't be copied
+    CLogSnapshot(const CLogSnapshot&);
+    CLogSnapshot& operator=(const CLogSnapshot&);
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// log_spec_t - Describes the storage engine to create for each shard of the log
+//==========================================================================================================
+struct log_spec_t
 {
-    time_t  timestamp;
-    string  tag;
-    string  data;
+    string      engine;         // "ring", "deque", "disk", or "packed"
+    int         max_entries;    // The maximum number of entries to keep
+    int         max_bytes;      // The size of the ring engine's storage arena, or the packed engine's budget
+    string      dir;            // The directory where the disk engine keeps its segment files
+    int         segment_size;   // The size of each of the disk engine's segment files
+    int         segment_age;    // The disk engine starts a new segment after this many seconds (0 = never)
+    int         tag_quota;      // The most of a shard, in percent, that one tag's entries may fill (0 = no limit)
+    int         quota_entries;  // The maximum number of entries kept from tags that are over their quota
+    vector<int> shard_entries;  // For each ordinary shard, the entries it keeps out of max_entries, or 0 (or
+                                // not listed) for an even share of what the shards with sizes of their own
+                                // leave over.  Empty = every shard gets an even share
 };
+//==========================================================================================================
 
 
 //==========================================================================================================
-// CLogData - A thread-safe double-ended queue
+// CLogData - A thread-safe queue of log entries, backed by a selectable storage engine
+//
+// The log is divided into one or more shards, each with its own storage engine, so that several
+// threads can append to the log without contending with each other.  Each shard should only ever be
+// appended to by a single thread.
+//
+// If tags have a quota, each shard keeps count of how many of its entries have each tag.  Once a tag
+// has its quota of a shard's entries, its new entries go to an overflow shard instead, where the only
+// entries they can evict are those of other tags that are over their quota.  The overflow shards come
+// after the ordinary ones, and are read like any other shard.
+//
+// The log can be resized while it's in use.  Each shard picks up its new size the next time it's
+// appended to, or the next time the thread that appends to it goes idle, so appends never wait on a
+// resize, and a shard with no traffic doesn't hold on to its old size.  An engine that
+// can't change size where it is gets replaced: its entries are copied into the new engine beforehand,
+// with no lock held, and only the entries appended since then are copied when the shard picks it up.
+// Cursors keep the engine they're walking alive, so a snapshot taken before the swap reads on undisturbed.
 //==========================================================================================================
 class CLogData
 {
 public:
-    CLogData() {m_max_entries = 1000;}
+    CLogData() {m_seq = 0; m_instance = 0;}
+    ~CLogData() {destroy();}
+
+    // Creates the storage engines.  Returns false on an unknown engine, or one that can't be created
+    bool    create(const log_spec_t& spec, int shards = 1);
+
+    // Append a data item to a shard of the queue, timestamped with the current time
+    void    append(int shard, const char* tag, int tag_len, const char* data, int data_len);
+
+    // Append a batch of data items to a shard of the queue in one operation
+    void    append(int shard, const log_item_t* item, int count);
 
-    // Determine the maximum number of data entries
-    void    set_max_entries(int count) {m_max_entries = count;}
+    // Lets a shard pick up its new size when it has nothing to append.  Only ever called by the thread
+    // that appends to the shard
+    void    idle(int shard);
 
-    // Append a data item to the queue
-    void    append(const string& tag, const string& data);
+    // Fills in a snapshot of the current contents of the queue
+    void    snapshot(CLogSnapshot& snap);
 
-    // Prevent other threads from accessing m_data
-    void    lock() {m_mutex.lock();}
+    // Fills in a snapshot of the entries in each shard with indices in the range [from, to)
+    void    snapshot(CLogSnapshot& snap, const vector<uint64_t>& from, const vector<uint64_t>& to);
 
-    // Allow other threads to access m_data
-    void    unlock() {m_mutex.unlock();}
+    // Fills in the index, for each shard, one past the newest entry in that shard
+    void    end(vector<uint64_t>& end);
 
-    // Get a reference to the queue data
-    deque<log_data_t>& get_data() {return m_data;}    
+    // Fills in the index, for each shard, of the oldest entry in that shard
+    void    first(vector<uint64_t>& first);
+
+    // Returns a sequence number that every entry before it has been appended by: no entry with a lower
+    // sequence number will ever turn up in the log after this returns
+    uint64_t settled();
+
+    // Returns the index of the first entry in a shard with a sequence number of at least "seq", or the
+    // end of the shard if there isn't one.  Entries before it may have been evicted already
+    uint64_t find_seq(int shard, uint64_t seq);
+
+    // Returns a newly allocated cursor over the entries in the range [from, to) of a single shard
+    CLogCursor* cursor(int shard, uint64_t from, uint64_t to);
+
+    // Changes the number of entries (and bytes) the log keeps, and the tags' quota of them.  Everything
+    // else in "spec" must be as it was when the log was created.  Only one thread may resize at a time
+    void    resize(const log_spec_t& spec);
+
+    // Returns the number of shards that haven't picked up their new size yet
+    int     resizing();
+
+    // Returns the number of shards the queue is divided into
+    int     shards() {return m_shard.size();}
+
+    // Returns an identifier for the log's indices.  It changes whenever they start over from zero, which
+    // they do every time the log is created, unless its engine recovered them from a previous run
+    uint64_t instance() {return m_instance;}
+
+    // Fills in the combined histogram of how long each append to any shard has taken, in nanoseconds
+    void    get_append_latency(CHistogram& latency);
+
+    // Returns the total time, in nanoseconds, that appends to every shard have spent waiting for locks
+    uint64_t lock_wait();
+
+    // Returns the number of entries that have gone to the overflow shards because their tag was over its quota
+    uint64_t diverted();
 
 protected:
 
-    // Maximum number of entries in our queue
-    int m_max_entries;
+    // How many of a shard's entries have each tag
+    struct tag_census_t
+    {
+        vector<uint32_t> tag;       // The tag ID of each entry being counted, by index modulo the shard's size
+        vector<uint32_t> count;     // For each tag ID, how many of the entries being counted have it
+        uint64_t    first, end;     // The range of indices of the entries being counted
+        uint32_t    quota;          // The most entries any one tag may have
+        uint64_t    diverted;       // The number of entries that have gone to the overflow shard instead
+    };
+
+    // A change of size waiting for the thread that appends to a shard to pick it up
+    struct resize_t
+    {
+        int         max_entries[2]; // The new size and byte budget of the shard, and of its overflow shard
+        int         max_bytes[2];
+        CLogEngine* engine[2];      // For an engine that can't be resized where it is, its replacement,
+                                    // with the entries already copied in.  Otherwise NULL
+        uint64_t    census_size;    // If tags have a quota, the new size of the shard's census, and the
+        uint32_t    quota;          // new quota
+    };
+
+    // Keeps count of the cursors walking an engine, so that an engine that has been replaced lives on
+    // until the last of them is deleted
+    struct engine_ref_t
+    {
+        CLogEngine* engine;
+        int         cursors;
+        bool        retired;
+    };
+
+    // A cursor that keeps its engine alive
+    friend class CSharedCursor;
+
+    // Deletes all of the storage engines
+    void    destroy();
+
+    // Picks up the change of size waiting for a shard, and for its overflow shard.  Only ever called by
+    // the thread that appends to the shard
+    void    apply_resize(int shard);
+
+    // Resizes a shard's engine, or puts the new one that was made for it in its place
+    void    resize_engine(int shard, int max_entries, int max_bytes, CLogEngine* engine);
+
+    // Copies every entry a cursor returns into an engine, starting over wherever there's a gap
+    static void copy_entries(CLogCursor* cursor, CLogEngine* engine);
+
+    // Changes the size of a shard's census of tags
+    void    resize_census(tag_census_t& census, uint64_t size, uint32_t quota);
+
+    // Forgets a cursor over an engine, and deletes the engine if it has been replaced and that was the
+    // last cursor walking it
+    void    release(engine_ref_t* ref);
+
+    // Works out how many of the log's entries and bytes each ordinary shard gets
+    static void divide(const log_spec_t& spec, int shards, vector<int>& entries, vector<int>& bytes);
+
+    // Creates the storage engine for one shard
+    CLogEngine* create_engine(const log_spec_t& spec, const char* dir, int max_entries, int max_bytes);
+
+    // Appends a batch of entries to a shard, sending those whose tags are over their quota to its
+    // overflow shard
+    void    append_by_quota(int shard, const log_item_t* item, int count, uint64_t seq);
+
+    // What the log was created with
+    log_spec_t          m_spec;
+
+    // The storage engine for each shard, and the count of the cursors walking it.  Only the thread that
+    // appends to a shard changes its engine, with m_mutex held
+    vector<CLogEngine*> m_shard;
+    vector<engine_ref_t*> m_ref;
+
+    // Keeps a shard's engine from being replaced while another thread is looking at it
+    CMutex              m_mutex;
+
+    // For each ordinary shard, the change of size waiting for it, or NULL
+    vector<resize_t*>   m_resize;
+
+    // For each shard, how long each append took.  Each one is only written by the thread appending to it
+    vector<CHistogram>  m_latency;
+
+    // If tags have a quota, the census of each ordinary shard.  Otherwise empty
+    vector<tag_census_t> m_census;
 
-    // All access to the queue is protected by this
-    CMutex m_mutex;
+    // The sequence number of the next entry appended to any shard
+    volatile uint64_t   m_seq;
 
-    // A double-ended queue of our log data
-    deque<log_data_t> m_data;
+    // Identifies the log's indices (see instance())
+    uint64_t            m_instance;
 
+    // For each ordinary shard, a sequence number no higher than any being appended to the shard right now,
+    // or LOG_END when nothing is.  A different thread writes each, so each has a cache line to itself
+    struct appending_t
+    {
+        volatile uint64_t   seq;
+        uint8_t             unused[56];
+    };
+    vector<appending_t> m_appending;
 };
 //==========================================================================================================
@@ -0,0 +1,216 @@
+//==========================================================================================================
+// lz.cpp - Implements a small, fast LZ77 compressor for blocks of log entries
+//==========================================================================================================
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+// The shortest match worth encoding
+static const int MIN_MATCH = 4;
+
+// The compressor finds matches through a hash table of this many recent positions
+static const int HASH_BITS = 12;
+
+// A match never starts within this many bytes of the end of the input, and the last few bytes of the
+// input are always literals, so the match finder never reads past the end
+static const int MATCH_LIMIT = 12;
+static const int LAST_LITERALS = 5;
+
+// Reads 4 unaligned bytes
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+// Hashes the 4 bytes at "p"
+static inline uint32_t hash4(const uint8_t* p)
+{
+    return (read32(p) * 2654435761U) >> (32 - HASH_BITS);
+}
+
+
+//==========================================================================================================
+// put_length() - Writes the part of a length that didn't fit in its nibble.  Returns the new output
+//                position, or NULL if there's no room
+//==========================================================================================================
+static uint8_t* put_length(uint8_t* op, uint8_t* oend, int length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (op == oend) return NULL;
+        *op++ = 255;
+    }
+    if (op == oend) return NULL;
+    *op++ = length;
+    return op;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// put_sequence() - Writes a token, its literals, and (if match is non-zero) its match
+//
+// Returns: The new output position, or NULL if there's no room
+//==========================================================================================================
+static uint8_t* put_sequence(uint8_t* op, uint8_t* oend, const uint8_t* literal, int literals,
+                             int offset, int match)
+{
+    // The token
+    int lit_nibble   = (literals < 15) ? literals : 15;
+    int match_nibble = 0;
+    if (match) match_nibble = (match - MIN_MATCH < 15) ? match - MIN_MATCH : 15;
+    if (op == oend) return NULL;
+    *op++ = (lit_nibble << 4) | match_nibble;
+
+    // The literal count, if it didn't fit in the token, and then the literals
+    if (lit_nibble == 15 && (op = put_length(op, oend, literals - 15)) == NULL) return NULL;
+    if (oend - op < literals) return NULL;
+    memcpy(op, literal, literals);
+    op += literals;
+
+    // If there's no match, this was the last token
+    if (match == 0) return op;
+
+    // The offset back to the match, then its length if it didn't fit in the token
+    if (oend - op < 2) return NULL;
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    if (match_nibble == 15) op = put_length(op, oend, match - MIN_MATCH - 15);
+    return op;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// lz_compress() - Compresses a block
+//
+// Passed:  src, length = The bytes to compress
+//          dst         = Where to store the compressed bytes
+//          capacity    = The size of "dst".  lz_bound(length) is always enough
+//
+// Returns: The size of the compressed block, or -1 if it didn't fit
+//==========================================================================================================
+int lz_compress(const char* src, int length, char* dst, int capacity)
+{
+    int32_t        table[1 << HASH_BITS];
+    const uint8_t* base   = (const uint8_t*)src;
+    const uint8_t* ip     = base;
+    const uint8_t* anchor = base;
+    const uint8_t* end    = base + length;
+    uint8_t*       op     = (uint8_t*)dst;
+    uint8_t*       oend   = op + capacity;
+
+    // Nothing has been seen yet
+    memset(table, 0xFF, sizeof table);
+
+    // Look for a match at each position, other than near the end
+    while (length > MATCH_LIMIT && ip < end - MATCH_LIMIT)
+    {
+        // Find the last position with the same hash, and remember this one in its place
+        uint32_t h = hash4(ip);
+        int32_t  candidate = table[h];
+        table[h] = ip - base;
+
+        // If it isn't a match (or is too far back to encode), move on
+        const uint8_t* ref = base + candidate;
+        if (candidate < 0 || ip - ref > LZ_WINDOW || read32(ref) != read32(ip))
+        {
+            ++ip;
+            continue;
+        }
+
+        // See how far the match extends
+        int match = MIN_MATCH;
+        while (ip + match < end - LAST_LITERALS && ref[match] == ip[match]) ++match;
+
+        // Write the literals since the last match, then the match
+        op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, match);
+        if (op == NULL) return -1;
+        ip += match;
+        anchor = ip;
+    }
+
+    // Whatever is left over is literals
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (op == NULL) return -1;
+    return op - (uint8_t*)dst;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_length() - Reads the part of a length that didn't fit in its nibble, adding it to *p_length
+//
+// Returns: The new input position, or NULL if the input ran out
+//==========================================================================================================
+static const uint8_t* get_length(const uint8_t* ip, const uint8_t* iend, int* p_length)
+{
+    uint8_t byte;
+    do
+    {
+        if (ip == iend) return NULL;
+        byte = *ip++;
+        *p_length += byte;
+    }
+    while (byte == 255);
+    return ip;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// lz_decompress() - Decompresses a block
+//
+// Passed:  src, length = The compressed block
+//          dst         = Where to store the decompressed bytes
+//          capacity    = The size of "dst"
+//
+// Returns: The size of the decompressed block, or -1 if it's corrupt or didn't fit
+//==========================================================================================================
+int lz_decompress(const char* src, int length, char* dst, int capacity)
+{
+    const uint8_t* ip   = (const uint8_t*)src;
+    const uint8_t* iend = ip + length;
+    uint8_t*       op   = (uint8_t*)dst;
+    uint8_t*       oend = op + capacity;
+
+    while (ip < iend)
+    {
+        // Fetch the token and the literal count
+        int token    = *ip++;
+        int literals = token >> 4;
+        if (literals == 15 && (ip = get_length(ip, iend, &literals)) == NULL) return -1;
+
+        // Copy the literals
+        if (iend - ip < literals || oend - op < literals) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // The last token has no match
+        if (ip == iend) break;
+
+        // Fetch the offset and length of the match
+        if (iend - ip < 2) return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int match = token & 15;
+        if (match == 15 && (ip = get_length(ip, iend, &match)) == NULL) return -1;
+        match += MIN_MATCH;
+        if (offset == 0 || offset > op - (uint8_t*)dst || oend - op < match) return -1;
+
+        // Copy the match.  It may overlap the bytes it's copying, which repeats them
+        const uint8_t* ref = op - offset;
+        if (offset >= match)
+        {
+            memcpy(op, ref, match);
+            op += match;
+        }
+        else while (match--) *op++ = *ref++;
+    }
+
+    return op - (uint8_t*)dst;
+}
+//==========================================================================================================
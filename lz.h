@@ -0,0 +1,28 @@
+//==========================================================================================================
+// lz.h - Declares a small, fast LZ77 compressor for blocks of log entries
+//
+// The format is a sequence of tokens.  Each token is a byte whose high nibble is a count of literal bytes
+// and whose low nibble is the length of a match (less the minimum match length of 4).  A nibble of 15
+// means the count continues in the following bytes, each of which is added to it, until a byte that
+// isn't 255.  The literals follow the token, then a 16-bit little-endian offset back to the match.  The
+// last token in a block carries only literals.
+//
+// Log text is highly repetitive, so this typically shrinks a block several times over, and it costs
+// little more than a memcpy to decompress.
+//==========================================================================================================
+#pragma once
+
+// The largest offset a match can refer back to, so a block larger than this compresses less well
+const int LZ_WINDOW = 65535;
+
+// Returns the most bytes that compressing "length" bytes can produce
+inline int lz_bound(int length) {return length + length / 255 + 16;}
+
+// Compresses "length" bytes from "src" into "dst".  Returns the compressed size, or -1 if it won't fit
+// into "capacity" bytes
+int     lz_compress(const char* src, int length, char* dst, int capacity);
+
+// Decompresses "length" bytes from "src" into "dst".  Returns the decompressed size, or -1 if the input
+// is corrupt or won't fit into "capacity" bytes
+int     lz_decompress(const char* src, int length, char* dst, int capacity);
+//==========================================================================================================
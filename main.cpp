@@ -5,82 +5,247 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
 #include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "config_file.h"
 #include "cmd_line.h"
 #include "cthread.h"
 #include "udpsock.h"
-#include "netsock.h"
 #include "logdata.h"
 #include "mgmt_server.h"
+#include "sockutil.h"
+#include "livelog.h"
+#include "formatter.h"
+#include "query.h"
+#include "tags.h"
+#include "metrics.h"
+#include "globals.h"
+#include "ingest_proto.h"
+#include "ingest.h"
+#include "ratelimit.h"
+#include "aggregator.h"
+#include "shm_listener.h"
+#include "uring.h"
 
 using namespace std;
 
 
+//==========================================================================================================
+// listener_stats_t - Counters maintained by the UDP listener
+//==========================================================================================================
+struct listener_stats_t
+{
+    uint64_t    datagrams;      // The number of datagrams received
+    uint64_t    bytes;          // The number of bytes in those datagrams
+    uint64_t    batches;        // The number of batches those datagrams arrived in
+    uint64_t    drops;          // The number of datagrams the kernel dropped for lack of buffer space
+    uint64_t    records;        // The number of entries logged from those datagrams
+    uint64_t    binary;         // The number of datagrams in the binary format
+    uint64_t    malformed;      // The number of binary datagrams that were damaged or truncated
+    uint64_t    sender_gaps;    // The number of binary records missing, according to senders' sequence numbers
+    uint64_t    suppressed;     // The number of records dropped because their tag was over its rate limit
+    uint64_t    sampled;        // The number of records kept as samples despite being over the limit
+    uint64_t    truncated;      // The number of datagrams longer than max_message, which were cut short
+    uint64_t    syscalls;       // The number of system calls made receiving
+};
+//==========================================================================================================
+
+
 //==========================================================================================================
 // Listener() - A thread that listens for incoming UDP messages to be logged
 //==========================================================================================================
 class CListener : public CThread
 {
 public:
-    void    spawn(int port);
+    void    spawn(int port, int shard);
+
+    // Hands the thread a socket bound to a new log port.  It reads whatever has already arrived on its
+    // old socket before it closes it
+    void    rebind(int port, int fd);
+
+    // Returns a copy of the listener's counters
+    listener_stats_t get_stats() {return m_stats;}
+
+    // Adds the times that binary records took to get from their sender to us to "transit"
+    void    get_transit(CHistogram& transit) {transit.merge(m_transit);}
 
 protected:
 
     void    main();
 
+    // Receives datagrams through io_uring.  Returns false, having received nothing, if the kernel can't
+    bool    receive_uring(int& fd, int& old_fd);
+
+    // Divides a datagram into records, and adds them to the batch
+    void    parse_datagram(char* p, int length, struct msghdr& hdr, const sockaddr_storage& addr, log_time_t now);
+
+    // Appends the batch to the log, less the records that are over their tag's rate limit
+    void    log_batch(int datagrams);
+
+    // Counts the records a binary-format sender skipped over
+    void    track_sender(const sockaddr_storage& addr, uint64_t seq);
+
+    // Logs a report for each tag whose suppressed records are due one
+    void    report_suppressed();
+
+    // The most senders whose sequence numbers we keep track of, and the biggest jump in a sender's
+    // sequence numbers that we believe
+    enum {MAX_SENDERS = 4096, MAX_GAP = 1000000};
+
     int     m_port;
+
+    // A socket on a new log port that the thread hasn't switched to yet, or -1
+    volatile int m_next_fd;
+
+    // The number of datagrams that sockets we've finished with dropped
+    uint64_t m_dropped;
+
+    // The records of the batch being received, and what their binary-format senders said about them
+    vector<log_item_t>    m_item;
+    vector<sender_info_t> m_sender_info;
+    int     m_records;
+
+    // The shard of the data-log that this listener appends to
+    int     m_shard;
+
+    listener_stats_t m_stats;
+
+    // How long, in nanoseconds, binary records took to arrive, going by the sender's timestamps
+    CHistogram  m_transit;
+
+    // For each sender of binary records, the next sequence number we expect from it
+    map<uint64_t, uint64_t> m_sender;
+
+    // Holds each tag to its rate limit, and the reports it makes about the records it suppresses
+    CRateLimiter m_limiter;
+    vector<log_item_t> m_report;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// dump_stats_t - Counters maintained by a dump thread
+//==========================================================================================================
+struct dump_stats_t
+{
+    uint64_t    clients;        // The number of clients that have been served
+    uint64_t    errors;         // The number of clients that sent a query we couldn't make sense of
+    uint64_t    lines;          // The number of lines sent to clients
+    uint64_t    syscalls;       // The number of system calls made sending to clients
+    uint64_t    active;         // 1 while a client is being served, otherwise 0
+    CHistogram  latency;        // How long each dump took in nanoseconds, from receiving the query to EOF
 };
 //==========================================================================================================
 
 
 //==========================================================================================================
-// CLiveLog - A thread that outputs logging messages in real time
+// CDumpServer - A thread that serves clients of the server port, one at a time.  There's a pool of these,
+//               all accepting connections from the same listening socket
 //==========================================================================================================
-class CLiveLog : public CThread
+class CDumpServer : public CThread
 {
 public:
+    CDumpServer() {m_stats.clients = m_stats.errors = m_stats.lines = m_stats.syscalls = m_stats.active = 0;}
 
-    // Called by another thread to spawn this server
-    void    spawn(int port);
+    void    spawn(int listen_fd);
 
-    // Called by other threads to write messages to the live-log
-    void    send(const char* tag, const char* message);
+    // Serves clients forever.  This is what the thread runs, but the main thread calls it too
+    void    serve(int listen_fd);
+
+    // Returns a copy of the thread's counters
+    dump_stats_t get_stats() {return m_stats;}
 
 protected:
 
     void    main();
-    int     m_port;
-    bool    m_has_client;
-    CMutex  m_mutex;
-    NetSock m_server;
+
+    // The socket that clients connect to
+    int     m_listen_fd;
+
+    dump_stats_t m_stats;
+
+    // Sends dumps through io_uring, if we can
+    CFixedSender m_sender;
 };
 //==========================================================================================================
 
 
-void fetch_specs();
-void dump_log_data(NetSock& server);
+//==========================================================================================================
+// CReloader - A thread that reloads the configuration whenever we're sent SIGHUP
+//==========================================================================================================
+class CReloader : public CThread
+{
+protected:
+
+    void    main();
+};
+//==========================================================================================================
+
+
+bool fetch_specs(conf_t& conf, string* p_error);
+void serve_client(int fd, dump_stats_t& stats, CFixedSender* sender);
+uint64_t dump_log_data(int fd, CLogQuery& query, CFixedSender* sender);
 void show_help();
 
-struct conf_t
-{
-    int             log_port;
-    int             server_port;
-    int             live_log_port;
-    int             max_entries;
-    int             id_length;
-    bool            use_section;
-    string          section;
-} conf;
+conf_t      conf;
 
 CLogData    DataLog;
 CLiveLog    LiveLog;
-NetSock     Server;
+CQueryIndex QueryIndex;
 CCmdLine    CmdLine;
 CMgmtServer Manager;
-CListener   Listener;
+CStatsServer StatsServer;
+
+// The maximum number of UDP listener threads
+const int MAX_LISTENERS = 64;
+
+// The longest a UDP datagram's payload can be
+const int MAX_DATAGRAM = 65507;
+
+// The size of the ancillary-data buffer a listener receives each datagram with
+const int CONTROL_SIZE = 128;
+
+// The listener threads.  Each one has its own shard of the data-log
+CListener   Listener[MAX_LISTENERS];
+
+// The maximum number of clients of the server port that are served at once
+const int MAX_DUMP_CLIENTS = 64;
+
+// The threads that serve clients of the server port.  The main thread is the first of them
+CDumpServer DumpServer[MAX_DUMP_CLIENTS];
+
+// Pulls entries from the upstream loggers, if we have any
+CAggregator Aggregator;
+
+// Drains the shared-memory ring, if we have one
+CShmListener ShmListener;
+
+// Reloads the configuration on SIGHUP
+CReloader   Reloader;
+
+// The socket that clients of the server port connect to
+int         server_fd = -1;
+
+// The number of times the configuration has been reloaded, and the number of those that failed
+uint64_t    reloads, failed_reloads;
+
+// When the logger started, for reporting its uptime
+time_t      start_time = time(NULL);
+
+// How long creating the data-log took at startup, in nanoseconds.  For the disk engine, that's how long it
+// took to recover the log from its segment files
+uint64_t    create_ns;
 
 // This is the name of the configuration file
 string   config_file = "logger.conf";
@@ -97,6 +262,13 @@ int main(int argc, char** argv)
     // Ignore SIGPIPE so that writes to closed sockets don't crash us
     signal(SIGPIPE, SIG_IGN);
 
+    // SIGHUP is only ever taken by the thread that reloads the configuration.  Every thread inherits this
+    // mask, so it has to be set before any of them are spawned
+    sigset_t hangup;
+    sigemptyset(&hangup);
+    sigaddset(&hangup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hangup, NULL);
+
     // Declare the valid command-line switches
     CmdLine.declare_switch("-config",  CLP_REQUIRED);
     CmdLine.declare_switch("-section", CLP_REQUIRED);
@@ -112,13 +284,55 @@ int main(int argc, char** argv)
     conf.use_section = CmdLine.has_switch("-section", &conf.section);
 
     // Fetch the configuration specs
-    fetch_specs();
+    if (!fetch_specs(conf, &s))
+    {
+        fprintf(stderr, "%s\n", s.c_str());
+        exit(1);
+    }
 
-    // Tell the data-log the maximum number of entries it should keep
-    DataLog.set_max_entries(conf.max_entries);
+    // Create the table that every distinct tag is stored in, rendered to the width it's output at
+    TagTable.create(conf.max_tags, conf.id_length);
+
+    // Create the storage engine for the data-log, with a shard for each listener thread, then one for the
+    // aggregator if there are upstream loggers, and one for the shared-memory ring if there is one.  The
+    // aggregator's shard may have a size of its own
+    log_spec_t spec;
+    spec.engine       = conf.log_engine;
+    spec.max_entries  = conf.max_entries;
+    spec.max_bytes    = conf.max_bytes;
+    spec.dir          = conf.log_dir;
+    spec.segment_size = conf.segment_size;
+    spec.segment_age  = conf.segment_age;
+    spec.tag_quota    = conf.tag_quota;
+    spec.quota_entries = conf.quota_entries;
+    int shards    = conf.listener_threads;
+    int agg_shard = conf.upstreams.empty() ? -1 : shards++;
+    int shm_shard = conf.shm_name.empty()  ? -1 : shards++;
+    if (agg_shard >= 0)
+    {
+        spec.shard_entries.assign(agg_shard + 1, 0);
+        spec.shard_entries[agg_shard] = conf.aggregate_entries;
+    }
+    uint64_t create_start = metrics_clock();
+    if (!DataLog.create(spec, shards))
+    {
+        fprintf(stderr, "Can't create log_engine \"%s\"\n", conf.log_engine.c_str());
+        exit(1);
+    }
+    create_ns = metrics_clock() - create_start;
+
+    // Spin up the threads that listen for incoming log messages
+    for (int i = 0; i < conf.listener_threads; ++i) Listener[i].spawn(conf.log_port, i);
 
-    // Spin up the thread that listens for incoming log messages
-    Listener.spawn(conf.log_port);
+    // Spin up the thread that merges entries from the upstream loggers into a shard of its own
+    if (agg_shard >= 0) Aggregator.spawn(conf.upstreams, agg_shard);
+
+    // And the one that drains the shared-memory ring that local emitters write to
+    if (shm_shard >= 0 && !ShmListener.spawn(conf.shm_name, conf.shm_size, shm_shard))
+    {
+        fprintf(stderr, "Can't create shared-memory ring \"%s\": %s\n", conf.shm_name.c_str(), strerror(errno));
+        exit(1);
+    }
 
     // Spin up the live-log thread
     LiveLog.spawn(conf.live_log_port);
@@ -126,47 +340,127 @@ int main(int argc, char** argv)
     // If there was an "-mport" switch on the command line, spawn the process manager
     if (CmdLine.has_switch("-mport", &mport)) Manager.spawn(&mport);
 
+    // If there's a stats port, spin up the thread that serves it
+    if (conf.stats_port) StatsServer.spawn(conf.stats_port);
+
     // Tell the user who we are and what we're doing
     printf("System logger listening on port %i\n", conf.server_port);
 
-    // Sit in a loop forever, waiting for a client to connect
-    while(true)
+    // Create a TCP server
+    server_fd = create_tcp_server(conf.server_port);
+    if (server_fd < 0)
     {
-        // Create a TCP server
-        if (!Server.create_server(conf.server_port, "", AF_INET))
-        {
-            fprintf(stderr, "Logger can't create server on port %i\n", conf.server_port);
-            exit(1);
-        }
-    
-        // Wait for someone to connect to our TCP server
-        Server.listen_and_accept();
+        fprintf(stderr, "Logger can't create server on port %i\n", conf.server_port);
+        exit(1);
+    }
 
-        // Send all of the log data to the connected client
-        dump_log_data(Server);
+    // Spin up the threads that serve dump clients.  Any more clients than that wait to be accepted
+    for (int i = 1; i < conf.dump_clients; ++i) DumpServer[i].spawn(server_fd);
 
-        // We're done.  Send an End-of-File message and close the port.
-        Server.send("EOF\n");
-        Server.close();
-    }
+    // Now that everything is running, we can take SIGHUP
+    Reloader.spawn();
+
+    // And serve clients ourselves, forever
+    DumpServer[0].serve(server_fd);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// spawn() - Spawns the thread
+//==========================================================================================================
+void CDumpServer::spawn(int listen_fd)
+{
+    m_listen_fd = listen_fd;
+    CThread::spawn();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Serves clients of the server port forever
+//==========================================================================================================
+void CDumpServer::main()
+{
+    serve(m_listen_fd);
 }
 //==========================================================================================================
 
 
 
 
+//==========================================================================================================
+// get_optional() - Fetches an optional setting from the configuration file.  If the setting isn't
+//                  present, the value is left untouched
+//==========================================================================================================
+template <class T> void get_optional(CConfigFile& cf, const char* key, T* p_value)
+{
+    try
+    {
+        cf.get(key, p_value);
+    }
+    catch(const std::exception& e)
+    {
+    }
+}
+//==========================================================================================================
+
+
 //==========================================================================================================
 // fetch_specs() - Reads and parses the configuration file
 //
-// On Exit: conf.port_map    = Maps a port number to a tag string
-//          conf.server_port = The TCP port to listen on for dumping the log
+// Passed:  conf    = The settings to fill in.  Its "use_section" and "section" say where to look
+//          p_error = Where to describe what's wrong with the configuration file, if anything is
+//
+// Returns: false if the file can't be read, or doesn't make sense
+//
+// Note:    This fills in the settings it's handed, rather than the ones in use, so that a reload can
+//          look the new settings over before it changes anything
 //==========================================================================================================
-void fetch_specs()
+bool fetch_specs(conf_t& conf, string* p_error)
 {
     CConfigFile cf;
 
+    // These settings are optional, and have default values
+    conf.log_engine = "ring";
+    conf.max_bytes  = 4000000;
+    conf.log_dir    = "logdata";
+    conf.segment_size = 64 * 1024 * 1024;
+    conf.segment_age  = 0;
+    conf.rx_batch   = 64;
+    conf.rx_buffer  = 0;
+    conf.listener_threads = 1;
+    conf.live_log_clients  = 64;
+    conf.live_log_queue    = 10000;
+    conf.live_log_overflow = "drop-oldest";
+    conf.time_precision    = 0;
+    conf.query_timeout     = 100;
+    conf.max_tags          = 65536;
+    conf.dump_clients      = 8;
+    conf.stats_port        = 0;
+    conf.tag_rate          = 0;
+    conf.tag_burst         = 0;
+    conf.tag_sample        = 0;
+    conf.rate_exempt       = "none";
+    conf.suppress_interval = 10;
+    conf.tag_quota         = 0;
+    conf.quota_entries     = -1;
+    conf.max_message       = MAX_DATAGRAM;
+    conf.aggregate_interval = 100;
+    conf.aggregate_batch    = 10000;
+    conf.aggregate_entries  = 0;
+    conf.merge_delay        = 200;
+    conf.shm_size           = 4 * 1024 * 1024;
+    conf.tag_limits.clear();
+    conf.upstreams.clear();
+    conf.shm_name.clear();
+
     // Open the config file and bail if we can't
-    if (!cf.read(config_file)) exit(1);
+    if (!cf.read(config_file))
+    {
+        *p_error = "Can't read " + config_file;
+        return false;
+    }
 
     // If the user wants us to look in a specific section, make it so
     if (conf.use_section) cf.set_current_section(conf.section);
@@ -179,12 +473,121 @@ void fetch_specs()
         cf.get("log_port",      &conf.log_port);
         cf.get("id_length",     &conf.id_length);
 
+        get_optional(cf, "log_engine", &conf.log_engine);
+        get_optional(cf, "max_bytes",  &conf.max_bytes);
+        get_optional(cf, "log_dir",    &conf.log_dir);
+        get_optional(cf, "segment_size", &conf.segment_size);
+        get_optional(cf, "segment_age",  &conf.segment_age);
+        get_optional(cf, "rx_batch",   &conf.rx_batch);
+        get_optional(cf, "rx_buffer",  &conf.rx_buffer);
+        get_optional(cf, "listener_threads", &conf.listener_threads);
+        get_optional(cf, "live_log_clients",  &conf.live_log_clients);
+        get_optional(cf, "live_log_queue",    &conf.live_log_queue);
+        get_optional(cf, "live_log_overflow", &conf.live_log_overflow);
+        get_optional(cf, "time_precision",    &conf.time_precision);
+        get_optional(cf, "query_timeout",     &conf.query_timeout);
+        get_optional(cf, "max_tags",          &conf.max_tags);
+        get_optional(cf, "dump_clients",      &conf.dump_clients);
+        get_optional(cf, "stats_port",        &conf.stats_port);
+        get_optional(cf, "tag_rate",          &conf.tag_rate);
+        get_optional(cf, "tag_burst",         &conf.tag_burst);
+        get_optional(cf, "tag_limits",        &conf.tag_limits);
+        get_optional(cf, "tag_sample",        &conf.tag_sample);
+        get_optional(cf, "rate_exempt",       &conf.rate_exempt);
+        get_optional(cf, "suppress_interval", &conf.suppress_interval);
+        get_optional(cf, "tag_quota",         &conf.tag_quota);
+        get_optional(cf, "quota_entries",     &conf.quota_entries);
+        get_optional(cf, "max_message",       &conf.max_message);
+        get_optional(cf, "upstreams",         &conf.upstreams);
+        get_optional(cf, "aggregate_interval", &conf.aggregate_interval);
+        get_optional(cf, "aggregate_batch",   &conf.aggregate_batch);
+        get_optional(cf, "aggregate_entries", &conf.aggregate_entries);
+        get_optional(cf, "merge_delay",       &conf.merge_delay);
+        get_optional(cf, "shm_name",          &conf.shm_name);
+        get_optional(cf, "shm_size",          &conf.shm_size);
     }
     catch(const std::exception& e)
     {
-        fprintf(stderr, "%s\n", e.what());
-        exit(1);
+        *p_error = e.what();
+        return false;
     }
+
+    // We always receive at least one datagram at a time
+    if (conf.rx_batch < 1) conf.rx_batch = 1;
+
+    // No datagram can be longer than a UDP datagram can be
+    if (conf.max_message < 1) conf.max_message = 1;
+    if (conf.max_message > MAX_DATAGRAM) conf.max_message = MAX_DATAGRAM;
+
+    // Make sure the live-log overflow policy is one we know about
+    overflow_t policy;
+    if (!CLiveLog::parse_overflow(conf.live_log_overflow, &policy))
+    {
+        *p_error = "Unknown live_log_overflow \"" + conf.live_log_overflow + "\"";
+        return false;
+    }
+
+    // Timestamps are output to the second, the millisecond, the microsecond, or the nanosecond
+    if (conf.time_precision != 0 && conf.time_precision != 3 && conf.time_precision != 6 && conf.time_precision != 9)
+    {
+        *p_error = "time_precision must be 0, 3, 6, or 9";
+        return false;
+    }
+
+    // Make sure the number of listener threads is sane
+    if (conf.listener_threads < 1) conf.listener_threads = 1;
+    if (conf.listener_threads > MAX_LISTENERS) conf.listener_threads = MAX_LISTENERS;
+
+    // Without SO_REUSEPORT, only one socket can be bound to the log port
+    #ifndef SO_REUSEPORT
+    if (conf.listener_threads > 1)
+    {
+        fprintf(stderr, "SO_REUSEPORT isn't supported, using a single listener thread\n");
+        conf.listener_threads = 1;
+    }
+    #endif
+
+    // Make sure the number of dump clients is sane
+    if (conf.dump_clients < 1) conf.dump_clients = 1;
+    if (conf.dump_clients > MAX_DUMP_CLIENTS) conf.dump_clients = MAX_DUMP_CLIENTS;
+
+    // Make sure the per-tag rate limits make sense
+    vector<tag_limit_t> limits;
+    string error;
+    int    severity;
+    if (!CRateLimiter::parse_limits(conf.tag_limits, limits, &error))
+    {
+        *p_error = "tag_limits: " + error;
+        return false;
+    }
+    if (!CRateLimiter::parse_severity(conf.rate_exempt, &severity))
+    {
+        *p_error = "Unknown rate_exempt \"" + conf.rate_exempt + "\"";
+        return false;
+    }
+
+    // A tag's quota is a percentage of the log.  Tags over their quota share a quarter as many entries
+    // again, unless told otherwise
+    if (conf.tag_quota < 0)   conf.tag_quota = 0;
+    if (conf.tag_quota > 100) conf.tag_quota = 100;
+    if (conf.quota_entries < 0) conf.quota_entries = conf.max_entries / 4;
+
+    // Make sure the upstream loggers make sense, and that we ask them for something reasonable
+    vector<string> upstream;
+    if (!CAggregator::parse_upstreams(conf.upstreams, upstream, &error))
+    {
+        *p_error = "upstreams: " + error;
+        return false;
+    }
+    if (conf.aggregate_interval < 1) conf.aggregate_interval = 1;
+    if (conf.aggregate_batch < 1)    conf.aggregate_batch    = 1;
+    if (conf.aggregate_entries < 0)  conf.aggregate_entries  = 0;
+    if (conf.aggregate_entries > conf.max_entries) conf.aggregate_entries = conf.max_entries;
+    if (conf.merge_delay < 0)        conf.merge_delay        = 0;
+
+    // A shared-memory ring has to hold at least a few of the longest datagrams
+    if (conf.shm_size < 256 * 1024) conf.shm_size = 256 * 1024;
+    return true;
 }
 //==========================================================================================================
 
@@ -205,65 +608,308 @@ void show_help()
 
 
 //==========================================================================================================
-// transmit_log_entry() - Formats a log entry and writes it to the specified server
-//
-// Passed:   entry  = timestamp, port, and message to be logged
-//           server = A reference to the NetSock where the formatted message should be written
+// report() - Appends a line to a statistics report, with the name of a statistic and its value
+//==========================================================================================================
+static void report(string& text, const char* name, uint64_t value)
+{
+    char line[128];
+    sprintf(line, "%s %llu\n", name, (unsigned long long)value);
+    text += line;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// report_stats() - Fills in a plain-text report of the logger's statistics
 //
-// Returns:  true if the message was succesfully written, false if the server port was closed
+// Each line of the report is a name and a value.  Every counter in it only ever increases, except the
+// ones that describe the logger as it is right now: io.uring, log.entries, log.resizing, agg.healthy,
+// agg.pending, live.clients, live.queued_lines, and dump.active.  log.create_ns is how long the log took
+// to create (or for the disk engine, to recover) at startup.  Latencies are in nanoseconds.
 //==========================================================================================================
-bool transmit_log_entry(log_data_t& entry, NetSock& server)
+void report_stats(string& text)
 {
-    char line[1024];
-    struct tm tm;
+    vector<uint64_t> first, end;
+    listener_stats_t total, stats;
+    dump_stats_t     dump;
+    live_stats_t     live = LiveLog.get_stats();
+    CHistogram       latency;
+    char             name[64];
+    uint64_t         entries = 0, evicted = 0;
+
+    text.clear();
+    report(text, "uptime_seconds", time(NULL) - start_time);
+    report(text, "config.reloads", reloads);
+    report(text, "config.failed_reloads", failed_reloads);
+    report(text, "io.uring", CUring::in_use());
+
+    // The log itself
+    DataLog.first(first);
+    DataLog.end(end);
+    for (size_t i = 0; i < end.size(); ++i)
+    {
+        entries += end[i] - first[i];
+        evicted += first[i];
+    }
+    DataLog.get_append_latency(latency);
+    text += "log.engine " + conf.log_engine + "\n";
+    report(text, "log.shards",       end.size());
+    report(text, "log.entries",      entries);
+    report(text, "log.evicted",      evicted);
+    report(text, "log.tags",         TagTable.count() - 1);
+    report(text, "log.lock_wait_ns", DataLog.lock_wait());
+    report(text, "log.over_quota",   DataLog.diverted());
+    report(text, "log.resizing",     DataLog.resizing());
+    report(text, "log.create_ns",    create_ns);
+    text += "log.append_latency_ns " + latency.summary() + "\n";
+
+    // The listeners, in total and one by one
+    memset(&total, 0, sizeof total);
+    latency.clear();
+    for (int i = 0; i < conf.listener_threads; ++i)
+    {
+        stats = Listener[i].get_stats();
+        total.datagrams   += stats.datagrams;
+        total.bytes       += stats.bytes;
+        total.batches     += stats.batches;
+        total.drops       += stats.drops;
+        total.records     += stats.records;
+        total.binary      += stats.binary;
+        total.malformed   += stats.malformed;
+        total.sender_gaps += stats.sender_gaps;
+        total.suppressed  += stats.suppressed;
+        total.sampled     += stats.sampled;
+        total.truncated   += stats.truncated;
+        total.syscalls    += stats.syscalls;
+        Listener[i].get_transit(latency);
+    }
+    report(text, "listener.datagrams",   total.datagrams);
+    report(text, "listener.bytes",       total.bytes);
+    report(text, "listener.batches",     total.batches);
+    report(text, "listener.drops",       total.drops);
+    report(text, "listener.records",     total.records);
+    report(text, "listener.binary",      total.binary);
+    report(text, "listener.malformed",   total.malformed);
+    report(text, "listener.sender_gaps", total.sender_gaps);
+    report(text, "listener.suppressed",  total.suppressed);
+    report(text, "listener.sampled",     total.sampled);
+    report(text, "listener.truncated",   total.truncated);
+    report(text, "listener.syscalls",    total.syscalls);
+    text += "listener.transit_ns " + latency.summary() + "\n";
+    for (int i = 0; conf.listener_threads > 1 && i < conf.listener_threads; ++i)
+    {
+        stats = Listener[i].get_stats();
+        sprintf(name, "listener.%d.datagrams", i); report(text, name, stats.datagrams);
+        sprintf(name, "listener.%d.drops", i);     report(text, name, stats.drops);
+    }
 
-    // Handy one-letter references to the "struct tm" fields we care about
-    int& h = tm.tm_hour;
-    int& m = tm.tm_min;
-    int& s = tm.tm_sec;
+    // The aggregator, if there is one
+    if (!conf.upstreams.empty())
+    {
+        agg_stats_t agg = Aggregator.get_stats();
+        report(text, "agg.upstreams", agg.upstreams);
+        report(text, "agg.healthy",   agg.healthy);
+        report(text, "agg.errors",    agg.errors);
+        report(text, "agg.batches",   agg.batches);
+        report(text, "agg.bytes",     agg.bytes);
+        report(text, "agg.entries",   agg.entries);
+        report(text, "agg.late",      agg.late);
+        report(text, "agg.pending",   agg.pending);
+    }
+
+    // The shared-memory ring, if there is one
+    if (!conf.shm_name.empty())
+    {
+        shm_stats_t shm = ShmListener.get_stats();
+        latency.clear();
+        ShmListener.get_transit(latency);
+        report(text, "shm.datagrams",  shm.datagrams);
+        report(text, "shm.bytes",      shm.bytes);
+        report(text, "shm.records",    shm.records);
+        report(text, "shm.malformed",  shm.malformed);
+        report(text, "shm.dropped",    shm.dropped);
+        report(text, "shm.wakeups",    shm.wakeups);
+        report(text, "shm.stalls",     shm.stalls);
+        report(text, "shm.suppressed", shm.suppressed);
+        report(text, "shm.sampled",    shm.sampled);
+        text += "shm.transit_ns " + latency.summary() + "\n";
+    }
 
-    // Look up the tag that corresponds to the UDP port that recevied the message
-    const char* tag = entry.tag.c_str();
+    // The live-log
+    report(text, "live.clients",          live.clients);
+    report(text, "live.queued_lines",     live.queued);
+    report(text, "live.sent_lines",       live.sent);
+    report(text, "live.missed_lines",     live.missed);
+    report(text, "live.dropped_clients",  live.dropped);
+    report(text, "live.rejected_clients", live.rejected);
+    report(text, "live.bad_requests",     live.errors);
+    report(text, "live.syscalls",         live.syscalls);
+
+    // The dump threads, in total
+    latency.clear();
+    uint64_t clients = 0, errors = 0, lines = 0, syscalls = 0, active = 0;
+    for (int i = 0; i < conf.dump_clients; ++i)
+    {
+        dump = DumpServer[i].get_stats();
+        clients  += dump.clients;
+        errors   += dump.errors;
+        lines    += dump.lines;
+        syscalls += dump.syscalls;
+        active   += dump.active;
+        latency.merge(dump.latency);
+    }
+    report(text, "dump.clients",      clients);
+    report(text, "dump.errors",       errors);
+    report(text, "dump.lines",        lines);
+    report(text, "dump.syscalls",     syscalls);
+    report(text, "dump.active",       active);
+    report(text, "dump.lock_wait_ns", QueryIndex.lock_wait());
+    text += "dump.latency_ns " + latency.summary() + "\n";
+}
+//==========================================================================================================
 
-    // Get a const char* to the line of data
-    const char* message = entry.data.c_str();
 
-    // Break the timestamp out into components
-    localtime_r(&entry.timestamp, &tm);
+//==========================================================================================================
+// transmit_buffer() - Writes the contents of an output buffer to the client, and empties it
+//
+// Passed:   buffer = The formatted lines to be sent.  Filled in with the buffer to fill next
+//           fd     = The client's socket
+//           sender = What sends the buffer through io_uring, or NULL to send it ourselves
+//
+// Returns:  true if the lines were succesfully written, false if the client has gone away
+//==========================================================================================================
+bool transmit_buffer(COutputBuffer*& buffer, int fd, CFixedSender* sender)
+{
+    // Through io_uring, the kernel sends the buffer while we fill the other one
+    if (sender)
+    {
+        bool ok = sender->send(fd);
+        buffer = &sender->buffer();
+        return ok;
+    }
 
-    // Format the time, tag, and data
-    sprintf(line, "%02d:%02d:%02d (%-*s): %s\n", h, m, s, conf.id_length, tag, message);
+    // Otherwise, send the buffered lines to the client in a single write
+    bool ok = send_all(fd, buffer->data(), buffer->size());
 
-    // And send this line to the client
-    int bytes_sent = server.send(line, strlen(line));
+    // The buffer is ready to be refilled
+    buffer->clear();
 
     // Tell the caller whether or not this worked
-    return (bytes_sent > 0);
+    return ok;
 }
 //==========================================================================================================
 
 
 //==========================================================================================================
-// dump_log_data() - Sends the entire log to the client connected to the server
+// serve() - Sits in a loop forever, serving one client of the server port at a time
+//
+// Every dump thread runs this on the same listening socket, and whichever thread is free accepts the
+// next client.  Each client is sent its own snapshot of the log, so clients never wait on each other.
 //==========================================================================================================
-void dump_log_data(NetSock& server)
+void CDumpServer::serve(int listen_fd)
 {
-    deque<log_data_t>::iterator it;
+    // If we can send through io_uring, that's how we send
+    CFixedSender* sender = m_sender.create() ? &m_sender : NULL;
 
-    // Prevent other threads from altering the deque
-    DataLog.lock();
+    while (true)
+    {
+        // Wait for someone to connect to our TCP server
+        int fd = wait_for_client(listen_fd);
+        if (fd < 0) continue;
+
+        // Send the client whatever it asks for, counting the system calls it takes
+        uint64_t calls = send_calls() + (sender ? sender->syscalls() : 0);
+        m_stats.active = 1;
+        serve_client(fd, m_stats, sender);
+        m_stats.active = 0;
+        m_stats.syscalls += send_calls() + (sender ? sender->syscalls() : 0) - calls;
+        ++m_stats.clients;
+
+        // We're done with this client
+        close(fd);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// serve_client() - Reads the client's request (if it sends one) and answers it
+//
+// A client that sends nothing within "query_timeout" milliseconds gets the entire log.  If "sender" isn't
+// NULL, the entries are sent through it
+//==========================================================================================================
+void serve_client(int fd, dump_stats_t& stats, CFixedSender* sender)
+{
+    char      request[1024];
+    string    error;
+    CLogQuery query;
 
-    // Get a reference to the log data
-    deque<log_data_t>& log_data = DataLog.get_data();
-    
-    // Loop through every item of log data, and transmit it.
-    for (it = log_data.begin(); it != log_data.end(); ++it)
+    // Find out whether the client wants anything in particular
+    int length = receive_line(fd, request, sizeof request, conf.query_timeout);
+    uint64_t start = metrics_clock();
+
+    // If the request doesn't make sense, tell the client what's wrong with it
+    if (length > 0 && !query.parse(request, &error))
+    {
+        error = "ERROR " + error + "\n";
+        send_all(fd, error.data(), error.size());
+        ++stats.errors;
+    }
+
+    // An aggregator gets its batch in the binary format, which ends with a trailer of its own
+    else if (query.m_binary)
     {
-        transmit_log_entry(*it, server);
+        stats.lines += forward_log_data(fd, query);
+        stats.latency.record(metrics_clock() - start);
+        return;
     }
 
-    // Allow other threads to have access to the deque
-    DataLog.unlock();
+    // Otherwise, send it the entries it asked for
+    else stats.lines += dump_log_data(fd, query, sender);
+
+    // We're done.  Once the last of the entries has been sent, send an End-of-File message
+    if (sender) sender->finish();
+    send_all(fd, "EOF\n", 4);
+    stats.latency.record(metrics_clock() - start);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// dump_log_data() - Sends the client the entries from the log that match its query
+//
+// Returns: The number of lines sent
+//==========================================================================================================
+uint64_t dump_log_data(int fd, CLogQuery& query, CFixedSender* sender)
+{
+    CLogSnapshot  snapshot;
+    log_view_t    entry;
+    uint64_t      lines = 0;
+
+    // The lines are formatted into the sender's buffers if there is one, or into one of our own
+    unique_ptr<COutputBuffer> own(sender ? NULL : new COutputBuffer);
+    COutputBuffer* buffer = sender ? &sender->buffer() : own.get();
+
+    // Take a snapshot of the entries that might match.  The log is only locked for as long as this takes,
+    // so other threads are free to keep appending to the log while we're sending the snapshot to a
+    // (perhaps slow) client
+    QueryIndex.plan(DataLog, query, snapshot);
+
+    // Loop through every item of log data in the snapshot, formatting the ones the client wants into the
+    // output buffer.  Each time the buffer fills up, transmit it.  If the client goes away, there's no
+    // point in continuing.
+    while (snapshot.next(entry))
+    {
+        if (!query.matches(entry)) continue;
+        ++lines;
+        if (buffer->append(entry)) continue;
+        if (!transmit_buffer(buffer, fd, sender)) return lines;
+        buffer->append(entry);
+    }
+
+    // Transmit whatever is left in the buffer
+    if (buffer->size()) transmit_buffer(buffer, fd, sender);
+    return lines;
 }
 //==========================================================================================================
 
@@ -273,135 +919,879 @@ void dump_log_data(NetSock& server)
 //==========================================================================================================
 // spawn() - Spawns the thread
 //==========================================================================================================
-void CListener::spawn(int port)
+void CListener::spawn(int port, int shard)
 {
-    m_port = port;
+    m_port    = port;
+    m_shard   = shard;
+    m_next_fd = -1;
+    memset(&m_stats, 0, sizeof m_stats);
     CThread::spawn();
 }
 //==========================================================================================================
 
 
 //==========================================================================================================
-// main() - This thread listens for incoming UPD messages and logs them
+// rebind() - Hands the thread a socket on a new log port, which it switches to the next time it wakes up.
+//            If it hadn't yet switched to a socket it was handed before, that one is closed unused
+//==========================================================================================================
+void CListener::rebind(int port, int fd)
+{
+    int stale = __sync_lock_test_and_set(&m_next_fd, fd);
+    if (stale >= 0) close(stale);
+    m_port = port;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// open_log_port() - Creates a socket for a listener thread to receive datagrams on
+//
+// Returns: The socket, or -1 if it can't be bound to the port
+//
+// Note:    A listener never waits more than a second for a datagram, so that it gets on with everything
+//          else it has to do (reporting on tags that have gone quiet, switching to a new log port) even
+//          when nothing arrives
+//==========================================================================================================
+static int open_log_port(int port)
+{
+    int fd = create_udp_server(port, conf.rx_buffer, conf.listener_threads > 1);
+    if (fd < 0) return -1;
+
+    struct timeval tv = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    return fd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// find_special() - Finds the first linefeed, carriage return, or nul in a buffer, or, if "dollar" is
+//                  true, the first '$' too, whichever comes first
+//
+// Passed:  buffer = The buffer
+//          i      = Where to start looking
+//          length = The length of the buffer.  Nothing is read beyond it
+//
+// Returns: The offset of the character found, or "length" if there isn't one
+//
+// Note:    Where SSE2 is available (every x86-64), sixteen bytes are compared at once, and blocks of
+//          64 bytes are skipped over with a cheaper test until one might contain a match
+//==========================================================================================================
+template <bool dollar> static inline int find_special(const char* buffer, int i, int length)
+{
+    #ifdef __SSE2__
+    const __m128i lf = _mm_set1_epi8(10), cr = _mm_set1_epi8(13), nul = _mm_setzero_si128(), sep = _mm_set1_epi8('$');
+
+    // A byte might be special if it's '$' or no higher than a carriage return.  That's cheaper to test
+    // for than each of the characters
+    #define MAYBE(chunk)   _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, cr), chunk), \
+                                        dollar ? _mm_cmpeq_epi8(chunk, sep) : nul)
+    #define SPECIAL(chunk) _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, cr)), \
+                                        _mm_or_si128(_mm_cmpeq_epi8(chunk, nul), dollar ? _mm_cmpeq_epi8(chunk, sep) : nul))
+
+    // Skip over 64 bytes at a time while none of them might be special.  When one might be, find out
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(buffer + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buffer + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(buffer + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(buffer + i + 48));
+        if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(MAYBE(a), MAYBE(b)), _mm_or_si128(MAYBE(c), MAYBE(d))))) continue;
+
+        unsigned found;
+        if ((found = _mm_movemask_epi8(SPECIAL(a)))) return i + __builtin_ctz(found);
+        if ((found = _mm_movemask_epi8(SPECIAL(b)))) return i + 16 + __builtin_ctz(found);
+        if ((found = _mm_movemask_epi8(SPECIAL(c)))) return i + 32 + __builtin_ctz(found);
+        if ((found = _mm_movemask_epi8(SPECIAL(d)))) return i + 48 + __builtin_ctz(found);
+    }
+
+    // Then 16 bytes at a time
+    for (; i + 16 <= length; i += 16)
+    {
+        unsigned found = _mm_movemask_epi8(SPECIAL(_mm_loadu_si128((const __m128i*)(buffer + i))));
+        if (found) return i + __builtin_ctz(found);
+    }
+    #undef MAYBE
+    #undef SPECIAL
+    #endif
+
+    // Whatever is left, a byte at a time
+    for (; i < length; ++i)
+    {
+        char c = buffer[i];
+        if (c == 10 || c == 13 || c == 0 || (dollar && c == '$')) return i;
+    }
+    return length;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// scan_message() - Finds the end of a text-format message, and the '$' that divides its tag from the
+//                  rest of it, in a single pass over the datagram
+//
+// Passed:  buffer = The datagram
+//          length = Its length in bytes
+//          dollar = Filled in with the offset of the first '$' before the end of the message, or -1
+//
+// Returns: The length of the message: everything up to the first linefeed, carriage return, or nul
+//==========================================================================================================
+static int scan_message(const char* buffer, int length, int* dollar)
+{
+    // Look for the '$' and the end of the message at the same time
+    int i = find_special<true>(buffer, 0, length);
+    if (i == length || buffer[i] != '$')
+    {
+        *dollar = -1;
+        return i;
+    }
+
+    // Once we've found the '$', only the end of the message is left to find
+    *dollar = i;
+    return find_special<false>(buffer, i + 1, length);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_message() - Divides a received text-format datagram into a tag and a message, in place
+//
+// Passed:  buffer = The datagram.  There must be room for a nul-terminator after it
+//          length = Its length in bytes
+//          item   = Filled in with the tag and message, which point into the buffer
+//==========================================================================================================
+static void parse_message(char* buffer, int length, log_item_t& item)
+{
+    int dollar, end = scan_message(buffer, length, &dollar);
+
+    // Chomp any carriage return or linefeed at the end of the message
+    buffer[end] = 0;
+
+    // If there's a '$' delimiter that divides the tag from the message, divide the buffer there
+    if (dollar >= 0)
+    {
+        buffer[dollar] = 0;
+        item.tag      = buffer;
+        item.tag_len  = dollar;
+        item.data     = buffer + dollar + 1;
+        item.data_len = end - dollar - 1;
+    }
+
+    // Otherwise, the entire buffer is the message and the tag is an empty string
+    else
+    {
+        item.tag      = "";
+        item.tag_len  = 0;
+        item.data     = buffer;
+        item.data_len = end;
+    }
+
+    item.severity = LOG_SEV_NONE;
+
+    // Look up the tag's ID, adding it to the tag table if this is the first time we've seen it
+    item.tag_id   = TagTable.intern(item.tag, item.tag_len);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// track_sender() - Checks a binary-format record's sequence number against the last one from the same
+//                  sender, and counts how many records went missing in between
+//
+// Passed:  addr = The address the datagram came from
+//          seq  = The record's sequence number
+//
+// Note:    A sequence number at or below the last one means the sender restarted, and one that's implausibly
+//          far ahead means it's not the sender we thought, so either way we start over
+//==========================================================================================================
+void CListener::track_sender(const sockaddr_storage& addr, uint64_t seq)
+{
+    // We only know how to tell IPv4 senders apart
+    if (addr.ss_family != AF_INET) return;
+    const sockaddr_in& sin = (const sockaddr_in&)addr;
+    uint64_t key = ((uint64_t)sin.sin_addr.s_addr << 16) | sin.sin_port;
+
+    // Don't let a stream of one-off senders grow the table without limit
+    if (m_sender.size() >= MAX_SENDERS && m_sender.find(key) == m_sender.end()) m_sender.clear();
+
+    // If this sender has skipped some sequence numbers, count them
+    map<uint64_t, uint64_t>::iterator it = m_sender.find(key);
+    if (it != m_sender.end() && seq > it->second && seq - it->second <= MAX_GAP) m_stats.sender_gaps += seq - it->second;
+    m_sender[key] = seq + 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// report_suppressed() - Logs an entry for each tag that has had records suppressed for long enough,
+//                       saying how many, under the tag itself
+//==========================================================================================================
+void CListener::report_suppressed()
+{
+    if (!m_limiter.pending()) return;
+    int count = m_limiter.summarize(metrics_clock(), m_report);
+    if (count == 0) return;
+    DataLog.append(m_shard, &m_report[0], count);
+    LiveLog.notify();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_datagram() - Divides a datagram into records, and adds them to the batch being received
+//
+// Passed:  p      = The datagram.  There must be room for a nul-terminator after it
+//          length = Its length in bytes
+//          hdr    = The message header it was received with, for its flags and ancillary data
+//          addr   = The address it came from
+//          now    = The time to stamp its records with, if the kernel didn't timestamp it
+//==========================================================================================================
+void CListener::parse_datagram(char* p, int length, struct msghdr& hdr, const sockaddr_storage& addr, log_time_t now)
+{
+    // A record that claims to have taken longer than this to arrive has a sender whose clock is wrong
+    const log_time_t MAX_TRANSIT = 60 * NS_PER_SEC;
+
+    log_time_t timestamp = now;
+    m_stats.bytes += length;
+
+    // A datagram that was longer than max_message has lost its end
+    if (hdr.msg_flags & MSG_TRUNC) ++m_stats.truncated;
+
+    // Pick up the ancillary data the kernel attached to the datagram
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET) continue;
+
+        // If the kernel told us how many datagrams it has dropped so far, keep track of that
+        #ifdef SO_RXQ_OVFL
+        if (cmsg->cmsg_type == SO_RXQ_OVFL) m_stats.drops = m_dropped + *(uint32_t*)CMSG_DATA(cmsg);
+        #endif
+
+        // If the kernel told us exactly when the datagram arrived, that's its timestamp
+        #ifdef SCM_TIMESTAMPNS
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+            timestamp = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+        }
+        #endif
+    }
+
+    // A text-format datagram is a single message
+    if (length == 0 || (uint8_t)p[0] != INGEST_MAGIC)
+    {
+        if (m_item.size() <= (size_t)m_records) m_item.resize(m_records + 1);
+        parse_message(p, length, m_item[m_records]);
+        m_item[m_records++].timestamp = timestamp;
+        return;
+    }
+
+    // A binary-format datagram holds any number of records.  A long one may hold more than we have
+    // room for
+    size_t most = m_records + length / INGEST_RECORD_SIZE;
+    if (m_item.size() < most) m_item.resize(most);
+    if (m_sender_info.size() < most - m_records) m_sender_info.resize(most - m_records);
+
+    // If it's damaged, we keep whatever records came before the damage
+    int n = parse_binary(p, length, &m_item[m_records], &m_sender_info[0]);
+    ++m_stats.binary;
+    if (n < 0)
+    {
+        ++m_stats.malformed;
+        n = -1 - n;
+    }
+
+    // Keep track of how long the records took to get here, and whether any went missing
+    for (int j = 0; j < n; ++j)
+    {
+        m_item[m_records + j].timestamp = timestamp;
+        log_time_t transit = timestamp - m_sender_info[j].timestamp;
+        if (m_sender_info[j].timestamp > 0 && transit > 0 && transit < MAX_TRANSIT) m_transit.record(transit);
+        track_sender(addr, m_sender_info[j].seq);
+    }
+    m_records += n;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// log_batch() - Appends the records of a batch of datagrams to the log, and starts a new batch
+//
+// Passed:  datagrams = The number of datagrams the records came from
+//==========================================================================================================
+void CListener::log_batch(int datagrams)
+{
+    int records = m_records;
+    m_records = 0;
+
+    // Drop the records that are over their tag's rate limit
+    if (m_limiter.enabled())
+    {
+        records = m_limiter.filter(&m_item[0], records, metrics_clock());
+        m_stats.suppressed = m_limiter.suppressed();
+        m_stats.sampled    = m_limiter.sampled();
+    }
+
+    // Stuff the entire batch of messages into our queue, along with any reports that are due
+    if (records) DataLog.append(m_shard, &m_item[0], records);
+    if (m_limiter.pending()) report_suppressed();
+
+    // And let the live-log know there are new messages for it
+    LiveLog.notify();
+
+    // Keep track of how many datagrams and records we've received, and in how many batches
+    m_stats.datagrams += datagrams;
+    m_stats.records   += records;
+    ++m_stats.batches;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - This thread listens for incoming UPD messages and logs them.  Datagrams are received in
+//          batches of up to "rx_batch" per system call, and each batch is appended to the log at once.
+//
+//          A datagram is either a single "tag$message" in the text format, or one or more records in the
+//          binary format described in ingest_proto.h.
+//
+//          Records whose tag is over its rate limit (see ratelimit.h) are dropped before the batch is
+//          appended.  Without any limits configured, that costs nothing.
+//
+//          A logger built with the io_uring backend receives through that instead, if the kernel lets it
 //==========================================================================================================
 void CListener::main()
 {
-    UDPSock udp;
-    char    buffer[1024], *p;
-    const char  *pmsg, *ptag;
+    // The size of the inline receive buffer for a single datagram.  Almost every datagram fits in one,
+    // and a datagram that doesn't spills over into a buffer of its own
+    const int INLINE_SIZE = 1024;
+
+    // The most records a datagram that fits in its inline buffer can hold
+    const int MAX_RECORDS = (INLINE_SIZE - INGEST_HEADER_SIZE) / INGEST_RECORD_SIZE;
 
-    // Create the server port
-    if (!udp.create_server(m_port, "", AF_INET))
+    int  i, count, batch = conf.rx_batch;
+
+    // Create the server port.  While we're switching to a new one, the old one is read until it's empty
+    int fd = open_log_port(m_port), old_fd = -1;
+    if (fd < 0)
     {
         fprintf(stderr, "Can't create listener on UDP port %i\n", m_port);
         exit(1);
     }
 
+    // Hold each tag to its rate limit.  A tag that has gone quiet gets its report of what was suppressed
+    // when a receive times out
+    rate_spec_t limits = {conf.tag_rate, conf.tag_burst, conf.tag_limits, conf.tag_sample, 0, conf.suppress_interval};
+    CRateLimiter::parse_severity(conf.rate_exempt, &limits.exempt);
+    m_limiter.create(limits);
+
+    // A batch of binary datagrams can hold many records apiece
+    m_dropped = m_records = 0;
+    m_item.resize(batch * MAX_RECORDS);
+    m_sender_info.resize(MAX_RECORDS);
+
+    // If we can receive through io_uring, that's how we do it, for as long as the ring keeps working.
+    // If it stops, we carry on below with whichever sockets it was receiving from
+    if (CUring::built_in()) receive_uring(fd, old_fd);
+
+    // Every datagram in a batch gets its own receive buffer, ancillary-data buffer, and sender address.
+    // The inline buffers are packed together, so a batch of short datagrams touches as little memory as
+    // possible.  If messages may be longer than an inline buffer, each datagram also gets a spill buffer
+    // that whatever doesn't fit is received into.  Its pages aren't touched until a long datagram arrives
+    int max_message = conf.max_message, spill_size = (max_message >= INLINE_SIZE) ? max_message + 1 : 0;
+    vector<char>             buffer(batch * INLINE_SIZE);
+    vector<char>             control(batch * CONTROL_SIZE);
+    vector<sockaddr_storage> addr(batch);
+    vector<iovec>            iov(2 * batch);
+    vector<mmsghdr>          msg(batch);
+    char*                    spill = spill_size ? new char[batch * spill_size] : NULL;
+
+    // Point every message header at its buffers.  We leave room for a nul-terminator
+    memset(&msg[0], 0, batch * sizeof(mmsghdr));
+    for (i = 0; i < batch; ++i)
+    {
+        iov[2 * i].iov_base = &buffer[i * INLINE_SIZE];
+        iov[2 * i].iov_len  = spill ? INLINE_SIZE - 1 : max_message;
+        msg[i].msg_hdr.msg_iov     = &iov[2 * i];
+        msg[i].msg_hdr.msg_iovlen  = 1;
+        msg[i].msg_hdr.msg_control = &control[i * CONTROL_SIZE];
+        msg[i].msg_hdr.msg_name    = &addr[i];
+
+        // The spill buffer starts with room to copy the inline part back in front of the rest
+        if (spill)
+        {
+            iov[2 * i + 1].iov_base = spill + i * spill_size + INLINE_SIZE - 1;
+            iov[2 * i + 1].iov_len  = max_message - (INLINE_SIZE - 1);
+            msg[i].msg_hdr.msg_iovlen = 2;
+        }
+    }
 
-    // Every time a message is received...
-    while (udp.receive(buffer, sizeof buffer)) 
+    // Sit in a loop forever, receiving batches of datagrams
+    while (true)
     {
-        // Chomp any carriage return or linefeed at the end of the message
-        p = strchr(buffer, 10); if (p) *p = 0;
-        p = strchr(buffer, 13); if (p) *p = 0;
-        
-        // Does the message contain the '$' delimeter that divides the tag from the message?
-        p = strchr(buffer, '$');
+        // The kernel shrinks msg_controllen and msg_namelen to what it used, so they must be reset
+        // every time
+        for (i = 0; i < batch; ++i)
+        {
+            msg[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+            msg[i].msg_hdr.msg_namelen    = sizeof(sockaddr_storage);
+        }
 
-        // If that delimieter exists, divide the buffer into a tag and a message
-        if (p)
+        // If we've been handed a socket on a new log port, switch to it.  Datagrams that arrive there
+        // queue up in the new socket while we read what had already arrived on the old one
+        if (old_fd < 0 && m_next_fd >= 0)
         {
-            *p = 0;
-            pmsg = p+1;
-            ptag = buffer;
+            old_fd = fd;
+            fd = __sync_lock_test_and_set(&m_next_fd, -1);
+            set_nonblocking(old_fd);
         }
 
-        // Otherwise, the entire buffer is the message and the tag is an empty string
-        else
+        // Wait for at least one datagram to arrive, and fetch as many as are waiting
+        count = receive_batch(old_fd >= 0 ? old_fd : fd, &msg[0], batch);
+        ++m_stats.syscalls;
+        if (count < 0 && errno == EINTR) continue;
+
+        // Once the old socket is empty, we're done with it.  The new one counts its drops from zero
+        if (old_fd >= 0 && count <= 0)
         {
-            pmsg = buffer;
-            ptag = "";            
+            close(old_fd);
+            old_fd    = -1;
+            m_dropped = m_stats.drops;
+            continue;
         }
 
+        // If nothing arrived before the receive timed out, it's just a chance to report on tags that
+        // have gone quiet, and to pick up a change in the log's size
+        if (count == 0 || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+        {
+            report_suppressed();
+            DataLog.idle(m_shard);
+            continue;
+        }
+        if (count < 0) break;
+
+        // If the kernel doesn't timestamp the datagrams for us, they're all stamped with the time they
+        // were received
+        log_time_t now = log_clock();
+
+        // Divide each datagram into records
+        for (i = 0; i < count; ++i)
+        {
+            char* p = (char*)iov[2 * i].iov_base;
+
+            // A datagram that spilled over its inline buffer is put back together in its spill buffer
+            if (msg[i].msg_len >= INLINE_SIZE)
+            {
+                memcpy(spill + i * spill_size, p, INLINE_SIZE - 1);
+                p = spill + i * spill_size;
+            }
+
+            parse_datagram(p, msg[i].msg_len, msg[i].msg_hdr, addr[i], now);
+        }
 
-        // Stuff the message into our queue
-        DataLog.append(ptag, pmsg);
-        
-        // And send the message to the live-log TCP port
-        LiveLog.send(ptag, pmsg);
+        // And log them
+        log_batch(count);
     }
+
+    delete[] spill;
 }
 //==========================================================================================================
 
 
+//==========================================================================================================
+// receive_uring() - Receives datagrams through io_uring, for as long as it can
+//
+// Passed:  fd     = The socket to receive from.  Updated if we're switched to a new log port
+//          old_fd = The socket we're switching away from, or -1.  Updated the same way
+//
+// Returns: false, having received nothing, if the kernel can't do this.  If the ring fails once it has
+//          started, the failure is reported and it returns false, leaving "fd" and "old_fd" as the sockets
+//          to carry on receiving from the ordinary way.  Otherwise it never returns
+//
+// Note:    A single multishot receive stays armed on the socket, and the kernel puts each datagram that
+//          arrives into a buffer of its own, picked from a ring of them that we hand back as we finish
+//          with them.  So there's no system call per batch just to receive: the one that waits for
+//          completions is all there is, and when datagrams are arriving steadily it usually finds a
+//          batch already waiting.  A one-second timer takes the place of the socket's receive timeout
+//==========================================================================================================
+bool CListener::receive_uring(int& fd, int& old_fd)
+{
+    #ifdef USE_IO_URING
+    // The buffer group our buffers belong to, and the tags of the completions that aren't datagrams
+    const int      GROUP     = 1;
+    const uint64_t TIMER_TAG = ~0ULL, CANCEL_TAG = ~0ULL - 1;
+    static const struct timespec TICK = {1, 0};
+
+    int batch = conf.rx_batch;
+
+    // What the kernel puts at the start of each buffer: a description of the datagram, the address it came
+    // from, and its ancillary data.  The datagram itself follows them.  The kernel only reads the sizes
+    // from this
+    struct msghdr layout;
+    memset(&layout, 0, sizeof layout);
+    layout.msg_namelen    = sizeof(sockaddr_storage);
+    layout.msg_controllen = CONTROL_SIZE;
+    int header = sizeof(io_uring_recvmsg_out) + layout.msg_namelen + layout.msg_controllen;
+
+    // There are enough buffers for a couple of batches to arrive while we're logging another, and every
+    // one of them can complete without the completion queue overflowing
+    int count = 64;
+    while (count < 2 * batch && count < 32768) count *= 2;
+
+    CUring ring;
+    if (!ring.create(16, count) || !ring.create_buffer_ring(GROUP, count, header + conf.max_message)) return false;
+
+    // Each socket's receive is tagged with a number of its own, so that a late completion from a socket
+    // we've finished with can't be mistaken for one from the socket that replaced it
+    uint64_t receiving = 1;
+    vector<int> used(count);
+    bool started = false, ticking = false, rearm = false;
+    ring.recvmsg_multishot(fd, &layout, GROUP, receiving);
+
+    while (true)
+    {
+        // Keep the timer running, so we get on with everything else we do even when nothing arrives
+        if (!ticking)
+        {
+            ring.timeout(&TICK, TIMER_TAG);
+            ticking = true;
+        }
+
+        // If we've been handed a socket on a new log port, we switch to it once the old one is empty.
+        // Datagrams that arrive there queue up in the new socket until then
+        if (old_fd < 0 && m_next_fd >= 0)
+        {
+            old_fd = fd;
+            fd = __sync_lock_test_and_set(&m_next_fd, -1);
+        }
+
+        // Wait for something to happen.  If the ring stops working, we say so and go back to receiving
+        // the ordinary way.  An old socket we were switching away from is then read dry without blocking
+        if (ring.submit(1) < 0)
+        {
+            if (!started) return false;
+            fprintf(stderr, "Listener on UDP port %i: io_uring failed (%s), falling back to recvmmsg\n",
+                    m_port, strerror(errno));
+            if (old_fd >= 0) set_nonblocking(old_fd);
+            return false;
+        }
+        m_stats.syscalls = ring.syscalls();
+
+        // If the kernel doesn't timestamp the datagrams for us, they're all stamped with the time we
+        // picked them up
+        log_time_t now = log_clock();
+        int      datagrams = 0, buffers = 0, result;
+        uint64_t tag;
+        uint32_t flags;
+
+        // Pick up a batch of whatever has completed
+        while (datagrams < batch && ring.next(&tag, &result, &flags))
+        {
+            if (tag == CANCEL_TAG) continue;
+
+            // When the timer goes off, it's a chance to report on tags that have gone quiet, and to pick up
+            // a change in the log's size
+            if (tag == TIMER_TAG)
+            {
+                ticking = false;
+                report_suppressed();
+                DataLog.idle(m_shard);
+                continue;
+            }
+
+            // A kernel that can't do multishot receives says so the first time we ask
+            if (!started && result == -EINVAL) return false;
+            started = true;
+
+            // The receive stops if it runs out of buffers or hits an error, and has to be started again.
+            // A socket we've finished with is left stopped
+            if (!(flags & IORING_CQE_F_MORE) && tag == receiving) rearm = true;
+            if (!(flags & IORING_CQE_F_BUFFER)) continue;
+
+            // The datagram, and what the kernel had to say about it, are in the buffer it picked
+            int id = flags >> IORING_CQE_BUFFER_SHIFT;
+            used[buffers++] = id;
+            if (result < 0) continue;
+
+            io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)ring.buffer(id);
+            char* name    = (char*)(out + 1);
+            char* control = name + layout.msg_namelen;
+
+            // Build a message header that describes the ancillary data, so it can be read the usual way
+            struct msghdr    hdr;
+            sockaddr_storage addr;
+            memset(&hdr, 0, sizeof hdr);
+            memset(&addr, 0, sizeof addr);
+            memcpy(&addr, name, out->namelen < sizeof addr ? out->namelen : sizeof addr);
+            hdr.msg_control    = control;
+            hdr.msg_controllen = out->controllen;
+            hdr.msg_flags      = out->flags;
+
+            parse_datagram(control + layout.msg_controllen, result - header, hdr, addr, now);
+            ++datagrams;
+        }
+
+        // Log the batch, and only then hand its buffers back to the kernel
+        if (datagrams) log_batch(datagrams);
+        for (int i = 0; i < buffers; ++i) ring.recycle(used[i]);
+        if (buffers) ring.publish();
 
+        // Once the old socket is empty, stop receiving from it and start on the new one, which counts its
+        // drops from zero.  Whatever the old one received before the cancel still completes as usual
+        int pending = 0;
+        if (old_fd >= 0 && (ioctl(old_fd, FIONREAD, &pending) < 0 || pending == 0))
+        {
+            ring.cancel(receiving, CANCEL_TAG);
+            close(old_fd);
+            old_fd    = -1;
+            m_dropped = m_stats.drops;
+            rearm     = true;
+            ++receiving;
+        }
+
+        // Start the current socket's receive again if it stopped
+        if (rearm)
+        {
+            ring.recvmsg_multishot(old_fd >= 0 ? old_fd : fd, &layout, GROUP, receiving);
+            rearm = false;
+        }
+    }
+    #else
+    (void)fd; (void)old_fd;
+    return false;
+    #endif
+}
 //==========================================================================================================
-// spawn() - Spawns the thread
+
+
+
+
+//==========================================================================================================
+// describe() - Adds a line to a reload's report, saying what became of a setting that changed
 //==========================================================================================================
-void CLiveLog::spawn(int port)
+static void describe(string& report, const char* name, int old_value, int new_value, const char* outcome)
 {
-    m_has_client = false;
-    m_port = port;
-    CThread::spawn();
+    char line[256];
+    sprintf(line, "%s %d -> %d%s\n", name, old_value, new_value, outcome);
+    report += line;
+}
+
+static void describe(string& report, const char* name, const string& old_value, const string& new_value, const char* outcome)
+{
+    report = report + name + " \"" + old_value + "\" -> \"" + new_value + "\"" + outcome + "\n";
 }
 //==========================================================================================================
 
 
 //==========================================================================================================
-// main() - Manages the TCP port
+// rebind_log_port() - Moves every listener thread to a new log port
+//
+// Returns: false if the new port can't be bound, in which case the listeners stay where they are
+//
+// Note:    Every listener's new socket is bound before any listener is told about it, so the port either
+//          changes for all of them, or for none.  Nothing sent to the old port that has already arrived is
+//          lost: each listener reads its old socket dry before it closes it
 //==========================================================================================================
-void CLiveLog::main()
+static bool rebind_log_port(int port)
 {
-    char    c;
+    int fd[MAX_LISTENERS], i;
 
-again:
+    for (i = 0; i < conf.listener_threads; ++i)
+    {
+        fd[i] = open_log_port(port);
+        if (fd[i] < 0) break;
+    }
 
-    // We do not currently have a client connected
-    m_mutex.lock();
-    m_has_client = false;
-    m_mutex.unlock();
+    if (i < conf.listener_threads)
+    {
+        while (i--) close(fd[i]);
+        return false;
+    }
 
-    // Create the server and wait for a connection
-    if (!m_server.create_server(m_port, "", AF_INET))
+    for (i = 0; i < conf.listener_threads; ++i) Listener[i].rebind(port, fd[i]);
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// reload_config() - Re-reads the configuration file, and applies whatever has changed while we run
+//
+// Passed:  report = Filled in with a line for each setting that changed, saying what became of it
+//
+// Returns: false if the configuration file couldn't be read, or made no sense, in which case nothing
+//          changes at all
+//
+// Note:    The size of the log, the ports, id_length, time_precision, and query_timeout take effect at
+//          once.  Everything else that changed needs a restart, and keeps its old value until then.  A
+//          port that can't be listened on stays as it was
+//==========================================================================================================
+bool reload_config(string& report)
+{
+    static CMutex mutex;
+    UniqueLock lock(mutex);
+
+    const char* RESTART = " (needs a restart)";
+    conf_t fresh;
+    string error;
+
+    report.clear();
+    ++reloads;
+
+    // Read the new settings, which don't replace the old ones unless they make sense
+    fresh.use_section = conf.use_section;
+    fresh.section     = conf.section;
+    if (!fetch_specs(fresh, &error))
     {
-        fprintf(stderr, "can't create server on TCP port %i\n", m_port);
-        exit(1);
+        report = error + "\n";
+        ++failed_reloads;
+        return false;
     }
 
-    // Wait for someone to connect to us
-    m_server.listen_and_accept();
+    // Move to any new ports.  The new port is listened on before the old one is given up
+    if (fresh.log_port != conf.log_port)
+    {
+        bool ok = rebind_log_port(fresh.log_port);
+        describe(report, "log_port", conf.log_port, fresh.log_port, ok ? "" : " (can't listen on it)");
+        if (ok) conf.log_port = fresh.log_port;
+    }
+    if (fresh.server_port != conf.server_port)
+    {
+        bool ok = rebind_tcp_server(server_fd, fresh.server_port);
+        describe(report, "server_port", conf.server_port, fresh.server_port, ok ? "" : " (can't listen on it)");
+        if (ok) conf.server_port = fresh.server_port;
+    }
+    if (fresh.live_log_port != conf.live_log_port)
+    {
+        bool ok = LiveLog.rebind(fresh.live_log_port);
+        describe(report, "live_log_port", conf.live_log_port, fresh.live_log_port, ok ? "" : " (can't listen on it)");
+        if (ok) conf.live_log_port = fresh.live_log_port;
+    }
+    if (fresh.stats_port != conf.stats_port)
+    {
+        // The stats server can only be started or stopped by a restart
+        bool ok = conf.stats_port && fresh.stats_port && StatsServer.rebind(fresh.stats_port);
+        describe(report, "stats_port", conf.stats_port, fresh.stats_port,
+                 ok ? "" : (conf.stats_port && fresh.stats_port) ? " (can't listen on it)" : RESTART);
+        if (ok) conf.stats_port = fresh.stats_port;
+    }
+
+    // Resize the log.  Whether tags have a quota at all decides how the log is divided into shards, so
+    // turning quotas on or off needs a restart
+    if (fresh.tag_quota != conf.tag_quota && (fresh.tag_quota == 0 || conf.tag_quota == 0))
+    {
+        describe(report, "tag_quota", conf.tag_quota, fresh.tag_quota, RESTART);
+        fresh.tag_quota = conf.tag_quota;
+    }
+    if (fresh.max_entries != conf.max_entries || fresh.max_bytes != conf.max_bytes ||
+        fresh.tag_quota != conf.tag_quota || fresh.quota_entries != conf.quota_entries ||
+        fresh.aggregate_entries != conf.aggregate_entries)
+    {
+        #define RESIZED(field) if (fresh.field != conf.field) describe(report, #field, conf.field, fresh.field, "")
+        RESIZED(max_entries);
+        RESIZED(max_bytes);
+        RESIZED(tag_quota);
+        RESIZED(quota_entries);
+        RESIZED(aggregate_entries);
+        #undef RESIZED
+
+        log_spec_t spec;
+        spec.engine        = conf.log_engine;
+        spec.max_entries   = conf.max_entries   = fresh.max_entries;
+        spec.max_bytes     = conf.max_bytes     = fresh.max_bytes;
+        spec.dir           = conf.log_dir;
+        spec.segment_size  = conf.segment_size;
+        spec.segment_age   = conf.segment_age;
+        spec.tag_quota     = conf.tag_quota     = fresh.tag_quota;
+        spec.quota_entries = conf.quota_entries = fresh.quota_entries;
+        conf.aggregate_entries = fresh.aggregate_entries;
+
+        // The aggregator's shard, if there is one, comes straight after the listeners'
+        if (!conf.upstreams.empty())
+        {
+            spec.shard_entries.assign(conf.listener_threads + 1, 0);
+            spec.shard_entries[conf.listener_threads] = conf.aggregate_entries;
+        }
+        DataLog.resize(spec);
+    }
 
-    // We have a client connected
-    m_mutex.lock();
-    m_has_client = true;
-    m_mutex.unlock();
+    // Tags are rendered at their new width from now on
+    if (fresh.id_length != conf.id_length)
+    {
+        describe(report, "id_length", conf.id_length, fresh.id_length, "");
+        TagTable.set_width(fresh.id_length);
+        conf.id_length = fresh.id_length;
+    }
 
-    // Send a message so that the client knows there is someone here
-    dump_log_data(m_server);
+    // These are looked at every time they're used
+    if (fresh.time_precision != conf.time_precision)
+    {
+        describe(report, "time_precision", conf.time_precision, fresh.time_precision, "");
+        conf.time_precision = fresh.time_precision;
+    }
+    if (fresh.query_timeout != conf.query_timeout)
+    {
+        describe(report, "query_timeout", conf.query_timeout, fresh.query_timeout, "");
+        conf.query_timeout = fresh.query_timeout;
+    }
 
-    // If the client closes the socket, start over
-    while (true) if (m_server.receive(&c, 1) < 1) goto again;
+    // Everything else is only looked at when the thread that uses it starts
+    #define RESTARTED(field) if (fresh.field != conf.field) describe(report, #field, conf.field, fresh.field, RESTART)
+    RESTARTED(log_engine);
+    RESTARTED(log_dir);
+    RESTARTED(segment_size);
+    RESTARTED(segment_age);
+    RESTARTED(rx_batch);
+    RESTARTED(rx_buffer);
+    RESTARTED(max_message);
+    RESTARTED(listener_threads);
+    RESTARTED(live_log_clients);
+    RESTARTED(live_log_queue);
+    RESTARTED(live_log_overflow);
+    RESTARTED(max_tags);
+    RESTARTED(dump_clients);
+    RESTARTED(tag_rate);
+    RESTARTED(tag_burst);
+    RESTARTED(tag_limits);
+    RESTARTED(tag_sample);
+    RESTARTED(rate_exempt);
+    RESTARTED(suppress_interval);
+    RESTARTED(upstreams);
+    RESTARTED(aggregate_interval);
+    RESTARTED(aggregate_batch);
+    RESTARTED(merge_delay);
+    RESTARTED(shm_name);
+    RESTARTED(shm_size);
+    #undef RESTARTED
+
+    if (report.empty()) report = "Nothing changed\n";
+    return true;
 }
 //==========================================================================================================
 
 
-
 //==========================================================================================================
-// send() - Sends data to the live-log output stream
+// main() - Waits for SIGHUP, and reloads the configuration each time it arrives
 //==========================================================================================================
-void CLiveLog::send(const char* tag, const char* message)
+void CReloader::main()
 {
-    // Ensure thread-synchronized access to both "m_has_client" and "m_server"
-    UniqueLock lock(m_mutex);
+    sigset_t hangup;
+    string   report;
+    int      number;
 
-    // If there's no client connected, do nothing
-    if (!m_has_client) return;
+    sigemptyset(&hangup);
+    sigaddset(&hangup, SIGHUP);
 
-    // Turn the data that describes our message into a log_data_t
-    log_data_t entry = {time(NULL), tag, message};
+    while (true)
+    {
+        if (sigwait(&hangup, &number) != 0) continue;
 
-    // Transmit the formatted message via the our TCP server
-    transmit_log_entry(entry, m_server);
+        // Tell the user what became of the new configuration
+        if (reload_config(report))
+            printf("Reloaded %s:\n%s", config_file.c_str(), report.c_str());
+        else
+            fprintf(stderr, "Can't reload %s: %s", config_file.c_str(), report.c_str());
+        fflush(stdout);
+    }
 }
 //==========================================================================================================
-
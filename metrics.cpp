@@ -0,0 +1,208 @@
+//==========================================================================================================
+// metrics.cpp - Implements the latency histograms, and the server that reports the logger's statistics
+//==========================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+#include "globals.h"
+#include "sockutil.h"
+
+// How many milliseconds a client of the stats port has to send its request
+static const int STATS_TIMEOUT = 100;
+
+// The most header lines we'll read from an HTTP client before we answer it
+static const int MAX_HEADERS = 64;
+
+
+//==========================================================================================================
+// clear() - Forgets every value that has been recorded
+//==========================================================================================================
+void CHistogram::clear()
+{
+    memset(m_bucket, 0, sizeof m_bucket);
+    m_count = m_sum = m_max = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bucket() - Returns the bucket that a value belongs in
+//
+// Values below SUB_BUCKETS each have a bucket of their own.  Above that, each power of two is divided
+// into SUB_BUCKETS buckets, selected by the bits just below the most significant bit.
+//==========================================================================================================
+int CHistogram::bucket(uint64_t value)
+{
+    if (value < SUB_BUCKETS) return value;
+    int msb = 63 - __builtin_clzll(value);
+    int sub = (value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// bucket_limit() - Returns the largest value that belongs in a bucket
+//==========================================================================================================
+uint64_t CHistogram::bucket_limit(int bucket)
+{
+    if (bucket < SUB_BUCKETS) return bucket;
+    int msb   = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    int sub   = bucket % SUB_BUCKETS;
+    int shift = msb - SUB_BITS;
+    uint64_t lowest = (uint64_t)(SUB_BUCKETS + sub) << shift;
+    return lowest + ((1ULL << shift) - 1);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// merge() - Adds the values recorded in another histogram to this one
+//==========================================================================================================
+void CHistogram::merge(const CHistogram& other)
+{
+    for (int i = 0; i < BUCKETS; ++i) m_bucket[i] += other.m_bucket[i];
+    m_count += other.m_count;
+    m_sum   += other.m_sum;
+    if (other.m_max > m_max) m_max = other.m_max;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// percentile() - Returns the value that "fraction" of the recorded values are at or below
+//
+// Note:    The answer is the upper limit of the bucket the percentile falls in, but never more than the
+//          largest value actually recorded
+//==========================================================================================================
+uint64_t CHistogram::percentile(double fraction) const
+{
+    // If nothing has been recorded, there's nothing to report
+    if (m_count == 0) return 0;
+
+    // Find the bucket where the running count reaches the requested fraction of the total
+    uint64_t wanted = (uint64_t)(fraction * m_count + 0.5), seen = 0;
+    if (wanted < 1) wanted = 1;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += m_bucket[i];
+        if (seen >= wanted) return (bucket_limit(i) < m_max) ? bucket_limit(i) : m_max;
+    }
+
+    // If we get here, values were recorded while we were looking
+    return m_max;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// summary() - Returns a one-line summary of the histogram
+//==========================================================================================================
+string CHistogram::summary() const
+{
+    char text[256];
+
+    sprintf(text, "count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu",
+            (unsigned long long)m_count,
+            (unsigned long long)(m_count ? m_sum / m_count : 0),
+            (unsigned long long)percentile(0.50),
+            (unsigned long long)percentile(0.90),
+            (unsigned long long)percentile(0.99),
+            (unsigned long long)percentile(0.999),
+            (unsigned long long)m_max);
+
+    return text;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// spawn() - Spawns the thread
+//==========================================================================================================
+void CStatsServer::spawn(int port)
+{
+    m_port = port;
+    CThread::spawn();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rebind() - Moves the server to a different port
+//
+// Returns: false if the new port can't be listened on, in which case we stay where we are
+//==========================================================================================================
+bool CStatsServer::rebind(int port)
+{
+    if (m_listen_fd < 0 || !rebind_tcp_server(m_listen_fd, port)) return false;
+    m_port = port;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Sends the statistics report to each client that connects, one client at a time
+//==========================================================================================================
+void CStatsServer::main()
+{
+    // Create the server
+    int listen_fd = create_tcp_server(m_port);
+    if (listen_fd < 0)
+    {
+        fprintf(stderr, "can't create stats server on TCP port %i\n", m_port);
+        exit(1);
+    }
+    m_listen_fd = listen_fd;
+
+    // Sit in a loop forever, waiting for someone to connect
+    while (true)
+    {
+        int fd = wait_for_client(listen_fd);
+        if (fd < 0) continue;
+        serve_client(fd);
+        close(fd);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// serve_client() - Sends the statistics report to a client
+//==========================================================================================================
+void CStatsServer::serve_client(int fd)
+{
+    char   line[1024];
+    char   header[256];
+    string report;
+
+    // See what the client has to say.  A client that says nothing is just sent the report
+    int length = receive_line(fd, line, sizeof line, STATS_TIMEOUT);
+    bool is_http = (length > 0 && strncmp(line, "GET ", 4) == 0);
+
+    // An HTTP client sends headers after its request.  We don't care what they say, but they have to
+    // be read before we answer, or closing the socket with them unread would reset the connection
+    for (int i = 0; is_http && i < MAX_HEADERS; ++i)
+    {
+        if (receive_line(fd, line, sizeof line, STATS_TIMEOUT) <= 0) break;
+    }
+
+    // Build the report
+    report_stats(report);
+
+    // An HTTP client gets a response header first
+    if (is_http)
+    {
+        int n = sprintf(header, "HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain\r\n"
+                                "Content-Length: %d\r\n"
+                                "Connection: close\r\n\r\n", (int)report.size());
+        send_all(fd, header, n);
+    }
+
+    // And then the report
+    send_all(fd, report.data(), report.size());
+}
+//==========================================================================================================
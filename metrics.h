@@ -0,0 +1,104 @@
+//==========================================================================================================
+// metrics.h - Defines the latency histograms, and the server that reports the logger's statistics
+//
+// The counters themselves live with the code they count, and each one is only ever written by a single
+// thread, so keeping them costs no locks and no atomic operations.  A report reads them all without
+// synchronizing, so it may be a few entries out of date, but it never slows down the threads it reports.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include "cthread.h"
+
+using namespace std;
+
+// Returns a monotonic timestamp in nanoseconds, for measuring how long something takes
+inline uint64_t metrics_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//==========================================================================================================
+// CHistogram - A histogram of values, such as latencies in nanoseconds
+//
+// Each power of two is divided into four buckets, so a percentile is accurate to within 25%.  Only one
+// thread may record values into a histogram.  Histograms from several threads are combined with merge().
+//==========================================================================================================
+class CHistogram
+{
+public:
+    CHistogram() {clear();}
+
+    // Forgets every value that has been recorded
+    void        clear();
+
+    // Records a value
+    void        record(uint64_t value)
+    {
+        ++m_bucket[bucket(value)];
+        ++m_count;
+        m_sum += value;
+        if (value > m_max) m_max = value;
+    }
+
+    // Adds the values recorded in another histogram to this one
+    void        merge(const CHistogram& other);
+
+    // Returns the value that "fraction" of the recorded values are at or below
+    uint64_t    percentile(double fraction) const;
+
+    // Returns a one-line summary: the count, the mean, several percentiles, and the maximum
+    string      summary() const;
+
+    // The number of values recorded, their total, and the largest of them
+    uint64_t    count() const {return m_count;}
+    uint64_t    sum()   const {return m_sum;}
+    uint64_t    max()   const {return m_max;}
+
+protected:
+
+    // Two bits of each value below its most significant bit select the bucket within a power of two
+    enum {SUB_BITS = 2, SUB_BUCKETS = 1 << SUB_BITS, BUCKETS = 64 * SUB_BUCKETS};
+
+    // Returns the bucket a value belongs in, and the largest value in a bucket
+    static int      bucket(uint64_t value);
+    static uint64_t bucket_limit(int bucket);
+
+    uint64_t    m_bucket[BUCKETS];
+    uint64_t    m_count, m_sum, m_max;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CStatsServer - A thread that sends the statistics report to anyone who connects to the stats port
+//
+// A client that sends an HTTP request gets the report as a plain-text HTTP response.  Any other client
+// just gets the report.
+//==========================================================================================================
+class CStatsServer : public CThread
+{
+public:
+    CStatsServer() {m_port = 0; m_listen_fd = -1;}
+
+    void    spawn(int port);
+
+    // Moves the server to a different port.  Returns false if the new port can't be listened on
+    bool    rebind(int port);
+
+protected:
+
+    void    main();
+
+    // Sends the report to a single client
+    void    serve_client(int fd);
+
+    // The TCP port we listen on, and the socket that listens on it
+    int     m_port;
+    volatile int m_listen_fd;
+};
+//==========================================================================================================
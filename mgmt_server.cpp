@@ -4,19 +4,38 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <string>
 #include "mgmt_server.h"
 #include "udpsock.h"
+#include "globals.h"
 
 enum
 {
-    CMD_PING = 1,
-    RSP_PING = 2,
-    CMD_DOWN = 3
+    CMD_PING  = 1,
+    RSP_PING  = 2,
+    CMD_DOWN  = 3,
+    CMD_STATS = 4,
+    RSP_STATS = 5,
+    CMD_RELOAD = 6,
+    RSP_RELOAD = 7
 };
 
 // Message structures for the message we understand
-struct cmd_ping_t {uint16_t cmd; uint16_t port;};
-struct rsp_ping_t {uint16_t cmd; uint16_t port;};
+struct cmd_ping_t  {uint16_t cmd; uint16_t port;};
+struct rsp_ping_t  {uint16_t cmd; uint16_t port;};
+struct cmd_stats_t {uint16_t cmd; uint16_t port;};
+
+// The stats response is this header, followed by the plain-text report (see report_stats())
+struct rsp_stats_t {uint16_t cmd; uint16_t port;};
+
+// The reload response is this header, followed by a line for each setting that changed, saying what
+// became of it (see reload_config()), or by "ERROR" and what's wrong with the configuration file
+struct cmd_reload_t {uint16_t cmd; uint16_t port;};
+struct rsp_reload_t {uint16_t cmd; uint16_t port;};
+
+// The largest UDP datagram we can send.  A report that's any bigger is truncated
+static const int MAX_DATAGRAM = 65507;
 
 //==========================================================================================================
 // main() - Performs process management
@@ -31,8 +50,13 @@ void CMgmtServer::main()
         uint16_t    cmd;
         cmd_ping_t  ping_cmd;
         rsp_ping_t  ping_rsp;
+        cmd_stats_t stats_cmd;
+        cmd_reload_t reload_cmd;
     };
 
+    // The stats report, and the response that carries it
+    string report, response;
+
     // The UDP client and server socket
     UDPSock client, server;
 
@@ -71,6 +95,39 @@ void CMgmtServer::main()
             continue;
         }        
 
+        // If the command was "stats"...
+        if (cmd == CMD_STATS)
+        {
+            // Build the response: a header that identifies who we are, then the report
+            rsp_stats_t header = {RSP_STATS, port};
+            report_stats(report);
+            response.assign((char*)&header, sizeof header);
+            response += report;
+            if (response.size() > MAX_DATAGRAM) response.resize(MAX_DATAGRAM);
+
+            // The stats message includes the port number to reply to
+            client.create_sender(stats_cmd.port, "localhost", AF_INET);
+            client.send(response.data(), response.size());
+            client.close();
+            continue;
+        }
+
+        // If the command was "reload", re-read the configuration file, and tell the sender what changed
+        if (cmd == CMD_RELOAD)
+        {
+            rsp_reload_t header = {RSP_RELOAD, port};
+            bool ok = reload_config(report);
+            response.assign((char*)&header, sizeof header);
+            if (!ok) response += "ERROR ";
+            response += report;
+            if (response.size() > MAX_DATAGRAM) response.resize(MAX_DATAGRAM);
+
+            client.create_sender(reload_cmd.port, "localhost", AF_INET);
+            client.send(response.data(), response.size());
+            client.close();
+            continue;
+        }
+
         // If the command was "down", exit the program
         if (cmd == CMD_DOWN) exit(0);
     }
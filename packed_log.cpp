@@ -0,0 +1,517 @@
+//==========================================================================================================
+// packed_log.cpp - Implements a log storage engine that keeps all but the newest entries compressed
+//==========================================================================================================
+#include <string.h>
+#include <vector>
+#include "packed_log.h"
+#include "atomics.h"
+#include "tags.h"
+#include "lz.h"
+
+// The largest data a record in the hot block can hold
+static const int MAX_DATA_LEN = PACKED_BLOCK_SIZE - sizeof(packed_rec_t) - 1;
+
+// The size of a record holding data of the specified length, rounded up to a multiple of 8
+static inline uint32_t record_size(uint32_t data_len)
+{
+    return (sizeof(packed_rec_t) + data_len + 1 + 7) & ~7;
+}
+
+// Appends an unsigned variable-length integer, 7 bits per byte, least significant first
+static inline char* put_varint(char* p, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (char)value;
+    return p;
+}
+
+// Fetches an unsigned variable-length integer.  Returns NULL if it runs past "end"
+static inline const char* get_varint(const char* p, const char* end, uint64_t* p_value)
+{
+    uint64_t value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            *p_value = value;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Timestamps can step backwards, so their deltas are zig-zag encoded: 0, -1, 1, -2, 2...
+static inline uint64_t zigzag(int64_t value)    {return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);}
+static inline int64_t  unzigzag(uint64_t value) {return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);}
+
+
+//==========================================================================================================
+// CPackedCursor - Walks a range of entry indices across the blocks that were captured when the snapshot
+//                 was taken.  Cold blocks are decompressed into a private buffer one at a time.
+//==========================================================================================================
+class CPackedCursor : public CLogCursor
+{
+public:
+    CPackedCursor(uint64_t first, uint64_t end);
+
+    // Fetches the next entry in the snapshot
+    bool    next(log_view_t& view);
+
+    // Skips ahead to the entry with the specified index
+    void    seek(uint64_t index) {if (index > m_index) m_index = index;}
+
+    // Remembers what the reader wants, so that cold blocks without any of it can be skipped
+    void    hint(const log_hint_t& hint) {m_hint = hint; m_has_hint = true;}
+
+    // The blocks that hold the snapshot, oldest first
+    vector<packed_block_ptr> m_block;
+
+protected:
+
+    // Returns false if the hint says that nothing in a cold block is wanted
+    bool    wanted(const packed_block_t& block);
+
+    // Gets ready to read a block from its first entry, decompressing it if it's cold
+    bool    load(const packed_block_t& block);
+
+    // Decodes the entry at the current position in the loaded block, and moves past it
+    bool    decode(log_view_t& view);
+
+    // The next entry to fetch, and one past the last entry in the snapshot
+    uint64_t    m_index, m_end;
+
+    // The block we're reading
+    size_t      m_current;
+
+    // The block that's loaded, and where we are in it: the byte offset and index of the next entry, and
+    // the timestamp and sequence number of the entry before it
+    const packed_block_t* m_loaded;
+    vector<char> m_buffer;
+    uint32_t    m_pos, m_size;
+    uint64_t    m_pos_index;
+    log_time_t  m_time;
+    uint64_t    m_seq;
+
+    // What the reader wants, if it told us
+    log_hint_t  m_hint;
+    bool        m_has_hint;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor
+//
+// Passed:  max_entries = The maximum number of entries in the log
+//          max_bytes   = The maximum number of bytes of blocks in the log.  The hot block always counts as
+//                        full.  There's always room for at least one cold block and the hot block.
+//==========================================================================================================
+CPackedLog::CPackedLog(int max_entries, int max_bytes)
+{
+    m_max_entries = (max_entries > 0) ? max_entries : 1;
+    m_max_bytes   = (max_bytes > 0) ? max_bytes : 0;
+    m_bytes       = 0;
+    m_first       = m_end = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// first() - Returns the index of the oldest entry in the log
+//==========================================================================================================
+uint64_t CPackedLog::first()
+{
+    return load_acquire(&m_first);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// end() - Returns the index one past the newest entry in the log
+//==========================================================================================================
+uint64_t CPackedLog::end()
+{
+    return load_acquire(&m_end);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends a batch of entries to the hot block, sealing it and starting another each time it
+//            fills up.  The readers see the entire batch appear at once.
+//==========================================================================================================
+void CPackedLog::append(const log_item_t* item, int count, uint64_t seq)
+{
+    uint64_t end = m_end;
+
+    for (int i = 0; i < count; ++i, ++seq, ++end)
+    {
+        // Make sure the entry will fit into a block, truncating it if need be
+        int data_len = item[i].data_len;
+        if (data_len > MAX_DATA_LEN) data_len = MAX_DATA_LEN;
+        uint32_t size = record_size(data_len);
+
+        // If there's no room in the hot block, compress it and start another
+        if (!m_hot || m_hot->raw_size + size > PACKED_BLOCK_SIZE)
+        {
+            if (m_hot) seal();
+            start_block(end);
+        }
+
+        // The first entry in a block is the base that the encoded deltas start from
+        packed_block_t& hot = *m_hot;
+        if (hot.count == 0)
+        {
+            hot.base_time = item[i].timestamp;
+            hot.base_seq  = seq;
+        }
+
+        // Write the record
+        packed_rec_t* rec = (packed_rec_t*)(hot.raw + hot.raw_size);
+        rec->tag_id    = item[i].tag_id;
+        rec->data_len  = data_len;
+        rec->severity  = item[i].severity;
+        rec->timestamp = item[i].timestamp;
+        rec->seq       = seq;
+        char* p = (char*)(rec + 1);
+        memcpy(p, item[i].data, data_len);
+        p[data_len] = 0;
+
+        // And commit it to the block
+        hot.raw_size += size;
+        store_release(&hot.count, hot.count + 1);
+    }
+
+    // Publish the new entries to the readers
+    store_release(&m_end, end);
+
+    // And throw away whatever no longer fits
+    if (m_end - m_first > m_max_entries || m_bytes > m_max_bytes) evict();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// start_block() - Starts a new hot block, whose first entry will have index "first"
+//==========================================================================================================
+void CPackedLog::start_block(uint64_t first)
+{
+    packed_block_ptr block(new packed_block_t);
+    block->first = first;
+    block->raw   = new char[PACKED_BLOCK_SIZE];
+    m_bytes += PACKED_BLOCK_SIZE;
+
+    m_mutex.lock();
+    m_block.push_back(block);
+    m_mutex.unlock();
+    m_hot = block;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// seal() - Replaces the hot block with a cold copy of it
+//
+// Each entry is encoded as the varints (timestamp delta, sequence delta, tag ID, data length) followed by
+// its severity byte, its data, and a nul-terminator, and then the whole block is compressed
+//==========================================================================================================
+void CPackedLog::seal()
+{
+    const packed_block_t& hot = *m_hot;
+    packed_block_ptr cold(new packed_block_t);
+
+    // The cold block holds the same entries as the hot one
+    cold->first     = hot.first;
+    cold->count     = hot.count;
+    cold->base_time = hot.base_time;
+    cold->base_seq  = hot.base_seq;
+    cold->oldest    = hot.base_time;
+    cold->newest    = hot.base_time;
+    cold->tags.clear();
+
+    // Encode every entry.  An encoded entry is never more than a few bytes bigger than its record
+    vector<char>& encoded = m_encoded;
+    vector<char>& compressed = m_compressed;
+    encoded.resize(hot.raw_size + 8 * hot.count);
+    char*      p    = &encoded[0];
+    log_time_t time = hot.base_time;
+    uint64_t   seq  = hot.base_seq;
+    for (uint32_t pos = 0; pos < hot.raw_size;)
+    {
+        const packed_rec_t* rec = (const packed_rec_t*)(hot.raw + pos);
+        p = put_varint(p, zigzag(rec->timestamp - time));
+        p = put_varint(p, rec->seq - seq);
+        p = put_varint(p, rec->tag_id);
+        p = put_varint(p, rec->data_len);
+        *p++ = rec->severity;
+        memcpy(p, rec + 1, rec->data_len + 1);
+        p += rec->data_len + 1;
+
+        // Keep track of the timestamps and tags in the block
+        time = rec->timestamp;
+        seq  = rec->seq;
+        if (time < cold->oldest) cold->oldest = time;
+        if (time > cold->newest) cold->newest = time;
+        cold->tags.add(rec->tag_id);
+
+        pos += record_size(rec->data_len);
+    }
+
+    // Compress the encoded entries.  lz_bound() guarantees there's room
+    int size = p - &encoded[0];
+    compressed.resize(lz_bound(size));
+    int packed = lz_compress(&encoded[0], size, &compressed[0], compressed.size());
+    cold->packed.assign(&compressed[0], packed);
+    cold->unpacked_size = size;
+
+    // And swap the cold block in for the hot one.  Readers that are walking the hot block keep it alive
+    m_mutex.lock();
+    m_block.back() = cold;
+    m_mutex.unlock();
+    m_bytes += cold->packed.size();
+    m_bytes -= PACKED_BLOCK_SIZE;
+    m_hot.reset();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// resize() - Changes the maximum number of entries and bytes of blocks, and drops whatever no longer fits
+//==========================================================================================================
+void CPackedLog::resize(int max_entries, int max_bytes)
+{
+    m_max_entries = (max_entries > 0) ? max_entries : 1;
+    m_max_bytes   = (max_bytes > 0) ? max_bytes : 0;
+    if (m_end - m_first > m_max_entries || m_bytes > m_max_bytes) evict();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// evict() - Drops entries until there are no more than m_max_entries, and drops the oldest cold blocks
+//           until the blocks fit in m_max_bytes.  Readers that are walking a dropped block keep it alive
+//           until they're done with it.
+//==========================================================================================================
+void CPackedLog::evict()
+{
+    // Figure out which is the oldest entry we keep
+    uint64_t first = m_first;
+    if (m_end - first > m_max_entries) first = m_end - m_max_entries;
+
+    // Throw away every block that ends before that entry, and as many more as it takes to fit in memory.
+    // The hot block is never thrown away
+    m_mutex.lock();
+    while (m_block.size() > 1)
+    {
+        packed_block_t& block = *m_block.front();
+        uint64_t block_end = block.first + block.count;
+        if (block_end > first && m_bytes <= m_max_bytes) break;
+        if (block_end > first) first = block_end;
+        m_bytes -= block.packed.size();
+        m_block.pop_front();
+    }
+    m_mutex.unlock();
+
+    // Tell the readers
+    store_release(&m_first, first);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Returns a cursor over the entries in the range [from, to) that are still in the log.  Only
+//              block references are copied while the lock is held.
+//==========================================================================================================
+CLogCursor* CPackedLog::snapshot(uint64_t from, uint64_t to)
+{
+    uint64_t end = this->end(), first = this->first();
+    if (to   > end  ) to   = end;
+    if (from < first) from = first;
+
+    CPackedCursor* cursor = new CPackedCursor(from, to);
+
+    // Collect every block that holds part of the range
+    m_mutex.lock();
+    for (size_t i = 0; i < m_block.size(); ++i)
+    {
+        const packed_block_t& block = *m_block[i];
+        if (block.first + load_acquire(&block.count) <= from) continue;
+        if (block.first >= to) break;
+        cursor->m_block.push_back(m_block[i]);
+    }
+    m_mutex.unlock();
+
+    // Hand the caller the cursor
+    return cursor;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor - The cursor starts out before the first entry, with nothing loaded
+//==========================================================================================================
+CPackedCursor::CPackedCursor(uint64_t first, uint64_t end)
+{
+    m_index    = first;
+    m_end      = end;
+    m_current  = 0;
+    m_loaded   = NULL;
+    m_has_hint = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wanted() - Returns false if the hint rules out every entry in a cold block
+//==========================================================================================================
+bool CPackedCursor::wanted(const packed_block_t& block)
+{
+    // If the block's timestamps are entirely outside the range the reader wants, it's not wanted
+    if (block.newest < m_hint.since || block.oldest >= m_hint.until) return false;
+
+    // If the reader wants any tag, the block might have something for it
+    if (m_hint.tags.empty()) return true;
+
+    // Otherwise, it's only wanted if it might have one of the tags
+    for (size_t i = 0; i < m_hint.tags.size(); ++i)
+    {
+        if (block.tags.has(m_hint.tags[i])) return true;
+    }
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// load() - Gets ready to read a block from its first entry, decompressing it if it's cold
+//
+// Returns: false if the block is corrupt
+//==========================================================================================================
+bool CPackedCursor::load(const packed_block_t& block)
+{
+    m_loaded    = &block;
+    m_pos       = 0;
+    m_pos_index = block.first;
+    m_time      = block.base_time;
+    m_seq       = block.base_seq;
+
+    // A hot block is read in place
+    if (!block.is_cold()) return true;
+
+    // A cold block has to be decompressed first
+    if (m_buffer.size() < block.unpacked_size) m_buffer.resize(block.unpacked_size);
+    int size = lz_decompress(block.packed.data(), block.packed.size(), &m_buffer[0], m_buffer.size());
+    m_size = (size < 0) ? 0 : size;
+    return size == (int)block.unpacked_size;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// decode() - Decodes the entry at the current position in the loaded block, and moves past it
+//
+// Returns: false if the block is corrupt
+//==========================================================================================================
+bool CPackedCursor::decode(log_view_t& view)
+{
+    uint64_t delta, seq, tag_id, data_len;
+
+    // A hot block holds records just like the ring engine's
+    if (!m_loaded->is_cold())
+    {
+        const packed_rec_t* rec = (const packed_rec_t*)(m_loaded->raw + m_pos);
+        view.timestamp = rec->timestamp;
+        view.seq       = rec->seq;
+        view.tag_id    = rec->tag_id;
+        view.severity  = rec->severity;
+        view.data      = (const char*)(rec + 1);
+        view.data_len  = rec->data_len;
+        m_pos += record_size(rec->data_len);
+    }
+
+    // A cold block holds encoded entries
+    else
+    {
+        const char* p   = &m_buffer[m_pos];
+        const char* end = &m_buffer[0] + m_size;
+        if ((p = get_varint(p, end, &delta   )) == NULL) return false;
+        if ((p = get_varint(p, end, &seq     )) == NULL) return false;
+        if ((p = get_varint(p, end, &tag_id  )) == NULL) return false;
+        if ((p = get_varint(p, end, &data_len)) == NULL) return false;
+        if (data_len + 1 >= (uint64_t)(end - p) || tag_id >= TagTable.count()) return false;
+        m_time += unzigzag(delta);
+        m_seq  += seq;
+        view.timestamp = m_time;
+        view.seq       = m_seq;
+        view.tag_id    = tag_id;
+        view.severity  = *p++;
+        view.data      = p;
+        view.data_len  = data_len;
+        m_pos = p + data_len + 1 - &m_buffer[0];
+    }
+
+    // Look up the tag
+    const tag_info_t& tag = TagTable.info(view.tag_id);
+    view.tag     = tag.name.c_str();
+    view.tag_len = tag.name.size();
+    ++m_pos_index;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the next entry in the snapshot
+//
+// Passed:  view = Filled in with the next entry
+//
+// Returns: true if an entry was fetched, false if we've reached the end of the snapshot
+//==========================================================================================================
+bool CPackedCursor::next(log_view_t& view)
+{
+    while (m_index < m_end && m_current < m_block.size())
+    {
+        const packed_block_t& block = *m_block[m_current];
+        uint64_t block_end = block.first + load_acquire(&block.count);
+
+        // If we're past the end of this block, move on to the next one
+        if (m_index >= block_end)
+        {
+            ++m_current;
+            continue;
+        }
+
+        // If the reader doesn't want anything in this block, or it's corrupt, skip over it
+        if ((block.is_cold() && m_has_hint && !wanted(block)) || (m_loaded != &block && !load(block)))
+        {
+            m_index = block_end;
+            continue;
+        }
+
+        // Skip ahead to the entry we want, if we're not already there.  A block can only be read from
+        // the front, so going back to an entry we've passed means starting the block over
+        if (m_pos_index > m_index && !load(block)) continue;
+        bool ok = true;
+        while (ok && m_pos_index < m_index) ok = decode(view);
+
+        // And hand the entry to the caller
+        if (ok && decode(view))
+        {
+            view.index = m_index++;
+            return true;
+        }
+
+        // If we get here, the block is corrupt
+        m_index = block_end;
+    }
+
+    // If we get here, there are no more entries
+    return false;
+}
+//==========================================================================================================
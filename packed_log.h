@@ -0,0 +1,158 @@
+//==========================================================================================================
+// packed_log.h - Defines a log storage engine that keeps all but the newest entries compressed
+//
+// Entries are appended to a "hot" block, uncompressed, in the same record format the ring engine uses.
+// When the hot block is full it is sealed: its entries are re-encoded compactly (timestamps and sequence
+// numbers as deltas, everything else as variable-length integers), compressed with the built-in LZ
+// codec, and the compressed "cold" block takes the hot block's place.  Readers decompress cold blocks one
+// at a time as they walk them, so a snapshot never needs more than a block's worth of memory.
+//
+// Each cold block records the range of timestamps in it and a bitmap of the tags in it, so a cursor
+// that has been told what its reader wants can skip whole blocks without decompressing them.
+//
+// There is exactly one writer.  Blocks are never modified once they're cold, and a hot block is only
+// ever appended to, so readers don't lock anything other than to find the blocks.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cthread.h"
+#include "logdata.h"
+
+using namespace std;
+
+// The size of the hot block.  This is also the most a block holds before it's compressed
+const int PACKED_BLOCK_SIZE = 64 * 1024;
+
+//----------------------------------------------------------------------------------------------------------
+// The fixed header at the front of every record in a hot block.  The data follows the header, with a
+// nul-terminator.  Records are padded to a multiple of 8 bytes.
+//----------------------------------------------------------------------------------------------------------
+struct packed_rec_t
+{
+    uint32_t    tag_id;
+    uint32_t    data_len : 24;
+    uint32_t    severity : 8;
+    int64_t     timestamp;
+    uint64_t    seq;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//----------------------------------------------------------------------------------------------------------
+// An approximate set of tag IDs.  A tag is in the set if bit (tag_id % TAG_BITS) is set, so a block may
+// claim to contain a tag that it doesn't, but never the other way around.
+//----------------------------------------------------------------------------------------------------------
+struct tag_bitmap_t
+{
+    enum {TAG_BITS = 256};
+    uint64_t    bits[TAG_BITS / 64];
+
+    void        clear()                   {for (int i = 0; i < TAG_BITS / 64; ++i) bits[i] = 0;}
+    void        add(uint32_t id)          {bits[(id % TAG_BITS) / 64] |= 1ULL << (id % 64);}
+    bool        has(uint32_t id) const    {return (bits[(id % TAG_BITS) / 64] >> (id % 64)) & 1;}
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// packed_block_t - A block of entries.  A block is created either hot or cold, and stays that way: when
+//                  a hot block is sealed, a new cold block replaces it, and readers that are still walking
+//                  the hot block keep it alive until they're done with it.
+//==========================================================================================================
+struct packed_block_t
+{
+    packed_block_t() {raw = NULL; raw_size = 0; count = 0; unpacked_size = 0;}
+    ~packed_block_t() {delete[] raw;}
+
+    // The index of the first entry in the block, and the number of entries in it
+    uint64_t    first;
+    volatile uint64_t count;
+
+    // The timestamp and sequence number of the first entry, which the encoded deltas start from
+    log_time_t  base_time;
+    uint64_t    base_seq;
+
+    // The range of timestamps in the block, and the tags in it.  Only filled in for a cold block
+    log_time_t  oldest, newest;
+    tag_bitmap_t tags;
+
+    // While the block is hot, its records, and how many bytes of them have been written
+    char*       raw;
+    uint32_t    raw_size;
+
+    // Once the block is cold, its compressed entries, and their size once decompressed
+    string      packed;
+    uint32_t    unpacked_size;
+
+    // Returns true if the block is cold
+    bool        is_cold() const {return raw == NULL;}
+};
+
+typedef shared_ptr<packed_block_t> packed_block_ptr;
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CPackedLog - Single-producer/multi-reader log that compresses its older entries
+//==========================================================================================================
+class CPackedLog : public CLogEngine
+{
+public:
+
+    // Passed: max_entries = The maximum number of entries in the log
+    //         max_bytes   = The maximum number of bytes of blocks, compressed and hot, in the log
+    CPackedLog(int max_entries, int max_bytes);
+
+    // Append a batch of entries to the log.  Must only ever be called from one thread at a time
+    void        append(const log_item_t* item, int count, uint64_t seq);
+
+    // Returns the index of the oldest entry in the log
+    uint64_t    first();
+
+    // Returns the index one past the newest entry in the log
+    uint64_t    end();
+
+    // Returns a cursor over the entries in the range [from, to) that are still in the log
+    CLogCursor* snapshot(uint64_t from, uint64_t to);
+
+    // Changes the maximum number of entries and bytes, evicting whatever no longer fits.  Must only be
+    // called from the thread that appends
+    bool        can_resize() {return true;}
+    void        resize(int max_entries, int max_bytes);
+
+protected:
+
+    // Starts a new hot block, whose first entry will have index "first"
+    void        start_block(uint64_t first);
+
+    // Replaces the hot block with a compressed copy of it
+    void        seal();
+
+    // Drops the oldest entries, and any block that no longer holds any entries
+    void        evict();
+
+    // The maximum number of entries, and bytes of blocks, in the log
+    uint64_t    m_max_entries, m_max_bytes;
+
+    // The blocks, oldest first.  The last one is the hot block.  The writer only locks this to add,
+    // replace, or remove a block
+    CMutex      m_mutex;
+    deque<packed_block_ptr> m_block;
+
+    // The block entries are being appended to
+    packed_block_ptr m_hot;
+
+    // The number of bytes of blocks in the log
+    uint64_t    m_bytes;
+
+    // Where seal() encodes and compresses a block, kept between calls to avoid reallocating them
+    vector<char> m_encoded, m_compressed;
+
+    // The oldest entry in the log, and one past the newest published entry
+    volatile uint64_t m_first, m_end;
+};
+//==========================================================================================================
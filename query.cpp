@@ -0,0 +1,628 @@
+//==========================================================================================================
+// query.cpp - Implements the queries that a client may make when it connects to the server port
+//==========================================================================================================
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "query.h"
+#include "tags.h"
+
+// The timestamp index records a mark every this many entries
+static const uint64_t TIME_STEP = 64;
+
+// When looking for the newest entries, we start with a window of at least this many candidates
+static const uint64_t MIN_WINDOW = 256;
+
+// The earliest and latest possible timestamps
+static const log_time_t TIME_MIN = INT64_MIN;
+static const log_time_t TIME_MAX = INT64_MAX;
+
+
+//==========================================================================================================
+// CSelectCursor - Walks a sorted list of entry indices, fetching each entry from an ordinary cursor over
+//                 the range that holds them.  Entries that have been evicted are skipped.
+//==========================================================================================================
+class CSelectCursor : public CLogCursor
+{
+public:
+
+    // Takes ownership of "cursor", and takes the contents of "index" (which is left empty)
+    CSelectCursor(CLogCursor* cursor, vector<uint64_t>& index) {m_cursor = cursor; m_index.swap(index); m_pos = 0;}
+    ~CSelectCursor() {delete m_cursor;}
+
+    // Fetches the next selected entry
+    bool    next(log_view_t& view);
+
+    // Skips ahead to the first selected entry at or after the specified index
+    void    seek(uint64_t index);
+
+    // Passes the hint along to the cursor we fetch entries from
+    void    hint(const log_hint_t& hint) {m_cursor->hint(hint);}
+
+protected:
+
+    CLogCursor*         m_cursor;
+    vector<uint64_t>    m_index;
+    size_t              m_pos;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the next selected entry
+//==========================================================================================================
+bool CSelectCursor::next(log_view_t& view)
+{
+    while (m_pos < m_index.size())
+    {
+        // Fetch the next selected entry, or if it has been evicted, whatever comes after it
+        m_cursor->seek(m_index[m_pos]);
+        if (!m_cursor->next(view)) return false;
+
+        // Skip over any selected entries that the cursor has passed, because they've been evicted
+        while (m_pos < m_index.size() && m_index[m_pos] < view.index) ++m_pos;
+
+        // If the entry we fetched is one of ours, hand it to the caller
+        if (m_pos < m_index.size() && m_index[m_pos] == view.index)
+        {
+            ++m_pos;
+            return true;
+        }
+    }
+
+    // If we get here, there are no more entries
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// seek() - Skips ahead to the first selected entry at or after the specified index
+//==========================================================================================================
+void CSelectCursor::seek(uint64_t index)
+{
+    while (m_pos < m_index.size() && m_index[m_pos] < index) ++m_pos;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_time() - Parses a time in seconds (with an optional fraction) into a log_time_t.  A negative time
+//                is relative to now
+//
+// Returns: true if the text was a valid time
+//==========================================================================================================
+static bool parse_time(const string& text, log_time_t* p_time)
+{
+    const char* p = text.c_str();
+    char* end;
+
+    // Is this relative to now?
+    bool relative = (*p == '-');
+    if (relative) ++p;
+
+    // Parse the whole seconds
+    if (*p < '0' || *p > '9') return false;
+    log_time_t seconds = strtoll(p, &end, 10);
+    p = end;
+
+    // Parse the fraction, to the nanosecond
+    log_time_t fraction = 0, scale = NS_PER_SEC;
+    if (*p == '.')
+    {
+        while (*++p >= '0' && *p <= '9')
+        {
+            if (scale > 1) fraction += (*p - '0') * (scale /= 10);
+        }
+    }
+
+    // There mustn't be anything else
+    if (*p) return false;
+
+    // And convert it to a timestamp
+    log_time_t time = seconds * NS_PER_SEC + fraction;
+    *p_time = relative ? log_clock() - time : time;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// clear() - Resets the query so that it asks for the entire log
+//==========================================================================================================
+void CLogQuery::clear()
+{
+    m_tag.clear();
+    m_since       = TIME_MIN;
+    m_until       = TIME_MAX;
+    m_last        = 0;
+    m_grep.clear();
+    m_binary      = false;
+    m_from.clear();
+    m_instance    = 0;
+    m_limit       = 0;
+    m_has_cutoff  = false;
+    m_cutoff_time = 0;
+    m_cutoff_seq  = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse() - Parses a request line from a client
+//
+// Passed:  text    = The request, without its line terminator
+//          p_error = Where to store a description of the problem if the request isn't valid
+//
+// Returns: true if the request is valid
+//==========================================================================================================
+bool CLogQuery::parse(const char* text, string* p_error)
+{
+    const char* p = text;
+
+    clear();
+
+    while (true)
+    {
+        // Skip over the whitespace between terms.  If there are no more terms, we're done
+        while (*p == ' ' || *p == '\t') ++p;
+        if (*p == 0) break;
+
+        // Find the key and its value
+        const char* equals = strchr(p, '=');
+        if (equals == NULL)
+        {
+            *p_error = "expected key=value at \"" + string(p) + "\"";
+            return false;
+        }
+        string key(p, equals - p);
+        p = equals + 1;
+
+        // The grep text is the rest of the line
+        if (key == "grep")
+        {
+            m_grep = p;
+            break;
+        }
+
+        // Every other value ends at the next whitespace
+        const char* end = p + strcspn(p, " \t");
+        string value(p, end - p);
+        p = end;
+
+        // A comma-separated list of tags
+        if (key == "tag")
+        {
+            size_t start = 0, comma;
+            do
+            {
+                comma = value.find(',', start);
+                m_tag.push_back(value.substr(start, comma - start));
+                start = comma + 1;
+            }
+            while (comma != string::npos);
+            continue;
+        }
+
+        // The start or end of a time range
+        if (key == "since" || key == "until")
+        {
+            if (!parse_time(value, key == "since" ? &m_since : &m_until))
+            {
+                *p_error = "invalid time \"" + value + "\"";
+                return false;
+            }
+            continue;
+        }
+
+        // The number of newest entries wanted
+        if (key == "last")
+        {
+            char* end;
+            m_last = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end || m_last == 0)
+            {
+                *p_error = "invalid count \"" + value + "\"";
+                return false;
+            }
+            continue;
+        }
+
+        // The format the entries are sent in
+        if (key == "format")
+        {
+            if (value != "text" && value != "binary")
+            {
+                *p_error = "unknown format \"" + value + "\"";
+                return false;
+            }
+            m_binary = (value == "binary");
+            continue;
+        }
+
+        // A comma-separated list of where to start in each shard
+        if (key == "from")
+        {
+            size_t start = 0, comma;
+            do
+            {
+                char* end;
+                comma = value.find(',', start);
+                string index = value.substr(start, comma - start);
+                m_from.push_back(strtoull(index.c_str(), &end, 10));
+                if (index.empty() || *end)
+                {
+                    *p_error = "invalid index \"" + index + "\"";
+                    return false;
+                }
+                start = comma + 1;
+            }
+            while (comma != string::npos);
+            continue;
+        }
+
+        // The instance of the log that "from" refers to
+        if (key == "instance")
+        {
+            char* end;
+            m_instance = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end)
+            {
+                *p_error = "invalid instance \"" + value + "\"";
+                return false;
+            }
+            continue;
+        }
+
+        // The most entries wanted
+        if (key == "limit")
+        {
+            char* end;
+            m_limit = strtoull(value.c_str(), &end, 10);
+            if (value.empty() || *end || m_limit == 0)
+            {
+                *p_error = "invalid limit \"" + value + "\"";
+                return false;
+            }
+            continue;
+        }
+
+        // If we get here, we don't know what the client is asking for
+        *p_error = "unknown key \"" + key + "\"";
+        return false;
+    }
+
+    // Keep the tags sorted, without duplicates
+    sort(m_tag.begin(), m_tag.end());
+    m_tag.erase(unique(m_tag.begin(), m_tag.end()), m_tag.end());
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// is_everything() - Returns true if the query asks for the entire log
+//==========================================================================================================
+bool CLogQuery::is_everything() const
+{
+    return m_tag.empty() && m_since == TIME_MIN && m_until == TIME_MAX && m_last == 0 && m_grep.empty();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// matches() - Returns true if an entry is one that the client asked for
+//==========================================================================================================
+bool CLogQuery::matches(const log_view_t& entry) const
+{
+    // Check the time range
+    if (entry.timestamp < m_since || entry.timestamp >= m_until) return false;
+
+    // If this is a "last=N" query, check that the entry is one of the newest
+    if (m_has_cutoff)
+    {
+        if (entry.timestamp < m_cutoff_time) return false;
+        if (entry.timestamp == m_cutoff_time && entry.seq < m_cutoff_seq) return false;
+    }
+
+    // Check the tag.  There are never more than a handful, so a linear search is fine
+    if (!m_tag.empty())
+    {
+        size_t i;
+        for (i = 0; i < m_tag.size(); ++i)
+        {
+            const string& tag = m_tag[i];
+            if ((int)tag.size() == entry.tag_len && memcmp(tag.data(), entry.tag, entry.tag_len) == 0) break;
+        }
+        if (i == m_tag.size()) return false;
+    }
+
+    // Check the message
+    if (!m_grep.empty() && memmem(entry.data, entry.data_len, m_grep.data(), m_grep.size()) == NULL) return false;
+
+    // If we get here, the entry is a match
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// update() - Brings the index up to date with the log
+//==========================================================================================================
+void CQueryIndex::update(CLogData& log)
+{
+    vector<uint64_t> first, end;
+    log_view_t entry;
+
+    log.first(first);
+    log.end(end);
+    m_shard.resize(end.size());
+
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        shard_t& shard = m_shard[i];
+
+        // Forget every entry that has been evicted from the log
+        map<uint32_t, deque<uint64_t> >::iterator it = shard.tag.begin();
+        while (it != shard.tag.end())
+        {
+            deque<uint64_t>& index = it->second;
+            while (!index.empty() && index.front() < first[i]) index.pop_front();
+            if (index.empty()) shard.tag.erase(it++); else ++it;
+        }
+        while (shard.time.size() > 1 && shard.time[1].index < first[i]) shard.time.pop_front();
+
+        // Index every entry that's been appended since last time
+        if (shard.next < first[i]) shard.next = first[i];
+        CLogCursor* cursor = log.cursor(i, shard.next, end[i]);
+        while (cursor->next(entry))
+        {
+            shard.tag[entry.tag_id].push_back(entry.index);
+            if (entry.timestamp > shard.newest) shard.newest = entry.timestamp;
+            if (entry.index % TIME_STEP == 0)
+            {
+                time_mark_t mark = {entry.index, shard.newest};
+                shard.time.push_back(mark);
+            }
+        }
+        delete cursor;
+        shard.next = end[i];
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// time_range() - Finds the range of entries in a shard whose timestamps might be in [since, until)
+//
+// Note:    Every entry before the range is known to be older than "since".  The end of the range
+//          assumes the clock never steps backwards
+//==========================================================================================================
+void CQueryIndex::time_range(int shard, log_time_t since, log_time_t until, uint64_t* p_from, uint64_t* p_to)
+{
+    const deque<time_mark_t>& time = m_shard[shard].time;
+
+    // Find the first mark that might be at or after "since".  Everything before the mark before it is older
+    size_t lo = 0, hi = time.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (time[mid].timestamp < since) lo = mid + 1; else hi = mid;
+    }
+    if (lo > 0) *p_from = max(*p_from, time[lo - 1].index + 1);
+
+    // Find the first mark that's at or after "until".  Everything after it is too new
+    hi = time.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (time[mid].timestamp < until) lo = mid + 1; else hi = mid;
+    }
+    if (lo < time.size()) *p_to = min(*p_to, time[lo].index + 1);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// select() - Fetches the indices of the entries in [from, to) of a shard with one of the query's tags,
+//            in order
+//==========================================================================================================
+void CQueryIndex::select(int shard, const CLogQuery& query, uint64_t from, uint64_t to, vector<uint64_t>& index)
+{
+    index.clear();
+
+    for (size_t i = 0; i < query.m_tag.size(); ++i)
+    {
+        // If the tag has never been logged, or nothing in this shard has it, there's nothing to add
+        uint32_t id;
+        const string& tag = query.m_tag[i];
+        if (!TagTable.find(tag.data(), tag.size(), &id)) continue;
+        map<uint32_t, deque<uint64_t> >::iterator it = m_shard[shard].tag.find(id);
+        if (it == m_shard[shard].tag.end()) continue;
+
+        // Add the portion of its entries that fall in range, keeping the whole list in order
+        deque<uint64_t>& list = it->second;
+        size_t middle = index.size();
+        index.insert(index.end(), lower_bound(list.begin(), list.end(), from), lower_bound(list.begin(), list.end(), to));
+        inplace_merge(index.begin(), index.begin() + middle, index.end());
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// cursor() - Returns a cursor over some of the candidate entries of a shard
+//
+// Passed:  shard  = The shard of the log
+//          index  = The candidates selected by tag, or NULL if every entry is a candidate
+//          lo, hi = The positions in "index" of the range of candidates, or if "index" is NULL, the
+//                   range of entry indices
+//==========================================================================================================
+CLogCursor* CQueryIndex::cursor(CLogData& log, int shard, const vector<uint64_t>* index, uint64_t lo, uint64_t hi)
+{
+    // If every entry is a candidate, an ordinary cursor will do
+    if (index == NULL) return log.cursor(shard, lo, hi);
+
+    // Otherwise, visit just the selected entries
+    if (lo >= hi) return log.cursor(shard, 0, 0);
+    vector<uint64_t> selected(index->begin() + lo, index->begin() + hi);
+    return new CSelectCursor(log.cursor(shard, selected.front(), selected.back() + 1), selected);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// newest() - Finds the newest matching entries in a shard, up to the number the query asks for
+//
+// Passed:  shard    = The shard of the log
+//          query    = The query
+//          from, to = The range of entry indices that might match
+//          index    = The candidates selected by tag, or NULL if every entry in range is a candidate
+//          key      = The keys of the entries that were found are appended to this
+//
+// Note:    The candidates are examined in windows, starting with the newest, and each window twice as
+//          large as the one before, until enough matches have been found
+//==========================================================================================================
+void CQueryIndex::newest(CLogData& log, int shard, const CLogQuery& query, uint64_t from, uint64_t to,
+                         const vector<uint64_t>* index, vector<entry_key_t>& key)
+{
+    vector<entry_key_t> found, window_found;
+    log_view_t entry;
+
+    // The candidates are positions in the index, or entry indices if there's no index
+    uint64_t lo = index ? 0 : from;
+    uint64_t hi = index ? index->size() : to;
+    uint64_t window = max(query.m_last, MIN_WINDOW);
+
+    while (hi > lo && found.size() < query.m_last)
+    {
+        // Examine the next window of candidates, going backwards
+        uint64_t start = (hi - lo > window) ? hi - window : lo;
+        CLogCursor* cursor = this->cursor(log, shard, index, start, hi);
+        window_found.clear();
+        while (cursor->next(entry))
+        {
+            if (!query.matches(entry)) continue;
+            entry_key_t k = {entry.timestamp, entry.seq, entry.index, shard};
+            window_found.push_back(k);
+        }
+        delete cursor;
+
+        // These are all older than what we found in previous windows
+        found.insert(found.begin(), window_found.begin(), window_found.end());
+        hi = start;
+        window *= 2;
+    }
+
+    // Only the newest of them can possibly make the cut
+    if (found.size() > query.m_last) found.erase(found.begin(), found.end() - query.m_last);
+    key.insert(key.end(), found.begin(), found.end());
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// key_less() - Orders entry keys by timestamp, then by sequence number
+//==========================================================================================================
+bool CQueryIndex::key_less(const entry_key_t& a, const entry_key_t& b)
+{
+    return a.timestamp < b.timestamp || (a.timestamp == b.timestamp && a.seq < b.seq);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// plan() - Fills in a snapshot of the entries that might match a query
+//
+// Passed:  log   = The log to be queried
+//          query = The query.  If it's a "last=N" query, its cutoff is filled in
+//          snap  = The snapshot to fill in.  Only entries for which query.matches() is true are wanted
+//==========================================================================================================
+void CQueryIndex::plan(CLogData& log, CLogQuery& query, CLogSnapshot& snap)
+{
+    vector<uint64_t>          first;
+    vector<uint64_t>          from, to;
+    vector<vector<uint64_t> > index;
+    vector<entry_key_t>       key;
+    log_hint_t                hint;
+
+    // If the client wants the entire log, it doesn't need the index
+    if (query.is_everything())
+    {
+        log.snapshot(snap);
+        return;
+    }
+
+    // Nobody else may touch the index until we're done with it
+    uint64_t start = metrics_clock();
+    UniqueLock lock(m_mutex);
+    m_lock_wait += metrics_clock() - start;
+
+    // Bring the index up to date
+    update(log);
+    log.first(first);
+    from.resize(m_shard.size());
+    to.resize(m_shard.size());
+    index.resize(m_shard.size());
+
+    // Figure out which entries of each shard might match
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        from[i] = first[i];
+        to[i]   = m_shard[i].next;
+        time_range(i, query.m_since, query.m_until, &from[i], &to[i]);
+        if (to[i] < from[i]) to[i] = from[i];
+        if (!query.m_tag.empty()) select(i, query, from[i], to[i], index[i]);
+    }
+
+    // If the client only wants the newest entries, find them, and ignore everything older
+    if (query.m_last)
+    {
+        for (size_t i = 0; i < m_shard.size(); ++i)
+        {
+            newest(log, i, query, from[i], to[i], query.m_tag.empty() ? NULL : &index[i], key);
+        }
+
+        // Only the newest N of those make the cut
+        sort(key.begin(), key.end(), key_less);
+        if (key.size() > query.m_last) key.erase(key.begin(), key.end() - query.m_last);
+        if (!key.empty())
+        {
+            query.m_has_cutoff  = true;
+            query.m_cutoff_time = key.front().timestamp;
+            query.m_cutoff_seq  = key.front().seq;
+        }
+
+        // And each shard starts with its oldest entry that made the cut (or is empty if none did)
+        vector<uint64_t> start(to);
+        for (size_t i = 0; i < key.size(); ++i) start[key[i].shard] = min(start[key[i].shard], key[i].index);
+        from = start;
+    }
+
+    // Tell the cursors what we're looking for, so an engine that can skip whole blocks of entries can
+    hint.since = query.m_has_cutoff ? max(query.m_since, query.m_cutoff_time) : query.m_since;
+    hint.until = query.m_until;
+    for (size_t i = 0; i < query.m_tag.size(); ++i)
+    {
+        uint32_t id;
+        if (TagTable.find(query.m_tag[i].data(), query.m_tag[i].size(), &id)) hint.tags.push_back(id);
+    }
+
+    // Build the snapshot
+    snap.clear();
+    for (size_t i = 0; i < m_shard.size(); ++i)
+    {
+        CLogCursor* cursor;
+        if (query.m_tag.empty())
+            cursor = log.cursor(i, from[i], to[i]);
+        else
+        {
+            vector<uint64_t>& list = index[i];
+            size_t lo = lower_bound(list.begin(), list.end(), from[i]) - list.begin();
+            cursor = this->cursor(log, i, &list, lo, list.size());
+        }
+        cursor->hint(hint);
+        snap.add(cursor, to[i]);
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,165 @@
+//==========================================================================================================
+// query.h - Defines the queries that a client may make when it connects to the server port
+//
+// A client that connects to the server port may send a single line saying what it wants, made up of
+// any of these space-separated terms:
+//
+//     tag=NAME[,NAME...]   Only entries with one of these tags
+//     since=TIME           Only entries logged at or after TIME
+//     until=TIME           Only entries logged before TIME
+//     last=N               Only the newest N entries that match everything else
+//     grep=TEXT            Only entries whose message contains TEXT.  This must be the last term on the
+//                          line, and TEXT is the entire remainder of the line
+//
+// An aggregator (see aggregator.h) pulls batches of entries from an upstream logger with these terms.
+// "from", "instance" and "limit" only apply along with "format=binary":
+//
+//     format=binary        Send the entries in the binary format, rather than as lines of text
+//     from=I[,I...]        Only entries at or after index I of each shard of the log, in shard order
+//     instance=ID          The instance of the log the indices in "from" belong to.  If the log's indices
+//                          have started over since (see CLogData::instance()), "from" is ignored
+//     limit=N              No more than N entries
+//
+// TIME is in seconds since the epoch, and may have a fractional part.  A negative TIME is that many
+// seconds before now.  A client that sends nothing (or an empty line) gets the entire log, just as it
+// always has.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "cthread.h"
+#include "logdata.h"
+
+using namespace std;
+
+
+//==========================================================================================================
+// CLogQuery - A parsed request from a client of the server port
+//==========================================================================================================
+class CLogQuery
+{
+public:
+    CLogQuery() {clear();}
+
+    // Resets the query to "the entire log"
+    void    clear();
+
+    // Parses a request line.  Returns false (with a description of the problem) if it isn't valid
+    bool    parse(const char* text, string* p_error);
+
+    // Returns true if the query asks for the entire log
+    bool    is_everything() const;
+
+    // Returns true if an entry is one the client asked for
+    bool    matches(const log_view_t& entry) const;
+
+    // The tags the client wants, in sorted order.  If this is empty, every tag is wanted
+    vector<string>  m_tag;
+
+    // The client wants entries with timestamps in the range [m_since, m_until)
+    log_time_t      m_since, m_until;
+
+    // If non-zero, the client only wants this many of the newest matching entries
+    uint64_t        m_last;
+
+    // If not empty, the client only wants entries whose data contains this text
+    string          m_grep;
+
+    // True if the client wants the entries in the binary format
+    bool            m_binary;
+
+    // The index, for each shard, of the first entry the client wants.  Shards not listed start at zero
+    vector<uint64_t> m_from;
+
+    // The instance of the log that m_from refers to, or zero if the client didn't say
+    uint64_t        m_instance;
+
+    // If non-zero, the client wants no more than this many entries
+    uint64_t        m_limit;
+
+    // Filled in when a "last=N" query is planned: only entries at or after this (timestamp, sequence)
+    // are wanted
+    bool            m_has_cutoff;
+    log_time_t      m_cutoff_time;
+    uint64_t        m_cutoff_seq;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CQueryIndex - Indexes the log by tag and by timestamp, so that a query only visits the entries that
+//               might match it, rather than every entry in the log
+//
+// The index follows the shards of the log by entry index, in the same way the live-log does, so the
+// threads that append to the log never touch it.  It is brought up to date each time a query is planned,
+// at the cost of visiting each new entry once.  Any number of threads may plan queries at once: they
+// take turns with the index, but not with the snapshots it produces.
+//==========================================================================================================
+class CQueryIndex
+{
+public:
+
+    CQueryIndex() {m_lock_wait = 0;}
+
+    // Fills in a snapshot of the entries that might match a query.  A "last=N" query gets its cutoff
+    void    plan(CLogData& log, CLogQuery& query, CLogSnapshot& snap);
+
+    // Returns the total time, in nanoseconds, that planning queries has spent waiting for the index
+    uint64_t lock_wait() {return m_lock_wait;}
+
+protected:
+
+    // A point in the timestamp index: the newest timestamp of any entry up to and including "index"
+    struct time_mark_t {uint64_t index; log_time_t timestamp;};
+
+    // The sort key of an entry, used to find the newest entries across every shard
+    struct entry_key_t {log_time_t timestamp; uint64_t seq; uint64_t index; int shard;};
+
+    // The index of a single shard of the log
+    struct shard_t
+    {
+        shard_t() {next = 0; newest = 0;}
+
+        // The index of the next entry to be indexed
+        uint64_t    next;
+
+        // For each tag ID, the indices of the entries with that tag, oldest first
+        map<uint32_t, deque<uint64_t> > tag;
+
+        // Every TIME_STEP entries, the newest timestamp seen so far
+        deque<time_mark_t> time;
+        log_time_t  newest;
+    };
+
+    // Indexes every entry appended to the log since the last call, and forgets evicted entries
+    void    update(CLogData& log);
+
+    // Finds the range of entries in a shard whose timestamps might be in [since, until)
+    void    time_range(int shard, log_time_t since, log_time_t until, uint64_t* p_from, uint64_t* p_to);
+
+    // Fetches the indices of the entries in [from, to) of a shard with one of the query's tags
+    void    select(int shard, const CLogQuery& query, uint64_t from, uint64_t to, vector<uint64_t>& index);
+
+    // Returns a cursor over some of the candidate entries of a shard
+    CLogCursor* cursor(CLogData& log, int shard, const vector<uint64_t>* index, uint64_t lo, uint64_t hi);
+
+    // Finds the newest matching entries in a shard, up to the number the query asks for
+    void    newest(CLogData& log, int shard, const CLogQuery& query, uint64_t from, uint64_t to,
+                   const vector<uint64_t>* index, vector<entry_key_t>& key);
+
+    // Orders entry keys by timestamp, then by sequence number
+    static bool key_less(const entry_key_t& a, const entry_key_t& b);
+
+    // The index of each shard
+    vector<shard_t> m_shard;
+
+    // Only one thread at a time may update or consult the index
+    CMutex  m_mutex;
+
+    // The total time threads have spent waiting for m_mutex.  It's only updated with m_mutex held
+    volatile uint64_t m_lock_wait;
+};
+//==========================================================================================================
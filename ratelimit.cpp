@@ -0,0 +1,266 @@
+//==========================================================================================================
+// ratelimit.cpp - Implements the per-tag rate limiter that the UDP listeners apply to incoming entries
+//==========================================================================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ratelimit.h"
+#include "ingest_proto.h"
+#include "tags.h"
+
+
+//==========================================================================================================
+// CRateLimiter() - Constructor.  Until create() is called, nothing is limited
+//==========================================================================================================
+CRateLimiter::CRateLimiter()
+{
+    memset(&m_default, 0, sizeof m_default);
+    m_enabled    = false;
+    m_sample     = 0;
+    m_exempt     = 0;
+    m_interval   = 0;
+    m_suppressed = m_sampled = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_limits() - Parses the limits for particular tags
+//
+// Passed:  text   = A comma-separated list of "tag:rate" or "tag:rate:burst"
+//          limits = Filled in with the limit for each tag
+//          error  = Filled in with a description of what's wrong, if anything is
+//
+// Returns: true if the text made sense
+//==========================================================================================================
+bool CRateLimiter::parse_limits(const string& text, vector<tag_limit_t>& limits, string* error)
+{
+    size_t pos = 0;
+
+    limits.clear();
+
+    while (pos < text.size())
+    {
+        // Fetch the next item in the list, ignoring blanks around it
+        size_t comma = text.find(',', pos);
+        if (comma == string::npos) comma = text.size();
+        string spec = text.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t a = spec.find_first_not_of(" \t"), b = spec.find_last_not_of(" \t");
+        if (a == string::npos) continue;
+        spec = spec.substr(a, b - a + 1);
+
+        // The tag is everything up to the last one or two colons, so a tag may contain colons itself
+        tag_limit_t limit;
+        char*  end;
+        size_t colon = spec.rfind(':');
+        if (colon == string::npos || colon == 0) {*error = "Expected tag:rate[:burst], got \"" + spec + "\""; return false;}
+        long   last = strtol(spec.c_str() + colon + 1, &end, 10);
+        if (*end || end == spec.c_str() + colon + 1 || last < 0) {*error = "Bad number in \"" + spec + "\""; return false;}
+
+        // If what comes before that is a number too, it's the rate and the last number is the burst
+        size_t colon2 = spec.rfind(':', colon - 1);
+        long   first  = (colon2 != string::npos && colon2 > 0) ? strtol(spec.c_str() + colon2 + 1, &end, 10) : -1;
+        if (first >= 0 && end == spec.c_str() + colon && end != spec.c_str() + colon2 + 1)
+        {
+            limit.tag   = spec.substr(0, colon2);
+            limit.rate  = first;
+            limit.burst = last;
+        }
+        else
+        {
+            limit.tag   = spec.substr(0, colon);
+            limit.rate  = last;
+            limit.burst = 0;
+        }
+        limits.push_back(limit);
+    }
+
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// parse_severity() - Parses a severity name, or "none"
+//==========================================================================================================
+bool CRateLimiter::parse_severity(const string& name, int* p_severity)
+{
+    static const char* names[] = {"none", "debug", "info", "warning", "error", "critical"};
+
+    for (int i = 0; i < (int)(sizeof names / sizeof names[0]); ++i)
+    {
+        if (strcasecmp(name.c_str(), names[i]) == 0) {*p_severity = i; return true;}
+    }
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_limit() - Fills in a bucket's limit.  A burst of zero means one second's worth of entries
+//==========================================================================================================
+void CRateLimiter::set_limit(bucket_t& b, int rate, int burst)
+{
+    if (burst <= 0) burst = rate;
+    b.cost    = (rate > 0) ? NS_PER_SEC / rate : 0;
+    b.depth   = b.cost * burst;
+    b.full_at = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Sets the limits
+//
+// Note:    The limits must already have been checked with parse_limits() and parse_severity()
+//==========================================================================================================
+void CRateLimiter::create(const rate_spec_t& spec)
+{
+    vector<tag_limit_t> limits;
+    string error;
+
+    // Every tag starts out with the default limit
+    set_limit(m_default, spec.rate, spec.burst);
+    m_bucket.clear();
+    m_enabled = (m_default.cost != 0);
+
+    // Except the ones that have limits of their own
+    parse_limits(spec.limits, limits, &error);
+    for (size_t i = 0; i < limits.size(); ++i)
+    {
+        bucket_t& b = bucket(TagTable.intern(limits[i].tag.c_str(), limits[i].tag.size()));
+        set_limit(b, limits[i].rate, limits[i].burst);
+        if (b.cost) m_enabled = true;
+    }
+
+    m_sample   = (spec.sample > 0) ? spec.sample : 0;
+    m_exempt   = spec.exempt;
+    m_interval = (uint64_t)(spec.interval > 0 ? spec.interval : 1) * NS_PER_SEC;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// keep_anyway() - Decides whether an entry that's over its tag's limit should be kept anyway.  If it
+//                 shouldn't, it's counted as suppressed
+//==========================================================================================================
+bool CRateLimiter::keep_anyway(const log_item_t& item, bucket_t& b)
+{
+    // Entries that are severe enough always get through
+    if (m_exempt && item.severity >= m_exempt) return true;
+
+    // As does one in every "m_sample" of the rest
+    if (m_sample && ++b.skipped >= m_sample)
+    {
+        b.skipped = 0;
+        ++m_sampled;
+        return true;
+    }
+
+    return false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// filter() - Removes the entries that are over their tag's limit
+//
+// Passed:  item  = The entries
+//          count = How many there are
+//          now   = The current metrics_clock() time
+//
+// Returns: The number of entries kept.  They're at the front of "item", in their original order
+//==========================================================================================================
+int CRateLimiter::filter(log_item_t* item, int count, uint64_t now)
+{
+    int kept = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        bucket_t& b = bucket(item[i].tag_id);
+
+        // A tag without a limit keeps everything
+        if (b.cost == 0)
+        {
+            if (kept != i) item[kept] = item[i];
+            ++kept;
+            continue;
+        }
+
+        // If there's a token in the bucket, take it.  If not, the entry is over the limit
+        uint64_t start = (b.full_at > now) ? b.full_at : now;
+        if (start + b.cost - now <= b.depth)
+            b.full_at = start + b.cost;
+        else if (!keep_anyway(item[i], b))
+        {
+            // Remember to tell the log about it later
+            if (b.suppressed++ == 0)
+            {
+                b.since = now;
+                m_pending.push_back(item[i].tag_id);
+            }
+            ++m_suppressed;
+            continue;
+        }
+
+        if (kept != i) item[kept] = item[i];
+        ++kept;
+    }
+
+    return kept;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// summarize() - Builds an entry for each tag that has had entries suppressed for at least the report
+//               interval, saying how many.  The tag's count starts over
+//
+// Passed:  now  = The current metrics_clock() time
+//          item = Filled in with the entries
+//
+// Returns: The number of entries
+//==========================================================================================================
+int CRateLimiter::summarize(uint64_t now, vector<log_item_t>& item)
+{
+    char text[64];
+
+    item.clear();
+    m_report.clear();
+
+    // Pick out the tags that are due a report.  The rest stay pending
+    size_t waiting = 0;
+    for (size_t i = 0; i < m_pending.size(); ++i)
+    {
+        bucket_t& b = m_bucket[m_pending[i]];
+        if (now - b.since < m_interval)
+            m_pending[waiting++] = m_pending[i];
+        else
+        {
+            sprintf(text, "%llu messages from ", (unsigned long long)b.suppressed);
+            m_report.push_back(text + TagTable.info(m_pending[i]).name + " suppressed");
+            item.push_back(log_item_t());
+            item.back().tag_id = m_pending[i];
+            b.suppressed = 0;
+        }
+    }
+    m_pending.resize(waiting);
+
+    // The reports are logged under the tag they're about, as warnings.  m_report doesn't grow again
+    // until we're done, so the text stays put
+    log_time_t timestamp = log_clock();
+    for (size_t i = 0; i < item.size(); ++i)
+    {
+        const tag_info_t& info = TagTable.info(item[i].tag_id);
+        item[i].timestamp = timestamp;
+        item[i].severity  = LOG_SEV_WARNING;
+        item[i].tag       = info.name.c_str();
+        item[i].tag_len   = info.name.size();
+        item[i].data      = m_report[i].c_str();
+        item[i].data_len  = m_report[i].size();
+    }
+
+    return item.size();
+}
+//==========================================================================================================
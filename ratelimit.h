@@ -0,0 +1,131 @@
+//==========================================================================================================
+// ratelimit.h - Defines the per-tag rate limiter that the UDP listeners apply to incoming entries
+//
+// Each tag has a token bucket that refills at "rate" entries per second and holds up to "burst" of
+// them.  An entry whose tag's bucket is empty is suppressed, unless it's severe enough to be exempt, or
+// it's picked as a sample.  Every so often, each tag that has had entries suppressed gets an entry of
+// its own in the log saying how many.
+//
+// Each listener thread has its own limiter, so nothing here is shared, and a tag's limit applies to
+// each listener separately.  A tag with no limit costs one array lookup per entry.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "logdata.h"
+
+using namespace std;
+
+
+//==========================================================================================================
+// tag_limit_t - The limit that a single tag is held to, in place of the default
+//==========================================================================================================
+struct tag_limit_t
+{
+    string      tag;
+    int         rate;           // Entries per second (0 = unlimited)
+    int         burst;          // The most entries that may arrive at once
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rate_spec_t - Describes the limits that the rate limiter enforces
+//==========================================================================================================
+struct rate_spec_t
+{
+    int         rate;           // The default entries per second for every tag (0 = unlimited)
+    int         burst;          // The default most entries that may arrive at once (0 = one second's worth)
+    string      limits;         // Limits for particular tags: "tag:rate[:burst], ..."
+    int         sample;         // Keep one of every this many entries that are over the limit (0 = none)
+    int         exempt;         // Entries at or above this severity are never suppressed (0 = none are exempt)
+    int         interval;       // The least number of seconds between a tag's "suppressed" entries
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CRateLimiter - Decides which entries to keep, and reports on the ones that weren't
+//==========================================================================================================
+class CRateLimiter
+{
+public:
+    CRateLimiter();
+
+    // Parses the limits for particular tags.  Returns false, with a description of the problem in
+    // "error", if they don't make sense
+    static bool parse_limits(const string& text, vector<tag_limit_t>& limits, string* error);
+
+    // Parses a severity name ("none", "debug", "info", "warning", "error", or "critical")
+    static bool parse_severity(const string& name, int* p_severity);
+
+    // Sets the limits.  Tags that have limits of their own are added to the TagTable
+    void    create(const rate_spec_t& spec);
+
+    // True if any tag has a limit.  If not, there's no need to call filter()
+    bool    enabled() {return m_enabled;}
+
+    // Removes the entries that are over their tag's limit, closing up the gaps.  "now" is a
+    // metrics_clock() time.  Returns the number of entries kept
+    int     filter(log_item_t* item, int count, uint64_t now);
+
+    // True if some tag has had entries suppressed that haven't been reported yet
+    bool    pending() {return !m_pending.empty();}
+
+    // Fills in an entry, for each tag that's due one, saying how many of its entries have been
+    // suppressed.  The entries remain valid until the next call.  Returns the number of entries
+    int     summarize(uint64_t now, vector<log_item_t>& item);
+
+    // The number of entries suppressed, and the number kept as samples despite being over the limit
+    uint64_t suppressed() {return m_suppressed;}
+    uint64_t sampled()    {return m_sampled;}
+
+protected:
+
+    // The state of a single tag's token bucket, kept as the time at which the bucket will be full again
+    struct bucket_t
+    {
+        uint64_t    full_at;    // When the bucket will be full again, if nothing else arrives
+        uint64_t    cost;       // How long an entry takes to refill, in nanoseconds (0 = unlimited)
+        uint64_t    depth;      // How far ahead of now "full_at" may get before entries are suppressed
+        uint64_t    suppressed; // The number of entries suppressed since the last report
+        uint64_t    since;      // When the first of those entries was suppressed
+        uint32_t    skipped;    // The number of over-limit entries since the last sample
+    };
+
+    // Returns the bucket for a tag, creating it with the default limit if need be
+    bucket_t&   bucket(uint32_t tag_id)
+    {
+        if (tag_id >= m_bucket.size()) m_bucket.resize(tag_id + 1, m_default);
+        return m_bucket[tag_id];
+    }
+
+    // Decides whether an entry over its tag's limit should be kept anyway
+    bool    keep_anyway(const log_item_t& item, bucket_t& b);
+
+    // Fills in a bucket's limit
+    static void set_limit(bucket_t& b, int rate, int burst);
+
+    // True if any tag has a limit
+    bool    m_enabled;
+
+    // The bucket for each tag, indexed by tag ID, and the bucket new tags start out with
+    vector<bucket_t> m_bucket;
+    bucket_t    m_default;
+
+    // The sampling rate, the severity that's exempt, and the interval between reports, in nanoseconds
+    uint32_t    m_sample;
+    int         m_exempt;
+    uint64_t    m_interval;
+
+    // The IDs of the tags that have suppressed entries that haven't been reported yet
+    vector<uint32_t> m_pending;
+
+    // The text of the reports handed out by the last call to summarize()
+    vector<string> m_report;
+
+    // Running totals
+    uint64_t    m_suppressed, m_sampled;
+};
+//==========================================================================================================
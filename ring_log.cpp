@@ -0,0 +1,272 @@
+//==========================================================================================================
+// ring_log.cpp - Implements a preallocated, fixed-capacity log storage engine
+//==========================================================================================================
+#include <string.h>
+#include "ring_log.h"
+#include "atomics.h"
+#include "tags.h"
+
+// The arena is never smaller than this many bytes
+static const uint64_t MIN_ARENA_SIZE = 64 * 1024;
+
+// No single record will ever be larger than this many bytes
+static const uint32_t MAX_RECORD_SIZE = 64 * 1024;
+
+// The size of a record holding data of the specified length, rounded up to a multiple of 8
+static inline uint32_t record_size(uint32_t data_len)
+{
+    return (sizeof(ring_hdr_t) + data_len + 1 + 7) & ~7;
+}
+
+
+//==========================================================================================================
+// CRingCursor - Walks a range of entry indices in a ring.  Each entry is copied into a private buffer
+//               before being handed to the caller, so the caller never sees a half-overwritten entry.
+//==========================================================================================================
+class CRingCursor : public CLogCursor
+{
+public:
+    CRingCursor(CRingLog* ring, uint64_t first, uint64_t end) {m_ring = ring; m_index = first; m_end = end;}
+
+    // Fetches the next entry that hasn't been evicted since the snapshot was taken
+    bool    next(log_view_t& view);
+
+    // Skips ahead to the entry with the specified index
+    void    seek(uint64_t index) {if (index > m_index) m_index = index;}
+
+protected:
+
+    CRingLog*       m_ring;
+    uint64_t        m_index, m_end;
+    vector<char>    m_buffer;
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor - Allocates the arena and the slot ring
+//
+// Passed:  max_entries = The maximum number of entries in the ring
+//          max_bytes   = The size of the arena in bytes
+//==========================================================================================================
+CRingLog::CRingLog(int max_entries, int max_bytes)
+{
+    // The arena is a multiple of 8 bytes, and never smaller than the minimum
+    m_arena_size = ((uint64_t)max_bytes + 7) & ~7ULL;
+    if (m_arena_size < MIN_ARENA_SIZE) m_arena_size = MIN_ARENA_SIZE;
+
+    // A single record may occupy no more than a quarter of the arena
+    m_max_record = m_arena_size / 4;
+    if (m_max_record > MAX_RECORD_SIZE) m_max_record = MAX_RECORD_SIZE;
+
+    // We need room for at least one entry
+    m_slot_count = (max_entries > 0) ? max_entries : 1;
+
+    // Allocate the storage up front.  Pages of the arena don't become resident until they're written
+    m_arena = new char[m_arena_size];
+    m_slot  = new uint64_t[m_slot_count];
+
+    // The ring starts out empty
+    m_first = m_end = m_write_pos = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Frees the arena and the slot ring
+//==========================================================================================================
+CRingLog::~CRingLog()
+{
+    delete[] m_arena;
+    delete[] m_slot;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// first() - Returns the index of the oldest entry still in the ring
+//==========================================================================================================
+uint64_t CRingLog::first()
+{
+    return load_acquire(&m_first);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// end() - Returns the index one past the newest entry in the ring
+//==========================================================================================================
+uint64_t CRingLog::end()
+{
+    return load_acquire(&m_end);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// restart() - Empties the ring, so that the next entry appended is given index "index".  Only ever called
+//             before any reader can see the ring
+//==========================================================================================================
+void CRingLog::restart(uint64_t index)
+{
+    store_release(&m_first, index);
+    store_release(&m_end, index);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// append() - Appends a batch of entries to the ring.  This never allocates memory and never takes a
+//            lock.  The readers see the entire batch appear at once.
+//==========================================================================================================
+void CRingLog::append(const log_item_t* item, int count, uint64_t seq)
+{
+    uint64_t end = m_end;
+
+    // Write each entry into the ring
+    for (int i = 0; i < count; ++i) write(end++, seq++, item[i]);
+
+    // And publish the new entries to the readers
+    store_release(&m_end, end);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// write() - Writes a single entry into the ring, evicting the oldest entries to make room for it
+//==========================================================================================================
+void CRingLog::write(uint64_t index, uint64_t seq, const log_item_t& item)
+{
+    int data_len = item.data_len;
+
+    // Make sure the entry will fit into a single record, truncating it if need be
+    int room = m_max_record - sizeof(ring_hdr_t) - 1;
+    if (data_len > room) data_len = room;
+
+    // Compute the size of the record
+    uint32_t size = record_size(data_len);
+
+    // If the record won't fit between here and the end of the arena, it goes at the start of the arena
+    uint64_t pos = m_write_pos;
+    uint64_t offset = pos % m_arena_size;
+    if (offset + size > m_arena_size) pos += m_arena_size - offset;
+
+    // Evict entries until there's a free slot, and the new record won't overwrite the oldest entry
+    uint64_t first = m_first;
+    while (first < index)
+    {
+        if (index - first < m_slot_count && pos + size - m_slot[first % m_slot_count] <= m_arena_size) break;
+        ++first;
+    }
+
+    // If we evicted anything, tell the readers before we start overwriting it
+    if (first != m_first)
+    {
+        store_release(&m_first, first);
+        fence_release();
+    }
+
+    // Fill in the record header
+    char* record = m_arena + pos % m_arena_size;
+    ring_hdr_t* hdr = (ring_hdr_t*)record;
+    hdr->tag_id    = item.tag_id;
+    hdr->data_len  = data_len;
+    hdr->severity  = item.severity;
+    hdr->timestamp = item.timestamp;
+    hdr->seq       = seq;
+
+    // Copy the data into the record, with a nul-terminator
+    char* p = record + sizeof(ring_hdr_t);
+    memcpy(p, item.data, data_len);
+    p[data_len] = 0;
+
+    // Record where this entry lives
+    m_slot[index % m_slot_count] = pos;
+    m_write_pos = pos + size;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// read() - Copies an entry out of the ring
+//
+// Passed:  index  = The index of the entry to fetch
+//          buffer = The buffer to copy the entry into
+//          view   = Filled in with a view of the copied entry
+//
+// Returns: true if the entry was fetched, false if it has been (or was being) evicted
+//==========================================================================================================
+bool CRingLog::read(uint64_t index, vector<char>& buffer, log_view_t& view)
+{
+    // If the entry has already been evicted, there's nothing to fetch
+    if (index < first()) return false;
+
+    // Find out where the record lives and how big it is
+    uint64_t pos = m_slot[index % m_slot_count];
+    const char* record = m_arena + pos % m_arena_size;
+    const volatile ring_hdr_t* live = (const volatile ring_hdr_t*)record;
+    uint32_t data_len = live->data_len;
+
+    // If the writer is overwriting the record as we look at it, the length may be nonsense
+    if (data_len > m_max_record) return false;
+    uint32_t size = record_size(data_len);
+    if (size > m_max_record || pos % m_arena_size + size > m_arena_size) return false;
+
+    // Copy the record into the caller's buffer
+    if (buffer.size() < m_max_record) buffer.resize(m_max_record);
+    memcpy(&buffer[0], record, size);
+
+    // If the entry was evicted while we were copying it, what we copied may be garbage
+    fence_acquire();
+    if (index < first()) return false;
+
+    // Fill in the caller's view of the entry
+    const ring_hdr_t* hdr = (const ring_hdr_t*)&buffer[0];
+    const tag_info_t& tag = TagTable.info(hdr->tag_id);
+    view.timestamp = hdr->timestamp;
+    view.seq       = hdr->seq;
+    view.tag_id    = hdr->tag_id;
+    view.severity  = hdr->severity;
+    view.tag       = tag.name.c_str();
+    view.tag_len   = tag.name.size();
+    view.data      = &buffer[sizeof(ring_hdr_t)];
+    view.data_len  = hdr->data_len;
+    view.index     = index;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// snapshot() - Returns a cursor over the entries in the range [from, to) that are still in the ring
+//==========================================================================================================
+CLogCursor* CRingLog::snapshot(uint64_t from, uint64_t to)
+{
+    uint64_t end = this->end(), first = this->first();
+    if (to   > end  ) to   = end;
+    if (from < first) from = first;
+    return new CRingCursor(this, from, to);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the next entry in the snapshot.  Entries that the writer evicts before we get to them
+//          are skipped.
+//==========================================================================================================
+bool CRingCursor::next(log_view_t& view)
+{
+    while (m_index < m_end)
+    {
+        // If we can fetch this entry, hand it to the caller
+        if (m_ring->read(m_index++, m_buffer, view)) return true;
+
+        // Otherwise, skip over every entry that has been evicted
+        uint64_t first = m_ring->first();
+        if (m_index < first) m_index = first;
+    }
+
+    // If we get here, there are no more entries
+    return false;
+}
+//==========================================================================================================
@@ -0,0 +1,85 @@
+//==========================================================================================================
+// ring_log.h - Defines a preallocated, fixed-capacity log storage engine
+//
+// Entries are stored back to back in a single contiguous arena, with the data inline after a small fixed
+// header.  The tag isn't stored at all, only its ID in the TagTable.  A second ring of "slots" records
+// where each entry begins.  Entries are numbered by a 64-bit index that only ever increases, and entry N
+// lives in slot N % max_entries.
+//
+// There is exactly one writer.  Readers never take a lock: they copy an entry out of the arena, and
+// then check that the writer didn't evict that entry while they were copying it.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "logdata.h"
+
+using namespace std;
+
+//----------------------------------------------------------------------------------------------------------
+// The fixed header at the front of every record in the arena.  The data follows the header, with a
+// nul-terminator.  Records are padded to a multiple of 8 bytes, so the size of a record follows from
+// the length of its data, and isn't stored.
+//----------------------------------------------------------------------------------------------------------
+struct ring_hdr_t
+{
+    uint32_t    tag_id;
+    uint32_t    data_len : 24;
+    uint32_t    severity : 8;
+    int64_t     timestamp;
+    uint64_t    seq;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// CRingLog - Lock-free, single-producer/multi-reader ring buffer of log entries
+//==========================================================================================================
+class CRingLog : public CLogEngine
+{
+public:
+    CRingLog(int max_entries, int max_bytes);
+    ~CRingLog();
+
+    // Append a batch of entries to the ring.  Must only ever be called from one thread at a time
+    void        append(const log_item_t* item, int count, uint64_t seq);
+
+    // Returns a cursor over the entries in the range [from, to) that are still in the ring
+    CLogCursor* snapshot(uint64_t from, uint64_t to);
+
+    // Copies entry "index" into "buffer" and points "view" at it.  Returns false if it's been evicted
+    bool        read(uint64_t index, vector<char>& buffer, log_view_t& view);
+
+    // The index of the oldest entry still in the ring
+    uint64_t    first();
+
+    // The index one past the newest entry in the ring
+    uint64_t    end();
+
+    // Empties the ring, so that the next entry appended is entry number "index".  The size of the ring
+    // is fixed, so it's never resized, only replaced
+    void        restart(uint64_t index);
+
+protected:
+
+    // Writes an entry into the ring as entry number "index", without publishing it to the readers
+    void        write(uint64_t index, uint64_t seq, const log_item_t& item);
+
+    // The storage arena, and its size in bytes
+    char*       m_arena;
+    uint64_t    m_arena_size;
+
+    // The largest record we'll store, in bytes
+    uint32_t    m_max_record;
+
+    // The arena position of every entry in the ring, indexed by (entry index % m_slot_count)
+    uint64_t*   m_slot;
+    uint64_t    m_slot_count;
+
+    // The oldest valid entry, and one past the newest published entry
+    volatile uint64_t m_first, m_end;
+
+    // The arena position (ever-increasing, not wrapped) where the next record will be written
+    uint64_t    m_write_pos;
+};
+//==========================================================================================================
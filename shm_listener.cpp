@@ -0,0 +1,312 @@
+//==========================================================================================================
+// shm_listener.cpp - Implements the thread that drains the shared-memory ring that local emitters write to
+//==========================================================================================================
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_listener.h"
+#include "ingest_proto.h"
+#include "atomics.h"
+#include "livelog.h"
+#include "globals.h"
+
+
+//==========================================================================================================
+// CShmListener() - Constructor
+//==========================================================================================================
+CShmListener::CShmListener()
+{
+    memset(&m_stats, 0, sizeof m_stats);
+    m_ring  = NULL;
+    m_data  = NULL;
+    m_mask  = 0;
+    m_shard = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// spawn() - Maps the ring into memory, creating it if need be, then spawns the thread
+//
+// Passed:  name  = The name of the POSIX shared-memory object, such as "/logger"
+//          size  = The size of the ring in bytes.  It's rounded up to a power of two
+//          shard = The shard of the log that entries are appended to
+//
+// Returns: false if the ring can't be created
+//
+// Note:    If a ring of the same size already exists and looks sound, it's left as it is.  Whatever a
+//          previous run of the logger hadn't read from it yet is logged, and emitters that had it
+//          mapped carry on writing to it
+//==========================================================================================================
+bool CShmListener::spawn(const string& name, uint64_t size, int shard)
+{
+    struct stat st;
+    uint64_t capacity = 4096;
+
+    while (capacity < size) capacity *= 2;
+    uint64_t total = sizeof(shm_ring_t) + capacity;
+
+    // Open the shared-memory object.  Anyone who can send us a datagram can write to it
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd < 0) return false;
+    fchmod(fd, 0666);
+
+    // Find out whether there's a ring in it already
+    bool reuse = (fstat(fd, &st) == 0 && (uint64_t)st.st_size == total);
+    if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, total) < 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    // Map it.  The mapping outlives the file descriptor
+    void* p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    m_ring = (shm_ring_t*)p;
+
+    // A ring we don't recognize gets started over.  Truncating the object has zeroed it, and the magic
+    // number goes in last, so emitters don't use the ring before it's ready
+    if (!reuse || m_ring->magic != SHM_MAGIC || m_ring->version != SHM_VERSION || m_ring->capacity != capacity
+               || m_ring->reserved - m_ring->consumed > capacity)
+    {
+        m_ring->magic = 0;
+        memset(p, 0, total);
+        m_ring->version  = SHM_VERSION;
+        m_ring->capacity = capacity;
+        fence_release();
+        m_ring->magic    = SHM_MAGIC;
+    }
+
+    m_data  = SHM_DATA(m_ring);
+    m_mask  = capacity - 1;
+    m_shard = shard;
+    CThread::spawn();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_stats() - Returns a copy of the thread's counters
+//==========================================================================================================
+shm_stats_t CShmListener::get_stats()
+{
+    shm_stats_t stats = m_stats;
+    if (m_ring) stats.dropped = m_ring->dropped;
+    return stats;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// report_suppressed() - Logs an entry for each tag that has had records suppressed for long enough
+//==========================================================================================================
+void CShmListener::report_suppressed()
+{
+    if (!m_limiter.pending()) return;
+    int count = m_limiter.summarize(metrics_clock(), m_report);
+    if (count == 0) return;
+    DataLog.append(m_shard, &m_report[0], count);
+    LiveLog.notify();
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// release() - Zeroes the records before "pos", so that they can't be mistaken for committed records the
+//             next time around the ring, and hands their space back to the producers
+//==========================================================================================================
+void CShmListener::release(uint64_t pos)
+{
+    uint64_t start  = m_ring->consumed;
+    uint64_t offset = start & m_mask;
+    uint64_t length = pos - start;
+    uint64_t first  = (length < m_mask + 1 - offset) ? length : m_mask + 1 - offset;
+
+    memset(m_data + offset, 0, first);
+    memset(m_data, 0, length - first);
+    store_release(&m_ring->consumed, pos);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait() - Sleeps until a producer wakes us up, or the timeout expires
+//
+// Note:    We say we're waiting before we check for the last time whether the ring is empty, and a
+//          producer checks whether we're waiting after it has claimed its space.  With a full barrier
+//          between each pair, either we see its record, or it sees that it needs to wake us
+//==========================================================================================================
+void CShmListener::wait(int timeout_ms)
+{
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+    store_release(&m_ring->waiting, 1);
+    fence_full();
+    if (load_acquire(&m_ring->reserved) == m_ring->consumed)
+    {
+        syscall(SYS_futex, &m_ring->waiting, FUTEX_WAIT, 1, &timeout, NULL, 0);
+        ++m_stats.wakeups;
+    }
+    store_release(&m_ring->waiting, 0);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// drain() - Reads the committed records at the head of the ring, and logs them
+//
+// Returns: false if there weren't any
+//==========================================================================================================
+bool CShmListener::drain()
+{
+    // A record that claims to have taken longer than this to arrive has a sender whose clock is wrong
+    const log_time_t MAX_TRANSIT = 60 * NS_PER_SEC;
+
+    // The most records we log at once, so that a busy ring doesn't keep the live-log waiting
+    const int MAX_BATCH = 4096;
+
+    uint64_t   start = m_ring->consumed, pos = start;
+    int        records = 0, datagrams = 0;
+    log_time_t now = log_clock();
+
+    // Read records until we reach one that isn't committed yet.  We don't hold on to more than a
+    // quarter of the ring, so that producers always have room
+    while (records < MAX_BATCH && pos - start < (m_mask + 1) / 4)
+    {
+        uint64_t offset = pos & m_mask;
+        uint32_t state  = load_acquire((volatile uint32_t*)(m_data + offset));
+        if (!(state & SHM_COMMITTED)) break;
+
+        // A record that runs off the end of the ring can only have been written by something that
+        // doesn't follow the rules.  All we can do is throw away everything that has been written
+        uint32_t length = state & SHM_LENGTH_MASK;
+        if (offset + SHM_RECORD_SIZE(length) > m_mask + 1)
+        {
+            ++m_stats.malformed;
+            pos = load_acquire(&m_ring->reserved);
+            break;
+        }
+        const char* p = m_data + offset + SHM_ALIGN;
+        pos += SHM_RECORD_SIZE(length);
+
+        // Padding just skips to the start of the ring
+        if (state & SHM_PAD) continue;
+        ++datagrams;
+        m_stats.bytes += length;
+
+        // Every datagram is in the binary format
+        if (length == 0 || (uint8_t)p[0] != INGEST_MAGIC)
+        {
+            ++m_stats.malformed;
+            continue;
+        }
+
+        // Divide it into records, keeping whatever came before any damage
+        size_t most = records + length / INGEST_RECORD_SIZE;
+        if (m_item.size() < most) m_item.resize(most);
+        if (m_sender.size() < most - records) m_sender.resize(most - records);
+        int n = parse_binary(p, length, &m_item[records], &m_sender[0]);
+        if (n < 0)
+        {
+            ++m_stats.malformed;
+            n = -1 - n;
+        }
+
+        // They're all stamped with the time we read them, and we keep track of how long they took
+        for (int j = 0; j < n; ++j)
+        {
+            m_item[records + j].timestamp = now;
+            log_time_t transit = now - m_sender[j].timestamp;
+            if (m_sender[j].timestamp > 0 && transit > 0 && transit < MAX_TRANSIT) m_transit.record(transit);
+        }
+        records += n;
+    }
+
+    if (pos == start) return false;
+
+    // Drop the records that are over their tag's rate limit
+    if (m_limiter.enabled())
+    {
+        records = m_limiter.filter(&m_item[0], records, metrics_clock());
+        m_stats.suppressed = m_limiter.suppressed();
+        m_stats.sampled    = m_limiter.sampled();
+    }
+
+    // Log them.  Their text is in the ring, so it can't be handed back until they've been appended
+    if (records) DataLog.append(m_shard, &m_item[0], records);
+    if (m_limiter.pending()) report_suppressed();
+    release(pos);
+    LiveLog.notify();
+
+    m_stats.datagrams += datagrams;
+    m_stats.records   += records;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// main() - Drains the ring forever, sleeping whenever it's empty
+//==========================================================================================================
+void CShmListener::main()
+{
+    // How long a producer may take to finish writing a record it has claimed space for, before we decide
+    // that it has died
+    const uint64_t STALL_NS = NS_PER_SEC;
+
+    uint64_t stalled = 0;
+    int      spins   = 0;
+
+    // Hold each tag to its rate limit, just as the UDP listeners do
+    rate_spec_t limits = {conf.tag_rate, conf.tag_burst, conf.tag_limits, conf.tag_sample, 0, conf.suppress_interval};
+    CRateLimiter::parse_severity(conf.rate_exempt, &limits.exempt);
+    m_limiter.create(limits);
+
+    while (true)
+    {
+        if (drain())
+        {
+            stalled = spins = 0;
+            continue;
+        }
+
+        // If nothing has been claimed, the ring is empty, and we sleep until something arrives.  We wake
+        // up once a second anyway, so that tags that have gone quiet get their reports of what was
+        // suppressed, and our shard picks up a change in the log's size
+        if (load_acquire(&m_ring->reserved) == m_ring->consumed)
+        {
+            stalled = spins = 0;
+            wait(1000);
+            report_suppressed();
+            DataLog.idle(m_shard);
+            continue;
+        }
+
+        // Otherwise a producer is part way through writing the next record.  It's usually done in
+        // moments, so we yield to it for a while before we start sleeping between checks
+        uint64_t now = metrics_clock();
+        if (stalled == 0) stalled = now;
+        if (now - stalled < STALL_NS)
+        {
+            if (++spins < 100) sched_yield(); else usleep(100);
+            continue;
+        }
+
+        // It has taken so long that the producer must have died.  Everything claimed so far is thrown
+        // away, or the ring would be stuck forever
+        fprintf(stderr, "A shared-memory producer died mid-write, discarding what was in the ring\n");
+        release(load_acquire(&m_ring->reserved));
+        ++m_stats.stalls;
+        stalled = spins = 0;
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,97 @@
+//==========================================================================================================
+// shm_listener.h - Defines the thread that drains the shared-memory ring that local emitters write to
+//
+// Emitters on the same host as the logger can skip the UDP socket altogether, and write binary-format
+// datagrams straight into a ring in shared memory (see shm_proto.h, and logclient_open_shm() in the
+// client library).  This thread reads them out of the ring and appends them to a shard of the log of its
+// own, alongside the UDP listeners.  It only sleeps when the ring is empty, and producers only wake it
+// when it's asleep.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "cthread.h"
+#include "logdata.h"
+#include "ingest.h"
+#include "ratelimit.h"
+#include "shm_proto.h"
+
+using namespace std;
+
+
+//==========================================================================================================
+// shm_stats_t - Counters maintained by the shared-memory listener
+//==========================================================================================================
+struct shm_stats_t
+{
+    uint64_t    datagrams;      // The number of datagrams read from the ring
+    uint64_t    bytes;          // The number of bytes in those datagrams
+    uint64_t    records;        // The number of entries logged from them
+    uint64_t    malformed;      // The number of datagrams that were damaged
+    uint64_t    dropped;        // The number of datagrams producers dropped because the ring was full
+    uint64_t    wakeups;        // The number of times the thread went to sleep on an empty ring
+    uint64_t    stalls;         // The number of times a producer died mid-write, and the ring was reset
+    uint64_t    suppressed;     // The number of records dropped because their tag was over its rate limit
+    uint64_t    sampled;        // The number of records kept as samples despite being over the limit
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CShmListener - A thread that reads the datagrams that emitters write to shared memory, and logs them
+//==========================================================================================================
+class CShmListener : public CThread
+{
+public:
+    CShmListener();
+
+    // Creates the ring (or picks up the one a previous run left behind), then spawns the thread, which
+    // appends to "shard" of the log.  Returns false if the ring can't be created
+    bool    spawn(const string& name, uint64_t size, int shard);
+
+    // Returns a copy of the thread's counters
+    shm_stats_t get_stats();
+
+    // Adds the times that records took to get from their sender to us to "transit"
+    void    get_transit(CHistogram& transit) {transit.merge(m_transit);}
+
+protected:
+
+    void    main();
+
+    // Reads the committed records at the head of the ring, up to a batch's worth, and logs them.
+    // Returns false if there weren't any
+    bool    drain();
+
+    // Zeroes the records we've finished with, and hands their space back to the producers
+    void    release(uint64_t pos);
+
+    // Sleeps until a producer wakes us up, or for no longer than "timeout_ms"
+    void    wait(int timeout_ms);
+
+    // Logs a report for each tag whose suppressed records are due one
+    void    report_suppressed();
+
+    // The ring, and the records in it
+    shm_ring_t* m_ring;
+    char*       m_data;
+    uint64_t    m_mask;
+
+    // The shard of the data-log that we append to
+    int         m_shard;
+
+    // The entries parsed out of a batch of datagrams, and what their senders said about them
+    vector<log_item_t>    m_item;
+    vector<sender_info_t> m_sender;
+
+    // Holds each tag to its rate limit, and the reports it makes about the records it suppresses
+    CRateLimiter m_limiter;
+    vector<log_item_t> m_report;
+
+    // How long, in nanoseconds, records took to arrive, going by the sender's timestamps
+    CHistogram  m_transit;
+
+    shm_stats_t m_stats;
+};
+//==========================================================================================================
@@ -0,0 +1,81 @@
+/*==========================================================================================================
+ * shm_proto.h - Defines the shared-memory ring that emitters on the logger's own host may write to, in
+ *               place of sending datagrams to log_port
+ *
+ * This header is shared by the logger and by the client library in client/, so it's plain C.
+ *
+ * The logger creates a POSIX shared-memory object named by its "shm_name" setting.  It begins with an
+ * shm_ring_t, and the rest is the ring itself: "capacity" bytes (a power of two), holding records that
+ * are each a 32-bit state word, 32 unused bits, and a binary-format datagram (see ingest_proto.h), padded
+ * out to a multiple of SHM_ALIGN bytes.  "reserved" and "consumed" count bytes since the ring was
+ * created, so a record at position P is at offset P & (capacity - 1).  A record never wraps around the
+ * end of the ring: a producer that would need it to first fills the rest of the ring with a pad record.
+ *
+ * Any number of producers, in any number of processes, write to the ring at once:
+ *
+ *     1. Claim SHM_RECORD_SIZE(length) bytes (plus any padding) by advancing "reserved" with a
+ *        compare-and-swap, as long as that leaves it no more than "capacity" ahead of "consumed".  If it
+ *        would, the ring is full: count the datagram in "dropped", and give up.
+ *     2. Copy the datagram in after the state word, then store SHM_COMMITTED | length in the state word,
+ *        with release semantics.
+ *     3. If "waiting" is set (after a full memory barrier), clear it and FUTEX_WAKE it.
+ *
+ * The logger reads the records in order, stopping at the first whose state word isn't committed yet.
+ * Once it's done with them, it zeroes them and advances "consumed" with release semantics.  When the ring
+ * is empty, it sets "waiting", checks once more, and sleeps on it with FUTEX_WAIT.  So a producer only
+ * makes a system call when the logger has nothing else to do.
+ *==========================================================================================================
+ */
+#ifndef SHM_PROTO_H
+#define SHM_PROTO_H
+#include <stdint.h>
+
+/* Identifies a ring, and the version of the layout described above */
+#define SHM_MAGIC               0x52474F4C
+#define SHM_VERSION             1
+
+/* Records start on a multiple of this many bytes, and this is the size of the state word and the unused
+   bits that follow it */
+#define SHM_ALIGN               8
+
+/* The bits of a record's state word.  The rest of it is the length of the datagram */
+#define SHM_COMMITTED           0x80000000u
+#define SHM_PAD                 0x40000000u
+#define SHM_LENGTH_MASK         0x3FFFFFFFu
+
+/* The number of bytes a record holding a datagram of "length" bytes takes up in the ring */
+#define SHM_RECORD_SIZE(length) (((length) + 2 * SHM_ALIGN - 1) & ~(uint64_t)(SHM_ALIGN - 1))
+
+/* The size of a cache line.  Fields written by different parties are kept on different lines */
+#define SHM_LINE                64
+
+typedef struct
+{
+    /* Written once, by the logger, when the ring is created.  "magic" is written last */
+    uint32_t            magic;
+    uint32_t            version;
+    uint64_t            capacity;
+    uint8_t             unused0[SHM_LINE - 16];
+
+    /* Advanced by producers as they claim space */
+    volatile uint64_t   reserved;
+    uint8_t             unused1[SHM_LINE - 8];
+
+    /* Advanced by the logger as it finishes with records */
+    volatile uint64_t   consumed;
+    uint8_t             unused2[SHM_LINE - 8];
+
+    /* 1 while the logger is asleep, waiting for records.  It's a futex */
+    volatile uint32_t   waiting;
+    uint32_t            unused3;
+
+    /* The number of datagrams that producers dropped because the ring was full */
+    volatile uint64_t   dropped;
+    uint8_t             unused4[SHM_LINE - 16];
+} shm_ring_t;
+
+/* The ring itself follows the header */
+#define SHM_DATA(ring)          ((char*)(ring) + sizeof(shm_ring_t))
+
+#endif
+/*========================================================================================================*/
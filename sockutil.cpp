@@ -0,0 +1,307 @@
+//==========================================================================================================
+// sockutil.cpp - Helpers for the sockets that need more control than UDPSock and NetSock provide
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "sockutil.h"
+
+// The number of send() calls send_all() has made on this thread
+static __thread uint64_t tc_send_calls = 0;
+
+
+//==========================================================================================================
+// create_udp_server() - Creates a UDP socket bound to the specified port on all interfaces
+//
+// Passed:  port       = The UDP port to listen on
+//          rcvbuf     = The size of the kernel receive buffer in bytes, or 0 for the system default
+//          reuse_port = true if several sockets will be bound to this port, with the kernel spreading
+//                       incoming datagrams across them
+//
+// Returns: the socket descriptor, or -1 on failure
+//
+// Note:    If the kernel supports it, the socket reports how many datagrams it has dropped, and the
+//          time each datagram arrived, to the nanosecond
+//==========================================================================================================
+int create_udp_server(int port, int rcvbuf, bool reuse_port)
+{
+    struct sockaddr_in addr;
+
+    // Create the socket
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+
+    // If the caller asked for a specific receive buffer size, ask for it.  SO_RCVBUFFORCE lets root
+    // exceed the system-wide limit in net.core.rmem_max, and SO_RCVBUF is the fallback for everyone else
+    if (rcvbuf > 0)
+    {
+        #ifdef SO_RCVBUFFORCE
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof rcvbuf) < 0)
+        #endif
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    }
+
+    // Ask the kernel to tell us how many datagrams it has dropped on this socket
+    #ifdef SO_RXQ_OVFL
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof one);
+    #endif
+
+    // Ask the kernel to timestamp every datagram as it arrives
+    #ifdef SO_TIMESTAMPNS
+    int stamp = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &stamp, sizeof stamp);
+    #endif
+
+    // If several sockets are going to share this port, tell the kernel so
+    #ifdef SO_REUSEPORT
+    int reuse = 1;
+    if (reuse_port) setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse);
+    #endif
+
+    // Bind the socket to our port on every interface
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Hand the caller the socket
+    return fd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_tcp_server() - Creates a non-blocking TCP socket listening on the specified port on all interfaces
+//
+// Passed:  port = The TCP port to listen on
+//
+// Returns: the socket descriptor, or -1 on failure
+//==========================================================================================================
+int create_tcp_server(int port)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    // Create the socket
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    // Allow the port to be re-used right away if we're restarted
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+
+    // Bind the socket to our port on every interface, and start listening
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Accepting connections should never block
+    set_nonblocking(fd);
+
+    // Hand the caller the socket
+    return fd;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// rebind_tcp_server() - Moves a listening socket to a different port, without its descriptor changing
+//
+// Passed:  listen_fd = The listening socket
+//          port      = The TCP port to listen on from now on
+//
+// Returns: true on success, false if the new port can't be listened on, in which case the socket is
+//          left as it was
+//
+// Note:    The new socket takes over the old one's descriptor, so the threads that accept connections
+//          from it carry on as they were.  Any of them that are waiting on the old socket are woken up
+//          when it's shut down, and find the new one in its place the next time they look.  Clients
+//          that have already been accepted aren't affected
+//==========================================================================================================
+bool rebind_tcp_server(int listen_fd, int port)
+{
+    // Start listening on the new port before we stop listening on the old one
+    int fd = create_tcp_server(port);
+    if (fd < 0) return false;
+
+    // Put the new socket in place of the old one, holding on to the old one until we've woken up
+    // anyone who's waiting on it
+    int old_fd = dup(listen_fd);
+    bool ok = (dup2(fd, listen_fd) >= 0);
+    close(fd);
+    if (old_fd >= 0)
+    {
+        if (ok) shutdown(old_fd, SHUT_RDWR);
+        close(old_fd);
+    }
+    return ok;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_nonblocking() - Puts a socket into non-blocking mode
+//==========================================================================================================
+void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_batch() - Receives as many datagrams as are available, up to "count", waiting for at least one
+//
+// Passed:  fd    = The socket descriptor
+//          msg   = An array of "count" message headers, with their buffers already filled in
+//          count = The maximum number of datagrams to receive
+//
+// Returns: the number of datagrams received, or -1 on error.  msg[i].msg_len is the length of datagram i
+//==========================================================================================================
+int receive_batch(int fd, struct mmsghdr* msg, int count)
+{
+    // If the C library supports it, this is one system call for the entire batch
+    #ifdef MSG_WAITFORONE
+    return recvmmsg(fd, msg, count, MSG_WAITFORONE, NULL);
+
+    // Otherwise, wait for the first datagram, then fetch whatever else is already waiting
+    #else
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        int len = recvmsg(fd, &msg[i].msg_hdr, i ? MSG_DONTWAIT : 0);
+        if (len < 0) break;
+        msg[i].msg_len = len;
+    }
+    return (i || errno == EAGAIN) ? i : -1;
+    #endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait_for_client() - Waits for a client to connect to a (non-blocking) listening socket
+//
+// Returns: the client's socket descriptor, which is in blocking mode, or -1 on error
+//
+// Note:    We look again every so often rather than waiting indefinitely.  If the socket is moved to
+//          another port, a poll that's already under way is woken, but carries on waiting on the old
+//          socket rather than the one that has taken its place
+//==========================================================================================================
+int wait_for_client(int listen_fd)
+{
+    const int RECHECK_MS = 1000;
+
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+
+    while (true)
+    {
+        // Accept a connection if there is one
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd >= 0) return fd;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+
+        // Otherwise, wait for one
+        poll(&pfd, 1, RECHECK_MS);
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_all() - Sends an entire buffer on a blocking socket
+//
+// Returns: true if everything was sent, false if the connection has failed
+//==========================================================================================================
+bool send_all(int fd, const char* data, int length)
+{
+    while (length > 0)
+    {
+        int n = send(fd, data, length, MSG_NOSIGNAL);
+        ++tc_send_calls;
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data   += n;
+        length -= n;
+    }
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send_calls() - Returns the number of system calls send_all() has made on the calling thread
+//==========================================================================================================
+uint64_t send_calls()
+{
+    return tc_send_calls;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// receive_line() - Receives a single line of text, giving up if it doesn't arrive in time
+//
+// Passed:  fd         = The socket descriptor
+//          buffer     = Where to store the line.  It is nul-terminated, without its CR/LF
+//          size       = The size of the buffer
+//          timeout_ms = The longest we'll wait for the entire line to arrive
+//
+// Returns: the length of the line, or -1 if no complete line arrived, or the connection was closed
+//
+// Note:    Only the bytes of the line itself are consumed from the socket
+//==========================================================================================================
+int receive_line(int fd, char* buffer, int size, int timeout_ms)
+{
+    struct pollfd   pfd = {fd, POLLIN, 0};
+    struct timespec start, now;
+    int length = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (length < size - 1)
+    {
+        // Figure out how much longer we're willing to wait
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= timeout_ms) return -1;
+
+        // Wait for something to arrive
+        int n = poll(&pfd, 1, timeout_ms - elapsed);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        // Fetch one character.  Requests are tiny, so this costs nothing worth worrying about
+        n = recv(fd, buffer + length, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        // If it's the end of the line, we're done
+        if (buffer[length] == '\n')
+        {
+            if (length && buffer[length - 1] == '\r') --length;
+            buffer[length] = 0;
+            return length;
+        }
+        ++length;
+    }
+
+    // The line is too long to be a request
+    return -1;
+}
+//==========================================================================================================
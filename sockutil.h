@@ -0,0 +1,41 @@
+//==========================================================================================================
+// sockutil.h - Helpers for the sockets that need more control than UDPSock and NetSock provide
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Older C libraries don't have recvmmsg(), but we still use its message structure
+#ifndef MSG_WAITFORONE
+struct mmsghdr {struct msghdr msg_hdr; unsigned int msg_len;};
+#endif
+
+// Creates a UDP socket bound to "port".  Returns the socket descriptor, or -1 on failure
+int     create_udp_server(int port, int rcvbuf, bool reuse_port = false);
+
+// Creates a non-blocking TCP socket listening on "port".  Returns the socket descriptor, or -1 on failure
+int     create_tcp_server(int port);
+
+// Moves a listening socket made by create_tcp_server() to "port", keeping its descriptor.  Returns false,
+// leaving the socket as it was, if the new port can't be listened on
+bool    rebind_tcp_server(int listen_fd, int port);
+
+// Puts a socket into non-blocking mode
+void    set_nonblocking(int fd);
+
+// Receives up to "count" datagrams, waiting for at least one.  Returns the number received, or -1
+int     receive_batch(int fd, struct mmsghdr* msg, int count);
+
+// Waits for a client to connect to a listening socket.  Returns the client's (blocking) socket, or -1
+int     wait_for_client(int listen_fd);
+
+// Sends an entire buffer on a blocking socket.  Returns false if the connection has failed
+bool    send_all(int fd, const char* data, int length);
+
+// The number of system calls send_all() has made on the calling thread
+uint64_t send_calls();
+
+// Receives a line of text, waiting no longer than "timeout_ms" for it.  Returns the length of the line
+// without its terminator, or -1 if no complete line arrived
+int     receive_line(int fd, char* buffer, int size, int timeout_ms);
+//==========================================================================================================
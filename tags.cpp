@@ -0,0 +1,215 @@
+//==========================================================================================================
+// tags.cpp - Implements the table that interns the tags of log entries
+//==========================================================================================================
+#include <stdio.h>
+#include <string.h>
+#include "tags.h"
+#include "atomics.h"
+
+// The one and only tag table
+CTagTable TagTable;
+
+
+//==========================================================================================================
+// hash_tag() - The 32-bit FNV-1a hash of a tag
+//==========================================================================================================
+static inline uint32_t hash_tag(const char* name, int length)
+{
+    uint32_t h = 2166136261U;
+    for (int i = 0; i < length; ++i) h = (h ^ (uint8_t)name[i]) * 16777619U;
+    return h;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Constructor - The table is empty until create() is called
+//==========================================================================================================
+CTagTable::CTagTable()
+{
+    m_slot      = NULL;
+    m_slot_mask = 0;
+    m_info      = NULL;
+    m_capacity  = 0;
+    m_count     = 0;
+    m_width     = 0;
+    m_full      = false;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// Destructor - Frees the table and every tag in it
+//==========================================================================================================
+CTagTable::~CTagTable()
+{
+    for (uint32_t i = 0; i < m_count; ++i) delete m_info[i];
+    for (size_t i = 0; i < m_retired.size(); ++i) delete m_retired[i];
+    m_retired.clear();
+    delete[] m_info;
+    delete[] m_slot;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Allocates the table
+//
+// Passed:  capacity = The maximum number of distinct tags
+//          width    = Tags are padded with spaces to this many characters when they're rendered
+//
+// Note:    This must be called before any other thread uses the table
+//==========================================================================================================
+void CTagTable::create(int capacity, int width)
+{
+    // Throw away any table we already have
+    this->~CTagTable();
+
+    // There is always room for TAG_OVERFLOW and at least one real tag
+    m_capacity = (capacity > 1) ? capacity + 1 : 2;
+    m_width    = width;
+    m_full     = false;
+
+    // Keep the hash table no more than half full, so that probe sequences stay short
+    uint32_t slots = 1;
+    while (slots < 2 * m_capacity) slots <<= 1;
+    m_slot      = new tag_info_t*[slots];
+    m_slot_mask = slots - 1;
+    memset((void*)m_slot, 0, slots * sizeof(tag_info_t*));
+
+    // TAG_OVERFLOW stands in for every tag that didn't fit.  It isn't in the hash table
+    m_info = new tag_info_t*[m_capacity];
+    m_info[TAG_OVERFLOW] = make_info(TAG_OVERFLOW, TAG_OVERFLOW_NAME, strlen(TAG_OVERFLOW_NAME), 0);
+    m_count = 1;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// make_info() - Creates the information about a tag, including its rendering in a formatted line
+//==========================================================================================================
+tag_info_t* CTagTable::make_info(uint32_t id, const char* name, int length, uint32_t hash)
+{
+    tag_info_t* info = new tag_info_t;
+    info->id   = id;
+    info->hash = hash;
+    info->name.assign(name, length);
+    info->rendered = " (" + info->name;
+    if (length < m_width) info->rendered.append(m_width - length, ' ');
+    info->rendered += "): ";
+    return info;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// lookup() - Probes the hash table for a tag
+//
+// Passed:  name, length = The tag
+//          hash         = The hash of the tag
+//          p_slot       = Where to store the index of the slot where the tag is, or the empty slot where
+//                         it would be added
+//
+// Returns: The tag's information, or NULL if it isn't in the table
+//==========================================================================================================
+tag_info_t* CTagTable::lookup(const char* name, int length, uint32_t hash, uint32_t* p_slot)
+{
+    for (uint32_t slot = hash & m_slot_mask;; slot = (slot + 1) & m_slot_mask)
+    {
+        tag_info_t* info = load_acquire(&m_slot[slot]);
+        *p_slot = slot;
+        if (info == NULL) return NULL;
+        if (info->hash == hash && (int)info->name.size() == length && memcmp(info->name.data(), name, length) == 0)
+        {
+            return info;
+        }
+    }
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// intern() - Returns the ID of a tag, adding it to the table if need be
+//
+// Returns: The tag's ID, or TAG_OVERFLOW if the tag is new and there's no more room in the table
+//==========================================================================================================
+uint32_t CTagTable::intern(const char* name, int length)
+{
+    uint32_t h = hash_tag(name, length), slot;
+
+    // This is almost always a tag we've seen before
+    tag_info_t* info = lookup(name, length, h, &slot);
+    if (info) return info->id;
+
+    // Otherwise, add it.  Someone else may have added it since we looked, so look again with the lock held
+    UniqueLock lock(m_mutex);
+    info = lookup(name, length, h, &slot);
+    if (info) return info->id;
+
+    // If the table is full, the tag can't be added
+    if (m_count == m_capacity)
+    {
+        if (!m_full) fprintf(stderr, "The tag table is full, new tags will be logged as \"%s\"\n", TAG_OVERFLOW_NAME);
+        m_full = true;
+        return TAG_OVERFLOW;
+    }
+
+    // Fill in the tag's information, and make it visible to info() before anyone can see its ID
+    uint32_t id = m_count;
+    info = make_info(id, name, length, h);
+    store_release(&m_info[id], info);
+    store_release(&m_count, m_count + 1);
+
+    // And publish it to the readers of the hash table
+    store_release(&m_slot[slot], info);
+    return id;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// find() - Looks up a tag without adding it to the table
+//
+// Returns: true if the tag is in the table, with its ID in *p_id
+//==========================================================================================================
+bool CTagTable::find(const char* name, int length, uint32_t* p_id)
+{
+    uint32_t slot;
+    tag_info_t* info = lookup(name, length, hash_tag(name, length), &slot);
+    if (info) *p_id = info->id;
+    return info != NULL;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// count() - Returns the number of tags in the table, including TAG_OVERFLOW
+//==========================================================================================================
+uint32_t CTagTable::count()
+{
+    return load_acquire(&m_count);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// set_width() - Renders every tag padded to a new width from now on
+//
+// Note:    Each tag's information is replaced, rather than changed, because other threads may be reading
+//          it.  The hash table still points at the old information, which is just as good for looking
+//          tags up, and is kept until the table is destroyed
+//==========================================================================================================
+void CTagTable::set_width(int width)
+{
+    UniqueLock lock(m_mutex);
+    if (width == m_width) return;
+    m_width = width;
+
+    for (uint32_t id = 0; id < m_count; ++id)
+    {
+        tag_info_t* old = m_info[id];
+        store_release(&m_info[id], make_info(id, old->name.data(), old->name.size(), old->hash));
+        m_retired.push_back(old);
+    }
+}
+//==========================================================================================================
@@ -0,0 +1,105 @@
+//==========================================================================================================
+// tags.h - Defines the table that interns the tags of log entries
+//
+// Our emitters use a few dozen distinct tags, so rather than every entry carrying its own copy of its
+// tag, each distinct tag is stored once in this table, and entries refer to it by a small integer ID.
+// The padded rendering of the tag that appears in every formatted line is computed once per tag, too.
+//
+// Looking up a tag that is already in the table never takes a lock.  Adding a new tag does, but that
+// only happens the first time a tag is seen.  Tags are never removed, so an ID stays valid forever.
+//
+// The width tags are rendered at can change while the table is in use.  Each tag gets new information,
+// and the old information is kept for as long as the table lives, since a reader may still be using it.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "cthread.h"
+
+using namespace std;
+
+// When the table is full, every new tag is given this ID, and is rendered as TAG_OVERFLOW_NAME
+const uint32_t TAG_OVERFLOW = 0;
+const char     TAG_OVERFLOW_NAME[] = "?";
+
+//----------------------------------------------------------------------------------------------------------
+// Everything we know about a single tag
+//----------------------------------------------------------------------------------------------------------
+struct tag_info_t
+{
+    uint32_t    id;
+    uint32_t    hash;
+
+    // The tag itself, nul-terminated
+    string      name;
+
+    // The tag as it appears in a formatted line: " (" + the tag padded to id_length + "): "
+    string      rendered;
+};
+//----------------------------------------------------------------------------------------------------------
+
+
+//==========================================================================================================
+// CTagTable - A fixed-capacity, open-addressed hash table of tags
+//==========================================================================================================
+class CTagTable
+{
+public:
+    CTagTable();
+    ~CTagTable();
+
+    // Allocates room for "capacity" tags, each rendered padded to "width" characters
+    void    create(int capacity, int width);
+
+    // Returns the ID of a tag, adding it to the table if it isn't there yet.  Returns TAG_OVERFLOW if
+    // the tag is new and the table is full
+    uint32_t intern(const char* name, int length);
+
+    // Returns the ID of a tag, or false if it isn't in the table
+    bool    find(const char* name, int length, uint32_t* p_id);
+
+    // Returns the information about a tag.  "id" must have come from intern() or find()
+    const tag_info_t& info(uint32_t id) {return *m_info[id];}
+
+    // Returns the number of tags in the table
+    uint32_t count();
+
+    // Renders every tag padded to "width" characters from now on
+    void    set_width(int width);
+
+protected:
+
+    // Finds the slot where a tag is, or where it would go.  Returns NULL if the tag isn't there
+    tag_info_t* lookup(const char* name, int length, uint32_t hash, uint32_t* p_slot);
+
+    // Creates the information about a tag
+    tag_info_t* make_info(uint32_t id, const char* name, int length, uint32_t hash);
+
+    // The hash table.  Each slot is empty, or points to the information about a tag
+    tag_info_t* volatile* m_slot;
+    uint32_t    m_slot_mask;
+
+    // The information about every tag, indexed by ID
+    tag_info_t** m_info;
+    uint32_t    m_capacity;
+
+    // The number of tags in the table, including TAG_OVERFLOW
+    volatile uint64_t m_count;
+
+    // The width tags are padded to when they're rendered
+    int         m_width;
+
+    // The information about tags that was replaced when the width changed
+    vector<tag_info_t*> m_retired;
+
+    // Serializes the addition of new tags
+    CMutex      m_mutex;
+
+    // True once we've complained about the table being full
+    bool        m_full;
+};
+//==========================================================================================================
+
+// The one and only tag table
+extern CTagTable TagTable;
@@ -0,0 +1,562 @@
+//==========================================================================================================
+// uring.cpp - Implements the thin wrapper around io_uring
+//==========================================================================================================
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "atomics.h"
+
+volatile bool CUring::s_in_use = false;
+
+
+//==========================================================================================================
+// Constructor
+//==========================================================================================================
+CUring::CUring()
+{
+    m_fd           = -1;
+    m_sq_map       = m_cq_map = NULL;
+    m_sq_map_size  = m_cq_map_size = 0;
+    m_sq_head      = m_sq_ktail = m_cq_head = m_cq_tail = NULL;
+    m_sq_array     = NULL;
+    m_sq_mask      = m_sq_entries = m_sq_tail = m_cq_mask = 0;
+    m_sqes         = NULL;
+    m_sqes_size    = 0;
+    m_cqes         = NULL;
+    m_buf_ring     = NULL;
+    m_buf_ring_size = 0;
+    m_buffers      = NULL;
+    m_buffer_size  = m_buffer_count = m_group = 0;
+    m_buf_tail     = 0;
+    m_syscalls     = 0;
+    m_timeout[0]   = m_timeout[1] = 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// built_in() - Returns true if the logger was built with the io_uring backend
+//==========================================================================================================
+bool CUring::built_in()
+{
+    #ifdef USE_IO_URING
+    return true;
+    #else
+    return false;
+    #endif
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// destroy() - Tears down the ring and its buffers.  Closing the ring cancels whatever is still in flight
+//==========================================================================================================
+void CUring::destroy()
+{
+    if (m_fd >= 0) close(m_fd);
+    if (m_sqes) munmap(m_sqes, m_sqes_size);
+    if (m_cq_map && m_cq_map != m_sq_map) munmap(m_cq_map, m_cq_map_size);
+    if (m_sq_map) munmap(m_sq_map, m_sq_map_size);
+    if (m_buf_ring) munmap(m_buf_ring, m_buf_ring_size);
+    delete[] m_buffers;
+
+    m_fd       = -1;
+    m_sqes     = NULL;
+    m_sq_map   = m_cq_map = NULL;
+    m_buf_ring = NULL;
+    m_buffers  = NULL;
+}
+//==========================================================================================================
+
+
+#ifdef USE_IO_URING
+
+//==========================================================================================================
+// create() - Creates the ring, and maps its queues into our memory
+//
+// Passed:  entries     = The size of the submission queue
+//          completions = The size of the completion queue, or 0 for twice the size of the submission queue
+//
+// Returns: false if the kernel doesn't have io_uring, or won't let us use it
+//==========================================================================================================
+bool CUring::create(int entries, int completions)
+{
+    struct io_uring_params p;
+
+    destroy();
+
+    memset(&p, 0, sizeof p);
+    if (completions)
+    {
+        p.flags     |= IORING_SETUP_CQSIZE;
+        p.cq_entries = completions;
+    }
+
+    // Create the ring
+    m_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (m_fd < 0) return false;
+
+    // Map the submission and completion queues.  Newer kernels put both in a single mapping
+    m_sq_map_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_map_size > m_sq_map_size) m_sq_map_size = m_cq_map_size;
+        m_cq_map_size = m_sq_map_size;
+    }
+    m_sq_map = mmap(NULL, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_map == MAP_FAILED)
+    {
+        m_sq_map = NULL;
+        destroy();
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_map = m_sq_map;
+    else
+    {
+        m_cq_map = mmap(NULL, m_cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_map == MAP_FAILED)
+        {
+            m_cq_map = NULL;
+            destroy();
+            return false;
+        }
+    }
+
+    // And the submission entries themselves
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        m_sqes = NULL;
+        destroy();
+        return false;
+    }
+
+    // Find our way around the queues
+    char* sq = (char*)m_sq_map;
+    char* cq = (char*)m_cq_map;
+    m_sq_head    = (uint32_t*)(sq + p.sq_off.head);
+    m_sq_ktail   = (uint32_t*)(sq + p.sq_off.tail);
+    m_sq_mask    = *(uint32_t*)(sq + p.sq_off.ring_mask);
+    m_sq_entries = p.sq_entries;
+    m_sq_array   = (uint32_t*)(sq + p.sq_off.array);
+    m_sq_tail    = *m_sq_ktail;
+    m_cq_head    = (uint32_t*)(cq + p.cq_off.head);
+    m_cq_tail    = (uint32_t*)(cq + p.cq_off.tail);
+    m_cq_mask    = *(uint32_t*)(cq + p.cq_off.ring_mask);
+    m_cqes       = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // Submission entry i always goes in slot i of the submission queue
+    for (uint32_t i = 0; i < m_sq_entries; ++i) m_sq_array[i] = i;
+
+    s_in_use = true;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// register_buffers() - Registers buffers with the kernel for fixed I/O.  Buffer i is then referred to by
+//                      its index, i
+//==========================================================================================================
+bool CUring::register_buffers(const struct iovec* iov, int count)
+{
+    ++m_syscalls;
+    return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create_buffer_ring() - Creates a ring of buffers for the kernel to receive into, and registers it
+//
+// Passed:  group = The buffer group ID that receives will ask for
+//          count = The number of buffers.  It must be a power of 2
+//          size  = The size of each buffer.  There's a spare byte after each one that the kernel never
+//                  touches, which leaves room for a terminator
+//
+// Returns: false if the kernel can't take a ring of provided buffers
+//
+// Note:    The buffers are allocated without being touched, so a buffer's pages don't take up memory
+//          until something big enough to need them is received into it
+//==========================================================================================================
+bool CUring::create_buffer_ring(int group, int count, int size)
+{
+    struct io_uring_buf_reg reg;
+
+    // The ring has to be page-aligned
+    m_buf_ring_size = count * sizeof(io_uring_buf);
+    m_buf_ring = mmap(NULL, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_buf_ring == MAP_FAILED)
+    {
+        m_buf_ring = NULL;
+        return false;
+    }
+
+    // Tell the kernel about it
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr    = (uint64_t)(uintptr_t)m_buf_ring;
+    reg.ring_entries = count;
+    reg.bgid         = group;
+    ++m_syscalls;
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        munmap(m_buf_ring, m_buf_ring_size);
+        m_buf_ring = NULL;
+        return false;
+    }
+
+    // Then fill it with buffers
+    m_buffer_size  = size + 1;
+    m_buffer_count = count;
+    m_group        = group;
+    m_buf_tail     = 0;
+    m_buffers      = new char[(size_t)count * m_buffer_size];
+    for (int id = 0; id < count; ++id) recycle(id);
+    publish();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// recycle() - Puts a buffer back in the ring.  The kernel doesn't see it until publish() is called
+//==========================================================================================================
+void CUring::recycle(int id)
+{
+    // Some kernel headers declare the ring's "bufs" behind an empty struct, which takes up space in C++,
+    // so the ring is indexed by hand.  The tail is where it should be
+    io_uring_buf* buf = (io_uring_buf*)m_buf_ring + (m_buf_tail++ & (m_buffer_count - 1));
+    buf->addr = (uint64_t)(uintptr_t)buffer(id);
+    buf->len  = m_buffer_size - 1;
+    buf->bid  = id;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// publish() - Lets the kernel see every buffer that has been recycled
+//==========================================================================================================
+void CUring::publish()
+{
+    io_uring_buf_ring* ring = (io_uring_buf_ring*)m_buf_ring;
+    store_release(&ring->tail, m_buf_tail);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// get_sqe() - Returns a cleared submission entry, submitting what's already queued if there's no room
+//==========================================================================================================
+io_uring_sqe* CUring::get_sqe()
+{
+    while (m_sq_tail - load_acquire(m_sq_head) >= m_sq_entries) submit(0);
+
+    io_uring_sqe* sqe = &m_sqes[m_sq_tail++ & m_sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// prepare() - Queues a submission, and fills in the fields that every operation has
+//==========================================================================================================
+io_uring_sqe* CUring::prepare(int op, int fd, const void* addr, uint32_t len, uint64_t offset, uint64_t tag)
+{
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode    = op;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)addr;
+    sqe->len       = len;
+    sqe->off       = offset;
+    sqe->user_data = tag;
+    return sqe;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// recvmsg_multishot() - Queues a receive that keeps on receiving datagrams, each into a buffer of its own
+//                       from buffer group "group", until it runs out of buffers or is cancelled
+//
+// Note:    Only the msg_namelen and msg_controllen of "msg" are used.  Each buffer starts with an
+//          io_uring_recvmsg_out, followed by room for that much address and ancillary data, followed
+//          by the datagram
+//==========================================================================================================
+void CUring::recvmsg_multishot(int fd, struct msghdr* msg, int group, uint64_t tag)
+{
+    io_uring_sqe* sqe = prepare(IORING_OP_RECVMSG, fd, msg, 1, 0, tag);
+    sqe->ioprio   |= IORING_RECV_MULTISHOT;
+    sqe->flags    |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// sendmsg() - Queues a gathering send.  "msg" and its iovecs must stay put until it completes
+//
+// Note:    If the socket is full, the kernel waits for it to have room rather than failing, even when
+//          the socket is non-blocking
+//==========================================================================================================
+void CUring::sendmsg(int fd, const struct msghdr* msg, int flags, uint64_t tag)
+{
+    io_uring_sqe* sqe = prepare(IORING_OP_SENDMSG, fd, msg, 1, 0, tag);
+    sqe->msg_flags = flags;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// write_fixed() - Queues a write from within registered buffer number "index"
+//==========================================================================================================
+void CUring::write_fixed(int fd, const char* data, int length, int index, uint64_t tag)
+{
+    io_uring_sqe* sqe = prepare(IORING_OP_WRITE_FIXED, fd, data, length, (uint64_t)-1, tag);
+    sqe->buf_index = index;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// timeout() - Queues a timer that completes (with -ETIME) once "ts" has passed
+//
+// Note:    The kernel reads the time when it's submitted, so only one timer can be queued between
+//          submits
+//==========================================================================================================
+void CUring::timeout(const struct timespec* ts, uint64_t tag)
+{
+    m_timeout[0] = ts->tv_sec;
+    m_timeout[1] = ts->tv_nsec;
+    prepare(IORING_OP_TIMEOUT, -1, m_timeout, 1, 0, tag);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// cancel() - Queues the cancellation of the submission whose tag is "target"
+//==========================================================================================================
+void CUring::cancel(uint64_t target, uint64_t tag)
+{
+    prepare(IORING_OP_ASYNC_CANCEL, -1, (void*)(uintptr_t)target, 0, 0, tag);
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// submit() - Hands the kernel whatever has been queued, and waits for at least "wait" completions
+//
+// Returns: The number of submissions the kernel took, or -1 on error
+//
+// Note:    If there's nothing to submit and there are already enough completions, there's no system call
+//==========================================================================================================
+int CUring::submit(int wait)
+{
+    uint32_t pending = m_sq_tail - load_acquire(m_sq_head);
+
+    // If there's nothing for the kernel to do, don't bother it
+    if (pending == 0 && (wait == 0 || load_acquire(m_cq_tail) - *m_cq_head >= (uint32_t)wait)) return 0;
+
+    // Publish our new entries, and tell the kernel about them
+    store_release(m_sq_ktail, m_sq_tail);
+    ++m_syscalls;
+    int ret = syscall(__NR_io_uring_enter, m_fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    // Being interrupted, or having to wait for room in the completion queue, isn't an error
+    if (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) return 0;
+    return ret;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// next() - Fetches the oldest completion waiting
+//
+// Passed:  p_tag    = Where to store the tag of the submission that completed
+//          p_result = Where to store its result
+//          p_flags  = Where to store its flags
+//
+// Returns: false if there aren't any completions waiting
+//==========================================================================================================
+bool CUring::next(uint64_t* p_tag, int* p_result, uint32_t* p_flags)
+{
+    uint32_t head = *m_cq_head;
+    if (head == load_acquire(m_cq_tail)) return false;
+
+    io_uring_cqe* cqe = &m_cqes[head & m_cq_mask];
+    *p_tag    = cqe->user_data;
+    *p_result = cqe->res;
+    *p_flags  = cqe->flags;
+    store_release(m_cq_head, head + 1);
+    return true;
+}
+//==========================================================================================================
+
+#else
+
+//==========================================================================================================
+// Without the io_uring backend there's never a ring, so nothing else is ever called
+//==========================================================================================================
+bool CUring::create(int entries, int completions) {return false;}
+bool CUring::register_buffers(const struct iovec* iov, int count) {return false;}
+bool CUring::create_buffer_ring(int group, int count, int size) {return false;}
+void CUring::recycle(int id) {}
+void CUring::publish() {}
+void CUring::recvmsg_multishot(int fd, struct msghdr* msg, int group, uint64_t tag) {}
+void CUring::sendmsg(int fd, const struct msghdr* msg, int flags, uint64_t tag) {}
+void CUring::write_fixed(int fd, const char* data, int length, int index, uint64_t tag) {}
+void CUring::timeout(const struct timespec* ts, uint64_t tag) {}
+void CUring::cancel(uint64_t target, uint64_t tag) {}
+int  CUring::submit(int wait) {return -1;}
+bool CUring::next(uint64_t* p_tag, int* p_result, uint32_t* p_flags) {return false;}
+//==========================================================================================================
+
+#endif
+
+
+
+
+//==========================================================================================================
+// Destructor
+//==========================================================================================================
+CFixedSender::~CFixedSender()
+{
+    m_ring.destroy();
+    delete m_buffer[0];
+    delete m_buffer[1];
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// create() - Creates the ring, and the two buffers, which are registered with the kernel
+//
+// Passed:  capacity = The size of each buffer
+//
+// Returns: false if the kernel can't do this
+//==========================================================================================================
+bool CFixedSender::create(int capacity)
+{
+    struct iovec iov[2];
+
+    if (!m_ring.create(4)) return false;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        m_buffer[i] = new COutputBuffer(capacity);
+        iov[i].iov_base = m_buffer[i]->data();
+        iov[i].iov_len  = capacity;
+    }
+
+    if (!m_ring.register_buffers(iov, 2))
+    {
+        m_ring.destroy();
+        return false;
+    }
+
+    m_current = 0;
+    m_busy    = false;
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// send() - Hands the buffer that has been filled to the kernel, and switches to the other one
+//
+// Returns: false if the client has gone away
+//
+// Note:    The write is only submitted here, not waited for, so the next buffer gets filled while the
+//          kernel is sending this one.  Writes never overlap: if the other buffer is still being sent,
+//          that finishes first
+//==========================================================================================================
+bool CFixedSender::send(int fd)
+{
+    COutputBuffer& filled = buffer();
+
+    // The previous write has to be done before this one starts, or their bytes could be interleaved
+    if (!wait())
+    {
+        filled.clear();
+        return false;
+    }
+
+    // Start sending this buffer
+    m_fd     = fd;
+    m_sent   = 0;
+    m_length = filled.size();
+    m_busy   = true;
+    m_ring.write_fixed(fd, filled.data(), m_length, m_current, 0);
+    m_ring.submit(0);
+
+    // And fill the other one in the meantime
+    m_current ^= 1;
+    buffer().clear();
+    return true;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// finish() - Waits for everything that has been handed to the kernel to be sent
+//
+// Returns: false if the client has gone away
+//==========================================================================================================
+bool CFixedSender::finish()
+{
+    bool ok = wait();
+    buffer().clear();
+    return ok;
+}
+//==========================================================================================================
+
+
+//==========================================================================================================
+// wait() - Waits for the write in flight (if there is one) to finish
+//
+// Returns: false if the client has gone away
+//
+// Note:    A socket may take only part of a write.  Whatever it didn't take is written again, from where
+//          it left off
+//==========================================================================================================
+bool CFixedSender::wait()
+{
+    uint64_t tag;
+    uint32_t flags;
+    int      result, sending = m_current ^ 1;
+
+    while (m_busy)
+    {
+        // Wait for the write to complete
+        if (m_ring.submit(1) < 0)
+        {
+            m_busy = false;
+            return false;
+        }
+        if (!m_ring.next(&tag, &result, &flags)) continue;
+
+        // If it was interrupted, try it again.  If it failed, the client is gone
+        if (result == -EINTR || result == -EAGAIN) result = 0;
+        if (result < 0)
+        {
+            m_busy = false;
+            return false;
+        }
+
+        // If it's all been sent, we're done
+        m_sent += result;
+        if (m_sent >= m_length) m_busy = false;
+
+        // Otherwise, send the rest of it
+        else m_ring.write_fixed(m_fd, m_buffer[sending]->data() + m_sent, m_length - m_sent, sending, 0);
+    }
+
+    return true;
+}
+//==========================================================================================================
@@ -0,0 +1,197 @@
+//==========================================================================================================
+// uring.h - A thin wrapper around io_uring, for the optional io_uring I/O backend
+//
+// The backend is chosen when the logger is built: "make IO_URING=1" defines USE_IO_URING.  Without it,
+// or with kernel headers too old to describe multishot receives, CUring::create() always fails and every
+// caller carries on with the ordinary socket calls.  The same happens at run time on a kernel that
+// doesn't have io_uring (or has it turned off), so a logger built with the backend runs anywhere.
+//
+// There's no liburing here: the ring is set up and driven with the raw system calls, as the futex in the
+// shared-memory listener is.
+//==========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "formatter.h"
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+
+// The kernel header drags in <linux/fs.h>, whose BLOCK_SIZE we have no use for and would collide with ours
+#undef BLOCK_SIZE
+
+// Multishot receives and provided-buffer rings arrived together.  Headers without them can't build the
+// backend, so it's left out
+#ifndef IORING_RECV_MULTISHOT
+#warning "linux/io_uring.h is too old for the io_uring backend, so it won't be used"
+#undef USE_IO_URING
+#endif
+#endif
+
+#ifndef USE_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+
+//==========================================================================================================
+// CUring - An io_uring instance: a submission queue, a completion queue, and, optionally, a ring of
+//          buffers that the kernel picks from for each datagram it receives
+//
+// A ring is only ever used by the thread that created it.
+//==========================================================================================================
+class CUring
+{
+public:
+    CUring();
+    ~CUring() {destroy();}
+
+    // Returns true if the logger was built with the io_uring backend
+    static bool built_in();
+
+    // Returns true once any ring has been created successfully, which means the kernel has io_uring
+    static bool in_use() {return s_in_use;}
+
+    // Creates a ring with room for "entries" submissions and "completions" completions (0 = twice the
+    // submissions).  Returns false if the kernel can't make one
+    bool    create(int entries, int completions = 0);
+
+    // Tears the ring down, along with its buffers
+    void    destroy();
+
+    // The ring's descriptor, which polls readable when there are completions waiting, or -1
+    int     fd() {return m_fd;}
+
+    // Registers buffers with the kernel, so that they can be used for fixed I/O by their index
+    bool    register_buffers(const struct iovec* iov, int count);
+
+    // Creates "count" (a power of 2) buffers of "size" bytes apiece, and hands them to the kernel as
+    // buffer group "group".  Returns false if the kernel can't take a ring of provided buffers
+    bool    create_buffer_ring(int group, int count, int size);
+
+    // Returns the buffer the kernel picked for a completion, by the ID it reported
+    char*   buffer(int id) {return m_buffers + (size_t)id * m_buffer_size;}
+
+    // Hands a buffer back to the kernel once we're done with what was received into it.  The buffers
+    // handed back aren't seen by the kernel until publish()
+    void    recycle(int id);
+    void    publish();
+
+    // Each of these queues a submission, submitting whatever is already queued first if there's no room
+    // for it.  "tag" comes back with the completion
+    void    recvmsg_multishot(int fd, struct msghdr* msg, int group, uint64_t tag);
+    void    sendmsg(int fd, const struct msghdr* msg, int flags, uint64_t tag);
+    void    write_fixed(int fd, const char* data, int length, int index, uint64_t tag);
+    void    timeout(const struct timespec* ts, uint64_t tag);
+    void    cancel(uint64_t target, uint64_t tag);
+
+    // Submits whatever has been queued, and waits for at least "wait" completions.  Returns the number of
+    // submissions the kernel took, or -1 on error
+    int     submit(int wait = 0);
+
+    // Fetches the oldest completion waiting, if there is one.  It's consumed by the time this returns
+    bool    next(uint64_t* p_tag, int* p_result, uint32_t* p_flags);
+
+    // The number of system calls made through the ring
+    uint64_t syscalls() {return m_syscalls;}
+
+protected:
+
+    // Returns a cleared submission entry, submitting what's queued to make room if need be
+    io_uring_sqe* get_sqe();
+
+    // Fills in the common fields of a submission entry
+    io_uring_sqe* prepare(int op, int fd, const void* addr, uint32_t len, uint64_t offset, uint64_t tag);
+
+    // The ring's descriptor, and how its queues are mapped into our memory
+    int         m_fd;
+    void*       m_sq_map;
+    void*       m_cq_map;
+    size_t      m_sq_map_size, m_cq_map_size;
+
+    // The submission queue: the kernel's head, our tail, and the entries themselves.  m_sq_tail counts
+    // the entries we've filled in, and is published to the kernel when we submit
+    volatile uint32_t*  m_sq_head;
+    volatile uint32_t*  m_sq_ktail;
+    uint32_t*           m_sq_array;
+    uint32_t            m_sq_mask, m_sq_entries, m_sq_tail;
+    io_uring_sqe*       m_sqes;
+    size_t              m_sqes_size;
+
+    // The completion queue
+    volatile uint32_t*  m_cq_head;
+    volatile uint32_t*  m_cq_tail;
+    uint32_t            m_cq_mask;
+    io_uring_cqe*       m_cqes;
+
+    // The ring of provided buffers, the buffers, and the tail we've filled it up to
+    void*       m_buf_ring;
+    size_t      m_buf_ring_size;
+    char*       m_buffers;
+    int         m_buffer_size, m_buffer_count, m_group;
+    uint16_t    m_buf_tail;
+
+    // The time a queued timer waits for, laid out as the kernel expects it
+    int64_t     m_timeout[2];
+
+    // The number of system calls made through the ring
+    uint64_t    m_syscalls;
+
+    // True once any ring has been created
+    static volatile bool s_in_use;
+
+private:
+
+    // A ring can't be copied
+    CUring(const CUring&);
+    CUring& operator=(const CUring&);
+};
+//==========================================================================================================
+
+
+//==========================================================================================================
+// CFixedSender - Sends a stream of output buffers to a socket through io_uring, from buffers that are
+//                registered with the kernel, so they aren't looked up and pinned for every write
+//
+// There are two buffers: one is filled while the other is being sent.  Only one write is ever in flight,
+// so the client receives everything in order.
+//==========================================================================================================
+class CFixedSender
+{
+public:
+    CFixedSender() {m_buffer[0] = m_buffer[1] = NULL; m_current = 0; m_busy = false;}
+    ~CFixedSender();
+
+    // Creates the ring and registers the buffers.  Returns false if the kernel can't, in which case the
+    // caller should send the ordinary way
+    bool    create(int capacity = 128 * 1024);
+
+    // The buffer to fill next
+    COutputBuffer& buffer() {return *m_buffer[m_current];}
+
+    // Hands the filled buffer to the kernel to send to "fd", and switches to the other one, waiting for
+    // it to finish being sent if need be.  Returns false if the client has gone away
+    bool    send(int fd);
+
+    // Waits for everything handed to the kernel to be sent.  Returns false if the client has gone away
+    bool    finish();
+
+    // The number of system calls made sending
+    uint64_t syscalls() {return m_ring.syscalls();}
+
+protected:
+
+    // Waits for the write in flight to finish, writing again whatever part of it the socket didn't take.
+    // Returns false if the client has gone away
+    bool    wait();
+
+    CUring          m_ring;
+    COutputBuffer*  m_buffer[2];
+
+    // The buffer being filled, and whether the other one is being sent, where to, and how much of it
+    int     m_current;
+    bool    m_busy;
+    int     m_fd, m_sent, m_length;
+};
+//==========================================================================================================